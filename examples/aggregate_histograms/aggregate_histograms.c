@@ -0,0 +1,114 @@
+// Copyright 2021 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define ENABLE_UNIKORN_SESSION_CREATION
+#include "unikorn_instrumentation.h"
+#include "unikorn_macros.h"
+#ifdef ENABLE_UNIKORN_RECORDING
+  #include "unikorn_file_loader.h"
+#endif
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NUM_REQUESTS 100000
+#define NUM_FLUSHES 4
+
+#ifdef ENABLE_UNIKORN_RECORDING
+static void *unikorn_session = NULL;
+#endif
+
+static double handleRequest() {
+  // Mostly short requests, with a long tail
+  int num_values = 10 + rand() % 50;
+  if (rand() % 100 == 0) num_values *= 100;
+  double sum = 0;
+  UK_RECORD_EVENT(unikorn_session, REQUEST_START_ID, 0);
+  for (int i=0; i<num_values; i++) {
+    UK_RECORD_EVENT(unikorn_session, SQRT_START_ID, 0);
+    sum += sqrt((double)i);
+    UK_RECORD_EVENT(unikorn_session, SQRT_END_ID, 0);
+  }
+  UK_RECORD_EVENT(unikorn_session, REQUEST_END_ID, 0);
+  return sum;
+}
+
+#ifdef ENABLE_UNIKORN_RECORDING
+static void printHistograms(const char *filename) {
+  UkEvents *events = ukLoadEventsFile(filename);
+  if (events == NULL) {
+    printf("Failed to load '%s'\n", filename);
+    return;
+  }
+  if (!events->is_aggregate) {
+    printf("'%s' was not recorded with aggregate_only=true\n", filename);
+    ukFreeEvents(events);
+    return;
+  }
+  printf("Durations in nanoseconds (percentiles are within %.2f%%)\n", 100.0 / (1 << events->histogram_sub_bucket_bits));
+  printf("%-20s %10s %10s %10s %10s %10s %10s %10s %10s %10s\n", "Event", "Count", "Min", "Avg", "P50", "P90", "P99", "P99.9", "Max", "Unmatched");
+  for (uint16_t i=0; i<events->event_registration_count; i++) {
+    UkHistogram *histogram = &events->histogram_list[i];
+    uint64_t avg = (histogram->count > 0) ? histogram->total_duration / histogram->count : 0;
+    printf("%-20s %10llu %10llu %10llu %10llu %10llu %10llu %10llu %10llu %10llu\n", events->event_registration_list[i].name,
+           (unsigned long long)histogram->count, (unsigned long long)histogram->min_duration, (unsigned long long)avg,
+           (unsigned long long)ukGetHistogramPercentile(events, i, 50), (unsigned long long)ukGetHistogramPercentile(events, i, 90),
+           (unsigned long long)ukGetHistogramPercentile(events, i, 99), (unsigned long long)ukGetHistogramPercentile(events, i, 99.9),
+           (unsigned long long)histogram->max_duration, (unsigned long long)histogram->unmatched_count);
+  }
+  ukFreeEvents(events);
+}
+#endif
+
+int main(int argc, char **argv) {
+#ifdef ENABLE_UNIKORN_RECORDING
+  if (argc == 2) {
+    // Just print the histograms of an existing file
+    printHistograms(argv[1]);
+    return 0;
+  }
+#else
+  (void)argc;
+  (void)argv;
+#endif
+
+  // Create event session: only the histograms are kept, so the memory does not grow with the number of events
+#ifdef ENABLE_UNIKORN_RECORDING
+  UkFileFlushInfo flush_info; // Needs to be persistent for life of session
+#endif
+  UK_CREATE("./aggregate_histograms.events", 1000, false, false, false, false, false,
+            NUM_UNIKORN_FOLDER_REGISTRATIONS, L_unikorn_folders,
+            NUM_UNIKORN_EVENT_REGISTRATIONS, L_unikorn_events,
+            &flush_info, &unikorn_session);
+
+  // Record: each flush holds the histograms since the previous flush
+  double sum = 0;
+  for (int i=0; i<NUM_REQUESTS; i++) {
+    sum += handleRequest();
+    if ((i+1) % (NUM_REQUESTS/NUM_FLUSHES) == 0) {
+      UK_FLUSH(unikorn_session);
+    }
+  }
+  printf("Sum = %f\n", sum);
+
+  // Clean up
+  UK_DESTROY(unikorn_session, &flush_info);
+#ifdef ENABLE_UNIKORN_RECORDING
+  printHistograms("./aggregate_histograms.events");
+#else
+  printf("Event recording is not enabled.\n");
+#endif
+
+  return 0;
+}
@@ -0,0 +1,141 @@
+// Copyright 2021 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define ENABLE_UNIKORN_SESSION_CREATION
+#include "unikorn_instrumentation.h"
+#include "unikorn_macros.h"
+#ifdef ENABLE_UNIKORN_RECORDING
+  #include "unikorn_clock_sync.h"
+#endif
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define SOCKET_PATH "./clock_sync.sock"
+#define SYNC_EXCHANGES 20
+
+#ifdef ENABLE_UNIKORN_RECORDING
+static void *unikorn_session = NULL; // Each process has its own session
+#endif
+
+static double doWork(int num_values) {
+  double sum = 0;
+  for (int i=0; i<num_values; i++) {
+    sum += sqrt((double)i);
+  }
+  return sum;
+}
+
+static void produce(int write_fd, int num_messages) {
+  // Create event session
+#ifdef ENABLE_UNIKORN_RECORDING
+  UkFileFlushInfo flush_info; // Needs to be persistent for life of session
+#endif
+  UK_CREATE("./clock_sync_producer.events", 10000, false, false, true, false, false,
+            NUM_UNIKORN_FOLDER_REGISTRATIONS, L_unikorn_folders,
+            NUM_UNIKORN_EVENT_REGISTRATIONS, L_unikorn_events,
+            &flush_info, &unikorn_session);
+#ifdef ENABLE_UNIKORN_RECORDING
+  // Wait for the consumer to serve its clock
+  while (!ukClockSyncWith(unikorn_session, ukGetTime, SOCKET_PATH, SYNC_EXCHANGES)) {
+    usleep(1000);
+  }
+#endif
+
+  // Produce the messages
+  double sum = 0;
+  for (int i=0; i<num_messages; i++) {
+    UK_RECORD_EVENT(unikorn_session, PRODUCE_START_ID, 0);
+    sum += doWork(10000);
+    UK_RECORD_EVENT(unikorn_session, PRODUCE_END_ID, 0);
+    int message = i;
+    if (write(write_fd, &message, sizeof(message)) != sizeof(message)) break;
+  }
+  close(write_fd);
+
+#ifdef ENABLE_UNIKORN_RECORDING
+  // Sync again, so the drift between the clocks can be corrected
+  if (!ukClockSyncWith(unikorn_session, ukGetTime, SOCKET_PATH, SYNC_EXCHANGES)) {
+    printf("Producer failed to sync with the consumer's clock\n");
+  }
+#endif
+
+  // Clean up
+  UK_FLUSH(unikorn_session);
+  UK_DESTROY(unikorn_session, &flush_info);
+  printf("Producer: sent %d messages (sum=%f)\n", num_messages, sum);
+}
+
+static void consume(int read_fd) {
+  // Create event session: multi-threaded since the clock sync samples are recorded by the serving thread
+#ifdef ENABLE_UNIKORN_RECORDING
+  UkFileFlushInfo flush_info; // Needs to be persistent for life of session
+#endif
+  UK_CREATE("./clock_sync_consumer.events", 10000, false, true, true, false, false,
+            NUM_UNIKORN_FOLDER_REGISTRATIONS, L_unikorn_folders,
+            NUM_UNIKORN_EVENT_REGISTRATIONS, L_unikorn_events,
+            &flush_info, &unikorn_session);
+#ifdef ENABLE_UNIKORN_RECORDING
+  if (!ukClockSyncServe(unikorn_session, ukGetTime, SOCKET_PATH)) {
+    printf("Failed to serve the consumer's clock\n");
+    exit(1);
+  }
+#endif
+
+  // Consume the messages until the producer closes the pipe
+  int message;
+  int num_messages = 0;
+  double sum = 0;
+  while (read(read_fd, &message, sizeof(message)) == sizeof(message)) {
+    UK_RECORD_EVENT(unikorn_session, CONSUME_START_ID, 0);
+    sum += doWork(5000);
+    UK_RECORD_EVENT(unikorn_session, CONSUME_END_ID, 0);
+    num_messages++;
+  }
+  close(read_fd);
+
+  // Clean up
+  wait(NULL); // The producer does its last clock sync after closing the pipe
+#ifdef ENABLE_UNIKORN_RECORDING
+  ukClockSyncStopServing();
+#endif
+  UK_FLUSH(unikorn_session);
+  UK_DESTROY(unikorn_session, &flush_info);
+  printf("Consumer: received %d messages (sum=%f)\n", num_messages, sum);
+}
+
+int main(int argc, char **argv) {
+  // Get arguments
+  if (argc != 2) { printf("usage: %s <num_messages>\n", argv[0]); return 1; }
+  int num_messages = atoi(argv[1]);
+
+  // Each process creates its own session after the fork, so each has its own events file
+  int pipe_fds[2];
+  if (pipe(pipe_fds) != 0) { printf("Failed to create pipe\n"); return 1; }
+  pid_t pid = fork();
+  if (pid < 0) { printf("Failed to fork\n"); return 1; }
+  if (pid == 0) {
+    close(pipe_fds[0]);
+    produce(pipe_fds[1], num_messages);
+  } else {
+    close(pipe_fds[1]);
+    consume(pipe_fds[0]);
+  }
+
+  return 0;
+}
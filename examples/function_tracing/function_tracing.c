@@ -0,0 +1,75 @@
+// Copyright 2021 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// No hand placed events: every function in this file is recorded via -finstrument-functions (see the Makefile)
+// NOTE: The functions are not static, so -rdynamic exports their names
+#ifdef ENABLE_UNIKORN_RECORDING
+  #include "unikorn_cyg_profile.h"
+  #include "unikorn_clock.h"
+  #include "unikorn_file_flush.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NUM_VALUES 200
+
+int fibonacci(int n) {
+  if (n < 2) return n;
+  return fibonacci(n-1) + fibonacci(n-2);
+}
+
+void swapValues(int *a, int *b) {
+  int temp = *a;
+  *a = *b;
+  *b = temp;
+}
+
+void bubbleSort(int *values, int count) {
+  for (int i=0; i<count; i++) {
+    for (int j=0; j<count-1-i; j++) {
+      if (values[j] > values[j+1]) swapValues(&values[j], &values[j+1]);
+    }
+  }
+}
+
+void fillValues(int *values, int count) {
+  for (int i=0; i<count; i++) {
+    values[i] = rand() % 1000;
+  }
+}
+
+int main() {
+#ifdef ENABLE_UNIKORN_RECORDING
+  // Only trace the application, and don't go deeper than 6 calls (keeps the recursive fibonacci() manageable)
+  ukCygProfileAllowModule(NULL);
+  UkFileFlushInfo flush_info = { .filename="./function_tracing.events", .file=NULL, .events_saved=false, .append_subsequent_saves=true };
+  UkAttrs attrs = { .max_event_count=100000, .flush_when_full=true, .record_instance=true };
+  ukCygProfileStart(&attrs, 100, 6, ukGetTime, &flush_info, ukPrepareFileFlush, ukFileFlush, ukFinishFileFlush);
+#endif
+
+  int values[NUM_VALUES];
+  fillValues(values, NUM_VALUES);
+  bubbleSort(values, NUM_VALUES);
+  printf("Smallest=%d, largest=%d\n", values[0], values[NUM_VALUES-1]);
+  printf("fibonacci(20)=%d\n", fibonacci(20));
+
+#ifdef ENABLE_UNIKORN_RECORDING
+  ukCygProfileStop();
+  printf("Events were recorded. Use UnikornViewer to view the .events file.\n");
+#else
+  printf("Event recording is not enabled.\n");
+#endif
+
+  return 0;
+}
@@ -0,0 +1,105 @@
+// Copyright 2021..2024 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "unikorn_instrumentation.hpp"
+#include "unikorn_macros.h"
+#include <stdio.h>
+#include <stdexcept>
+#include <vector>
+
+#ifdef ENABLE_UNIKORN_RECORDING
+static void *unikorn_session = NULL;
+#endif
+
+static int findFirstNegative(const std::vector<int> &values) {
+  // The end event is recorded on each return
+  UK_NAMED_SCOPE(search_scope, unikorn_session, Search, (double)values.size());
+  for (size_t i=0; i<values.size(); i++) {
+    if (values[i] < 0) {
+      search_scope.setEndValue((double)i);
+      return (int)i;
+    }
+  }
+  search_scope.setEndValue(-1);
+  return -1;
+}
+
+static void validate(int value) {
+  // The end event is recorded even if an exception is thrown
+  UK_NAMED_SCOPE(validate_scope, unikorn_session, Validate, value);
+  if (value < 0) throw std::invalid_argument("negative value");
+}
+
+int main() {
+  // Create event session
+#ifdef ENABLE_UNIKORN_RECORDING
+  UkFileFlushInfo flush_info; // Needs to be persistent for life of session
+#endif
+  UK_CREATE("./hello_cpp.events", 10000, false, false, true, true, true,
+            UnikornRegistry::folderCount(), UnikornRegistry::folderList(),
+            UnikornRegistry::eventCount(), UnikornRegistry::eventList(),
+            &flush_info, &unikorn_session);
+
+  // Print without recording
+  printf("Hello!\n");
+
+  // Record print
+  {
+    UK_SCOPE(unikorn_session, Print);
+    printf("Hello!\n");
+  }
+
+  // Folders and loops
+  {
+    UK_FOLDER_SCOPE(unikorn_session, SolarSystem);
+    UK_SCOPE(unikorn_session, ForLoop);
+    for (int j=0; j<5; j++) {
+      UK_NAMED_SCOPE(print_scope, unikorn_session, Print, j);
+      printf("Earth to Mars!\n");
+      print_scope.setEndValue(299792458);
+    }
+  }
+
+  // Early returns
+  std::vector<int> values = { 3, 1, -4, 1, -5 };
+  printf("First negative value is at index %d\n", findFirstNegative(values));
+  values = { 2, 7, 1, 8 };
+  printf("First negative value is at index %d\n", findFirstNegative(values));
+
+  // Exceptions
+  for (int value : { 6, -2, 8 }) {
+    try {
+      validate(value);
+      printf("%d is valid\n", value);
+    } catch (const std::invalid_argument &error) {
+      printf("%d is not valid: %s\n", value, error.what());
+    }
+  }
+
+  // The C macros can also be used with the registry's IDs
+  UK_RECORD_EVENT(unikorn_session, UK_START_ID(Print), 0);
+  printf("Good Bye!\n");
+  UK_RECORD_EVENT(unikorn_session, UK_END_ID(Print), 23.33);
+
+  // Clean up
+  UK_FLUSH(unikorn_session);
+  UK_DESTROY(unikorn_session, &flush_info);
+#ifdef ENABLE_UNIKORN_RECORDING
+  printf("Events were recorded. Use UnikornViewer to view the .events file.\n");
+#else
+  printf("Event recording is not enabled.\n");
+#endif
+
+  return 0;
+}
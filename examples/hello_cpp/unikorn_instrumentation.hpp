@@ -0,0 +1,44 @@
+// Copyright 2021..2024 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _UNIKORN_INSTRUMENTATION_HPP_
+#define _UNIKORN_INSTRUMENTATION_HPP_
+
+// NOTE: Include this header file in any source file that will use unikorn event intrumenting
+#include "unikorn.hpp"
+#ifdef ENABLE_UNIKORN_RECORDING
+
+// ------------------------------------------------
+// Define custom folders
+// ------------------------------------------------
+//        Type         Name
+UK_FOLDER(SolarSystem, "Solar System");
+
+// ------------------------------------------------
+// Define custom events
+// ------------------------------------------------
+//       Type      Name        Color     Start Value Name  End Value Name
+UK_EVENT(ForLoop,  "For Loop", UK_BLACK, "",               "");
+UK_EVENT(Print,    "Print",    UK_BLUE,  "Loop Index",     "Favorite Number");
+UK_EVENT(Search,   "Search",   UK_GREEN, "Count",          "Found Index");
+UK_EVENT(Validate, "Validate", UK_RED,   "Value",          "");
+
+// ------------------------------------------------
+// The IDs and registration lists are derived from the order of the types here
+// ------------------------------------------------
+using UnikornRegistry = uk::Registry<uk::Folders<SolarSystem>,
+                                     uk::Events<ForLoop, Print, Search, Validate>>;
+
+#endif // ENABLE_UNIKORN_RECORDING
+#endif // _UNIKORN_INSTRUMENTATION_HPP_
@@ -0,0 +1,107 @@
+// Copyright 2021..2024 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define ENABLE_UNIKORN_SESSION_CREATION
+#include "unikorn_instrumentation.h"
+#include "unikorn_macros.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define NUM_ROUNDS 5
+#define NUM_RECORDS 200
+#define RECORDS_PER_SYNC 20
+#define JOURNAL_FILENAME "./preload_io.journal"
+
+static size_t writeLog(int fd, uint32_t round) {
+  // Small writes, with an fsync() every few records: the fsync() calls are the slow ones
+  size_t bytes = 0;
+  for (uint32_t i=0; i<NUM_RECORDS; i++) {
+    char record[64];
+    int length = snprintf(record, sizeof(record), "round %u, record %u\n", round, i);
+    ssize_t written = write(fd, record, (size_t)length);
+    if (written != length) { printf("Failed to write to the journal\n"); exit(1); }
+    bytes += (size_t)written;
+    if ((i+1) % RECORDS_PER_SYNC == 0) fsync(fd);
+  }
+  return bytes;
+}
+
+static size_t replay(int fd, off_t offset, size_t bytes, int sockets[2]) {
+  // Read the round's records back, and pass them through a socket pair
+  size_t replayed = 0;
+  char buffer[512];
+  while (replayed < bytes) {
+    size_t count = bytes - replayed;
+    if (count > sizeof(buffer)) count = sizeof(buffer);
+    ssize_t read_bytes = pread(fd, buffer, count, offset + (off_t)replayed);
+    if (read_bytes <= 0) { printf("Failed to read the journal\n"); exit(1); }
+    ssize_t sent = send(sockets[0], buffer, (size_t)read_bytes, 0);
+    ssize_t received = recv(sockets[1], buffer, sizeof(buffer), 0);
+    if (sent != read_bytes || received != sent) { printf("Failed to pass the records through the socket pair\n"); exit(1); }
+    replayed += (size_t)read_bytes;
+  }
+  return replayed;
+}
+
+int main() {
+  // Create event session
+#ifdef ENABLE_UNIKORN_RECORDING
+  UkFileFlushInfo flush_info; // Needs to be persistent for life of session
+  void *unikorn_session = NULL;
+#endif
+  UK_CREATE("./preload_io.events", 10000, false, false, true, true, true,
+            NUM_UNIKORN_FOLDER_REGISTRATIONS, L_unikorn_folders,
+            NUM_UNIKORN_EVENT_REGISTRATIONS, L_unikorn_events,
+            &flush_info, &unikorn_session);
+
+  int fd = open(JOURNAL_FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) { printf("Failed to create '%s'\n", JOURNAL_FILENAME); return 1; }
+  int sockets[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) { printf("Failed to create a socket pair\n"); return 1; }
+
+  off_t offset = 0;
+  size_t total_bytes = 0;
+  size_t total_replayed = 0;
+  for (uint32_t round=1; round<=NUM_ROUNDS; round++) {
+    UK_RECORD_EVENT(unikorn_session, LOG_START_ID, round);
+    size_t bytes = writeLog(fd, round);
+    UK_RECORD_EVENT(unikorn_session, LOG_END_ID, bytes);
+    UK_RECORD_EVENT(unikorn_session, REPLAY_START_ID, round);
+    size_t replayed = replay(fd, offset, bytes, sockets);
+    UK_RECORD_EVENT(unikorn_session, REPLAY_END_ID, replayed);
+    offset += (off_t)bytes;
+    total_bytes += bytes;
+    total_replayed += replayed;
+  }
+  printf("Logged %d rounds of %d records (%zu bytes), and replayed %zu bytes\n", NUM_ROUNDS, NUM_RECORDS, total_bytes, total_replayed);
+  close(sockets[0]);
+  close(sockets[1]);
+  close(fd);
+
+  // Clean up
+  UK_FLUSH(unikorn_session);
+  UK_DESTROY(unikorn_session, &flush_info);
+#ifdef ENABLE_UNIKORN_RECORDING
+  printf("Events were recorded. Use UnikornViewer to view the .events file.\n");
+#else
+  printf("Event recording is not enabled.\n");
+#endif
+
+  return 0;
+}
@@ -0,0 +1,110 @@
+// Copyright 2021..2024 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define ENABLE_UNIKORN_SESSION_CREATION
+#include "unikorn_instrumentation.h"
+#include "unikorn_macros.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define NUM_ROUNDS 5
+#define NUM_RECORDS 20000
+
+typedef struct {
+  char *name;
+  char *value;
+} Record;
+
+static Record *parse(uint32_t round, uint32_t *count_ret) {
+  // Lots of small allocations: a burst that is easy to miss without seeing the allocator
+  Record *records = NULL;
+  uint32_t count = 0;
+  uint32_t capacity = 0;
+  for (uint32_t i=0; i<NUM_RECORDS; i++) {
+    if (count == capacity) {
+      capacity = (capacity == 0) ? 16 : capacity * 2;
+      records = realloc(records, capacity * sizeof(Record));
+    }
+    char text[64];
+    snprintf(text, sizeof(text), "name_%u_%u", round, i);
+    records[count].name = strdup(text);
+    snprintf(text, sizeof(text), "value_%u", i * round);
+    records[count].value = strdup(text);
+    count++;
+  }
+  *count_ret = count;
+  return records;
+}
+
+static size_t buildIndex(Record *records, uint32_t count) {
+  // A few large allocations
+  size_t bytes = count * sizeof(uint64_t) * 16;
+  uint64_t *index = calloc(count * 16, sizeof(uint64_t));
+  for (uint32_t i=0; i<count; i++) {
+    index[i * 16] = (uint64_t)strlen(records[i].name) + (uint64_t)strlen(records[i].value);
+  }
+  size_t total = 0;
+  for (uint32_t i=0; i<count; i++) total += index[i * 16];
+  free(index);
+  return (total > 0) ? bytes : 0;
+}
+
+static void cleanUp(Record *records, uint32_t count) {
+  for (uint32_t i=0; i<count; i++) {
+    free(records[i].name);
+    free(records[i].value);
+  }
+  free(records);
+}
+
+int main() {
+  // Create event session
+#ifdef ENABLE_UNIKORN_RECORDING
+  UkFileFlushInfo flush_info; // Needs to be persistent for life of session
+  void *unikorn_session = NULL;
+#endif
+  UK_CREATE("./preload_malloc.events", 10000, false, false, true, true, true,
+            NUM_UNIKORN_FOLDER_REGISTRATIONS, L_unikorn_folders,
+            NUM_UNIKORN_EVENT_REGISTRATIONS, L_unikorn_events,
+            &flush_info, &unikorn_session);
+
+  size_t index_bytes = 0;
+  for (uint32_t round=1; round<=NUM_ROUNDS; round++) {
+    uint32_t count;
+    UK_RECORD_EVENT(unikorn_session, PARSE_START_ID, round);
+    Record *records = parse(round, &count);
+    UK_RECORD_EVENT(unikorn_session, PARSE_END_ID, count);
+    UK_RECORD_EVENT(unikorn_session, INDEX_START_ID, 0);
+    size_t bytes = buildIndex(records, count);
+    UK_RECORD_EVENT(unikorn_session, INDEX_END_ID, bytes);
+    index_bytes += bytes;
+    UK_RECORD_EVENT(unikorn_session, CLEANUP_START_ID, 0);
+    cleanUp(records, count);
+    UK_RECORD_EVENT(unikorn_session, CLEANUP_END_ID, 0);
+  }
+  printf("Parsed %d rounds of %d records, and built %zu bytes of indexes\n", NUM_ROUNDS, NUM_RECORDS, index_bytes);
+
+  // Clean up
+  UK_FLUSH(unikorn_session);
+  UK_DESTROY(unikorn_session, &flush_info);
+#ifdef ENABLE_UNIKORN_RECORDING
+  printf("Events were recorded. Use UnikornViewer to view the .events file.\n");
+#else
+  printf("Event recording is not enabled.\n");
+#endif
+
+  return 0;
+}
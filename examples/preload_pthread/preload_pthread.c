@@ -0,0 +1,106 @@
+// Copyright 2021..2024 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define ENABLE_UNIKORN_SESSION_CREATION
+#include "unikorn_instrumentation.h"
+#include "unikorn_macros.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+
+#define NUM_THREADS 4
+#define NUM_TASKS 20000
+
+// A thread pool where every task also updates shared totals while holding the queue's mutex, so the pool is serialized.
+// Not static, so the interposer can find the names of the mutexes (the application is linked with -rdynamic).
+pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static uint32_t next_task = 0;
+static uint32_t queued_tasks = 0;
+static bool no_more_tasks = false;
+static double total = 0;
+#ifdef ENABLE_UNIKORN_RECORDING
+static void *unikorn_session = NULL;
+#endif
+
+static double work(uint32_t task) {
+  double sum = 0;
+  for (uint32_t i=0; i<200; i++) sum += sqrt((double)(task + i));
+  return sum;
+}
+
+static void *workerThread(void *user_data) {
+  while (1) {
+    pthread_mutex_lock(&queue_mutex);
+    while (queued_tasks == 0 && !no_more_tasks) pthread_cond_wait(&queue_cond, &queue_mutex);
+    if (queued_tasks == 0) {
+      pthread_mutex_unlock(&queue_mutex);
+      break;
+    }
+    uint32_t task = next_task++;
+    queued_tasks--;
+    UK_RECORD_EVENT(unikorn_session, TASK_START_ID, task);
+    total += work(task); // The mistake: the work is done while holding the mutex
+    UK_RECORD_EVENT(unikorn_session, TASK_END_ID, 0);
+    pthread_mutex_unlock(&queue_mutex);
+  }
+  return user_data;
+}
+
+int main() {
+  // Create event session
+#ifdef ENABLE_UNIKORN_RECORDING
+  UkFileFlushInfo flush_info; // Needs to be persistent for life of session
+#endif
+  UK_CREATE("./preload_pthread.events", 100000, false, true, true, true, false,
+            NUM_UNIKORN_FOLDER_REGISTRATIONS, L_unikorn_folders,
+            NUM_UNIKORN_EVENT_REGISTRATIONS, L_unikorn_events,
+            &flush_info, &unikorn_session);
+
+  // Start the pool
+  pthread_t threads[NUM_THREADS];
+  for (uint32_t i=0; i<NUM_THREADS; i++) {
+    pthread_create(&threads[i], NULL, workerThread, NULL);
+  }
+
+  // Queue the tasks
+  for (uint32_t i=0; i<NUM_TASKS; i++) {
+    pthread_mutex_lock(&queue_mutex);
+    queued_tasks++;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+  }
+  pthread_mutex_lock(&queue_mutex);
+  no_more_tasks = true;
+  pthread_cond_broadcast(&queue_cond);
+  pthread_mutex_unlock(&queue_mutex);
+  for (uint32_t i=0; i<NUM_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  printf("Ran %d tasks on %d threads: total=%g\n", NUM_TASKS, NUM_THREADS, total);
+
+  // Clean up
+  UK_FLUSH(unikorn_session);
+  UK_DESTROY(unikorn_session, &flush_info);
+#ifdef ENABLE_UNIKORN_RECORDING
+  printf("Events were recorded. Use UnikornViewer to view the .events file.\n");
+#else
+  printf("Event recording is not enabled.\n");
+#endif
+
+  return 0;
+}
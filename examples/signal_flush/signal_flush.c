@@ -0,0 +1,104 @@
+// Copyright 2021 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define ENABLE_UNIKORN_SESSION_CREATION
+#include "unikorn_instrumentation.h"
+#include "unikorn_macros.h"
+#ifdef ENABLE_UNIKORN_RECORDING
+  #include "unikorn_signal_flush.h"
+#endif
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define NUM_THREADS 4
+
+static volatile bool keep_running = true; // Using volatile to avoid compiler optimizations
+#ifdef ENABLE_UNIKORN_RECORDING
+static void *unikorn_session = NULL;
+#endif
+
+static void *serviceThread(void *user_data) {
+  uint32_t seed = (uint32_t)((uint64_t)user_data);
+  double sum = 0;
+  while (keep_running) {
+    // Mostly short requests, with a long tail
+    int num_values = 10 + rand_r(&seed) % 50;
+    if (rand_r(&seed) % 100 == 0) num_values *= 100;
+    UK_RECORD_EVENT(unikorn_session, REQUEST_START_ID, 0);
+    for (int i=0; i<num_values; i++) {
+      UK_RECORD_EVENT(unikorn_session, SQRT_START_ID, 0);
+      sum += sqrt((double)i);
+      UK_RECORD_EVENT(unikorn_session, SQRT_END_ID, 0);
+    }
+    UK_RECORD_EVENT(unikorn_session, REQUEST_END_ID, 0);
+    // Idle between requests
+    struct timespec idle_time = { .tv_sec = 0, .tv_nsec = 100000 };
+    nanosleep(&idle_time, NULL);
+  }
+  return (sum > 0) ? NULL : user_data;
+}
+
+int main(int argc, char **argv) {
+  // Get arguments
+  if (argc != 2) { printf("usage: %s <seconds>\n", argv[0]); return 1; }
+  int seconds = atoi(argv[1]);
+
+  // Create event session: only the most recent events are kept, since the process is long running
+#ifdef ENABLE_UNIKORN_RECORDING
+  UkFileFlushInfo flush_info; // Needs to be persistent for life of session
+#endif
+  UK_CREATE("./signal_flush.events", 100000, false, true, true, false, false,
+            NUM_UNIKORN_FOLDER_REGISTRATIONS, L_unikorn_folders,
+            NUM_UNIKORN_EVENT_REGISTRATIONS, L_unikorn_events,
+            &flush_info, &unikorn_session);
+#ifdef ENABLE_UNIKORN_RECORDING
+  // Each SIGUSR1 saves a snapshot of the recent events to a new file
+  if (!ukSignalFlushStart(unikorn_session, SIGUSR1, "./signal_flush", true)) {
+    printf("Failed to start saving events on SIGUSR1\n");
+    return 1;
+  }
+  printf("Running for %d seconds. To save the recent events: kill -USR1 %d\n", seconds, (int)getpid());
+#else
+  printf("Running for %d seconds. Event recording is not enabled.\n", seconds);
+#endif
+
+  // Run the service
+  pthread_t thread_ids[NUM_THREADS];
+  for (uint64_t i=0; i<NUM_THREADS; i++) {
+    pthread_create(&thread_ids[i], NULL, serviceThread, (void *)(i+1));
+  }
+  time_t end_time = time(NULL) + seconds;
+  while (time(NULL) < end_time) {
+    sleep(1); // NOTE: The signal can end the sleep early
+  }
+  keep_running = false;
+  for (int i=0; i<NUM_THREADS; i++) {
+    pthread_join(thread_ids[i], NULL);
+  }
+
+  // Clean up
+#ifdef ENABLE_UNIKORN_RECORDING
+  ukSignalFlushStop();
+#endif
+  UK_DESTROY(unikorn_session, &flush_info);
+
+  return 0;
+}
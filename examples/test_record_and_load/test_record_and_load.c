@@ -22,6 +22,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#if defined(ENABLE_UNIKORN_RECORDING) && !defined(_WIN32)
+  #include <pthread.h>
+  #include <signal.h>
+  #include <unistd.h>
+  #include <sys/wait.h>
+#endif
 #ifdef NDEBUG // Don't want assert compiled out
   #undef NDEBUG
 #endif
@@ -30,20 +36,472 @@
 #ifdef ENABLE_UNIKORN_RECORDING
 static void *unikorn_session = NULL;
 #endif
+#ifndef UK_RECORD_SPANS
+  #define UK_RECORD_SPANS false  // Build with SPANS=Yes to record the print as one span instead of a start and end event
+#endif
 
 static void doStuff() {
   double a = 4.0;
   UK_RECORD_EVENT(unikorn_session, SQRT_START_ID, a);
   double b = sqrt(a);
   UK_RECORD_EVENT(unikorn_session, SQRT_END_ID, b);
+#if defined(ENABLE_UNIKORN_RECORDING) && UK_RECORD_SPANS
+  uint64_t start_time = ukGetTime();
+  printf("The square root of %f is %f\n", a, b);
+  UK_RECORD_SPAN(unikorn_session, PRINT_START_ID, start_time, ukGetTime(), 0);
+#else
   UK_RECORD_EVENT(unikorn_session, PRINT_START_ID, 0);
   printf("The square root of %f is %f\n", a, b);
   UK_RECORD_EVENT(unikorn_session, PRINT_END_ID, 0);
+#endif
+}
+
+#ifdef ENABLE_UNIKORN_RECORDING
+// ------------------------------------------------
+// Feature tests: each one records with a session made for the feature, then checks what was loaded back.
+// The sessions use a fake clock, so durations don't depend on how fast the test runs.
+// ------------------------------------------------
+static uint64_t L_fake_time = 1000;
+
+static uint64_t fakeTime() {
+  return L_fake_time;
+}
+
+static void initTestAttrs(UkAttrs *attrs) {
+  memset(attrs, 0, sizeof(UkAttrs));
+  attrs->max_event_count = 1000;
+  attrs->is_multi_threaded = true;
+  attrs->record_instance = true;
+  attrs->record_value = true;
+  attrs->folder_registration_count = NUM_UNIKORN_FOLDER_REGISTRATIONS;
+  attrs->folder_registration_list = L_unikorn_folders;
+  attrs->event_registration_count = NUM_UNIKORN_EVENT_REGISTRATIONS;
+  attrs->event_registration_list = L_unikorn_events;
 }
 
+static void *createTestSession(UkAttrs *attrs, const char *filename, UkFileFlushInfo *flush_info, bool (*prepareFlush)(void *user_data)) {
+  remove(filename); // Nothing is saved if no events are recorded, so don't load the previous test's file
+  flush_info->filename = (char *)filename;
+  flush_info->file = NULL;
+  flush_info->events_saved = false;
+  flush_info->append_subsequent_saves = true;
+  return ukCreate(attrs, fakeTime, flush_info, prepareFlush, ukFileFlush, ukFinishFileFlush);
+}
+
+static void recordAt(void *session, uint64_t time, uint16_t event_id, double value) {
+  L_fake_time = time;
+  ukRecordEvent(session, event_id, value, NULL, NULL, 0);
+}
+
+static UkEvents *saveAndLoad(void *session, const char *filename) {
+  ukFlush(session);
+  ukDestroy(session);
+  UkEvents *events = ukLoadEventsFile(filename);
+  assert(events != NULL);
+  return events;
+}
+
+static uint32_t countEvents(UkEvents *events, uint16_t event_id) {
+  uint32_t count = 0;
+  for (uint32_t i=0; i<events->event_count; i++) {
+    if (events->event_buffer[i].event_id == event_id) count++;
+  }
+  return count;
+}
+
+static void testThreshold(const char *filename, bool is_multi_threaded) {
+  // Only the instances lasting at least the threshold are kept, with the events recorded during them
+  UkAttrs attrs;
+  initTestAttrs(&attrs);
+  attrs.is_multi_threaded = is_multi_threaded;
+  UkFileFlushInfo flush_info;
+  void *session = createTestSession(&attrs, filename, &flush_info, ukPrepareFileFlush);
+  ukSetEventThreshold(session, SQRT_START_ID, 100);
+  uint64_t durations[] = { 50, 150, 99, 100, 1000 };
+  uint64_t time = 1000;
+  for (uint32_t i=0; i<sizeof(durations)/sizeof(uint64_t); i++) {
+    recordAt(session, time, SQRT_START_ID, i);
+    recordAt(session, time+1, PRINT_START_ID, i);
+    recordAt(session, time+2, PRINT_END_ID, i);
+    recordAt(session, time+durations[i], SQRT_END_ID, i);
+    time += 2000;
+  }
+  recordAt(session, time, PRINT_START_ID, 10); // Not thresholded
+  recordAt(session, time+1, PRINT_END_ID, 10);
+  UkEvents *events = saveAndLoad(session, filename);
+  assert(events->has_thresholds);
+  assert(countEvents(events, SQRT_START_ID) == 3);
+  assert(countEvents(events, SQRT_END_ID) == 3);
+  assert(countEvents(events, PRINT_START_ID) == 4);
+  for (uint32_t i=0; i<events->event_count; i++) {
+    uint32_t value = (uint32_t)events->event_buffer[i].value;
+    assert(value == 1 || value == 3 || value == 4 || value == 10);
+  }
+  ukFreeEvents(events);
+}
+
+static void testEventCapacity(const char *filename, bool is_multi_threaded) {
+  // An event type with its own buffer only keeps its newest events, and the other event types can't evict them
+  UkAttrs attrs;
+  initTestAttrs(&attrs);
+  attrs.max_event_count = 100;
+  attrs.is_multi_threaded = is_multi_threaded;
+  UkFileFlushInfo flush_info;
+  void *session = createTestSession(&attrs, filename, &flush_info, ukPrepareFileFlush);
+  ukSetEventCapacity(session, SQRT_START_ID, 10);
+  uint64_t time = 1000;
+  for (uint32_t i=0; i<100; i++) {
+    recordAt(session, time++, SQRT_START_ID, i);
+    recordAt(session, time++, SQRT_END_ID, i);
+  }
+  for (uint32_t i=0; i<500; i++) {
+    recordAt(session, time++, PRINT_START_ID, i);
+    recordAt(session, time++, PRINT_END_ID, i);
+  }
+  UkEvents *events = saveAndLoad(session, filename);
+  assert(countEvents(events, SQRT_START_ID) == 5);
+  assert(countEvents(events, SQRT_END_ID) == 5);
+  assert(countEvents(events, PRINT_START_ID) + countEvents(events, PRINT_END_ID) == 100);
+  for (uint32_t i=0; i<events->event_count; i++) {
+    UkEvent *event = &events->event_buffer[i];
+    if (event->event_id == SQRT_START_ID || event->event_id == SQRT_END_ID) assert(event->value >= 95);
+    else assert(event->value >= 450);
+  }
+  ukFreeEvents(events);
+}
+
+static void testPause(const char *filename, bool is_multi_threaded) {
+  // The paused time range is stored, and the events recorded while paused are not
+  UkAttrs attrs;
+  initTestAttrs(&attrs);
+  attrs.is_multi_threaded = is_multi_threaded;
+  UkFileFlushInfo flush_info;
+  void *session = createTestSession(&attrs, filename, &flush_info, ukPrepareFileFlush);
+  recordAt(session, 1000, SQRT_START_ID, 0);
+  recordAt(session, 1100, SQRT_END_ID, 0);
+  L_fake_time = 2000;
+  ukPause(session);
+  recordAt(session, 2100, SQRT_START_ID, 1);
+  recordAt(session, 2200, SQRT_END_ID, 1);
+  L_fake_time = 3000;
+  ukResume(session);
+  recordAt(session, 3100, SQRT_START_ID, 2);
+  recordAt(session, 3200, SQRT_END_ID, 2);
+  UkEvents *events = saveAndLoad(session, filename);
+  assert(events->pause_count == 1);
+  assert(events->pause_list[0].start_time == 2000 && events->pause_list[0].end_time == 3000);
+  assert(events->event_count == 4);
+  for (uint32_t i=0; i<events->event_count; i++) {
+    uint64_t time = events->event_buffer[i].time;
+    assert(time < events->pause_list[0].start_time || time > events->pause_list[0].end_time);
+    assert(events->event_buffer[i].value != 1);
+  }
+  ukFreeEvents(events);
+}
+
+static void setConfig(const char *config) {
+#ifdef _WIN32
+  _putenv_s("UNIKORN_CONFIG", (config == NULL) ? "" : config);
+#else
+  if (config == NULL) unsetenv("UNIKORN_CONFIG");
+  else setenv("UNIKORN_CONFIG", config, 1);
+#endif
+}
+
+static void testConfig(const char *filename, bool apply_config) {
+  // UNIKORN_CONFIG only changes the sessions that opt in
+  const char *prev_config = getenv("UNIKORN_CONFIG");
+  char *saved_config = (prev_config == NULL) ? NULL : strdup(prev_config);
+  setConfig("record_value=false,disable=Print,sample=Sqrt:2");
+  UkAttrs attrs;
+  initTestAttrs(&attrs);
+  attrs.apply_config = apply_config;
+  UkFileFlushInfo flush_info;
+  void *session = createTestSession(&attrs, filename, &flush_info, ukPrepareFileFlush);
+  setConfig(saved_config);
+  free(saved_config);
+  uint64_t time = 1000;
+  for (uint32_t i=0; i<10; i++) {
+    recordAt(session, time++, SQRT_START_ID, i);
+    recordAt(session, time++, PRINT_START_ID, i);
+    recordAt(session, time++, PRINT_END_ID, i);
+    recordAt(session, time++, SQRT_END_ID, i);
+  }
+  UkEvents *events = saveAndLoad(session, filename);
+  assert(events->includes_value == !apply_config);
+  assert(countEvents(events, PRINT_START_ID) == (apply_config ? 0 : 10));
+  assert(countEvents(events, SQRT_START_ID) == (apply_config ? 5 : 10));
+  assert(countEvents(events, SQRT_END_ID) == (apply_config ? 5 : 10));
+  ukFreeEvents(events);
+}
+
+static UkEvents *recordForRealTime(const char *filename, bool is_multi_threaded, bool real_time) {
+  UkAttrs attrs;
+  initTestAttrs(&attrs);
+  attrs.max_event_count = 20;
+  attrs.flush_when_full = true;
+  attrs.is_multi_threaded = is_multi_threaded;
+  attrs.real_time = real_time;
+  UkFileFlushInfo flush_info;
+  void *session = createTestSession(&attrs, filename, &flush_info, ukPrepareFileFlush);
+  ukSetEventThreshold(session, PRINT_START_ID, 5);
+  uint64_t time = 1000;
+  for (uint32_t i=0; i<100; i++) {
+    if (i == 50) { L_fake_time = time++; ukPause(session); }
+    if (i == 60) { L_fake_time = time++; ukResume(session); }
+    recordAt(session, time++, SQRT_START_ID, i);
+    recordAt(session, time, PRINT_START_ID, i);
+    time += i % 10;
+    recordAt(session, time++, PRINT_END_ID, i);
+    recordAt(session, time++, SQRT_END_ID, i);
+  }
+  return saveAndLoad(session, filename);
+}
+
+static void testRealTime(const char *filename, bool is_multi_threaded) {
+  // Real time mode only changes how the memory is allocated, so the file has the same events
+  UkEvents *expected = recordForRealTime(filename, is_multi_threaded, false);
+  UkEvents *events = recordForRealTime(filename, is_multi_threaded, true);
+  assert(events->event_count == expected->event_count);
+  for (uint32_t i=0; i<events->event_count; i++) {
+    UkEvent *event = &events->event_buffer[i];
+    UkEvent *expected_event = &expected->event_buffer[i];
+    assert(event->time == expected_event->time);
+    assert(event->event_id == expected_event->event_id);
+    assert(event->instance == expected_event->instance);
+    assert(event->value == expected_event->value);
+    if (is_multi_threaded) assert(event->thread_index == expected_event->thread_index);
+  }
+  assert(events->pause_count == expected->pause_count);
+  for (uint32_t i=0; i<events->pause_count; i++) {
+    assert(events->pause_list[i].start_time == expected->pause_list[i].start_time);
+    assert(events->pause_list[i].end_time == expected->pause_list[i].end_time);
+  }
+  ukFreeEvents(expected);
+  ukFreeEvents(events);
+}
+
+#ifndef _WIN32
+static void *exitWhileStaged(void *session) {
+  // The Sqrt instance never ends: the first one has lasted longer than the threshold when the thread exits, the second one hasn't
+  uint64_t start_time = L_fake_time;
+  recordAt(session, start_time, SQRT_START_ID, 1);
+  recordAt(session, start_time+10, PRINT_START_ID, 1);
+  recordAt(session, start_time+20, PRINT_END_ID, 1);
+  L_fake_time = start_time + ((start_time == 1000) ? 500 : 50);
+  return NULL;
+}
+
+static void testThreadExitWithStagedEvents(const char *filename, bool record_per_cpu) {
+  // A thread exiting before its staged instance ends still keeps the instance if it already exceeded the threshold
+  UkAttrs attrs;
+  initTestAttrs(&attrs);
+  attrs.record_per_cpu = record_per_cpu;
+  UkFileFlushInfo flush_info;
+  void *session = createTestSession(&attrs, filename, &flush_info, ukPrepareFileFlush);
+  ukSetEventThreshold(session, SQRT_START_ID, 100);
+  L_fake_time = 1000;
+  pthread_t thread;
+  pthread_create(&thread, NULL, exitWhileStaged, session);
+  pthread_join(thread, NULL);
+  L_fake_time = 2000;
+  pthread_create(&thread, NULL, exitWhileStaged, session);
+  pthread_join(thread, NULL);
+  UkEvents *events = saveAndLoad(session, filename);
+  assert(countEvents(events, SQRT_START_ID) == 1);
+  assert(countEvents(events, PRINT_START_ID) == 1);
+  assert(countEvents(events, PRINT_END_ID) == 1);
+  for (uint32_t i=0; i<events->event_count; i++) assert(events->event_buffer[i].time < 2000);
+  ukFreeEvents(events);
+}
+
+static void testForkWithSpilling(const char *filename) {
+  // The child gets its own spill thread, so it can keep spilling and flushing
+  UkAttrs attrs;
+  initTestAttrs(&attrs);
+  attrs.max_event_count = 20;
+  attrs.spill_when_full = true;
+  attrs.spill_buffer_count = 1;
+  UkFileFlushInfo flush_info;
+  void *session = createTestSession(&attrs, filename, &flush_info, ukPrepareFileFlush);
+  for (uint32_t i=0; i<50; i++) recordAt(session, 1000+i, SQRT_START_ID, i);
+  ukLockForFork(session);
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    ukUnlockAfterFork(session, true);
+    alarm(10); // Fail instead of hanging
+    char child_filename[1024];
+    snprintf(child_filename, sizeof(child_filename), "%s.child", filename);
+    remove(child_filename);
+    flush_info.filename = child_filename;
+    flush_info.events_saved = false;
+    for (uint32_t i=0; i<50; i++) recordAt(session, 2000+i, PRINT_START_ID, i);
+    UkEvents *events = saveAndLoad(session, child_filename);
+    bool is_ok = countEvents(events, PRINT_START_ID) == 50;
+    ukFreeEvents(events);
+    remove(child_filename);
+    _exit(is_ok ? 0 : 1);
+  }
+  ukUnlockAfterFork(session, false);
+  int status = 0;
+  assert(waitpid(pid, &status, 0) == pid);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  for (uint32_t i=50; i<100; i++) recordAt(session, 1000+i, SQRT_START_ID, i);
+  UkEvents *events = saveAndLoad(session, filename);
+  assert(countEvents(events, SQRT_START_ID) == 100);
+  assert(countEvents(events, PRINT_START_ID) == 0);
+  ukFreeEvents(events);
+}
+
+static void *resumeTask(void *session) {
+  // Another thread picks up task 77
+  ukSetTaskId(session, 77);
+  recordAt(session, 1300, SQRT_END_ID, 77);
+  ukEndTask(session, 77);
+  return NULL;
+}
+
+static void *endOtherTask(void *session) {
+  // Ends task 55 while the main thread is still set to it, then a new task likely reuses its info
+  ukEndTask(session, 55);
+  ukSetTaskId(session, 66);
+  recordAt(session, 1500, SQRT_START_ID, 66);
+  recordAt(session, 1550, SQRT_END_ID, 66);
+  return NULL;
+}
+
+static uint64_t loadedThreadId(UkEvents *events, uint16_t event_id, double value, bool *is_task_ret) {
+  for (uint32_t i=0; i<events->event_count; i++) {
+    UkEvent *event = &events->event_buffer[i];
+    if (event->event_id != event_id || event->value != value) continue;
+    *is_task_ret = events->thread_is_task_list[event->thread_index];
+    return events->thread_id_list[event->thread_index];
+  }
+  assert(0);
+  return 0;
+}
+
+static void testTasks(const char *filename) {
+  // Events are grouped by task ID instead of by thread, even when the task moves to another thread
+  UkAttrs attrs;
+  initTestAttrs(&attrs);
+  UkFileFlushInfo flush_info;
+  void *session = createTestSession(&attrs, filename, &flush_info, ukPrepareFileFlush);
+  ukSetTaskId(session, 77);
+  recordAt(session, 1000, SQRT_START_ID, 77);
+  ukSetTaskId(session, 88);
+  recordAt(session, 1100, SQRT_START_ID, 88);
+  recordAt(session, 1150, SQRT_END_ID, 88);
+  ukEndTask(session, 88);
+  recordAt(session, 1200, PRINT_START_ID, 0); // Back to the thread
+  recordAt(session, 1250, PRINT_END_ID, 0);
+  pthread_t thread;
+  pthread_create(&thread, NULL, resumeTask, session);
+  pthread_join(thread, NULL);
+  ukSetTaskId(session, 55);
+  recordAt(session, 1400, SQRT_START_ID, 55);
+  pthread_create(&thread, NULL, endOtherTask, session);
+  pthread_join(thread, NULL);
+  recordAt(session, 1600, PRINT_START_ID, 55); // Task 55 was ended, so back to the thread
+  recordAt(session, 1650, PRINT_END_ID, 55);
+  UkEvents *events = saveAndLoad(session, filename);
+  bool is_task = false;
+  assert(loadedThreadId(events, SQRT_START_ID, 77, &is_task) == 77 && is_task);
+  assert(loadedThreadId(events, SQRT_END_ID, 77, &is_task) == 77 && is_task);
+  assert(loadedThreadId(events, SQRT_START_ID, 88, &is_task) == 88 && is_task);
+  assert(loadedThreadId(events, SQRT_END_ID, 88, &is_task) == 88 && is_task);
+  assert(loadedThreadId(events, PRINT_START_ID, 0, &is_task) != 0 && !is_task);
+  assert(loadedThreadId(events, SQRT_START_ID, 66, &is_task) == 66 && is_task);
+  uint64_t thread_id = loadedThreadId(events, PRINT_START_ID, 0, &is_task);
+  assert(loadedThreadId(events, PRINT_START_ID, 55, &is_task) == thread_id && !is_task);
+  ukFreeEvents(events);
+}
+
+static pthread_mutex_t L_flush_gate = PTHREAD_MUTEX_INITIALIZER;
+
+static bool gatedPrepareFlush(void *user_data) {
+  // Holds up the spill thread while the test has the gate locked, so the spare buffers stay busy
+  pthread_mutex_lock(&L_flush_gate);
+  pthread_mutex_unlock(&L_flush_gate);
+  return ukPrepareFileFlush(user_data);
+}
+
+static void testSpillPolicy(const char *filename, uint8_t spill_policy) {
+  // BLOCK keeps every event. Otherwise the spill thread is held up, so the events recorded while every spare is busy are dropped (newest) or overwrite the buffered ones (oldest).
+  UkAttrs attrs;
+  initTestAttrs(&attrs);
+  attrs.max_event_count = 20;
+  attrs.spill_when_full = true;
+  attrs.spill_buffer_count = 1;
+  attrs.spill_policy = spill_policy;
+  UkFileFlushInfo flush_info;
+  void *session = createTestSession(&attrs, filename, &flush_info, gatedPrepareFlush);
+  uint32_t recorded_count = (spill_policy == UK_SPILL_BLOCK) ? 1000 : 100;
+  if (spill_policy != UK_SPILL_BLOCK) pthread_mutex_lock(&L_flush_gate);
+  for (uint32_t i=0; i<recorded_count; i++) recordAt(session, 1000+i, SQRT_START_ID, i);
+  if (spill_policy != UK_SPILL_BLOCK) pthread_mutex_unlock(&L_flush_gate);
+  ukFlush(session);
+  uint64_t dropped_count = ukDroppedEventCount(session);
+  UkEvents *events = saveAndLoad(session, filename);
+
+  // The kept events are in the order recorded, with one gap where the events were dropped
+  assert(events->event_count + dropped_count == recorded_count);
+  uint32_t gap_start = events->event_count;
+  for (uint32_t i=0; i<events->event_count; i++) {
+    uint32_t value = (uint32_t)events->event_buffer[i].value;
+    if (i < gap_start && value != i) gap_start = i;
+    assert(value == ((i < gap_start) ? i : i + dropped_count));
+  }
+  if (spill_policy == UK_SPILL_BLOCK) {
+    assert(dropped_count == 0);
+  } else if (spill_policy == UK_SPILL_DROP_NEWEST) {
+    // Only the events that fit in the buffers are kept
+    assert(dropped_count > 0 && gap_start == events->event_count);
+  } else {
+    // The spilled events are kept, and the newest events replaced the ones buffered after them
+    assert(dropped_count > 0 && gap_start > 0 && gap_start < events->event_count);
+  }
+  ukFreeEvents(events);
+}
+#endif
+
+static void testFeatures(const char *filename) {
+  testThreshold(filename, false);
+  testThreshold(filename, true);
+  testEventCapacity(filename, false);
+  testEventCapacity(filename, true);
+  testPause(filename, false);
+  testPause(filename, true);
+  testConfig(filename, false);
+  testConfig(filename, true);
+  testRealTime(filename, false);
+  testRealTime(filename, true);
+#ifndef _WIN32
+  testThreadExitWithStagedEvents(filename, false);
+  testThreadExitWithStagedEvents(filename, true);
+  testTasks(filename);
+  testForkWithSpilling(filename);
+  testSpillPolicy(filename, UK_SPILL_BLOCK);
+  testSpillPolicy(filename, UK_SPILL_DROP_NEWEST);
+  testSpillPolicy(filename, UK_SPILL_DROP_OLDEST);
+#endif
+  printf("Feature tests passed.\n");
+}
+#endif
+
 int main(int argc, char **argv) {
+  if (argc == 3 && strcmp(argv[2], "features") == 0) {
+#ifdef ENABLE_UNIKORN_RECORDING
+    testFeatures(argv[1]);
+#else
+    printf("Event recording is not enabled.\n");
+#endif
+    return 0;
+  }
   if (argc != 8) {
     printf("Usage Example:  %s record_and_load.events 100 auto_flush=no threaded=yes instance=yes value=yes location=yes\n", argv[0]);
+    printf("                %s features.events features\n", argv[0]);
     return 0;
   }
 
@@ -90,6 +548,18 @@ int main(int argc, char **argv) {
   // Load the events
 #ifdef ENABLE_UNIKORN_RECORDING
   UkEvents *instance = ukLoadEventsFile(filename);
+  assert(instance != NULL);
+  if (UK_RECORD_SPANS) {
+    // Each span is loaded as a start and end event, so the pairs are never split by overwriting the oldest events
+    uint32_t start_count = 0;
+    uint32_t end_count = 0;
+    for (uint32_t i=0; i<instance->event_count; i++) {
+      if (instance->event_buffer[i].event_id == PRINT_START_ID) start_count++;
+      if (instance->event_buffer[i].event_id == PRINT_END_ID) end_count++;
+    }
+    assert(instance->has_spans);
+    assert(start_count > 0 && start_count == end_count);
+  }
   ukFreeEvents(instance);
   printf("Events were recorded to the file '%s'. Use the Unikorn Viewer to view the results.\n", filename);
 #else
@@ -0,0 +1,147 @@
+// Copyright 2021 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifdef ENABLE_UNIKORN_RECORDING
+  #include "unikorn.h"
+  #include "unikorn_clock.h"
+  #include "unikorn_inline.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef ENABLE_UNIKORN_RECORDING
+
+#define NUM_EVENTS 4000000   // Recorded per configuration
+#define MAX_EVENTS 100000    // Less than NUM_EVENTS, so the cost of overwriting the oldest events is included
+#ifndef UK_REAL_TIME
+  #define UK_REAL_TIME false  // Build with REAL_TIME=Yes to prefault and lock the event memory
+#endif
+
+enum {
+  WORK_START_ID=1,
+  WORK_END_ID,
+};
+
+static UkEventRegistration L_events[] = {
+  // Name    Color    Start ID       End ID       Start Value Name  End Value Name
+  { "Work",  UK_BLUE, WORK_START_ID, WORK_END_ID, "",               ""},
+};
+
+typedef struct {
+  const char *name;
+  bool is_multi_threaded;
+  bool record_instance;
+  bool record_value;
+  bool record_file_location;
+} Configuration;
+
+static Configuration L_configurations[] = {
+  // Name                        Threaded  Instance  Value  Location
+  { "minimal",                   false,    false,    false, false },
+  { "instance",                  false,    true,     false, false },
+  { "instance+value",            false,    true,     true,  false },
+  { "instance+value+location",   false,    true,     true,  true  },
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  { "threaded",                  true,     false,    false, false },
+  { "threaded+instance+value",   true,     true,     true,  false },
+  { "threaded+all",              true,     true,     true,  true  },
+#endif
+};
+#define NUM_CONFIGURATIONS (sizeof(L_configurations) / sizeof(Configuration))
+
+// Events are never flushed
+static bool prepareFlush(void *user_data) { (void)user_data; return true; }
+static bool flush(void *user_data, const void *data, size_t bytes) { (void)user_data; (void)data; (void)bytes; return true; }
+static bool finishFlush(void *user_data) { (void)user_data; return true; }
+
+static double measureClock() {
+  uint64_t start_time = ukGetTime();
+  for (int i=0; i<NUM_EVENTS; i++) {
+    (void)ukGetTime();
+  }
+  return (double)(ukGetTime() - start_time) / NUM_EVENTS;
+}
+
+static double measureRecording(Configuration *configuration, bool use_inline) {
+  UkAttrs attrs;
+  memset(&attrs, 0, sizeof(attrs));
+  attrs.max_event_count = MAX_EVENTS;
+  attrs.flush_when_full = false;
+  attrs.is_multi_threaded = configuration->is_multi_threaded;
+  attrs.record_instance = configuration->record_instance;
+  attrs.record_value = configuration->record_value;
+  attrs.record_file_location = configuration->record_file_location;
+  attrs.event_registration_count = sizeof(L_events) / sizeof(UkEventRegistration);
+  attrs.event_registration_list = L_events;
+  attrs.real_time = UK_REAL_TIME;
+  void *session = ukCreate(&attrs, ukGetTime, NULL, prepareFlush, flush, finishFlush);
+
+  // Prime the buffers, so the measurement does not include the first touch of the memory
+  for (int i=0; i<MAX_EVENTS; i+=2) {
+    ukRecordEvent(session, WORK_START_ID, 0, __FILE__, __FUNCTION__, __LINE__);
+    ukRecordEvent(session, WORK_END_ID, 0, __FILE__, __FUNCTION__, __LINE__);
+  }
+
+  // Measure
+  uint64_t start_time = ukGetTime();
+  if (use_inline) {
+    for (int i=0; i<NUM_EVENTS; i+=2) {
+      ukRecordEventInline(session, WORK_START_ID, 1.0, __FILE__, __FUNCTION__, __LINE__);
+      ukRecordEventInline(session, WORK_END_ID, 2.0, __FILE__, __FUNCTION__, __LINE__);
+    }
+  } else {
+    for (int i=0; i<NUM_EVENTS; i+=2) {
+      ukRecordEvent(session, WORK_START_ID, 1.0, __FILE__, __FUNCTION__, __LINE__);
+      ukRecordEvent(session, WORK_END_ID, 2.0, __FILE__, __FUNCTION__, __LINE__);
+    }
+  }
+  double nanoseconds = (double)(ukGetTime() - start_time) / NUM_EVENTS;
+
+  ukDestroy(session);
+  return nanoseconds;
+}
+
+int main() {
+#ifdef DISABLE_UNIKORN_SPECIALIZED_RECORDING
+  printf("Recording with the general path (built with SPECIALIZED=No)\n");
+#else
+  printf("Recording with the specialized record functions\n");
+#endif
+  if (UK_REAL_TIME) printf("Real time mode: the event memory is prefaulted and locked\n");
+  printf("  %-26s %.1f nanoseconds\n", "ukGetTime() only:", measureClock());
+  printf("  ukRecordEvent(), including ukGetTime():\n");
+  for (uint32_t i=0; i<NUM_CONFIGURATIONS; i++) {
+    Configuration *configuration = &L_configurations[i];
+    printf("    %-24s %.1f nanoseconds per event\n", configuration->name, measureRecording(configuration, false));
+  }
+  printf("  ukRecordEventInline(), including the inline clock:\n");
+  for (uint32_t i=0; i<NUM_CONFIGURATIONS; i++) {
+    Configuration *configuration = &L_configurations[i];
+    if (configuration->is_multi_threaded) continue; // Always recorded out of line
+    printf("    %-24s %.1f nanoseconds per event\n", configuration->name, measureRecording(configuration, true));
+  }
+  return 0;
+}
+
+#else
+
+int main() {
+  printf("Event recording is not enabled, so there is nothing to measure. Build with INSTRUMENT_APP=Yes\n");
+  return 0;
+}
+
+#endif
@@ -21,11 +21,26 @@
 
 // Version
 #define UK_API_VERSION_MAJOR 1
-#define UK_API_VERSION_MINOR 1
-#define UK_PACKAGE_VERSION   14 // Increases for every bug fix, examples update, UnikornViewer update, etc. Resets to 0 if UK_API_VERSION_MAJOR or UK_API_VERSION_MINOR changes
+#define UK_API_VERSION_MINOR 16
+#define UK_PACKAGE_VERSION   0  // Increases for every bug fix, examples update, UnikornViewer update, etc. Resets to 0 if UK_API_VERSION_MAJOR or UK_API_VERSION_MINOR changes
 // API changes
 //   v1.0: Initial release
 //   v1.1: In UkEventRegistration, added names for start and end values
+//   v1.2: Thread slots of exited threads are recycled, so the thread list in each flush includes a generation per slot
+//   v1.3: In UkAttrs, added record_cpu to store the CPU core index with each event
+//   v1.4: In UkAttrs, added counter_mask to sample counters (e.g. cycles, instructions, cache misses) with each event
+//   v1.5: Added ukSetEventName(), so event names in the header may change from flush to flush (the last flushed name is used)
+//   v1.6: In UkAttrs, added aggregate_only to only keep a histogram of the durations of each event type instead of storing the events
+//   v1.7: Added ukSetEventThreshold(), to only keep the instances of an event type that last at least a given time. Kept instances may be older than events in previous flushes.
+//   v1.8: Added ukSetEventCapacity(), to give an event type its own buffer so the other event types can't overwrite its events
+//   v1.9: Added ukPause() and ukResume(), to only record during some phases of the application. The paused time ranges are stored with each flush.
+//   v1.10: ukCreate() applies the optional runtime config in the environment variable UNIKORN_CONFIG (if UkAttrs.apply_config==true). Added ukConfigFilename() to get its events file name.
+//   v1.11: Added ukFlushTo(), to save the events with other flush functions (e.g. a snapshot to a different file) and optionally keep them in the session
+//   v1.12: Added ukSetTaskId() and ukEndTask(), so events are grouped by logical task (e.g. coroutine) instead of thread. Each thread slot in a flush says if it's a task.
+//   v1.13: Each flush stores the host name, process ID, and (clock time, wall clock time) pairs sampled by ukCreate() and by the flush, so viewers can align files automatically
+//   v1.14: Added ukRecordClockSync(), to store measured clock offsets to other processes (see unikorn_clock_sync.h) with each flush, for aligning files more precisely than the wall clock
+//   v1.15: Added ukRecordSpan() and UkAttrs.record_spans, to store a start and end event as one record. Loaders expand each span into its start and end events.
+//   v1.16: Added ukLockForFork() and ukUnlockAfterFork(), so a process can fork while other threads are recording. Added ukDroppedEventCount().
 
 // Predefined RGB colors. Application can still use custom color values, format is 0x0RGB
 enum {
@@ -41,6 +56,32 @@ enum {
   UK_BLACK  = 0x0000,
 };
 
+// Counters that can be sampled with each event (see UkAttrs.counter_mask). The viewer shows how much they changed from the start to the end of a duration.
+// Counters are per thread, and read via perf_event_open() or getrusage(RUSAGE_THREAD) (Linux only). Counters not supported by the system (e.g. hardware counters in some virtual machines) are not recorded.
+enum {
+  UK_COUNTER_TASK_CLOCK           = 0x0001, // Nanoseconds the thread was running
+  UK_COUNTER_PAGE_FAULTS          = 0x0002,
+  UK_COUNTER_CONTEXT_SWITCHES     = 0x0004,
+  UK_COUNTER_CYCLES               = 0x0008, // Hardware counter
+  UK_COUNTER_INSTRUCTIONS         = 0x0010, // Hardware counter
+  UK_COUNTER_CACHE_MISSES         = 0x0020, // Hardware counter
+  UK_COUNTER_BRANCH_MISSES        = 0x0040, // Hardware counter
+  UK_COUNTER_MINOR_FAULTS         = 0x0080, // From getrusage(): page faults that did not need I/O
+  UK_COUNTER_MAJOR_FAULTS         = 0x0100, // From getrusage(): page faults that needed I/O
+  UK_COUNTER_VOLUNTARY_SWITCHES   = 0x0200, // From getrusage(): the thread blocked (e.g. waiting on I/O or a lock)
+  UK_COUNTER_INVOLUNTARY_SWITCHES = 0x0400, // From getrusage(): the thread was preempted
+  UK_COUNTER_USER_TIME            = 0x0800, // From getrusage(): microseconds running in user space
+  UK_COUNTER_SYSTEM_TIME          = 0x1000, // From getrusage(): microseconds running in the kernel
+  UK_COUNTER_RUSAGE               = 0x1F80, // All of the getrusage() counters
+};
+
+// What to do when spilling (see UkAttrs.spill_when_full) and every spare buffer is still being flushed by the spill thread
+enum {
+  UK_SPILL_BLOCK       = 0, // The recording thread waits for a spare buffer, so no events are lost
+  UK_SPILL_DROP_NEWEST = 1, // New events are dropped until a spare buffer is free
+  UK_SPILL_DROP_OLDEST = 2, // The oldest unflushed events are overwritten until a spare buffer is free
+};
+
 typedef struct {
   const char *name;
   uint16_t id;        // ID's must start with 1 and be contiguous across folders (defined first) and events. ID 0 is reserved for 'close folder' event.
@@ -66,6 +107,24 @@ typedef struct {
   UkFolderRegistration *folder_registration_list;
   uint16_t event_registration_count;    // Unique event types that can be recorded
   UkEventRegistration *event_registration_list;
+  bool record_per_cpu;          // If true (requires is_multi_threaded), events are stored in one buffer per online CPU core (when ukCreate() is called) instead of one shared buffer, to reduce lock contention when many threads are recording. max_event_count is split across the buffers.
+  bool record_cpu;              // If true, will store the index of the CPU core the event was recorded on (helps to see thread migration). Not supported on Mac.
+  uint32_t counter_mask;        // Bitwise OR of UK_COUNTER_* values to read with each event, or 0 for no counters. Reading the counters adds a system call to each event (two if mixing perf and getrusage() counters).
+  bool aggregate_only;          // If true, events are not stored. Each end event is paired with the same thread's start event, and the duration is added to the event type's log scaled histogram (within 6.25% precision).
+                                // Memory is constant no matter how many events are recorded. Each flush stores the histograms since the previous flush. Folders, instance, value, location, CPU and counters are ignored.
+                                // UnikornViewer can't show these files: read them with ukLoadEventsFile() (UkEvents.histogram_list), e.g. examples/aggregate_histograms
+  bool real_time;               // If true, the event buffers are prefaulted and locked in memory (with huge pages where available), and everything a flush needs is allocated by ukCreate(),
+                                // so recording and flushing never page fault or allocate. Exceptions: each thread's (or task's) first event allocates its per thread state, ukSetEventCapacity()
+                                // allocates its buffer, the spill thread grows its copy of the thread list once more than 64 threads (or tasks) have recorded, and the application's flush functions may allocate (e.g. ukFileFlush() uses stdio). Locking may need a higher limit (e.g. 'ulimit -l');
+                                // if it fails, a warning is printed and the memory is only prefaulted. Pauses and clock syncs between flushes are limited to 100 each.
+  bool spill_when_full;         // If true (requires is_multi_threaded), a full buffer is handed to a background spill thread that flushes it, while recording continues into a spare buffer,
+                                // so long recordings keep every event without flushing in the recording threads. Implies flush_when_full. Each spill is a flush of the full buffers (with the
+                                // per CPU and per event type buffers), but its pauses and clock syncs are left for the next ukFlush(). ukFlush() waits for the spill thread to finish first.
+  uint16_t spill_buffer_count;  // Number of spare buffers (each the size of all the session's buffers) for spill_when_full. 0 means 2.
+  uint8_t spill_policy;         // One of UK_SPILL_*: what to do when a buffer is full and every spare buffer is still being flushed. The dropped event count is printed by ukDestroy() (see ukDroppedEventCount()).
+  bool record_spans;            // If true, ukRecordSpan() can be used. Each event slot gets room for a duration (8 more bytes), and event IDs must be less than 0x8000.
+  bool apply_config;            // If true, ukCreate() applies the runtime config in UNIKORN_CONFIG (see below). UK_CREATE() sets it. Leave it false for sessions that depend on their own attributes
+                                // (e.g. the sessions created by ukCygProfileStart() and the LD_PRELOAD interposers), so the application's config can't change them.
 } UkAttrs;
 
 #ifdef __cplusplus
@@ -73,6 +132,17 @@ extern "C"
 {
 #endif
 
+// Runtime config (optional): if UkAttrs.apply_config==true, ukCreate() overrides the attributes with the settings in the environment variable UNIKORN_CONFIG, so tracing can be tuned per deployment without rebuilding.
+// UNIKORN_CONFIG either has the settings separated by commas (e.g. "max_event_count=100000,disable=Idle,sample=Request:10"), or is the name of a file with one setting per line ('#' starts a comment).
+//   max_event_count=<count>     flush_when_full=<true|false>   record_instance=<true|false>   record_value=<true|false>   record_file_location=<true|false>
+//   record_cpu=<true|false>     record_per_cpu=<true|false>    counter_mask=<mask>            aggregate_only=<true|false>   real_time=<true|false>
+//   spill_when_full=<true|false>   spill_buffer_count=<count>  spill_policy=<block|drop_newest|drop_oldest>
+//   disable=<event or folder name>  The event type or folder is not recorded. Can be used more than once.
+//   enable=<event or folder name>   Only the enabled event types (or folders) are recorded. Can be used more than once.
+//   sample=<event name>:<ratio>     Only record 1 of every 'ratio' instances of the event type (per thread).
+//   file=<filename>                 The events file name, returned by ukConfigFilename()
+// Unknown or invalid settings are printed and ignored. is_multi_threaded and record_spans can't be changed, since they depend on how the application uses the session.
+
 // Create an event session
 void *ukCreate(UkAttrs *attrs,
 	       uint64_t (*clockNanoseconds)(),           // Application defined clock returning elapsed nanoseconds from some application defined base time
@@ -82,6 +152,9 @@ void *ukCreate(UkAttrs *attrs,
 	       bool (*finishFlush)(void *user_data)      // Done with flushing. Use this to close the file or socket if needed
 	       );
 
+// Returns a copy of the file name from UNIKORN_CONFIG, or of 'filename' if not set. Free it when done.
+char *ukConfigFilename(const char *filename);
+
 // Destroy the event session. This will not automatically save unsaved events
 void ukDestroy(void *instance);
 
@@ -91,8 +164,14 @@ void ukDestroy(void *instance);
 
 // Record event: event ID, time, instance (optional), file (optional), function (optional), line number (optional), thread ID (optional)
 // If the event buffer is full and auto flushing is not enabled, the oldest event will be replaced by the new event
+// Single threaded sessions can record most events without a call into the library: see ukRecordEventInline() in unikorn_inline.h
 void ukRecordEvent(void *instance, uint16_t event_id, double value, const char *file, const char *function, uint16_t line_number);
 
+// Record a complete instance of an event type as one record, instead of a start and end event (requires UkAttrs.record_spans==true): half the buffer space and flush size.
+// The times are from the session's clock (e.g. measured before and after the call being timed), and start_time must not be after end_time. The value (and the counters, if any,
+// sampled at this call) is used for both the start and end events. Thresholds, sampling and histograms see the span the same as a start and end event on the calling thread.
+void ukRecordSpan(void *instance, uint16_t start_id, uint64_t start_time, uint64_t end_time, double value, const char *file, const char *function, uint16_t line_number);
+
 // Open a folder to contain any subsequent events that are recorded
 // Can call multiple times to have folders in folders
 void ukOpenFolder(void *instance, uint16_t folder_id);
@@ -103,6 +182,55 @@ void ukCloseFolder(void *instance);
 // Push recorded events to sessions's defined container (e.g. file, socket), and then mark the event buffer as empty
 void ukFlush(void *instance);
 
+// Same as ukFlush(), but the events are pushed with the given flush functions instead of the ones given to ukCreate() (e.g. to save a snapshot to a different file)
+// If keep_events==true, the event buffers (and histograms) are not emptied, so the events are also in the next flush. Nothing is pushed if no events are recorded.
+void ukFlushTo(void *instance, bool keep_events,
+               void *flush_user_data,
+               bool (*prepareFlush)(void *user_data),
+               bool (*flush)(void *user_data, const void *data, size_t bytes),
+               bool (*finishFlush)(void *user_data));
+
+// Fork safety: call ukLockForFork() right before fork() (e.g. from a pthread_atfork() prepare handler), so no other thread is holding one of the session's locks,
+// then ukUnlockAfterFork() in both the parent and the child. The child has a copy of the parent's unsaved events, so it usually shouldn't flush the session.
+// If spill_when_full==true, ukLockForFork() first waits for the spill thread to write what's already spilled, and the child gets its own spill thread.
+void ukLockForFork(void *instance);
+void ukUnlockAfterFork(void *instance, bool is_child);
+
+// The number of events dropped or overwritten so far because every spill buffer was busy (see UkAttrs.spill_policy). Always 0 if spill_when_full==false.
+uint64_t ukDroppedEventCount(void *instance);
+
+// Change the name of a registered event type. Helpful when the name is not known until after the session is created (e.g. resolving function names)
+// The new name is used by the next flush, and replaces the old name when the events are loaded
+void ukSetEventName(void *instance, uint16_t start_id, const char *name);
+
+// Tail latency capture: only keep the instances of an event type that last at least 'threshold' nanoseconds (0 keeps all instances, the default)
+// A start is staged per thread, with any events the thread records until the matching end. The staged events are only stored if the instance exceeded the threshold.
+// If an instance records more than 100 events, it is kept without waiting for its end. Call this before recording the event type. Ignored if aggregate_only==true.
+void ukSetEventThreshold(void *instance, uint16_t start_id, uint64_t threshold);
+
+// Retention: store an event type's start and end events in its own buffer of max_event_count events, instead of the buffer shared by the other event types.
+// If flush_when_full==false, a frequent event type then can't overwrite a rare one (e.g. a once a minute compaction). The buffers are merged by time when flushed.
+// The memory is in addition to UkAttrs.max_event_count. Call this before recording the event type. Ignored if aggregate_only==true.
+void ukSetEventCapacity(void *instance, uint16_t start_id, uint32_t max_event_count);
+
+// Stop recording events until ukResume(), e.g. to skip the warmup phase. While paused, ukRecordEvent() only costs a load and a branch.
+// Folders are still opened and closed, and instance counts continue when resumed. The paused time ranges are flushed, so viewers can show where events were not recorded.
+// Instances that start or end while paused will be missing their start or end event. Pausing or resuming more than once has no effect.
+void ukPause(void *instance);
+void ukResume(void *instance);
+
+// Logical tasks (e.g. coroutines or fibers multiplexed over a few threads): until the next call, the calling thread's events belong to the task instead of the thread.
+// Each task is shown as its own thread, so start/end pairing (including thresholds, sampling, and histograms) follows a task that hops between threads.
+// Call it each time a thread switches to a task, and with task_id=0 to go back to recording as the thread. Requires is_multi_threaded==true. Counters are still per thread.
+void ukSetTaskId(void *instance, uint64_t task_id);
+// The task will not record any more events, so its resources are freed and its slot can be recycled.
+// Another thread that is still set to the task goes back to recording as itself, as if it called ukSetTaskId() with task_id=0. It must not be recording an event for the task at the time.
+void ukEndTask(void *instance, uint64_t task_id);
+
+// Clock sync: at 'time' (from this session's clock), the clock of the process peer_process_id read time+offset. round_trip is the duration of the exchange that measured it, so the offset is within round_trip/2.
+// The samples are flushed, so a loader can map times between the files of the two processes (see ukGetPeerTime()). Usually called by unikorn_clock_sync.c instead of the application.
+void ukRecordClockSync(void *instance, uint64_t peer_process_id, uint64_t time, int64_t offset, uint64_t round_trip);
+
 #ifdef __cplusplus
 }
 #endif
@@ -110,7 +238,7 @@ void ukFlush(void *instance);
 
 /* Flush format requirements (stored as binary since millions of events might be stored):
   -------------------------------------------------
-  | HEADER: does not change from flush to flush   |
+  | HEADER: only event names may change (v1.5+)   |
   -------------------------------------------------
   (bool)           is_big_endian
   (uint16_t)       version_major
@@ -119,6 +247,9 @@ void ukFlush(void *instance);
   (bool)           includes_instance
   (bool)           includes_value
   (bool)           includes_file_location
+  (bool)           includes_cpu                  # Added in version 1.3
+  (bool)           is_aggregate                  # Added in version 1.6: if true, event_count is zero and the histograms follow the events
+  (bool)           has_thresholds                # Added in version 1.7: if true, events may be older than the events of previous flushes, so the loader sorts them by time
   (uint16_t)       folder_registration_count     (can be zero)
     (uint16_t)       id
     (uint16_t)       num_name_chars
@@ -133,6 +264,14 @@ void ukFlush(void *instance);
     (char[])         start_value_name_chars              # Added in version 1.1
     (uint16_t)       num_end_value_name_chars            # Added in version 1.1
     (char[])         end_value_name_chars                # Added in version 1.1
+  (uint16_t)       counter_count                 # Added in version 1.4
+    (uint16_t)       num_name_chars
+    (char[])         name_chars
+  (uint16_t)       num_host_name_chars           # Added in version 1.13: the host and process that recorded the events
+  (char[])         host_name_chars
+  (uint64_t)       process_id
+  (uint64_t)       create_time                   # Added in version 1.13: clock time when the session was created
+  (uint64_t)       create_wall_time              # Added in version 1.13: nanoseconds since the Unix epoch (UTC) at create_time
   -------------------------------------------------
   | DATA: may be different with each flush        |
   -------------------------------------------------
@@ -144,17 +283,45 @@ void ukFlush(void *instance);
     (char[])         chars
   (uint16_t)       thread_id_count                (0 if is_multi_threaded==false)
     (uint64_t)       thread_id
+    (uint32_t)       generation                   # Added in version 1.2: changes when the slot is recycled for a new thread (only threads alive at the same time have unique slots)
+    (bool)           is_task                      # Added in version 1.12: if true, thread_id is a task ID from ukSetTaskId()
   (uint16_t)       num_open_folders               (stack of folders that were already open before the first event in the record buffer)
     (uint16_t)       folder id
+  (bool)           has_spans                      # Added in version 1.15: if true, each event says if it's a span (see ukRecordSpan()). Spans are stored by start time, so end events may be out of order.
   (uint32_t)       event_count
-    (uint64_t)       elapsed time since clocks base time
-    (uint16_t)       event id
+    (uint64_t)       elapsed time since clocks base time    (the start time, if a span)
+    (uint16_t)       event id                               (the start ID, if a span)
+    (bool)           is_span                      (only recorded if has_spans==true) # Added in version 1.15: the loader expands it into the start event and the end event (start ID + 1)
+    (uint64_t)       span duration                (only recorded if is_span==true) # Added in version 1.15: nanoseconds from the start event to the end event
     (uint64_t)       instance                     (only recorded if record_instance==true)
     (uint64_t)       value                        (only recorded if record_value==true)
-    (uint16_t)       index in thread list         (only recorded if is_multi_threaded==true)
+    (uint16_t)       index in thread list         (only recorded if is_multi_threaded==true) The slot's thread and generation in this flush identify the thread
+    (uint16_t)       cpu index                    (only recorded if record_cpu==true) # Added in version 1.3: 0xFFFF if the CPU core is unknown
+    (uint64_t[])     counter values               (counter_count values) # Added in version 1.4: the raw counter values when the event was recorded; zero for folder events
     (uint16_t)       index in file name list      (only recorded if record_file_location==true)
     (uint16_t)       index in function name list  (only recorded if record_file_location==true)
     (uint16_t)       line number                  (only recorded if record_file_location==true)
+  (uint16_t)       histogram_sub_bucket_bits      (only recorded if is_aggregate==true) # Added in version 1.6
+  (per event registration, in the same order)     (only recorded if is_aggregate==true) # Added in version 1.6: durations (nanoseconds) since the previous flush
+    (uint64_t)       count
+    (uint64_t)       min duration                 (0 if count==0)
+    (uint64_t)       max duration
+    (uint64_t)       total duration
+    (uint64_t)       unmatched count              (end events without a start event on the same thread)
+    (uint16_t)       used_bucket_count
+      (uint16_t)       bucket index               If less than 2^sub_bucket_bits, the bucket holds the durations equal to the index. Otherwise with S=2^sub_bucket_bits, e=index/S+sub_bucket_bits-1,
+                                                  the bucket holds durations from (S+index%S)<<(e-sub_bucket_bits) up to, but not including, (S+index%S+1)<<(e-sub_bucket_bits)
+      (uint64_t)       bucket count
+  (uint32_t)       pause_count                    # Added in version 1.9: time ranges since the previous flush when recording was paused (see ukPause())
+    (uint64_t)       pause time                   If still paused when flushed, the range ends at the time of the flush, and the next flush continues it
+    (uint64_t)       resume time
+  (uint64_t)       flush_time                     # Added in version 1.13: clock time of the flush
+  (uint64_t)       flush_wall_time                # Added in version 1.13: nanoseconds since the Unix epoch (UTC) at flush_time
+  (uint32_t)       clock_sync_count               # Added in version 1.14: clock offsets to other processes since the previous flush (see ukRecordClockSync())
+    (uint64_t)       time
+    (uint64_t)       peer_process_id
+    (int64_t)        offset                       The peer's clock read time+offset
+    (uint64_t)       round_trip
 */
 
 /* File suffix requirements
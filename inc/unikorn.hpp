@@ -0,0 +1,182 @@
+// Copyright 2021 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _UNIKORN_HPP_
+#define _UNIKORN_HPP_
+
+// Optional C++ (C++11 or newer) helpers for the Unikorn instrumentation (see examples/hello_cpp):
+//  - Folders and event types are declared as types, and a registry derives their contiguous IDs and the registration lists at compile time,
+//    so there's no hand maintained enum that has to be kept in the same order as the registration lists
+//  - UK_SCOPE() records the start event, and the end event when the scope exits, even on an early return or an exception, so the start
+//    and end events are always paired
+//  - Like unikorn_macros.h, everything compiles out if ENABLE_UNIKORN_RECORDING is not defined
+//
+//   UK_FOLDER(SolarSystem, "Solar System");
+//   UK_EVENT(Print, "Print", UK_BLUE, "Loop Index", "Favorite Number");   // Name, color, start value name, end value name
+//   using UnikornRegistry = uk::Registry<uk::Folders<SolarSystem>, uk::Events<Print>>;
+//   ...
+//   UK_CREATE(..., UnikornRegistry::folderCount(), UnikornRegistry::folderList(), UnikornRegistry::eventCount(), UnikornRegistry::eventList(), ...);
+//   ...
+//   void print() {
+//     UK_SCOPE(session, Print);
+//     ...
+//   }
+//
+// The macros use the registry named UnikornRegistry. Define UK_REGISTRY before including this file to use a different name.
+
+#define UK_CONCAT_NAME_(_a, _b) _a##_b
+#define UK_CONCAT_NAME(_a, _b) UK_CONCAT_NAME_(_a, _b)
+#ifndef UK_REGISTRY
+  #define UK_REGISTRY UnikornRegistry
+#endif
+
+#ifdef ENABLE_UNIKORN_RECORDING
+
+#include "unikorn.h"
+#ifdef UK_INLINE_RECORDING
+  #include "unikorn_inline.h"
+#endif
+#include <stdint.h>
+
+// Declare a folder or event type. The type only holds the registration info; its ID comes from its position in the registry.
+#define UK_FOLDER(_Type, _name) \
+  struct _Type { \
+    static constexpr const char *name() { return _name; } \
+  }
+#define UK_EVENT(_Type, _name, _rgb, _start_value_name, _end_value_name) \
+  struct _Type { \
+    static constexpr const char *name() { return _name; } \
+    static constexpr uint16_t rgb() { return _rgb; } \
+    static constexpr const char *startValueName() { return _start_value_name; } \
+    static constexpr const char *endValueName() { return _end_value_name; } \
+  }
+
+// Record the start event now, and the end event when the scope exits
+#define UK_SCOPE(_session, _Event) uk::ScopedEvent<UK_REGISTRY, _Event> UK_CONCAT_NAME(unikorn_scope_, __LINE__)(_session, 0, __FILE__, __FUNCTION__, __LINE__)
+// Same as UK_SCOPE(), but with a start value, and the guard is named so the end value can be set: _name.setEndValue(value)
+#define UK_NAMED_SCOPE(_name, _session, _Event, _start_value) uk::ScopedEvent<UK_REGISTRY, _Event> _name(_session, _start_value, __FILE__, __FUNCTION__, __LINE__)
+// Open the folder now, and close it when the scope exits
+#define UK_FOLDER_SCOPE(_session, _Folder) uk::ScopedFolder<UK_REGISTRY, _Folder> UK_CONCAT_NAME(unikorn_folder_scope_, __LINE__)(_session)
+// The IDs, for use with the macros in unikorn_macros.h: e.g. UK_RECORD_EVENT(session, UK_START_ID(Print), 0)
+#define UK_FOLDER_ID(_Folder) (UK_REGISTRY::folderId<_Folder>())
+#define UK_START_ID(_Event) (UK_REGISTRY::startId<_Event>())
+#define UK_END_ID(_Event) (UK_REGISTRY::endId<_Event>())
+
+namespace uk {
+
+template <typename... Types> struct Folders {};
+template <typename... Types> struct Events {};
+
+namespace detail {
+  // Position of T in the list. Fails to compile if T is not in the list.
+  template <typename T, typename... List> struct IndexOf {
+    static_assert(sizeof(T) == 0, "Unikorn: the folder or event type is not in the registry");
+  };
+  template <typename T, typename... Rest> struct IndexOf<T, T, Rest...> {
+    static constexpr uint16_t value = 0;
+  };
+  template <typename T, typename First, typename... Rest> struct IndexOf<T, First, Rest...> {
+    static constexpr uint16_t value = 1 + IndexOf<T, Rest...>::value;
+  };
+}
+
+template <typename FolderList, typename EventList> struct Registry;
+
+template <typename... FolderTypes, typename... EventTypes>
+struct Registry<Folders<FolderTypes...>, Events<EventTypes...>> {
+  static_assert(sizeof...(EventTypes) > 0, "Unikorn: at least one event type must be registered");
+  static_assert(1 + sizeof...(FolderTypes) + 2*sizeof...(EventTypes) <= UINT16_MAX, "Unikorn: too many folders and event types");
+
+  // IDs: 0 is reserved for 'close folder', then the folders, then a start and end ID for each event type
+  template <typename Folder> static constexpr uint16_t folderId() { return (uint16_t)(1 + detail::IndexOf<Folder, FolderTypes...>::value); }
+  template <typename Event> static constexpr uint16_t startId() { return (uint16_t)(1 + sizeof...(FolderTypes) + 2*detail::IndexOf<Event, EventTypes...>::value); }
+  template <typename Event> static constexpr uint16_t endId() { return (uint16_t)(startId<Event>() + 1); }
+
+  // The registration lists for UkAttrs
+  static constexpr uint16_t folderCount() { return (uint16_t)sizeof...(FolderTypes); }
+  static constexpr uint16_t eventCount() { return (uint16_t)sizeof...(EventTypes); }
+  static UkFolderRegistration *folderList() {
+    static UkFolderRegistration list[] = { { FolderTypes::name(), folderId<FolderTypes>() }..., { nullptr, 0 } }; // The extra entry allows no folders
+    return (sizeof...(FolderTypes) == 0) ? nullptr : list;
+  }
+  static UkEventRegistration *eventList() {
+    static UkEventRegistration list[] = { { EventTypes::name(), EventTypes::rgb(), startId<EventTypes>(), endId<EventTypes>(), EventTypes::startValueName(), EventTypes::endValueName() }... };
+    return list;
+  }
+};
+
+inline void recordEvent(void *session, uint16_t event_id, double value, const char *file, const char *function, uint16_t line_number) {
+#ifdef UK_INLINE_RECORDING
+  ukRecordEventInline(session, event_id, value, file, function, line_number);
+#else
+  ukRecordEvent(session, event_id, value, file, function, line_number);
+#endif
+}
+
+// The end event has the file location of the start event, since the scope can exit in many places
+template <typename RegistryType, typename Event>
+class ScopedEvent {
+public:
+  ScopedEvent(void *session, double start_value, const char *file, const char *function, uint16_t line_number)
+    : session_(session), end_value_(0), file_(file), function_(function), line_number_(line_number) {
+    recordEvent(session_, RegistryType::template startId<Event>(), start_value, file_, function_, line_number_);
+  }
+  ~ScopedEvent() {
+    recordEvent(session_, RegistryType::template endId<Event>(), end_value_, file_, function_, line_number_);
+  }
+  void setEndValue(double value) { end_value_ = value; }
+  ScopedEvent(const ScopedEvent &) = delete;
+  ScopedEvent &operator=(const ScopedEvent &) = delete;
+private:
+  void *session_;
+  double end_value_;
+  const char *file_;
+  const char *function_;
+  uint16_t line_number_;
+};
+
+template <typename RegistryType, typename Folder>
+class ScopedFolder {
+public:
+  explicit ScopedFolder(void *session) : session_(session) { ukOpenFolder(session_, RegistryType::template folderId<Folder>()); }
+  ~ScopedFolder() { ukCloseFolder(session_); }
+  ScopedFolder(const ScopedFolder &) = delete;
+  ScopedFolder &operator=(const ScopedFolder &) = delete;
+private:
+  void *session_;
+};
+
+} // namespace uk
+
+#else
+
+// Recording is compiled out
+#define UK_FOLDER(_Type, _name) struct _Type {}
+#define UK_EVENT(_Type, _name, _rgb, _start_value_name, _end_value_name) struct _Type {}
+#define UK_SCOPE(_session, _Event)
+#define UK_NAMED_SCOPE(_name, _session, _Event, _start_value) uk::NoScope _name
+#define UK_FOLDER_SCOPE(_session, _Folder)
+#define UK_FOLDER_ID(_Folder) 0
+#define UK_START_ID(_Event) 0
+#define UK_END_ID(_Event) 0
+
+namespace uk {
+  struct NoScope {
+    NoScope() {} // Not trivial, so an unused guard doesn't cause a warning
+    void setEndValue(double value) { (void)value; }
+  };
+}
+
+#endif
+#endif
@@ -0,0 +1,72 @@
+// Copyright 2021 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _UNIKORN_ADDRESS_SLOTS_H_
+#define _UNIKORN_ADDRESS_SLOTS_H_
+
+// Internal: shared by the adapters that give each address they see (e.g. a function or a mutex) its own event types, assigned on first use
+// (src/unikorn_cyg_profile.c and src/unikorn_preload_pthread.c). Linux and Mac only.
+//  - Slots are assigned in the order the addresses are first seen, up to max_slots. Addresses are never removed.
+//  - ukAddressSlot() is lock free, since it's called on every function call or lock
+//  - The names are resolved with dladdr() when the events are saved, not when recording
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define UK_NO_SLOT -1           // Filtered out, or max_slots was reached
+
+typedef struct {
+  void *address;              // NULL if the entry is unused
+  int32_t slot;               // Index of the address, UK_NO_SLOT, or pending while another thread assigns it
+} UkAddressEntry;
+
+typedef struct {
+  uint16_t max_slots;
+  uint8_t hash_shift;         // Low bits of the addresses that are always zero (e.g. due to alignment)
+  bool (*isAllowed)(void *address); // NULL if all addresses are allowed
+  uint32_t count;             // Can be larger than max_slots if the table ran out of slots
+  void **addresses;           // Address of each slot: set after the slot is assigned
+  uint32_t table_size;        // Power of 2
+  UkAddressEntry *table;      // Open addressing hash table: address -> slot
+} UkAddressSlots;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// isAllowed is only called the first time an address is seen, and can be NULL
+extern void ukAddressSlotsInit(UkAddressSlots *slots, uint16_t max_slots, uint8_t hash_shift, bool (*isAllowed)(void *address));
+extern void ukAddressSlotsFree(UkAddressSlots *slots);
+
+// The address's slot, assigning the next one if it's the first use. Returns UK_NO_SLOT if not allowed, or if max_slots was reached.
+extern int32_t ukAddressSlot(UkAddressSlots *slots, void *address);
+
+// The number of assigned slots, and the address of each. Returns NULL if the slot is still being assigned.
+extern uint32_t ukAddressSlotCount(UkAddressSlots *slots);
+extern void *ukSlotAddress(UkAddressSlots *slots, uint32_t slot);
+
+// The name of the address:
+//  - The symbol's name, if the address is the start of an exported symbol (the application needs to be linked with -rdynamic)
+//  - If is_data==true, 'symbol+offset' if the address is inside one (e.g. a member of a global or static struct)
+//  - If is_data==false, 'module+offset' (e.g. a static function: use addr2line to get its name)
+//  - Otherwise the address
+extern void ukAddressName(void *address, bool is_data, char *name, size_t max_name_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,47 @@
+// Copyright 2021 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _UNIKORN_CLOCK_SYNC_H_
+#define _UNIKORN_CLOCK_SYNC_H_
+
+// Optional: measure the offset between the clocks of two processes on the same host, over a Unix domain socket (Linux or Mac)
+//  - One process serves its clock. Others sync with it using NTP style ping exchanges: the exchange with the shortest round trip is kept, since it has the least uncertainty
+//  - Both sessions store the sample with ukRecordClockSync(), so either file can be mapped to the other's clock with ukGetPeerTime()
+//  - Sync at the start and end of a long recording (or periodically), so the loader can correct for the drift between the clocks
+//  - clockNanoseconds must be the clock given to ukCreate()
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "unikorn.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Start a thread that answers sync requests on the socket. Only one session at a time. Returns false if the socket or thread can't be created.
+// IMPORTANT: The session must be created with UkAttrs.is_multi_threaded=true, since the samples are recorded from the serving thread
+extern bool ukClockSyncServe(void *session, uint64_t (*clockNanoseconds)(), const char *socket_path);
+
+// Stop the serving thread and remove the socket. Call this before ukDestroy()
+extern void ukClockSyncStopServing();
+
+// Do exchange_count ping exchanges with the serving process, and record the best one in both sessions. Returns false if the server can't be reached, or doesn't reply within a second.
+extern bool ukClockSyncWith(void *session, uint64_t (*clockNanoseconds)(), const char *socket_path, uint16_t exchange_count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,65 @@
+// Copyright 2021 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _UNIKORN_CYG_PROFILE_H_
+#define _UNIKORN_CYG_PROFILE_H_
+
+// Optional: records a start/end event for each call of every function compiled with -finstrument-functions (GCC or Clang, Linux or Mac)
+//  - Each unique function gets its own event type, created the first time the function is called
+//  - Function names are resolved via dladdr() when flushing, not when recording. Link with -rdynamic to get the names of non static functions,
+//    otherwise the name is 'module+offset' (use addr2line to find the function)
+//  - IMPORTANT: Compile the Unikorn source files without -finstrument-functions
+//  - Link with -ldl if using a glibc older than 2.34
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "unikorn.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Optional: limit which functions are traced. Must be called before ukCygProfileStart(). A function in a denied range is never traced.
+// If any allowed ranges are given, only functions in the allowed ranges are traced.
+extern void ukCygProfileAllow(const void *start_address, const void *end_address);
+extern void ukCygProfileDeny(const void *start_address, const void *end_address);
+// Same as above, but for all the code in a loaded module (e.g. "libfoo.so"), or the application if module_name is NULL. Returns false if not loaded.
+extern bool ukCygProfileAllowModule(const char *module_name);
+extern bool ukCygProfileDenyModule(const char *module_name);
+
+// Start tracing. The event registrations in attrs are ignored: max_functions event types are created instead (folders can still be used)
+// max_call_depth: calls nested deeper than this are not recorded, to keep whole program tracing affordable. Use 0 for no limit.
+// If attrs->is_multi_threaded, events are recorded in per CPU buffers (record_per_cpu is enabled) to avoid a shared lock. File locations are not recorded.
+// UNIKORN_CONFIG is not applied (attrs->apply_config is ignored), since the application's config could undo these attributes.
+// Returns the Unikorn session
+extern void *ukCygProfileStart(UkAttrs *attrs, uint16_t max_functions, uint16_t max_call_depth,
+                               uint64_t (*clockNanoseconds)(),
+                               void *flush_user_data,
+                               bool (*prepareFlush)(void *user_data),
+                               bool (*flush)(void *user_data, const void *data, size_t bytes),
+                               bool (*finishFlush)(void *user_data));
+
+// Resolve the names of the newly traced functions, then flush. Use this instead of ukFlush()
+extern void ukCygProfileFlush();
+
+// Stop tracing, flush and destroy the session
+extern void ukCygProfileStop();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
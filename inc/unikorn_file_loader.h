@@ -19,6 +19,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#define UK_UNKNOWN_CPU 0xFFFF
+
 typedef struct {
   uint16_t id;
   char *name;
@@ -38,13 +40,40 @@ typedef struct {
   uint16_t event_id; // Could also be a folder ID
   uint64_t instance;
   double value;
-  uint16_t thread_index;
+  uint32_t thread_index; // Threads are unique over the life of the recording, even if the OS reuses the thread ID
+  uint16_t cpu_index;    // UK_UNKNOWN_CPU if the CPU core was not known when recorded
   uint16_t file_name_index;
   uint16_t function_name_index;
   uint16_t line_number;
   bool is_ghosted; // Used by UnikornViewer
 } UkEvent;
 
+typedef struct {
+  uint64_t count;          // Number of durations
+  uint64_t min_duration;   // Nanoseconds (0 if count==0)
+  uint64_t max_duration;
+  uint64_t total_duration;
+  uint64_t unmatched_count; // End events without a start event on the same thread
+  uint64_t *bucket_counts; // histogram_bucket_count log scaled buckets: use ukGetHistogramBucketStart() to get the range of a bucket
+} UkHistogram;
+
+typedef struct {
+  uint64_t start_time;     // Recording was paused with ukPause()
+  uint64_t end_time;       // Recording was resumed with ukResume()
+} UkPause;                 // A time range without events (except folders)
+
+typedef struct {
+  uint64_t time;           // From the recording's clock, same as UkEvent.time
+  uint64_t wall_time;      // Nanoseconds since the Unix epoch (UTC), at the same moment
+} UkClockAnchor;           // Sampled when the session was created and at each flush
+
+typedef struct {
+  uint64_t time;           // From the recording's clock, same as UkEvent.time
+  uint64_t peer_process_id;
+  int64_t offset;          // The peer process's clock read time+offset at the same moment
+  uint64_t round_trip;     // Duration of the exchange that measured the offset, so the offset is within round_trip/2
+} UkClockSync;             // See ukRecordClockSync() and unikorn_clock_sync.h
+
 typedef struct {
   // Header (should be same for each flush)
   uint16_t version_major;
@@ -53,20 +82,39 @@ typedef struct {
   bool includes_instance;
   bool includes_value;
   bool includes_file_location;
+  bool includes_cpu;
+  bool is_aggregate;       // If true, there are no events, only histograms
+  bool has_thresholds;     // If true, only instances that exceeded their event type's threshold were kept (see ukSetEventThreshold()). Can change from flush to flush.
+  bool has_spans;          // If true, some instances were recorded as one span (see ukRecordSpan()), and were expanded into their start and end events. Can change from flush to flush.
   uint16_t folder_registration_count;
   UkLoaderFolderRegistration *folder_registration_list;
   uint16_t event_registration_count;
   UkLoaderEventRegistration *event_registration_list;
+  uint16_t counter_count;
+  char **counter_name_list;
 
   // Recorded Events (different for each flush)
   uint16_t file_name_count;
   char **file_name_list;
   uint16_t function_name_count;
   char **function_name_list;
-  uint16_t thread_id_count;
+  uint32_t thread_id_count;
   uint64_t *thread_id_list;
+  bool *thread_is_task_list;  // Same length as thread_id_list: true if the ID is a task ID from ukSetTaskId() instead of a thread ID
   uint32_t event_count;
   UkEvent *event_buffer;
+  uint64_t *counter_value_buffer; // counter_count values for each event in event_buffer: use ukGetCounterValues()
+  uint16_t histogram_sub_bucket_bits;
+  uint32_t histogram_bucket_count;
+  UkHistogram *histogram_list; // One per event registration, merged from all flushes. NULL if is_aggregate==false
+  uint32_t pause_count;
+  UkPause *pause_list;     // Time ordered ranges when recording was paused
+  char *host_name;         // Host and process that recorded the events. NULL and 0 if not known (files older than version 1.13)
+  uint64_t process_id;
+  uint32_t clock_anchor_count; // Zero if not known (files older than version 1.13)
+  UkClockAnchor *clock_anchor_list; // Time ordered: use ukGetWallTime() to align files from different processes or hosts
+  uint32_t clock_sync_count;
+  UkClockSync *clock_sync_list; // Clock offsets to other processes: use ukGetPeerTime() to align with the file of a peer process
 } UkEvents;
 
 #ifdef __cplusplus
@@ -74,8 +122,14 @@ extern "C"
 {
 #endif
 
+// Returns NULL if the file can't be opened, is empty, or was saved with an unsupported version (e.g. by a newer Unikorn)
 extern UkEvents *ukLoadEventsFile(const char *filename);
 extern void ukFreeEvents(UkEvents *instance);
+extern uint64_t *ukGetCounterValues(UkEvents *instance, uint32_t event_index); // Returns NULL if no counters were recorded
+extern uint64_t ukGetHistogramBucketStart(UkEvents *instance, uint32_t bucket_index); // The bucket holds durations from its start up to, but not including, the next bucket's start
+extern uint64_t ukGetWallTime(UkEvents *instance, uint64_t time); // Converts a loaded event time to nanoseconds since the Unix epoch (UTC), interpolated between the clock anchors. Returns 0 if the file has no clock anchors
+extern uint64_t ukGetPeerTime(UkEvents *instance, uint64_t peer_process_id, uint64_t time, uint64_t *uncertainty_ret); // Converts a loaded event time to the clock of the peer process (its UkEvents.process_id), corrected for drift. Returns 0 if there are no clock syncs with the peer. uncertainty_ret can be NULL
+extern uint64_t ukGetHistogramPercentile(UkEvents *instance, uint16_t event_registration_index, double percentile); // E.g. percentile=99.9. Returns the end of the bucket holding the percentile, capped at the max duration
 
 #ifdef __cplusplus
 }
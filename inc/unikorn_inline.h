@@ -0,0 +1,100 @@
+// Copyright 2021 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _UNIKORN_INLINE_H_
+#define _UNIKORN_INLINE_H_
+
+// Optional: record events with an inline function, so most events don't need a call into the library
+//  - ukRecordEventInline() is the same as ukRecordEvent(), but stores the event inline if the current chunk of the event buffer has a free slot
+//  - Everything else (starting a new chunk, flushing, overwriting the oldest events, folders, pausing) is done out of line by the library
+//  - If flush_when_full==false, the library makes room for the rest of the chunk before the inline function records into it, so the buffer
+//    may hold up to a chunk (64 events) fewer than max_event_count
+//  - Only single threaded sessions (UkAttrs.is_multi_threaded=false) without counters, CPU info, aggregate_only, thresholds, sampling, event
+//    capacities, or disabled event types use the inline path. Other sessions still work, but every event is recorded out of line.
+//  - The clock is read inline with UK_INLINE_CLOCK(). If not defined before including this file, it's clock_gettime(CLOCK_MONOTONIC) on Linux
+//    and Mac (same as src/unikorn_clock_gettime.c), otherwise ukGetTime()
+//  - IMPORTANT: UK_INLINE_CLOCK() must return the same time as the clockNanoseconds given to ukCreate()
+//  - With unikorn_macros.h, define UK_INLINE_RECORDING (e.g. -DUK_INLINE_RECORDING) to have UK_RECORD_EVENT() use ukRecordEventInline()
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "unikorn.h"
+#include "unikorn_clock.h"
+
+#ifndef UK_INLINE_CLOCK
+  #if defined(_WIN32) || defined(USE_ZERO_BASE_TIME)
+    #define UK_INLINE_CLOCK() ukGetTime()
+  #else
+    #include <time.h>
+    static inline uint64_t ukInlineClockGettime() {
+      struct timespec curr_time;
+      clock_gettime(CLOCK_MONOTONIC, &curr_time);
+      return ((uint64_t)curr_time.tv_sec * 1000000000) + (uint64_t)curr_time.tv_nsec;
+    }
+    #define UK_INLINE_CLOCK() ukInlineClockGettime()
+  #endif
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// The free slots of the current chunk that the inline function can record into. Owned by the library: only the inline function advances next_slot.
+// IMPORTANT: This is the first member of the session, so it's found without a call into the library
+typedef struct {
+  uint32_t next_slot;             // Equal to end_slot if there are no free slots, so the next event is recorded out of line
+  uint32_t end_slot;
+  uint64_t base_time;             // The chunk's base time: each event stores a 32 bit delta from it
+  uint16_t first_event_id;
+  int32_t *time_delta_list;
+  uint16_t *event_id_list;
+  uint64_t *instance_list;        // NULL if UkAttrs.record_instance==false
+  uint64_t *instance_counter_list; // The next instance of each event ID, indexed by (event_id - first_event_id)
+  double *value_list;             // NULL if UkAttrs.record_value==false
+  char **file_name_list;          // NULL if UkAttrs.record_file_location==false
+  char **function_name_list;
+  uint16_t *line_number_list;
+} UkInlineState;
+
+// Same as ukRecordEvent(), then gives the inline function the rest of the current chunk if the session allows it
+void ukRecordEventOutOfLine(void *instance, uint16_t event_id, double value, const char *file, const char *function, uint16_t line_number);
+
+static inline void ukRecordEventInline(void *instance, uint16_t event_id, double value, const char *file, const char *function, uint16_t line_number) {
+  UkInlineState *state = (UkInlineState *)instance;
+  uint32_t slot = state->next_slot;
+  if (slot != state->end_slot) {
+    uint64_t time_delta = UK_INLINE_CLOCK() - state->base_time;
+    if (time_delta <= INT32_MAX) {
+      state->next_slot = slot + 1;
+      state->time_delta_list[slot] = (int32_t)time_delta;
+      state->event_id_list[slot] = event_id;
+      if (state->instance_list != NULL) state->instance_list[slot] = state->instance_counter_list[event_id - state->first_event_id]++;
+      if (state->value_list != NULL) state->value_list[slot] = value;
+      if (state->file_name_list != NULL) {
+        state->file_name_list[slot] = (char *)file;
+        state->function_name_list[slot] = (char *)function;
+        state->line_number_list[slot] = line_number;
+      }
+      return;
+    }
+  }
+  ukRecordEventOutOfLine(instance, event_id, value, file, function, line_number);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
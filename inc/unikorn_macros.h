@@ -29,6 +29,39 @@
   #define strdup _strdup
 #endif
 
+// Define UK_RECORD_PER_CPU as true (e.g. -DUK_RECORD_PER_CPU=true) to use one event buffer per CPU core with multi threaded sessions
+#ifndef UK_RECORD_PER_CPU
+  #define UK_RECORD_PER_CPU false
+#endif
+// Define UK_RECORD_CPU as true to store the CPU core index with each event
+#ifndef UK_RECORD_CPU
+  #define UK_RECORD_CPU false
+#endif
+// Define UK_COUNTER_MASK as a bitwise OR of UK_COUNTER_* values to sample counters with each event
+#ifndef UK_COUNTER_MASK
+  #define UK_COUNTER_MASK 0
+#endif
+// Define UK_AGGREGATE_ONLY as true to only keep a histogram of the durations of each event type
+#ifndef UK_AGGREGATE_ONLY
+  #define UK_AGGREGATE_ONLY false
+#endif
+// Define UK_REAL_TIME as true to prefault and lock the event memory, and allocate everything a flush needs up front
+#ifndef UK_REAL_TIME
+  #define UK_REAL_TIME false
+#endif
+// Define UK_SPILL_WHEN_FULL as true to have a background thread write full buffers while multi threaded sessions keep recording
+#ifndef UK_SPILL_WHEN_FULL
+  #define UK_SPILL_WHEN_FULL false
+#endif
+// Define UK_RECORD_SPANS as true so UK_RECORD_SPAN() can store a start and end event as one record
+#ifndef UK_RECORD_SPANS
+  #define UK_RECORD_SPANS false
+#endif
+// Define UK_INLINE_RECORDING to record events with the inline function in unikorn_inline.h
+#ifdef UK_INLINE_RECORDING
+  #include "unikorn_inline.h"
+#endif
+
 // Argument types:
 //    const char *_filename
 //    uint32_t _max_events
@@ -54,9 +87,19 @@
     .folder_registration_count = (_folder_registration_count), \
     .folder_registration_list = (_folder_registration_list), \
     .event_registration_count = (_event_registration_count), \
-    .event_registration_list = (_event_registration_list) \
+    .event_registration_list = (_event_registration_list), \
+    .record_per_cpu = (_is_multi_threaded) && UK_RECORD_PER_CPU, \
+    .record_cpu = UK_RECORD_CPU, \
+    .counter_mask = UK_COUNTER_MASK, \
+    .aggregate_only = UK_AGGREGATE_ONLY, \
+    .real_time = UK_REAL_TIME, \
+    .spill_when_full = (_is_multi_threaded) && UK_SPILL_WHEN_FULL, \
+    .spill_buffer_count = 0, \
+    .spill_policy = UK_SPILL_BLOCK, \
+    .record_spans = UK_RECORD_SPANS, \
+    .apply_config = true \
   }; \
-  (_flush_info)->filename = strdup(_filename); \
+  (_flush_info)->filename = ukConfigFilename(_filename); \
   (_flush_info)->file = NULL; \
   (_flush_info)->events_saved = false; \
   (_flush_info)->append_subsequent_saves = true; \
@@ -66,7 +109,18 @@
 #define UK_FLUSH(_session) ukFlush(_session)
 #define UK_OPEN_FOLDER(_session, _folder_id) ukOpenFolder(_session, _folder_id)
 #define UK_CLOSE_FOLDER(_session) ukCloseFolder(_session)
-#define UK_RECORD_EVENT(_session, _event_id, _value) ukRecordEvent(_session, _event_id, _value, __FILE__, __FUNCTION__, __LINE__)
+#ifdef UK_INLINE_RECORDING
+  #define UK_RECORD_EVENT(_session, _event_id, _value) ukRecordEventInline(_session, _event_id, _value, __FILE__, __FUNCTION__, __LINE__)
+#else
+  #define UK_RECORD_EVENT(_session, _event_id, _value) ukRecordEvent(_session, _event_id, _value, __FILE__, __FUNCTION__, __LINE__)
+#endif
+#define UK_RECORD_SPAN(_session, _start_id, _start_time, _end_time, _value) ukRecordSpan(_session, _start_id, _start_time, _end_time, _value, __FILE__, __FUNCTION__, __LINE__)
+#define UK_SET_EVENT_THRESHOLD(_session, _start_id, _threshold) ukSetEventThreshold(_session, _start_id, _threshold)
+#define UK_SET_EVENT_CAPACITY(_session, _start_id, _max_events) ukSetEventCapacity(_session, _start_id, _max_events)
+#define UK_PAUSE(_session) ukPause(_session)
+#define UK_RESUME(_session) ukResume(_session)
+#define UK_SET_TASK_ID(_session, _task_id) ukSetTaskId(_session, _task_id)
+#define UK_END_TASK(_session, _task_id) ukEndTask(_session, _task_id)
 
 #else  // ENABLE_UNIKORN_RECORDING
 
@@ -76,6 +130,13 @@
 #define UK_OPEN_FOLDER(_session, _folder_id)
 #define UK_CLOSE_FOLDER(_session)
 #define UK_RECORD_EVENT(_session, _event_id, _value)
+#define UK_RECORD_SPAN(_session, _start_id, _start_time, _end_time, _value)
+#define UK_SET_EVENT_THRESHOLD(_session, _start_id, _threshold)
+#define UK_SET_EVENT_CAPACITY(_session, _start_id, _max_events)
+#define UK_PAUSE(_session)
+#define UK_RESUME(_session)
+#define UK_SET_TASK_ID(_session, _task_id)
+#define UK_END_TASK(_session, _task_id)
 
 #endif   // ENABLE_UNIKORN_RECORDING
 
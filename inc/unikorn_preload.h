@@ -0,0 +1,73 @@
+// Copyright 2021 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _UNIKORN_PRELOAD_H_
+#define _UNIKORN_PRELOAD_H_
+
+// Optional: the common part of the LD_PRELOAD interposer libraries, which record the calls an application makes into code that can't be instrumented
+// (e.g. libc), without rebuilding the application. Linux only. Build them with 'make preload' in lib/, then run the application with one or more of them:
+//    > LD_PRELOAD=<path>/libunikorn_malloc.so ./my_app
+//  - Each interposer library records into its own session, saved when the process exits to 'unikorn_<name>_<pid>.events' in the current folder,
+//    or in the folder given by the environment variable UNIKORN_PRELOAD_DIR. UnikornViewer aligns it with the application's events files by time.
+//  - Settings are in the environment variable UNIKORN_<NAME> (e.g. UNIKORN_MALLOC="max_event_count=100000,small=100"), separated by commas:
+//      max_event_count=<count>    Default is 1000000. If flush_when_full==false, only the most recent events are kept.
+//      flush_when_full=<true|false>
+//      aggregate_only=<true|false>    Only keep a histogram of the durations of each event type (see UkAttrs.aggregate_only). UnikornViewer
+//                                     can't show these files: print them with examples/aggregate_histograms
+//    Any other setting is given to the interposer library (see its source file)
+//  - Calls made while recording (e.g. Unikorn allocating memory, even by another interposer library) and calls made by exiting threads are not recorded
+//  - A forked child doesn't record (it would only save a copy of the parent's events), but a child that calls exec() starts its own session
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "unikorn.h"
+
+// The libraries are built with -fvisibility=hidden, so only the interposed functions are exported, and each library keeps its own copy of Unikorn
+#define UK_PRELOAD_EXPORT __attribute__((visibility("default")))
+// The libraries are loaded with the application, so their thread local variables can use the fastest model
+#define THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Called for each setting that ukPreloadReadSettings() doesn't know
+typedef void (*UkPreloadApplySetting)(const char *name, const char *value);
+
+// Read the settings in UNIKORN_<NAME>. Call this from the library's constructor, before ukPreloadStart(), so the interposer's own settings can
+// decide its event registrations.
+extern void ukPreloadReadSettings(const char *name, UkPreloadApplySetting applySetting);
+
+// Create the session. The event registrations can't have folders. If record_file_location==true, the interposer gives each event its own
+// file name, function name and line number (e.g. what the call was made on).
+extern void ukPreloadStart(uint16_t event_registration_count, UkEventRegistration *event_registration_list, bool record_file_location);
+
+// Stop recording and save the events. Call this from the library's destructor. The session isn't destroyed, since other threads may still be using it.
+extern void ukPreloadStop();
+
+// Returns the session if the calling thread can record, and until ukPreloadEnd(), the thread's other interposed calls are not recorded.
+// Returns NULL if not started, or if the thread is already recording (e.g. Unikorn allocated memory) or exiting.
+// Also use these around any other calls into the session (e.g. ukSetEventName()), since Unikorn may call the interposed functions.
+extern void *ukPreloadBegin();
+extern void ukPreloadEnd();
+
+// The next definition of the interposed function (e.g. libc's). Asserts if not found.
+extern void *ukPreloadRealFunction(const char *function_name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,44 @@
+// Copyright 2021 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _UNIKORN_SIGNAL_FLUSH_H_
+#define _UNIKORN_SIGNAL_FLUSH_H_
+
+// Optional: save the recorded events of a running process on demand, by sending it a signal (e.g. 'kill -USR1 <pid>'). Linux or Mac
+//  - The signal handler only sets a flag. A dedicated thread checks the flag every 100 milliseconds and saves the events, so no I/O is done in the handler
+//  - Each save goes to a new file named '<base_filename>_<YYYYMMDD>_<HHMMSS>_<save count>.events', using ukFlushTo() and unikorn_file_flush.c
+//  - IMPORTANT: The session must be created with UkAttrs.is_multi_threaded=true, since the events are saved from a different thread
+//  - Use UkAttrs.flush_when_full=false so the session always holds the most recent events
+//  - Like any signal, it can end some blocking calls early (e.g. sleep() or calls that return EINTR), even though SA_RESTART is used
+
+#include <stdbool.h>
+#include "unikorn.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Install the signal handler (e.g. signal_number=SIGUSR1) and start the save thread. Only one session at a time. Returns false if the handler or thread can't be started.
+// keep_events: if true, a snapshot is saved and the events stay in the session (e.g. for the application's own flushes), otherwise the session is flushed
+extern bool ukSignalFlushStart(void *session, int signal_number, const char *base_filename, bool keep_events);
+
+// Restore the previous signal handler and stop the save thread. Call this before ukDestroy()
+extern void ukSignalFlushStop();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -12,7 +12,11 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#ifdef __linux__
+  #define _GNU_SOURCE             // For sched_getcpu()
+#endif
 #include "unikorn.h"
+#include "unikorn_inline.h"
 #ifdef NDEBUG // Don't want assert compiled out
   #undef NDEBUG
 #endif
@@ -21,14 +25,24 @@
 #include <stdio.h>
 #include <limits.h>
 #include <string.h>
+#include <stddef.h>
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #include <Windows.h>        // For GetCurrentProcessorNumber() and GetCurrentThreadId()
+#endif
+#ifndef _WIN32
+  #include <unistd.h>         // For syscall(), sysconf(), read(), close(), gethostname() and getpid()
+  #include <sys/syscall.h>    // For SYS_gettid and SYS_perf_event_open
+  #include <time.h>           // For clock_gettime(CLOCK_REALTIME)
+  #include <sys/mman.h>       // For mmap(), madvise() and mlock()
+#endif
+#ifdef __linux__
+  #include <sched.h>          // For sched_getcpu()
+  #include <sys/resource.h>   // For getrusage()
+  #include <linux/perf_event.h>
+  #include <errno.h>
+#endif
 #ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
-  #ifdef _WIN32
-    #define WIN32_LEAN_AND_MEAN
-    #include <Windows.h>
-  #else
-    #include <unistd.h>       // For syscall()
-    #include <sys/syscall.h>  // For SYS_gettid
-  #endif
   #include <pthread.h>
 #endif
 #ifdef _WIN32
@@ -40,22 +54,46 @@
   #define UINT64_FORMAT "zu"
 #endif
 
-// Memory layout of the event buffer
-//     - Time                   sizeof(uint64_t)
+// Memory layout of the event buffer: one list per value, so only the values being recorded use memory (e.g. 6 bytes per event if only recording the time and event ID)
+//     - Time delta             sizeof(int32_t)                                            Nanoseconds from the base time of the event's chunk (see TimeChunk)
 //     - Event ID               sizeof(uint16_t)
 //     - Instance               sizeof(uint64_t)  (only if record_instance==true)          Number of times the event ID was stored
 //     - Value                  sizeof(double)    (only if store_value == true)            64bit float value
-//     - Thread ID              sizeof(uint64_t)  (only if is_multi_threaded == true)      Thread ID (can be used as a folder in the GUI)
+//     - Thread slot            sizeof(uint16_t)  (only if is_multi_threaded == true)      Index into the thread slot list (can be used as a folder in the GUI)
+//     - CPU index              sizeof(uint16_t)  (only if record_cpu == true)             CPU core the event was recorded on (can be used as a folder in the GUI)
+//     - Counter values         counter_count*sizeof(uint64_t) (only if counter_count > 0)
 //     - File Name Pointer      sizeof(char *)    (only if record_file_location == true)   Resolves to the name of the file where the event was stored
 //     - Function Name Pointer  sizeof(char *)    (only if record_file_location == true)   Resolves to the name of the function where the event was stored
 //     - Line number            sizeof(uint16_t)  (only if record_file_location == true)   Line number in the file where the event was stored
+// The events are unpacked to the Event struct (with the full 64 bit time) when flushed
 
 #define MAX_NAME_LENGTH 100      // Don't want event and folder names to get unruly, but this can increase without changing the spec
 #define MIN_EVENT_COUNT 10       // Need some reasonable min
 #define MAGIC_VALUE1 123456789   // Use to partically validate the data structure
 #define MAGIC_VALUE2 987654321   // Use to partically validate the data structure
 #define CLOSE_FOLDER_ID 0        // Reserved ID
+#define UNKNOWN_CPU USHRT_MAX    // If the OS can't report the CPU core
 #define INITIAL_LIST_SIZE 10
+#define MAX_COUNTERS 16          // Max number of counters that can be sampled with each event
+#define HISTOGRAM_SUB_BUCKET_BITS 4 // Each power of 2 is split into 16 buckets, so a bucket's range is within 6.25% of its start
+#define HISTOGRAM_BUCKET_COUNT ((64-HISTOGRAM_SUB_BUCKET_BITS+1) << HISTOGRAM_SUB_BUCKET_BITS)
+#define MAX_AGGREGATE_NESTING 8  // Max nested starts of the same event type (per thread) that can be paired with their ends
+#define TIME_CHUNK_EVENT_COUNT 64 // Events per chunk of the event buffer. Each chunk has a 64 bit base time, and each event a 32 bit delta from it.
+#define CONFIG_ENV_NAME "UNIKORN_CONFIG" // Optional runtime config: see ukCreate() in unikorn.h
+#define MIN_TASK_TABLE_SIZE 64   // Initial size of the hash table of tasks (see ukSetTaskId()). Doubles when half full.
+#define MAX_STAGED_EVENT_COUNT 100 // Max events (per thread) staged while waiting to see if an instance exceeds its threshold. If exceeded, the instance is kept.
+#define REAL_TIME_MAX_PAUSE_COUNT 100 // Real time mode: pauses between flushes. Once full, each pause is merged with the previous one.
+#define REAL_TIME_MAX_CLOCK_SYNC_COUNT 100 // Real time mode: clock syncs between flushes. Once full, new ones are dropped.
+#define HUGE_PAGE_BYTES (2*1024*1024) // Real time mode: try explicit huge pages for blocks at least this big
+#define CACHE_LINE_BYTES 64      // Real time mode: each list in a locked block starts on its own cache line
+#define DEFAULT_SPILL_BUFFER_COUNT 2 // Spare buffers if spilling and UkAttrs.spill_buffer_count is zero
+#define INITIAL_SPILL_THREAD_SLOTS 64 // Threads (or tasks) the spill thread's copy of the thread slots can hold before it grows
+#define SPAN_EVENT_FLAG 0x8000   // Set in a buffered event ID if the event is a span (see ukRecordSpan()): the slot's time is the end time, and its duration is in span_duration_list
+#ifdef _WIN32
+  #define FORCE_INLINE __forceinline
+#else
+  #define FORCE_INLINE inline __attribute__((always_inline))
+#endif
 #ifdef UNIKORN_RELEASE_BUILD
   #define OPTIONAL_ASSERT(condition)
 #else
@@ -72,6 +110,7 @@
 typedef struct {
   char *name;
   uint16_t id;        // ID's must start with 1 and be contiguous across folders (defined first) and events
+  bool is_disabled;   // Opening and closing the folder is not recorded (see UNIKORN_CONFIG)
 } PrivateFolderInfo;
 
 typedef struct {
@@ -79,8 +118,11 @@ typedef struct {
   uint16_t start_id;  // ID's must start with 1 and be contiguous across folders (defined first) and events
   uint16_t end_id;    // ID's must start with 1 and be contiguous across folders (defined first) and events
   uint16_t rgb;       // 0x0RGB
-  uint64_t start_instance; // Number of times the start event was used
-  uint64_t end_instance;   // Number of times the end event was used
+  uint64_t threshold;      // Nanoseconds: if not zero, only instances lasting at least this long are kept (see ukSetEventThreshold())
+  struct EventBuffer *ring; // The event type's own buffer (see ukSetEventCapacity()), or NULL if stored with the other event types
+  bool is_disabled;        // The event type is not recorded (see UNIKORN_CONFIG)
+  uint32_t sample_ratio;   // If greater than 1, only 1 of every sample_ratio instances is recorded per thread (see UNIKORN_CONFIG)
+  bool is_plain;           // Not disabled, sampled, thresholded, or in its own ring, so it can use the session's specialized record function
   char *start_value_name;
   char *end_value_name;
 } PrivateEventInfo;
@@ -90,13 +132,179 @@ typedef struct {
   uint16_t event_id;
   uint64_t instance;
   double value;
-  uint64_t thread_id;
+  uint16_t thread_slot;
+  uint16_t cpu;
+  uint64_t *counter_values; // Points into the buffer's list of counter values
   char *file_name;
   char *function_name;
   uint16_t line_number;
+  bool is_span;             // If true, time is the start time, and the end event is span_duration later (see ukRecordSpan())
+  uint64_t span_duration;
 } Event;
 
 typedef struct {
+  uint64_t start_time;
+  uint64_t end_time;
+} SpanTimes;               // A start and end event recorded as one event (see ukRecordSpan())
+
+typedef enum {
+  COUNTER_SOURCE_PERF,     // Read via perf_event_open()
+  COUNTER_SOURCE_RUSAGE,   // Read via getrusage(RUSAGE_THREAD)
+} CounterSource;
+
+typedef enum {
+  RUSAGE_FIELD_MINOR_FAULTS,
+  RUSAGE_FIELD_MAJOR_FAULTS,
+  RUSAGE_FIELD_VOLUNTARY_SWITCHES,
+  RUSAGE_FIELD_INVOLUNTARY_SWITCHES,
+  RUSAGE_FIELD_USER_TIME,
+  RUSAGE_FIELD_SYSTEM_TIME,
+} RusageField;
+
+typedef struct {
+  uint32_t mask;           // One of UK_COUNTER_*
+  const char *name;
+  CounterSource source;
+#ifdef __linux__
+  uint32_t perf_type;      // Only used if source==COUNTER_SOURCE_PERF
+  uint64_t perf_config;    // Only used if source==COUNTER_SOURCE_PERF
+  RusageField rusage_field; // Only used if source==COUNTER_SOURCE_RUSAGE
+#endif
+} CounterDefinition;
+
+typedef struct {
+  bool is_opened;
+  int group_fd;            // -1 if the counters could not be opened
+  uint16_t fd_count;
+  int fd_list[MAX_COUNTERS];
+} CounterReader;           // Counters are read for the thread that opened them
+
+typedef struct {
+  uint64_t count;          // Number of durations
+  uint64_t min_duration;   // Nanoseconds
+  uint64_t max_duration;
+  uint64_t total_duration;
+  uint64_t unmatched_count; // End events without a start event on the same thread
+  uint64_t bucket_counts[HISTOGRAM_BUCKET_COUNT]; // Log scaled: see histogramBucketIndex()
+} Histogram;               // The durations of an event type
+
+typedef struct {
+  uint64_t base_time;      // Time of the first event in the chunk
+  uint32_t first_event_index; // Events before this were overwritten
+  uint32_t event_count;    // A chunk may end early if an event's time is too far from the base time for a 32 bit delta
+} TimeChunk;
+
+typedef struct {
+  uint64_t pause_time;
+  uint64_t resume_time;
+} PauseInterval;           // A time range when recording was paused
+
+typedef struct EventBuffer {
+  uint32_t max_event_count;
+  uint32_t num_stored_events;
+  // Chunks: a ring of TIME_CHUNK_EVENT_COUNT event slots each. If flush_when_full==false, the oldest events are overwritten once full.
+  uint32_t chunk_count;
+  uint32_t first_chunk;    // Oldest chunk with unsaved events
+  uint32_t curr_chunk;     // Chunk being recorded into
+  uint32_t used_chunk_count;
+  TimeChunk *chunk_list;
+  // Event values: see 'Memory layout of the event buffer' above. The optional lists are NULL if not recorded.
+  int32_t *time_delta_list;
+  uint16_t *event_id_list;
+  uint64_t *instance_list;
+  double *value_list;
+  uint16_t *thread_slot_list;
+  uint16_t *cpu_list;
+  uint64_t *counter_values; // counter_count values per event
+  char **file_name_list;
+  char **function_name_list;
+  uint16_t *line_number_list;
+  uint64_t *span_duration_list; // Only set for the slots of spans (see SPAN_EVENT_FLAG)
+  void *locked_memory;     // Real time mode: the lists are carved out of this one block, instead of each being malloc'd
+  size_t locked_bytes;
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  pthread_mutex_t mutex; // Only used by the per CPU buffers; the main buffer is protected by the session's mutex
+#endif
+} EventBuffer;
+
+typedef struct {
+  char *base;              // NULL while measuring the size of the block
+  size_t bytes;
+} LockedBlock;             // Real time mode: lists are carved out of one block of locked memory (see allocList())
+
+typedef struct {
+  uint16_t *depth_list;    // Per event type: number of starts not yet paired with an end
+  uint64_t *start_time_list; // Per event type: MAX_AGGREGATE_NESTING start times
+} AggregateStarts;         // Only used with aggregate_only==true
+
+typedef struct {
+  EventBuffer events;      // Allocated the first time an instance is staged
+  uint16_t event_registration_index; // The event type of the staged instance
+  uint16_t depth;          // Nested starts of the staged event type not yet ended, or zero if nothing is staged
+} StagedEvents;            // The events of an instance (including nested events) that are only kept if the instance exceeds its event type's threshold
+
+typedef struct {
+  uint32_t start_count;    // Starts seen, to keep 1 of every sample_ratio
+  uint16_t depth;          // Nested starts not yet ended
+  uint64_t kept_mask;      // Bit per nesting depth: set if the start was kept, so its end is also kept
+} SampleState;             // Per event type, only used if the event type has a sample ratio
+
+typedef struct ThreadInfo {
+  void *session;           // The UnikornSession this info belongs to
+  uint64_t thread_id;      // Or the task ID if is_task==true
+  uint16_t thread_slot;
+  bool is_task;            // A logical task from ukSetTaskId() (e.g. a coroutine), which may run on different threads over its life
+  struct ThreadInfo *curr_task_info; // The task the thread is running, or NULL. Not used if is_task==true
+  uint64_t curr_task_id;   // The task ID of curr_task_info when it was set: if the info's ID no longer matches, another thread ended the task (see currTaskInfo())
+  struct ThreadInfo *next_ended_task; // Only used by UnikornSession.ended_task_list
+  CounterReader counter_reader; // Not used if is_task==true, since counters are per thread
+  AggregateStarts aggregate_starts;
+  StagedEvents staged_events;
+  SampleState *sample_states; // Allocated the first time a sampled event type is recorded
+} ThreadInfo;
+
+typedef struct {
+  uint64_t thread_id;
+  uint32_t generation;     // Incremented each time the slot is recycled for a new thread
+  bool is_task;            // thread_id is a task ID from ukSetTaskId()
+  bool is_retired;         // The thread has exited, or the task has ended
+  uint64_t retire_time;    // The slot can be recycled once all events older than this are flushed or overwritten
+  ThreadInfo *thread_info; // NULL if retired
+} ThreadSlot;
+
+typedef struct {
+  uint64_t time;           // From the session's clock
+  uint64_t wall_time;      // Nanoseconds since the Unix epoch (UTC), at the same moment
+} ClockAnchor;             // Lets viewers align files from different processes or hosts, since each clock has its own base time
+
+typedef struct {
+  uint64_t time;           // From the session's clock
+  uint64_t peer_process_id;
+  int64_t offset;          // The peer's clock read time+offset at the same moment
+  uint64_t round_trip;     // Of the exchange that measured the offset: the offset is within round_trip/2
+} ClockSync;
+
+typedef struct {
+  uint64_t task_id;        // Zero if the entry is not used
+  ThreadInfo *task_info;
+} TaskEntry;
+
+typedef struct SpillBuffers {
+  EventBuffer main_buffer;
+  EventBuffer *cpu_buffer_list;   // Same count as the session's, or NULL if record_per_cpu==false
+  EventBuffer **ring_list;        // Per event type: the spare of the event type's own buffer (see ukSetEventCapacity()), or NULL
+  bool has_thresholds;            // The session's has_thresholds when the buffers were spilled
+  uint16_t starting_folder_stack_count; // Folders that were already open before the first spilled event
+  uint16_t *starting_folder_stack;
+  bool is_busy;                   // Waiting to be written, or being written, by the spill thread
+  bool has_events;
+  uint64_t oldest_time;           // Of the spilled events, so thread slots are not recycled until the events are written (see acquireThreadSlot())
+  struct SpillBuffers *next;      // In the free list or the spill queue
+} SpillBuffers;            // A spare for each of the session's buffers, swapped in when a buffer is full (see spillEvents())
+
+typedef struct {
+  // Inline recording: must be first (see unikorn_inline.h)
+  UkInlineState inline_state;
   uint32_t magic_value1;
   // User defined functions
   uint64_t (*clockNanoseconds)();
@@ -110,6 +318,15 @@ typedef struct {
   bool record_instance;
   bool record_file_location;
   bool record_value;
+  bool record_per_cpu;
+  bool record_cpu;
+  bool record_spans;
+  // Specialized recording: a record function without per event checks of the recording attributes (see recordPlainEvent())
+  bool use_plain_recording;       // False if a session wide feature needs the general recording path (e.g. counters or thresholds)
+  uint8_t plain_record_index;     // The specialized record function that matches the recording attributes
+  bool use_inline_recording;      // True if ukRecordEventInline() can record into the main buffer (see openInlineRange())
+  bool is_inline_range_open;      // The inline state's slots are in the current chunk, but not yet accounted for (see closeInlineRange())
+  uint32_t inline_range_start;    // The first slot given to the inline state
   // Folders
   uint16_t folder_registration_count;
   PrivateFolderInfo *folder_registration_list;
@@ -121,23 +338,109 @@ typedef struct {
   uint16_t first_event_id;
   uint16_t event_registration_count;
   PrivateEventInfo *event_registration_list;
-  // Event buffer
-  uint32_t max_event_count;
-  uint32_t num_stored_events;
-  uint32_t curr_event_index;
-  uint32_t first_unsaved_event_index;
-  Event *events_buffer;
+  uint64_t *instance_counter_list; // The next instance of each event ID, indexed by (event_id - first_event_id). Shared with the inline state.
+  // Counters
+  uint16_t counter_count;
+  uint16_t perf_counter_count;    // The perf counters are first in counter_list, followed by the getrusage() counters
+  const CounterDefinition *counter_list[MAX_COUNTERS];
+  CounterReader counter_reader;   // Only used if is_multi_threaded==false, otherwise each thread has its own
+  // Aggregate only: no events are stored, just a histogram of the durations of each event type
+  bool aggregate_only;
+  Histogram *histogram_list;      // One per event type, or NULL if aggregate_only==false
+  AggregateStarts aggregate_starts; // Only used if is_multi_threaded==false, otherwise each thread has its own
+  // Tail latency capture: instances of event types with a threshold are staged until their duration is known
+  bool has_thresholds;            // If true, committed instances are older than the events already buffered, so the flushed events need sorting
+  StagedEvents staged_events;     // Only used if is_multi_threaded==false, otherwise each thread has its own
+  SampleState *sample_states;     // Only used if is_multi_threaded==false, otherwise each thread has its own
+  // Retention: event types with their own buffer can't be overwritten by the other event types
+  uint16_t event_ring_count;      // Number of event types with their own buffer. Protected by the session's mutex, same as the main buffer.
+  // Pause/resume: events are not recorded while paused
+  bool is_paused;                 // Only changed while holding the session's mutex, but read without it when recording: see isPaused()
+  uint64_t pause_time;            // Start of the current pause, or the last flush if it happened during the pause
+  uint32_t pause_count;           // Pauses since the last flush. Protected by the session's mutex.
+  uint32_t max_pause_count;
+  PauseInterval *pause_list;
+  // Where and when: stored with each flush so files from different processes or hosts can be aligned
+  char host_name[MAX_NAME_LENGTH];
+  uint64_t process_id;
+  ClockAnchor create_anchor;      // Sampled by ukCreate()
+  uint32_t clock_sync_count;      // Clock offsets to other processes since the last flush (see ukRecordClockSync()). Protected by the session's mutex.
+  uint32_t max_clock_sync_count;
+  ClockSync *clock_sync_list;
+  // Real time mode: the memory is prefaulted and locked, and everything a flush needs is allocated up front
+  bool real_time;
+  uint32_t flush_capacity;        // The sum of the buffers' max_event_count, so the flush lists have room for every buffered event
+  uint16_t max_flush_name_count;
+  void *flush_memory;             // Locked block holding the flush lists
+  size_t flush_memory_bytes;
+  Event *flush_event_list;
+  Event **flush_pointer_list;
+  Event **flush_scratch_list;
+  char **flush_file_name_list;    // NULL if record_file_location==false
+  char **flush_function_name_list;
+  uint16_t *flush_bucket_index_list; // NULL if aggregate_only==false
+  uint64_t *flush_bucket_count_list;
+  // Event buffers
+  EventBuffer main_buffer;        // Stores all events, or only the folder events if record_per_cpu==true
+  uint16_t cpu_buffer_count;      // Zero if record_per_cpu==false
+  EventBuffer *cpu_buffer_list;   // One per CPU core, each with its own mutex
   // Thread safety
 #ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
   pthread_mutex_t mutex;
+  pthread_key_t thread_key;       // Each thread's ThreadInfo, so the thread ID is only queried once and thread exits are detected
+#endif
+  uint16_t thread_slot_count;     // This needs to be persistent between flushes since each event refers to a slot, but only grows to the max number of threads alive at the same time
+  ThreadSlot *thread_slot_list;   // Slots of exited threads are recycled (with a new generation) once their events are no longer buffered
+  // Logical tasks: each task gets its own thread slot, so its events are grouped by task instead of by the threads running it
+  uint32_t task_count;
+  uint32_t task_table_size;       // Power of 2, or zero if no tasks were used
+  TaskEntry *task_table;          // Open addressing hash table: task ID -> the task's info. Protected by the session's mutex.
+  ThreadInfo *ended_task_list;    // Infos of ended tasks, reused for new tasks instead of freed, since other threads may still point to them. Protected by the session's mutex.
+  // Spilling: full buffers are flushed by the spill thread while recording continues into spare buffers. Protected by the session's mutex.
+  bool spill_when_full;
+  bool drop_newest_when_full;     // spill_policy==UK_SPILL_DROP_NEWEST: checked before storing each event
+  uint8_t spill_policy;
+  uint16_t spill_buffer_count;
+  SpillBuffers *spill_buffer_list;
+  SpillBuffers *free_spill_buffers;
+  SpillBuffers *first_spill;      // Queue of spilled buffers to write, oldest first
+  SpillBuffers *last_spill;
+  uint16_t busy_spill_count;      // Spilled buffers not yet written
+  ThreadSlot *spill_thread_slot_list; // The spill thread's copy of thread_slot_list, since new threads may grow the list while a spill is written
+  uint16_t spill_thread_slot_capacity;
+  bool stop_spilling;
+  uint64_t dropped_event_count;   // Events dropped or overwritten while every spare buffer was busy. Updated atomically, since the per CPU buffers don't lock the session's mutex.
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  pthread_t spill_thread;
+  pthread_cond_t spill_ready_cond; // Signaled when buffers are spilled, or the spill thread needs to stop
+  pthread_cond_t spill_done_cond; // Signaled when spilled buffers are written
 #endif
-  uint16_t thread_id_list_count;  // This needs to be persistent and growing between flushes as threads come and go
-  uint64_t *thread_id_list;       // This needs to be persistent and growing between flushes as threads come and go
   uint32_t magic_value2;
 } UnikornSession;
 
 static const char *L_unused_name = "N/A";
 
+static const CounterDefinition L_counter_definitions[] = {
+#ifdef __linux__
+  // NOTE: The perf counters must be before the getrusage() counters
+  { UK_COUNTER_TASK_CLOCK,           "task-clock (ns)",       COUNTER_SOURCE_PERF,   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK,       0 },
+  { UK_COUNTER_PAGE_FAULTS,          "page-faults",           COUNTER_SOURCE_PERF,   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,      0 },
+  { UK_COUNTER_CONTEXT_SWITCHES,     "context-switches",      COUNTER_SOURCE_PERF,   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, 0 },
+  { UK_COUNTER_CYCLES,               "cycles",                COUNTER_SOURCE_PERF,   PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,       0 },
+  { UK_COUNTER_INSTRUCTIONS,         "instructions",          COUNTER_SOURCE_PERF,   PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,     0 },
+  { UK_COUNTER_CACHE_MISSES,         "cache-misses",          COUNTER_SOURCE_PERF,   PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,     0 },
+  { UK_COUNTER_BRANCH_MISSES,        "branch-misses",         COUNTER_SOURCE_PERF,   PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,    0 },
+  { UK_COUNTER_MINOR_FAULTS,         "minor-faults",          COUNTER_SOURCE_RUSAGE, 0, 0, RUSAGE_FIELD_MINOR_FAULTS },
+  { UK_COUNTER_MAJOR_FAULTS,         "major-faults",          COUNTER_SOURCE_RUSAGE, 0, 0, RUSAGE_FIELD_MAJOR_FAULTS },
+  { UK_COUNTER_VOLUNTARY_SWITCHES,   "voluntary-switches",    COUNTER_SOURCE_RUSAGE, 0, 0, RUSAGE_FIELD_VOLUNTARY_SWITCHES },
+  { UK_COUNTER_INVOLUNTARY_SWITCHES, "involuntary-switches",  COUNTER_SOURCE_RUSAGE, 0, 0, RUSAGE_FIELD_INVOLUNTARY_SWITCHES },
+  { UK_COUNTER_USER_TIME,            "user-time (us)",        COUNTER_SOURCE_RUSAGE, 0, 0, RUSAGE_FIELD_USER_TIME },
+  { UK_COUNTER_SYSTEM_TIME,          "system-time (us)",      COUNTER_SOURCE_RUSAGE, 0, 0, RUSAGE_FIELD_SYSTEM_TIME },
+#else
+  { 0, NULL, COUNTER_SOURCE_PERF } // Counters are not yet supported on this OS
+#endif
+};
+
 static bool isBigEndian() {
   uint32_t a = 1;
   unsigned char *b = (unsigned char *)&a;
@@ -159,6 +462,41 @@ static uint64_t myThreadId() {
 }
 #endif
 
+static uint64_t wallClockTime() {
+  // Nanoseconds since the Unix epoch (UTC)
+#ifdef _WIN32
+  FILETIME file_time;
+  GetSystemTimePreciseAsFileTime(&file_time);
+  uint64_t intervals = ((uint64_t)file_time.dwHighDateTime << 32) | file_time.dwLowDateTime; // 100 nanosecond intervals since 1601
+  return (intervals - 116444736000000000ULL) * 100;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static ClockAnchor sampleClockAnchor(UnikornSession *session) {
+  // The wall clock is read between two reads of the session's clock, and paired with their midpoint
+  uint64_t time1 = session->clockNanoseconds();
+  uint64_t wall_time = wallClockTime();
+  uint64_t time2 = session->clockNanoseconds();
+  ClockAnchor anchor = { .time = time1 + (time2 - time1) / 2, .wall_time = wall_time };
+  return anchor;
+}
+
+static void getHostInfo(char *host_name, uint64_t *process_id_ret) {
+#ifdef _WIN32
+  DWORD length = MAX_NAME_LENGTH;
+  if (!GetComputerNameA(host_name, &length)) host_name[0] = '\0';
+  *process_id_ret = GetCurrentProcessId();
+#else
+  if (gethostname(host_name, MAX_NAME_LENGTH) != 0) host_name[0] = '\0';
+  *process_id_ret = (uint64_t)getpid();
+#endif
+  host_name[MAX_NAME_LENGTH-1] = '\0'; // Might be truncated without a terminator
+}
+
 static bool containsName(char **name_list, uint16_t name_count, char *name) {
   for (uint16_t i=0; i<name_count; i++) {
     // IMPORTANT: need to use strcmp() instead of ==. Can't assume compiler or app will use the same pointer value for __FILE__ or __FUNCTION__ (Microsoft compiler does not)
@@ -167,18 +505,18 @@ static bool containsName(char **name_list, uint16_t name_count, char *name) {
   return false;
 }
 
-static char **getFileNameList(UnikornSession *session, uint16_t *count_ret) {
+static char **getFileNameList(Event **flush_list, uint32_t event_count, char **preallocated_list, uint16_t preallocated_count, uint16_t *count_ret) {
+  // The preallocated list is only given in real time mode, with room for the name of every event
   uint16_t name_count = 0;
-  uint16_t max_name_count = INITIAL_LIST_SIZE;
-  char **file_name_list = malloc(max_name_count*sizeof(char *));
+  uint16_t max_name_count = (preallocated_list != NULL) ? preallocated_count : INITIAL_LIST_SIZE;
+  char **file_name_list = (preallocated_list != NULL) ? preallocated_list : malloc(max_name_count*sizeof(char *));
   assert(file_name_list);
 
-  uint32_t index = session->first_unsaved_event_index;
-  for (uint32_t i=0; i<session->num_stored_events; i++) {
-    char *name = session->events_buffer[index].file_name;
+  for (uint32_t i=0; i<event_count; i++) {
+    char *name = flush_list[i]->file_name;
     if (!containsName(file_name_list, name_count, name)) {
       if (name_count == max_name_count) {
-	assert(max_name_count <= (USHRT_MAX/2));
+	assert(preallocated_list == NULL && max_name_count <= (USHRT_MAX/2));
 	max_name_count *= 2;
 	file_name_list = realloc(file_name_list, max_name_count*sizeof(char *));
 	assert(file_name_list);
@@ -186,25 +524,24 @@ static char **getFileNameList(UnikornSession *session, uint16_t *count_ret) {
       file_name_list[name_count] = name;
       name_count++;
     }
-    index = (index + 1) % session->max_event_count;
   }
 
   *count_ret = name_count;
   return file_name_list;
 }
 
-static char **getFunctionNameList(UnikornSession *session, uint16_t *count_ret) {
+static char **getFunctionNameList(Event **flush_list, uint32_t event_count, char **preallocated_list, uint16_t preallocated_count, uint16_t *count_ret) {
+  // The preallocated list is only given in real time mode, with room for the name of every event
   uint16_t name_count = 0;
-  uint16_t max_name_count = INITIAL_LIST_SIZE;
-  char **function_name_list = malloc(max_name_count*sizeof(char *));
+  uint16_t max_name_count = (preallocated_list != NULL) ? preallocated_count : INITIAL_LIST_SIZE;
+  char **function_name_list = (preallocated_list != NULL) ? preallocated_list : malloc(max_name_count*sizeof(char *));
   assert(function_name_list);
 
-  uint32_t index = session->first_unsaved_event_index;
-  for (uint32_t i=0; i<session->num_stored_events; i++) {
-    char *name = session->events_buffer[index].function_name;
+  for (uint32_t i=0; i<event_count; i++) {
+    char *name = flush_list[i]->function_name;
     if (!containsName(function_name_list, name_count, name)) {
       if (name_count == max_name_count) {
-	assert(max_name_count <= (USHRT_MAX/2));
+	assert(preallocated_list == NULL && max_name_count <= (USHRT_MAX/2));
 	max_name_count *= 2;
 	function_name_list = realloc(function_name_list, max_name_count*sizeof(char *));
 	assert(function_name_list);
@@ -212,47 +549,12 @@ static char **getFunctionNameList(UnikornSession *session, uint16_t *count_ret)
       function_name_list[name_count] = name;
       name_count++;
     }
-    index = (index + 1) % session->max_event_count;
   }
 
   *count_ret = name_count;
   return function_name_list;
 }
 
-static bool containsValue(uint64_t *value_list, uint16_t value_count, uint64_t value) {
-  for (uint16_t i=0; i<value_count; i++) {
-    if (value == value_list[i]) return true;
-  }
-  return false;
-}
-
-static void getThreadIdList(UnikornSession *session) {
-  uint32_t index = session->first_unsaved_event_index;
-  for (uint32_t i=0; i<session->num_stored_events; i++) {
-    uint64_t thread_id = session->events_buffer[index].thread_id;
-    if (!containsValue(session->thread_id_list, session->thread_id_list_count, thread_id)) {
-      // Thread ID not in list, add to it
-      if (session->thread_id_list_count == USHRT_MAX) {
-        printf("Unikorn is only defined to handle up to %d threads.\n", USHRT_MAX);
-        assert(0);
-      }
-      session->thread_id_list_count++;
-      session->thread_id_list = realloc(session->thread_id_list, session->thread_id_list_count*sizeof(uint64_t));
-      assert(session->thread_id_list);
-      session->thread_id_list[session->thread_id_list_count-1] = thread_id;
-    }
-    index = (index + 1) % session->max_event_count;
-  }
-}
-
-static uint16_t getThreadIndex(uint64_t thread_id, uint64_t *thread_id_list, uint16_t thread_id_count) {
-  for (uint16_t i=0; i<thread_id_count; i++) {
-    if (thread_id == thread_id_list[i]) return i;
-  }
-  assert(0);
-  return 0;
-}
-
 static uint16_t getNameIndex(char *name, char **name_list, uint16_t name_count) {
   for (uint16_t i=0; i<name_count; i++) {
     // IMPORTANT: need to use strcmp() instead of ==. Can't assume compiler or app will use the same pointer value for __FILE__ or __FUNCTION__ (Microsoft compiler does not)
@@ -277,176 +579,1605 @@ static void popStartingFolderStack(UnikornSession *session) {
   session->starting_folder_stack_count--;
 }
 
-void *ukCreate(UkAttrs *attrs,
-	       uint64_t (*clockNanoseconds)(),
-	       void *flush_user_data,
-	       bool (*prepareFlush)(void *user_data),
-	       bool (*flush)(void *user_data, const void *data, size_t bytes),
-	       bool (*finishFlush)(void *user_data)) {
-  // Verify attributes
-  if (attrs->max_event_count < MIN_EVENT_COUNT) { printf("Expected max events count=%d to be at least %d\n", attrs->max_event_count, MIN_EVENT_COUNT); assert(0); }
-  if (attrs->event_registration_count == 0) { printf("Expected at least one named event to be registered\n"); assert(0); }
-#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+static void initEventBufferAccounting(EventBuffer *buffer) {
+  buffer->num_stored_events = 0;
+  buffer->first_chunk = 0;
+  buffer->curr_chunk = 0;
+  buffer->used_chunk_count = 0;
+}
+
+static void *allocLockedMemory(size_t *bytes_ref) {
+  // Real time mode: the pages are faulted in and locked up front, so using them never page faults. The size may be rounded up.
+  size_t bytes = *bytes_ref;
+#ifdef _WIN32
+  void *memory = VirtualAlloc(NULL, bytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+  assert(memory != NULL);
+  memset(memory, 0, bytes);
+  if (!VirtualLock(memory, bytes)) printf("Unikorn: failed to lock %zu bytes of event memory (see SetProcessWorkingSetSize()), so it may be paged out\n", bytes);
 #else
-  if (attrs->is_multi_threaded) { printf("Asked for threading, but the library is not compiled with threading.\n"); assert(0); }
+  void *memory = MAP_FAILED;
+#if defined(MAP_HUGETLB) && defined(MAP_POPULATE)
+  if (bytes >= HUGE_PAGE_BYTES) {
+    // Explicit huge pages: only succeeds if the system has huge pages reserved (e.g. /proc/sys/vm/nr_hugepages)
+    size_t huge_bytes = (bytes + HUGE_PAGE_BYTES - 1) & ~(size_t)(HUGE_PAGE_BYTES - 1);
+    memory = mmap(NULL, huge_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+    if (memory != MAP_FAILED) bytes = huge_bytes;
+  }
 #endif
-  uint32_t num_event_types = 1;
-  for (uint16_t i=0; i<attrs->folder_registration_count; i++) {
-    if (attrs->folder_registration_list[i].name == NULL) { printf("Folder name[%d] is NULL\n", i); assert(0); }
-    if (strlen(attrs->folder_registration_list[i].name) >= MAX_NAME_LENGTH) { printf("Folder name[%d]='%s' has more than %d chars.\n", i, attrs->folder_registration_list[i].name, MAX_NAME_LENGTH); assert(0); }
-    if (attrs->folder_registration_list[i].id != num_event_types) { printf("Folder name[%d]='%s' was expected to have an ID=%d but has %d\n", i, attrs->folder_registration_list[i].name, num_event_types, attrs->folder_registration_list[i].id); assert(0); }
-    num_event_types++;
+  if (memory == MAP_FAILED) {
+    memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(memory != MAP_FAILED);
+#ifdef MADV_HUGEPAGE
+    // Transparent huge pages, if the system allows them. Needs to be done before the pages are faulted in.
+    (void)madvise(memory, bytes, MADV_HUGEPAGE);
+#endif
+    memset(memory, 0, bytes);
   }
-  uint16_t first_event_id = num_event_types;
-  for (uint16_t i=0; i<attrs->event_registration_count; i++) {
-    if (attrs->event_registration_list[i].name == NULL) { printf("Event name[%d] is NULL\n", i); assert(0); }
-    if (strlen(attrs->event_registration_list[i].name) >= MAX_NAME_LENGTH) { printf("Event name[%d]='%s' has more than %d chars.\n", i, attrs->event_registration_list[i].name, MAX_NAME_LENGTH); assert(0); }
-    if (attrs->event_registration_list[i].start_id != num_event_types) { printf("Event name[%d]='%s' was expected to have a start ID=%d but has %d\n", i, attrs->event_registration_list[i].name, num_event_types, attrs->event_registration_list[i].start_id); assert(0); }
-    num_event_types++;
-    if (attrs->event_registration_list[i].end_id != num_event_types) { printf("Event name[%d]='%s' was expected to have an end ID=%d but has %d\n", i, attrs->event_registration_list[i].name, num_event_types, attrs->event_registration_list[i].end_id); assert(0); }
-    num_event_types++;
+  if (mlock(memory, bytes) != 0) printf("Unikorn: failed to lock %zu bytes of event memory (see 'ulimit -l'), so it may be paged out\n", bytes);
+#endif
+  *bytes_ref = bytes;
+  return memory;
+}
+
+static void freeLockedMemory(void *memory, size_t bytes) {
+#ifdef _WIN32
+  (void)bytes;
+  VirtualFree(memory, 0, MEM_RELEASE);
+#else
+  munmap(memory, bytes);
+#endif
+}
+
+static void *allocList(bool is_recorded, uint32_t count, size_t element_size, LockedBlock *block) {
+  if (!is_recorded) return NULL;
+  if (block != NULL) {
+    // Real time mode: carve the list out of the block, or if the block is not allocated yet, only add the list to its size
+    size_t offset = (block->bytes + CACHE_LINE_BYTES - 1) & ~(size_t)(CACHE_LINE_BYTES - 1);
+    block->bytes = offset + (size_t)count * element_size;
+    return (block->base == NULL) ? NULL : block->base + offset;
   }
+  void *list = malloc(count * element_size);
+  assert(list != NULL);
+  return list;
+}
 
-  // Build session
-  UnikornSession *session = calloc(1, sizeof(UnikornSession));
-  assert(session != NULL);
-  session->magic_value1 = MAGIC_VALUE1;
-  session->magic_value2 = MAGIC_VALUE2;
-  session->clockNanoseconds = clockNanoseconds;
-  session->flush_user_data = flush_user_data;
-  session->prepareFlush = prepareFlush;
-  session->flush = flush;
-  session->finishFlush = finishFlush;
-  session->max_event_count = attrs->max_event_count;
-  session->flush_when_full = attrs->flush_when_full;
-  session->is_multi_threaded = attrs->is_multi_threaded;
-  session->record_instance = attrs->record_instance;
-  session->record_value = attrs->record_value;
-  session->record_file_location = attrs->record_file_location;
-  session->folder_registration_count = (attrs->folder_registration_count == 0) ? 0 : attrs->folder_registration_count + 1; // Also need the close folder event
-  session->event_registration_count = attrs->event_registration_count;
-  session->first_event_id = first_event_id;
+static void allocEventLists(UnikornSession *session, EventBuffer *buffer, LockedBlock *block) {
+  buffer->chunk_list = allocList(true, buffer->chunk_count, sizeof(TimeChunk), block);
+  uint32_t slot_count = buffer->chunk_count * TIME_CHUNK_EVENT_COUNT;
+  buffer->time_delta_list = allocList(true, slot_count, sizeof(int32_t), block);
+  buffer->event_id_list = allocList(true, slot_count, sizeof(uint16_t), block);
+  buffer->instance_list = allocList(session->record_instance, slot_count, sizeof(uint64_t), block);
+  buffer->value_list = allocList(session->record_value, slot_count, sizeof(double), block);
+  buffer->thread_slot_list = allocList(session->is_multi_threaded, slot_count, sizeof(uint16_t), block);
+  buffer->cpu_list = allocList(session->record_cpu, slot_count, sizeof(uint16_t), block);
+  buffer->counter_values = allocList(session->counter_count > 0, slot_count, session->counter_count * sizeof(uint64_t), block);
+  buffer->file_name_list = allocList(session->record_file_location, slot_count, sizeof(char *), block);
+  buffer->function_name_list = allocList(session->record_file_location, slot_count, sizeof(char *), block);
+  buffer->line_number_list = allocList(session->record_file_location, slot_count, sizeof(uint16_t), block);
+  buffer->span_duration_list = allocList(session->record_spans, slot_count, sizeof(uint64_t), block);
+}
+
+static void initEventBuffer(UnikornSession *session, EventBuffer *buffer, uint32_t max_event_count) {
+  buffer->max_event_count = max_event_count;
+  initEventBufferAccounting(buffer);
+  // One more chunk than needed, so overwriting the oldest chunk still leaves at least max_event_count events (unless chunks ended early)
+  buffer->chunk_count = (max_event_count + TIME_CHUNK_EVENT_COUNT - 1) / TIME_CHUNK_EVENT_COUNT + 1;
+  buffer->locked_memory = NULL;
+  buffer->locked_bytes = 0;
+  if (session->real_time) {
+    // Measure the lists, then carve them out of one locked block
+    LockedBlock block = { NULL, 0 };
+    allocEventLists(session, buffer, &block);
+    buffer->locked_bytes = block.bytes;
+    buffer->locked_memory = allocLockedMemory(&buffer->locked_bytes);
+    block.base = buffer->locked_memory;
+    block.bytes = 0;
+    allocEventLists(session, buffer, &block);
+  } else {
+    allocEventLists(session, buffer, NULL);
+  }
 #ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
-  pthread_mutex_init(&session->mutex, NULL);
+  pthread_mutex_init(&buffer->mutex, NULL);
 #endif
-  session->thread_id_list_count = 0;
-  session->thread_id_list = NULL;
+}
 
-#ifdef PRINT_INIT_INFO
-  printf("%s():\n", __FUNCTION__);
-  printf("  max_event_count = %d\n", session->max_event_count);
-  printf("  flush_when_full = %s\n", session->flush_when_full ? "yes" : "no");
-  printf("  is_multi_threaded = %s\n", session->is_multi_threaded ? "yes" : "no");
-  printf("  record_instance = %s\n", session->record_instance ? "yes" : "no");
-  printf("  record_value = %s\n", session->record_value ? "yes" : "no");
-  printf("  record_file_location = %s\n", session->record_file_location ? "yes" : "no");
-  printf("  first_event_id = %d\n", session->first_event_id);
+static void freeEventBuffer(EventBuffer *buffer) {
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  pthread_mutex_destroy(&buffer->mutex);
 #endif
+  if (buffer->locked_memory != NULL) {
+    freeLockedMemory(buffer->locked_memory, buffer->locked_bytes);
+    return;
+  }
+  free(buffer->chunk_list);
+  free(buffer->time_delta_list);
+  free(buffer->event_id_list);
+  free(buffer->instance_list);
+  free(buffer->value_list);
+  free(buffer->thread_slot_list);
+  free(buffer->cpu_list);
+  free(buffer->counter_values);
+  free(buffer->file_name_list);
+  free(buffer->function_name_list);
+  free(buffer->line_number_list);
+  free(buffer->span_duration_list);
+}
 
-  // Named Folders
-#ifdef PRINT_INIT_INFO
-  printf("  folder_registration_count = %d\n", session->folder_registration_count);
-#endif
-  if (session->folder_registration_count > 0) {
-    session->folder_registration_list = calloc(session->folder_registration_count, sizeof(PrivateFolderInfo));
-    assert(session->folder_registration_list != NULL);
-    // Register the CLOSE_FOLDER_ID event
-    session->folder_registration_list[0].id = CLOSE_FOLDER_ID;
-    session->folder_registration_list[0].name = strdup("Close Folder");
-#ifdef PRINT_INIT_INFO
-    printf("    ID=%d, name='%s'\n", session->folder_registration_list[0].id, session->folder_registration_list[0].name);
-#endif
-    assert(session->folder_registration_list[0].name != NULL);
-    // Register custom folders
-    for (uint16_t i=1; i<session->folder_registration_count; i++) {
-      session->folder_registration_list[i].id = attrs->folder_registration_list[i-1].id;
-      session->folder_registration_list[i].name = strdup(attrs->folder_registration_list[i-1].name);
-#ifdef PRINT_INIT_INFO
-      printf("    ID=%d, name='%s'\n", session->folder_registration_list[i].id, session->folder_registration_list[i].name);
-#endif
-      assert(session->folder_registration_list[i].name != NULL);
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+static void initSpillBuffers(UnikornSession *session, SpillBuffers *spill) {
+  // Same sizes as the session's buffers, so a spill is a swap
+  initEventBuffer(session, &spill->main_buffer, session->main_buffer.max_event_count);
+  spill->cpu_buffer_list = NULL;
+  if (session->cpu_buffer_count > 0) {
+    spill->cpu_buffer_list = calloc(session->cpu_buffer_count, sizeof(EventBuffer));
+    assert(spill->cpu_buffer_list != NULL);
+    for (uint16_t i=0; i<session->cpu_buffer_count; i++) {
+      initEventBuffer(session, &spill->cpu_buffer_list[i], session->cpu_buffer_list[i].max_event_count);
     }
-    // Create the stacks to track what folders are open
-    uint16_t max_folder_stack_count = session->folder_registration_count - 1; // -1 due to the close folder event
-    session->curr_folder_stack_count = 0;
-    session->curr_folder_stack = calloc(max_folder_stack_count, sizeof(uint16_t));
-    session->starting_folder_stack_count = 0;
-    session->starting_folder_stack = calloc(max_folder_stack_count, sizeof(uint16_t));
   }
+  spill->ring_list = calloc(session->event_registration_count, sizeof(EventBuffer *));
+  assert(spill->ring_list != NULL);
+  spill->starting_folder_stack_count = 0;
+  spill->starting_folder_stack = NULL;
+  if (session->folder_registration_count > 0) {
+    spill->starting_folder_stack = calloc(session->folder_registration_count - 1, sizeof(uint16_t)); // -1 due to the close folder event
+    assert(spill->starting_folder_stack != NULL);
+  }
+  spill->is_busy = false;
+  spill->has_events = false;
+  spill->oldest_time = 0;
+}
 
-  // Named events
-#ifdef PRINT_INIT_INFO
-  printf("  event_registration_count = %d\n", session->event_registration_count);
-#endif
-  session->event_registration_list = calloc(session->event_registration_count, sizeof(PrivateEventInfo));
-  assert(session->event_registration_list != NULL);
-  // Register custom events
+static void freeSpillBuffers(UnikornSession *session, SpillBuffers *spill) {
+  freeEventBuffer(&spill->main_buffer);
+  for (uint16_t i=0; i<session->cpu_buffer_count; i++) {
+    freeEventBuffer(&spill->cpu_buffer_list[i]);
+  }
+  free(spill->cpu_buffer_list);
   for (uint16_t i=0; i<session->event_registration_count; i++) {
-    session->event_registration_list[i].start_id = attrs->event_registration_list[i].start_id;
-    session->event_registration_list[i].end_id = attrs->event_registration_list[i].end_id;
-    session->event_registration_list[i].rgb = attrs->event_registration_list[i].rgb;
-    session->event_registration_list[i].name = strdup(attrs->event_registration_list[i].name);
-    assert(session->event_registration_list[i].name != NULL);
-    session->event_registration_list[i].start_value_name = strdup(attrs->event_registration_list[i].start_value_name);
-    assert(session->event_registration_list[i].start_value_name != NULL);
-    session->event_registration_list[i].end_value_name = strdup(attrs->event_registration_list[i].end_value_name);
-    assert(session->event_registration_list[i].end_value_name != NULL);
-#ifdef PRINT_INIT_INFO
-    printf("    startID=%d, endID=%d, RGB=0x%04x, name='%s', start_value_name='%s', end_value_name='%s'\n", session->event_registration_list[i].start_id, session->event_registration_list[i].end_id, session->event_registration_list[i].rgb,
-           session->event_registration_list[i].name, session->event_registration_list[i].start_value_name, session->event_registration_list[i].end_value_name);
+    if (spill->ring_list[i] != NULL) {
+      freeEventBuffer(spill->ring_list[i]);
+      free(spill->ring_list[i]);
+    }
+  }
+  free(spill->ring_list);
+  free(spill->starting_folder_stack);
+}
 #endif
-    session->event_registration_list[i].start_instance = 1;
-    session->event_registration_list[i].end_instance = 1;
+
+static void allocFlushLists(UnikornSession *session, LockedBlock *block) {
+  session->flush_event_list = allocList(true, session->flush_capacity, sizeof(Event), block);
+  session->flush_pointer_list = allocList(true, session->flush_capacity, sizeof(Event *), block);
+  session->flush_scratch_list = allocList(true, session->flush_capacity, sizeof(Event *), block);
+  session->flush_file_name_list = allocList(session->record_file_location, session->max_flush_name_count, sizeof(char *), block);
+  session->flush_function_name_list = allocList(session->record_file_location, session->max_flush_name_count, sizeof(char *), block);
+  session->flush_bucket_index_list = allocList(session->aggregate_only, HISTOGRAM_BUCKET_COUNT, sizeof(uint16_t), block);
+  session->flush_bucket_count_list = allocList(session->aggregate_only, HISTOGRAM_BUCKET_COUNT, sizeof(uint64_t), block);
+}
+
+static void prepareRealTimeFlush(UnikornSession *session) {
+  // Real time mode: allocate everything saveEvents() needs, with room for every buffered event. Called again if a buffer is added.
+  if (session->flush_memory != NULL) freeLockedMemory(session->flush_memory, session->flush_memory_bytes);
+  uint32_t capacity = session->main_buffer.max_event_count;
+  for (uint16_t i=0; i<session->cpu_buffer_count; i++) {
+    capacity += session->cpu_buffer_list[i].max_event_count;
   }
+  for (uint16_t i=0; session->event_ring_count>0 && i<session->event_registration_count; i++) {
+    EventBuffer *ring = session->event_registration_list[i].ring;
+    if (ring != NULL) capacity += ring->max_event_count;
+  }
+  session->flush_capacity = capacity;
+  session->max_flush_name_count = (capacity < USHRT_MAX) ? (uint16_t)capacity : USHRT_MAX;
+  // Measure the lists, then carve them out of one locked block
+  LockedBlock block = { NULL, 0 };
+  allocFlushLists(session, &block);
+  session->flush_memory_bytes = block.bytes;
+  session->flush_memory = allocLockedMemory(&session->flush_memory_bytes);
+  block.base = session->flush_memory;
+  block.bytes = 0;
+  allocFlushLists(session, &block);
+}
 
-  // Prepare the storage buffer
-  session->num_stored_events = 0;
-  session->curr_event_index = 0;
-  session->first_unsaved_event_index = 0;
-  session->events_buffer = malloc(session->max_event_count * sizeof(Event));
-  assert(session->events_buffer != NULL);
+static uint64_t eventTime(EventBuffer *buffer, uint32_t slot) {
+  return buffer->chunk_list[slot / TIME_CHUNK_EVENT_COUNT].base_time + (int64_t)buffer->time_delta_list[slot];
+}
 
-  return session;
+static uint32_t firstEventSlot(EventBuffer *buffer) {
+  return buffer->first_chunk * TIME_CHUNK_EVENT_COUNT + buffer->chunk_list[buffer->first_chunk].first_event_index;
 }
 
-static void flushEvents(UnikornSession *session) {
-  if (session->num_stored_events == 0) return; // Nothing to flush
+static uint32_t lastEventSlot(EventBuffer *buffer) {
+  return buffer->curr_chunk * TIME_CHUNK_EVENT_COUNT + buffer->chunk_list[buffer->curr_chunk].event_count - 1;
+}
 
-  // Make sure the application defined file, socket, etc. is ready for the data
-  bool ok = session->prepareFlush(session->flush_user_data);
-  assert(ok);
+static bool isEventBufferFull(EventBuffer *buffer) {
+  // Once the last free chunk is started, the buffer is treated as full, so a chunk that ends early never forces an overwrite when flush_when_full==true
+  return buffer->num_stored_events >= buffer->max_event_count || buffer->used_chunk_count == buffer->chunk_count;
+}
 
-  // Endian
-  bool is_big_endian = isBigEndian();
-#ifdef PRINT_FLUSH_INFO
-  printf("%s():\n", __FUNCTION__);
-  printf("  is_big_endian = %s\n", is_big_endian ? "yes" : "no");
+static void closeInlineRange(UnikornSession *session) {
+  // Account for the events recorded by ukRecordEventInline(), and take back the rest of the range. Must be called before the main buffer is used by the library.
+  if (!session->is_inline_range_open) return;
+  UkInlineState *state = &session->inline_state;
+  EventBuffer *buffer = &session->main_buffer;
+  uint32_t inline_event_count = state->next_slot - session->inline_range_start;
+  buffer->chunk_list[buffer->curr_chunk].event_count += inline_event_count;
+  buffer->num_stored_events += inline_event_count;
+  state->next_slot = 0;
+  state->end_slot = 0;
+  session->is_inline_range_open = false;
+}
+
+
+static int myCpu() {
+  // Returns -1 if the CPU core can't be determined
+#ifdef _WIN32
+  return (int)GetCurrentProcessorNumber();
+#elif __linux__
+  return sched_getcpu(); // Uses the vDSO (rdtscp or rdpid on x86), so no system call
+#else
+  return -1;
 #endif
-  assert(session->flush(session->flush_user_data, &is_big_endian, sizeof(is_big_endian)));
+}
 
-  // Version
-  uint16_t major = UK_API_VERSION_MAJOR;
-  uint16_t minor = UK_API_VERSION_MINOR;
-#ifdef PRINT_FLUSH_INFO
-  printf("  version: %d.%d\n", major, minor);
+#ifdef __linux__
+static int openPerfCounter(const CounterDefinition *counter, int group_fd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = counter->perf_type;
+  attr.config = counter->perf_config;
+  attr.read_format = PERF_FORMAT_GROUP;
+  attr.exclude_hv = 1;
+  // Only count the calling thread, on any CPU core
+  int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+  if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+    // Not allowed to count kernel activity (see /proc/sys/kernel/perf_event_paranoid), so only count the user space activity
+    attr.exclude_kernel = 1;
+    fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+  }
+  return fd;
+}
 #endif
-  assert(session->flush(session->flush_user_data, &major, sizeof(major)));
-  assert(session->flush(session->flush_user_data, &minor, sizeof(minor)));
 
-  // Miscellanyous info
-#ifdef PRINT_FLUSH_INFO
-  printf("  is_multi_threaded = %s\n", session->is_multi_threaded ? "yes" : "no");
-  printf("  record_instance = %s\n", session->record_instance ? "yes" : "no");
-  printf("  record_value = %s\n", session->record_value ? "yes" : "no");
-  printf("  record_file_location = %s\n", session->record_file_location ? "yes" : "no");
+#ifdef __linux__
+static uint64_t rusageValue(const struct rusage *usage, RusageField field) {
+  switch (field) {
+  case RUSAGE_FIELD_MINOR_FAULTS:         return (uint64_t)usage->ru_minflt;
+  case RUSAGE_FIELD_MAJOR_FAULTS:         return (uint64_t)usage->ru_majflt;
+  case RUSAGE_FIELD_VOLUNTARY_SWITCHES:   return (uint64_t)usage->ru_nvcsw;
+  case RUSAGE_FIELD_INVOLUNTARY_SWITCHES: return (uint64_t)usage->ru_nivcsw;
+  case RUSAGE_FIELD_USER_TIME:            return (uint64_t)usage->ru_utime.tv_sec*1000000 + (uint64_t)usage->ru_utime.tv_usec;
+  case RUSAGE_FIELD_SYSTEM_TIME:          return (uint64_t)usage->ru_stime.tv_sec*1000000 + (uint64_t)usage->ru_stime.tv_usec;
+  }
+  return 0;
+}
 #endif
-  assert(session->flush(session->flush_user_data, &session->is_multi_threaded, sizeof(session->is_multi_threaded)));
-  assert(session->flush(session->flush_user_data, &session->record_instance, sizeof(session->record_instance)));
-  assert(session->flush(session->flush_user_data, &session->record_value, sizeof(session->record_value)));
-  assert(session->flush(session->flush_user_data, &session->record_file_location, sizeof(session->record_file_location)));
 
-  // Folder info
-#ifdef PRINT_FLUSH_INFO
+static bool counterIsAvailable(const CounterDefinition *counter) {
+#ifdef __linux__
+  if (counter->source == COUNTER_SOURCE_RUSAGE) {
+    struct rusage usage;
+    return getrusage(RUSAGE_THREAD, &usage) == 0;
+  }
+  int fd = openPerfCounter(counter, -1);
+  if (fd < 0) return false;
+  close(fd);
+  return true;
+#else
+  (void)counter;
+  return false;
+#endif
+}
+
+static void closeCounters(CounterReader *reader) {
+  if (!reader->is_opened) return;
+#ifdef __linux__
+  for (uint16_t i=0; i<reader->fd_count; i++) {
+    close(reader->fd_list[i]);
+  }
+#endif
+  reader->fd_count = 0;
+  reader->group_fd = -1;
+}
+
+static void openCounters(UnikornSession *session, CounterReader *reader) {
+  // NOTE: The counters only count the activity of the calling thread
+  reader->is_opened = true;
+  reader->group_fd = -1;
+  reader->fd_count = 0;
+#ifdef __linux__
+  for (uint16_t i=0; i<session->perf_counter_count; i++) {
+    int fd = openPerfCounter(session->counter_list[i], reader->group_fd);
+    if (fd < 0) {
+      // The values will be recorded as zero for this thread
+      closeCounters(reader);
+      return;
+    }
+    if (i == 0) reader->group_fd = fd;
+    reader->fd_list[reader->fd_count] = fd;
+    reader->fd_count++;
+  }
+#else
+  (void)session;
+#endif
+}
+
+static void readCounters(UnikornSession *session, CounterReader *reader, uint64_t *values) {
+  if (!reader->is_opened) openCounters(session, reader);
+  // Perf counters
+  uint16_t perf_count = session->perf_counter_count;
+  bool ok = false;
+#ifdef __linux__
+  if (reader->group_fd >= 0) {
+    // All the counters are in one group, so a single read() gets all the values: the number of counters followed by the values
+    uint64_t group_values[1+MAX_COUNTERS];
+    size_t bytes = (1+perf_count)*sizeof(uint64_t);
+    ok = (read(reader->group_fd, group_values, bytes) == (ssize_t)bytes && group_values[0] == perf_count);
+    if (ok) memcpy(values, &group_values[1], perf_count*sizeof(uint64_t));
+  }
+#endif
+  if (!ok) memset(values, 0, perf_count*sizeof(uint64_t));
+
+  // getrusage() counters: one system call gets all of them
+  uint16_t rusage_count = session->counter_count - perf_count;
+  if (rusage_count == 0) return;
+  ok = false;
+#ifdef __linux__
+  struct rusage usage;
+  if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+    for (uint16_t i=perf_count; i<session->counter_count; i++) {
+      values[i] = rusageValue(&usage, session->counter_list[i]->rusage_field);
+    }
+    ok = true;
+  }
+#endif
+  if (!ok) memset(&values[perf_count], 0, rusage_count*sizeof(uint64_t));
+}
+
+static void atomicAdd(uint64_t *value, uint64_t amount) {
+#ifdef _WIN32
+  InterlockedExchangeAdd64((volatile LONG64 *)value, (LONG64)amount);
+#else
+  __atomic_fetch_add(value, amount, __ATOMIC_RELAXED);
+#endif
+}
+
+static uint64_t atomicExchange(uint64_t *value, uint64_t new_value) {
+#ifdef _WIN32
+  return (uint64_t)InterlockedExchange64((volatile LONG64 *)value, (LONG64)new_value);
+#else
+  return __atomic_exchange_n(value, new_value, __ATOMIC_RELAXED);
+#endif
+}
+
+static uint64_t atomicLoad(uint64_t *value) {
+#ifdef _WIN32
+  return (uint64_t)InterlockedOr64((volatile LONG64 *)value, 0);
+#else
+  return __atomic_load_n(value, __ATOMIC_RELAXED);
+#endif
+}
+
+static void atomicMin(uint64_t *value, uint64_t candidate) {
+  uint64_t curr = *(volatile uint64_t *)value;
+  while (candidate < curr) {
+#ifdef _WIN32
+    uint64_t prev = (uint64_t)InterlockedCompareExchange64((volatile LONG64 *)value, (LONG64)candidate, (LONG64)curr);
+    if (prev == curr) return;
+    curr = prev;
+#else
+    if (__atomic_compare_exchange_n(value, &curr, candidate, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) return;
+#endif
+  }
+}
+
+static void atomicMax(uint64_t *value, uint64_t candidate) {
+  uint64_t curr = *(volatile uint64_t *)value;
+  while (candidate > curr) {
+#ifdef _WIN32
+    uint64_t prev = (uint64_t)InterlockedCompareExchange64((volatile LONG64 *)value, (LONG64)candidate, (LONG64)curr);
+    if (prev == curr) return;
+    curr = prev;
+#else
+    if (__atomic_compare_exchange_n(value, &curr, candidate, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) return;
+#endif
+  }
+}
+
+static uint16_t histogramBucketIndex(uint64_t duration) {
+  // Durations less than the sub bucket count have their own bucket. Beyond that, each power of 2 is split into the same number of sub buckets.
+  uint64_t sub_bucket_count = 1 << HISTOGRAM_SUB_BUCKET_BITS;
+  if (duration < sub_bucket_count) return (uint16_t)duration;
+#ifdef _WIN32
+  unsigned long exponent;
+  _BitScanReverse64(&exponent, duration);
+#else
+  uint16_t exponent = 63 - (uint16_t)__builtin_clzll(duration);
+#endif
+  uint64_t sub_bucket = (duration >> (exponent - HISTOGRAM_SUB_BUCKET_BITS)) & (sub_bucket_count - 1);
+  return (uint16_t)((exponent - HISTOGRAM_SUB_BUCKET_BITS + 1) * sub_bucket_count + sub_bucket);
+}
+
+static void initHistogram(Histogram *histogram) {
+  memset(histogram, 0, sizeof(Histogram));
+  histogram->min_duration = UINT64_MAX;
+}
+
+static void initAggregateStarts(UnikornSession *session, AggregateStarts *starts) {
+  starts->depth_list = NULL;
+  starts->start_time_list = NULL;
+  if (!session->aggregate_only) return;
+  starts->depth_list = calloc(session->event_registration_count, sizeof(uint16_t));
+  assert(starts->depth_list != NULL);
+  starts->start_time_list = malloc(session->event_registration_count * MAX_AGGREGATE_NESTING * sizeof(uint64_t));
+  assert(starts->start_time_list != NULL);
+}
+
+static void freeAggregateStarts(AggregateStarts *starts) {
+  free(starts->depth_list);
+  free(starts->start_time_list);
+}
+
+static void initStagedEvents(StagedEvents *staged) {
+  staged->events.chunk_list = NULL;
+  staged->depth = 0;
+}
+
+static void freeStagedEvents(StagedEvents *staged) {
+  if (staged->events.chunk_list != NULL) freeEventBuffer(&staged->events);
+}
+
+static void preallocThreadState(UnikornSession *session, StagedEvents *staged, SampleState **sample_states_ref) {
+  // Real time mode: allocate the thread's state that would otherwise be allocated by the first event that needs it
+  if (!session->real_time) return;
+  if (session->has_thresholds && staged->events.chunk_list == NULL) initEventBuffer(session, &staged->events, MAX_STAGED_EVENT_COUNT);
+  if (*sample_states_ref == NULL) {
+    *sample_states_ref = calloc(session->event_registration_count, sizeof(SampleState));
+    assert(*sample_states_ref != NULL);
+  }
+}
+
+static bool isSampled(UnikornSession *session, SampleState **sample_states_ref, uint16_t event_registration_index, bool is_start) {
+  // Returns true if the event should be recorded. An end is only recorded if its start was recorded.
+  // NOTE: The sample states are only accessed by the calling thread, so no locking is needed
+  if (*sample_states_ref == NULL) {
+    *sample_states_ref = calloc(session->event_registration_count, sizeof(SampleState));
+    assert(*sample_states_ref != NULL);
+  }
+  SampleState *state = &(*sample_states_ref)[event_registration_index];
+  if (is_start) {
+    // Starts nested too deep to remember are not kept
+    bool is_kept = state->depth < 64 && (state->start_count % session->event_registration_list[event_registration_index].sample_ratio) == 0;
+    state->start_count++;
+    if (is_kept) {
+      state->kept_mask |= (1ULL << state->depth);
+    } else if (state->depth < 64) {
+      state->kept_mask &= ~(1ULL << state->depth);
+    }
+    state->depth++;
+    return is_kept;
+  }
+  if (state->depth == 0) return true; // No start to pair with
+  state->depth--;
+  return state->depth < 64 && (state->kept_mask & (1ULL << state->depth)) != 0;
+}
+
+static void addHistogramDuration(Histogram *histogram, uint64_t duration) {
+  atomicAdd(&histogram->bucket_counts[histogramBucketIndex(duration)], 1);
+  atomicAdd(&histogram->count, 1);
+  atomicAdd(&histogram->total_duration, duration);
+  atomicMin(&histogram->min_duration, duration);
+  atomicMax(&histogram->max_duration, duration);
+}
+
+static void aggregateEvent(UnikornSession *session, AggregateStarts *starts, uint16_t event_registration_index, bool is_start) {
+  // NOTE: The starts are only accessed by the calling thread, and the histograms are updated atomically, so no locking is needed
+  uint64_t time = session->clockNanoseconds();
+  uint16_t *depth = &starts->depth_list[event_registration_index];
+  uint64_t *start_times = &starts->start_time_list[event_registration_index * MAX_AGGREGATE_NESTING];
+  Histogram *histogram = &session->histogram_list[event_registration_index];
+  if (is_start) {
+    // Remember the start until its end is recorded
+    if (*depth < MAX_AGGREGATE_NESTING) start_times[*depth] = time;
+    if (*depth < USHRT_MAX) (*depth)++;
+    return;
+  }
+  if (*depth == 0) {
+    atomicAdd(&histogram->unmatched_count, 1);
+    return;
+  }
+  (*depth)--;
+  if (*depth >= MAX_AGGREGATE_NESTING) {
+    // Nested too deep, so the start time was not kept
+    atomicAdd(&histogram->unmatched_count, 1);
+    return;
+  }
+  addHistogramDuration(histogram, time - start_times[*depth]);
+}
+
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+static uint16_t numCpus() {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  long num_cpus = (long)info.dwNumberOfProcessors;
+#else
+  // Only the cores that are online: configured but offline cores (e.g. disabled SMT siblings) would only waste their share of max_event_count.
+  // Cores brought online later share buffers with the others (see myCpuBuffer()).
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if (num_cpus < 1) num_cpus = 1;
+  if (num_cpus > USHRT_MAX) num_cpus = USHRT_MAX;
+  return (uint16_t)num_cpus;
+}
+
+static EventBuffer *myCpuBuffer(UnikornSession *session, uint64_t thread_id) {
+  // NOTE: The thread may migrate to a different core right after this, but that only costs some cache locality since each buffer has its own mutex
+  int cpu = myCpu();
+  // If no fast way to get the current core, at least keep each thread on a consistent buffer
+  uint64_t index = (cpu < 0) ? thread_id : (uint64_t)cpu;
+  return &session->cpu_buffer_list[index % session->cpu_buffer_count];
+}
+#endif
+
+static void lockCpuBuffers(UnikornSession *session) {
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  for (uint16_t i=0; i<session->cpu_buffer_count; i++) {
+    pthread_mutex_lock(&session->cpu_buffer_list[i].mutex);
+  }
+#else
+  (void)session;
+#endif
+}
+
+static void unlockCpuBuffers(UnikornSession *session) {
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  for (uint16_t i=0; i<session->cpu_buffer_count; i++) {
+    pthread_mutex_unlock(&session->cpu_buffer_list[i].mutex);
+  }
+#else
+  (void)session;
+#endif
+}
+
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+static bool getOldestBufferedTime(EventBuffer *buffer, bool has_time, uint64_t *oldest_time) {
+  if (buffer->num_stored_events > 0) {
+    uint64_t time = eventTime(buffer, firstEventSlot(buffer));
+    if (!has_time || time < *oldest_time) *oldest_time = time;
+    has_time = true;
+  }
+  return has_time;
+}
+
+static uint16_t acquireThreadSlot(UnikornSession *session, ThreadInfo *thread_info) {
+  // NOTE: The session mutex is already locked
+  // Find the oldest event still in the buffers, since any thread that exited before it was recorded has no more events to save
+  lockCpuBuffers(session);
+  uint64_t oldest_time = 0;
+  bool has_events = getOldestBufferedTime(&session->main_buffer, false, &oldest_time);
+  for (uint16_t i=0; i<session->cpu_buffer_count; i++) {
+    has_events = getOldestBufferedTime(&session->cpu_buffer_list[i], has_events, &oldest_time);
+  }
+  for (uint16_t i=0; session->event_ring_count>0 && i<session->event_registration_count; i++) {
+    EventBuffer *ring = session->event_registration_list[i].ring;
+    if (ring != NULL) has_events = getOldestBufferedTime(ring, has_events, &oldest_time);
+  }
+  unlockCpuBuffers(session);
+  for (uint16_t i=0; i<session->spill_buffer_count; i++) {
+    // Spilled events are still buffered until the spill thread writes them
+    SpillBuffers *spill = &session->spill_buffer_list[i];
+    if (spill->is_busy && spill->has_events && (!has_events || spill->oldest_time < oldest_time)) {
+      oldest_time = spill->oldest_time;
+      has_events = true;
+    }
+  }
+
+  // Recycle the slot of an exited thread if possible
+  for (uint16_t i=0; i<session->thread_slot_count; i++) {
+    ThreadSlot *slot = &session->thread_slot_list[i];
+    if (slot->is_retired && (!has_events || slot->retire_time < oldest_time)) {
+      slot->thread_id = thread_info->thread_id;
+      slot->generation++;
+      slot->is_task = thread_info->is_task;
+      slot->is_retired = false;
+      slot->thread_info = thread_info;
+      return i;
+    }
+  }
+
+  // Add a new slot
+  if (session->thread_slot_count == USHRT_MAX) {
+    printf("Unikorn is only defined to handle up to %d threads with recorded events at the same time.\n", USHRT_MAX);
+    assert(0);
+  }
+  session->thread_slot_count++;
+  session->thread_slot_list = realloc(session->thread_slot_list, session->thread_slot_count*sizeof(ThreadSlot));
+  assert(session->thread_slot_list);
+  ThreadSlot *slot = &session->thread_slot_list[session->thread_slot_count-1];
+  slot->thread_id = thread_info->thread_id;
+  slot->generation = 0;
+  slot->is_task = thread_info->is_task;
+  slot->is_retired = false;
+  slot->retire_time = 0;
+  slot->thread_info = thread_info;
+  return session->thread_slot_count-1;
+}
+
+static void retireThreadSlot(UnikornSession *session, ThreadInfo *thread_info) {
+  // NOTE: The session mutex is already locked
+  // The thread's events may still be in the buffers, so can't recycle the slot yet
+  ThreadSlot *slot = &session->thread_slot_list[thread_info->thread_slot];
+  slot->is_retired = true;
+  slot->retire_time = session->clockNanoseconds();
+  slot->thread_info = NULL;
+}
+#endif
+
+static void clearThreadInfo(ThreadInfo *thread_info) {
+  // Frees what the info refers to, but not the info
+  closeCounters(&thread_info->counter_reader);
+  freeAggregateStarts(&thread_info->aggregate_starts);
+  freeStagedEvents(&thread_info->staged_events);
+  free(thread_info->sample_states);
+}
+
+static void freeThreadInfo(ThreadInfo *thread_info) {
+  clearThreadInfo(thread_info);
+  free(thread_info);
+}
+
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+static void drainStagedEvents(UnikornSession *session, StagedEvents *staged, uint64_t thread_id); // With the other staging functions below
+
+static void threadExited(void *value) {
+  // Called by pthreads when a thread, that recorded an event, exits
+  ThreadInfo *thread_info = (ThreadInfo *)value;
+  UnikornSession *session = (UnikornSession *)thread_info->session;
+  drainStagedEvents(session, &thread_info->staged_events, thread_info->thread_id);
+  pthread_mutex_lock(&session->mutex);
+  retireThreadSlot(session, thread_info);
+  pthread_mutex_unlock(&session->mutex);
+  freeThreadInfo(thread_info);
+}
+
+static ThreadInfo *newThreadInfo(UnikornSession *session, uint64_t thread_id, bool is_task) {
+  // NOTE: The session mutex is already locked
+  ThreadInfo *thread_info = NULL;
+  if (is_task && session->ended_task_list != NULL) {
+    // Reuse the info of an ended task (see ukEndTask())
+    thread_info = session->ended_task_list;
+    session->ended_task_list = thread_info->next_ended_task;
+  } else {
+    thread_info = malloc(sizeof(ThreadInfo));
+    assert(thread_info != NULL);
+  }
+  thread_info->session = session;
+  atomicExchange(&thread_info->thread_id, thread_id);
+  thread_info->is_task = is_task;
+  thread_info->curr_task_info = NULL;
+  thread_info->curr_task_id = 0;
+  thread_info->next_ended_task = NULL;
+  thread_info->counter_reader.is_opened = false;
+  initAggregateStarts(session, &thread_info->aggregate_starts);
+  initStagedEvents(&thread_info->staged_events);
+  thread_info->sample_states = NULL;
+  preallocThreadState(session, &thread_info->staged_events, &thread_info->sample_states);
+  thread_info->thread_slot = acquireThreadSlot(session, thread_info);
+  return thread_info;
+}
+
+static ThreadInfo *myThreadInfo(UnikornSession *session) {
+  ThreadInfo *thread_info = (ThreadInfo *)pthread_getspecific(session->thread_key);
+  if (thread_info == NULL) {
+    // First time this thread is recording to the session
+    uint64_t thread_id = myThreadId();
+    pthread_mutex_lock(&session->mutex);
+    thread_info = newThreadInfo(session, thread_id, false);
+    pthread_mutex_unlock(&session->mutex);
+    int rc = pthread_setspecific(session->thread_key, thread_info);
+    assert(rc == 0);
+  }
+  return thread_info;
+}
+
+static ThreadInfo *currTaskInfo(ThreadInfo *thread_info) {
+  // The info of the task the thread is running (see ukSetTaskId()), or NULL
+  // NOTE: Another thread may have ended the task. The info is not freed (see ukEndTask()), so its task ID can still be checked.
+  ThreadInfo *task_info = thread_info->curr_task_info;
+  if (task_info != NULL && atomicLoad(&task_info->thread_id) != thread_info->curr_task_id) {
+    task_info = NULL;
+    thread_info->curr_task_info = NULL;
+  }
+  return task_info;
+}
+
+static ThreadInfo *myTaskInfo(UnikornSession *session) {
+  // The info of the task the thread is running (see ukSetTaskId()), or else the thread's info
+  ThreadInfo *thread_info = myThreadInfo(session);
+  ThreadInfo *task_info = currTaskInfo(thread_info);
+  return (task_info != NULL) ? task_info : thread_info;
+}
+
+static uint32_t taskHomeIndex(uint64_t task_id, uint32_t mask) {
+  // Fibonacci hashing, since task IDs are often sequential or aligned pointers
+  return (uint32_t)((task_id * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+static uint32_t taskTableIndex(UnikornSession *session, uint64_t task_id) {
+  // NOTE: The session mutex is already locked
+  // Returns the entry with the task ID, or the empty entry where it would be added
+  uint32_t mask = session->task_table_size - 1;
+  uint32_t index = taskHomeIndex(task_id, mask);
+  while (session->task_table[index].task_id != 0 && session->task_table[index].task_id != task_id) {
+    index = (index + 1) & mask;
+  }
+  return index;
+}
+
+static void growTaskTable(UnikornSession *session) {
+  // NOTE: The session mutex is already locked
+  uint32_t prev_size = session->task_table_size;
+  TaskEntry *prev_table = session->task_table;
+  session->task_table_size = (prev_size == 0) ? MIN_TASK_TABLE_SIZE : prev_size * 2;
+  session->task_table = calloc(session->task_table_size, sizeof(TaskEntry));
+  assert(session->task_table != NULL);
+  for (uint32_t i=0; i<prev_size; i++) {
+    if (prev_table[i].task_id == 0) continue;
+    session->task_table[taskTableIndex(session, prev_table[i].task_id)] = prev_table[i];
+  }
+  free(prev_table);
+}
+
+static void removeTaskEntry(UnikornSession *session, uint32_t index) {
+  // NOTE: The session mutex is already locked
+  // Move back any following entries that would no longer be found after the gap
+  uint32_t mask = session->task_table_size - 1;
+  uint32_t gap = index;
+  uint32_t next = index;
+  while (1) {
+    next = (next + 1) & mask;
+    if (session->task_table[next].task_id == 0) break;
+    uint32_t home = taskHomeIndex(session->task_table[next].task_id, mask);
+    bool home_is_after_gap = (gap <= next) ? (home > gap && home <= next) : (home > gap || home <= next);
+    if (home_is_after_gap) continue;
+    session->task_table[gap] = session->task_table[next];
+    gap = next;
+  }
+  session->task_table[gap].task_id = 0;
+  session->task_table[gap].task_info = NULL;
+  session->task_count--;
+}
+#endif
+
+static void unpackEvent(UnikornSession *session, EventBuffer *buffer, uint32_t slot, Event *event) {
+  event->time = eventTime(buffer, slot);
+  event->event_id = buffer->event_id_list[slot];
+  event->is_span = (event->event_id & SPAN_EVENT_FLAG) != 0;
+  event->span_duration = 0;
+  if (event->is_span) {
+    // Flushed as the start event, at the start time
+    event->event_id &= ~SPAN_EVENT_FLAG;
+    event->span_duration = buffer->span_duration_list[slot];
+    event->time -= event->span_duration;
+  }
+  event->instance = session->record_instance ? buffer->instance_list[slot] : 0;
+  event->value = session->record_value ? buffer->value_list[slot] : 0;
+  event->thread_slot = session->is_multi_threaded ? buffer->thread_slot_list[slot] : 0;
+  event->cpu = session->record_cpu ? buffer->cpu_list[slot] : UNKNOWN_CPU;
+  event->counter_values = (session->counter_count > 0) ? &buffer->counter_values[slot * session->counter_count] : NULL;
+  event->file_name = session->record_file_location ? buffer->file_name_list[slot] : NULL;
+  event->function_name = session->record_file_location ? buffer->function_name_list[slot] : NULL;
+  event->line_number = session->record_file_location ? buffer->line_number_list[slot] : 0;
+}
+
+static uint32_t appendBufferToFlushList(UnikornSession *session, EventBuffer *buffer, Event *event_list, Event **flush_list, uint32_t event_count) {
+  // Unpack the events, from oldest to newest, so they have their full time
+  for (uint32_t i=0; i<buffer->used_chunk_count; i++) {
+    uint32_t chunk_index = (buffer->first_chunk + i) % buffer->chunk_count;
+    for (uint32_t j=buffer->chunk_list[chunk_index].first_event_index; j<buffer->chunk_list[chunk_index].event_count; j++) {
+      unpackEvent(session, buffer, chunk_index * TIME_CHUNK_EVENT_COUNT + j, &event_list[event_count]);
+      flush_list[event_count] = &event_list[event_count];
+      event_count++;
+    }
+  }
+  return event_count;
+}
+
+static Event **sortFlushList(Event **list, Event **scratch, uint32_t count) {
+  // Natural merge sort: each buffer is already ordered by time, so only need to merge the ordered runs. A single ordered run is detected in one pass.
+  // NOTE: This is a stable sort so events with the same time keep their recorded order
+  while (true) {
+    uint32_t num_runs = 0;
+    uint32_t start = 0;
+    while (start < count) {
+      uint32_t mid = start + 1;
+      while (mid < count && list[mid-1]->time <= list[mid]->time) mid++;
+      if (start == 0 && mid == count) return list; // Already sorted
+      uint32_t end = mid;
+      if (end < count) {
+        end++;
+        while (end < count && list[end-1]->time <= list[end]->time) end++;
+      }
+      // Merge the two runs into the scratch list
+      uint32_t a = start;
+      uint32_t b = mid;
+      for (uint32_t i=start; i<end; i++) {
+        if (a < mid && (b == end || list[a]->time <= list[b]->time)) {
+          scratch[i] = list[a];
+          a++;
+        } else {
+          scratch[i] = list[b];
+          b++;
+        }
+      }
+      num_runs++;
+      start = end;
+    }
+    Event **temp = list;
+    list = scratch;
+    scratch = temp;
+    if (num_runs == 1) return list;
+  }
+}
+
+typedef void (*ApplyConfigSetting)(void *data, const char *name, const char *value);
+
+static char *loadConfig(char *separator_ret, bool report_errors) {
+  // Returns NULL if UNIKORN_CONFIG is not set. It either has the settings (separated by commas), or the name of a file with the settings (one per line).
+#ifdef _WIN32
+  char *config = NULL;
+  size_t config_length;
+  if (_dupenv_s(&config, &config_length, CONFIG_ENV_NAME) != 0 || config == NULL) return NULL;
+#else
+  const char *env_value = getenv(CONFIG_ENV_NAME);
+  if (env_value == NULL) return NULL;
+  char *config = strdup(env_value);
+  assert(config != NULL);
+#endif
+  if (strchr(config, '=') != NULL || config[0] == '\0') {
+    *separator_ret = ',';
+    return config;
+  }
+#ifdef _WIN32
+  FILE *file;
+  if (fopen_s(&file, config, "rb") != 0) file = NULL;
+#else
+  FILE *file = fopen(config, "rb");
+#endif
+  if (file == NULL) {
+    if (report_errors) printf("Unikorn: could not open the config file '%s' from %s, so it will be ignored\n", config, CONFIG_ENV_NAME);
+    free(config);
+    return NULL;
+  }
+  free(config);
+  fseek(file, 0, SEEK_END);
+  long bytes = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  assert(bytes >= 0);
+  char *text = malloc(bytes+1);
+  assert(text != NULL);
+  size_t bytes_read = fread(text, 1, bytes, file);
+  text[bytes_read] = '\0';
+  fclose(file);
+  *separator_ret = '\n';
+  return text;
+}
+
+static char *trimSpaces(char *text) {
+  while (*text == ' ' || *text == '\t') text++;
+  size_t length = strlen(text);
+  while (length > 0 && (text[length-1] == ' ' || text[length-1] == '\t' || text[length-1] == '\r')) length--;
+  text[length] = '\0';
+  return text;
+}
+
+static void forEachConfigSetting(ApplyConfigSetting applySetting, void *data, bool report_errors) {
+  // NOTE: The settings are read once per pass, so only one pass reports the problems that are not specific to the pass
+  char separator;
+  char *text = loadConfig(&separator, report_errors);
+  if (text == NULL) return;
+  char *setting = text;
+  while (setting != NULL) {
+    char *next_setting = strchr(setting, separator);
+    if (next_setting != NULL) {
+      *next_setting = '\0';
+      next_setting++;
+    }
+    char *comment = strchr(setting, '#');
+    if (comment != NULL) *comment = '\0';
+    char *equals = strchr(setting, '=');
+    if (equals != NULL) {
+      *equals = '\0';
+      applySetting(data, trimSpaces(setting), trimSpaces(equals+1));
+    } else if (report_errors) {
+      setting = trimSpaces(setting);
+      if (setting[0] != '\0') printf("Unikorn: the config setting '%s' has no value, so it will be ignored\n", setting);
+    }
+    setting = next_setting;
+  }
+  free(text);
+}
+
+static void applyConfigBool(const char *name, const char *value, bool *value_ret) {
+  if (strcmp(value, "true") == 0 || strcmp(value, "1") == 0) {
+    *value_ret = true;
+  } else if (strcmp(value, "false") == 0 || strcmp(value, "0") == 0) {
+    *value_ret = false;
+  } else {
+    printf("Unikorn: the config setting '%s=%s' is not true or false, so it will be ignored\n", name, value);
+  }
+}
+
+static void applyConfigAttr(void *data, const char *name, const char *value) {
+  UkAttrs *attrs = (UkAttrs *)data;
+  if (strcmp(name, "max_event_count") == 0) {
+    unsigned long max_event_count = strtoul(value, NULL, 0);
+    if (max_event_count < MIN_EVENT_COUNT || max_event_count > UINT32_MAX) {
+      printf("Unikorn: the config setting '%s=%s' is not in the range %d to %u, so it will be ignored\n", name, value, MIN_EVENT_COUNT, UINT32_MAX);
+    } else {
+      attrs->max_event_count = (uint32_t)max_event_count;
+    }
+  } else if (strcmp(name, "flush_when_full") == 0) {
+    applyConfigBool(name, value, &attrs->flush_when_full);
+  } else if (strcmp(name, "record_instance") == 0) {
+    applyConfigBool(name, value, &attrs->record_instance);
+  } else if (strcmp(name, "record_value") == 0) {
+    applyConfigBool(name, value, &attrs->record_value);
+  } else if (strcmp(name, "record_file_location") == 0) {
+    applyConfigBool(name, value, &attrs->record_file_location);
+  } else if (strcmp(name, "record_cpu") == 0) {
+    applyConfigBool(name, value, &attrs->record_cpu);
+  } else if (strcmp(name, "record_per_cpu") == 0) {
+    bool record_per_cpu = attrs->record_per_cpu;
+    applyConfigBool(name, value, &record_per_cpu);
+    if (record_per_cpu && !attrs->is_multi_threaded) {
+      printf("Unikorn: the config setting '%s=%s' requires threading, so it will be ignored\n", name, value);
+    } else {
+      attrs->record_per_cpu = record_per_cpu;
+    }
+  } else if (strcmp(name, "counter_mask") == 0) {
+    attrs->counter_mask = (uint32_t)strtoul(value, NULL, 0);
+  } else if (strcmp(name, "aggregate_only") == 0) {
+    applyConfigBool(name, value, &attrs->aggregate_only);
+  } else if (strcmp(name, "real_time") == 0) {
+    applyConfigBool(name, value, &attrs->real_time);
+  } else if (strcmp(name, "spill_when_full") == 0) {
+    bool spill_when_full = attrs->spill_when_full;
+    applyConfigBool(name, value, &spill_when_full);
+    if (spill_when_full && !attrs->is_multi_threaded) {
+      printf("Unikorn: the config setting '%s=%s' requires threading, so it will be ignored\n", name, value);
+    } else {
+      attrs->spill_when_full = spill_when_full;
+    }
+  } else if (strcmp(name, "spill_buffer_count") == 0) {
+    unsigned long spill_buffer_count = strtoul(value, NULL, 0);
+    if (spill_buffer_count < 1 || spill_buffer_count > USHRT_MAX) {
+      printf("Unikorn: the config setting '%s=%s' is not in the range 1 to %d, so it will be ignored\n", name, value, USHRT_MAX);
+    } else {
+      attrs->spill_buffer_count = (uint16_t)spill_buffer_count;
+    }
+  } else if (strcmp(name, "spill_policy") == 0) {
+    if (strcmp(value, "block") == 0) attrs->spill_policy = UK_SPILL_BLOCK;
+    else if (strcmp(value, "drop_newest") == 0) attrs->spill_policy = UK_SPILL_DROP_NEWEST;
+    else if (strcmp(value, "drop_oldest") == 0) attrs->spill_policy = UK_SPILL_DROP_OLDEST;
+    else printf("Unikorn: the config setting '%s=%s' is not block, drop_newest or drop_oldest, so it will be ignored\n", name, value);
+  } else if (strcmp(name, "enable") != 0 && strcmp(name, "disable") != 0 && strcmp(name, "sample") != 0 && strcmp(name, "file") != 0) {
+    printf("Unikorn: the config setting '%s' is not known, so it will be ignored\n", name);
+  }
+}
+
+typedef struct {
+  UnikornSession *session;
+  bool *is_folder_enabled;    // Only used if has_enabled_folders==true
+  bool *is_event_enabled;     // Only used if has_enabled_events==true
+  bool has_enabled_folders;
+  bool has_enabled_events;
+} ConfigNames;
+
+static void applyConfigName(void *data, const char *name, const char *value) {
+  ConfigNames *names = (ConfigNames *)data;
+  UnikornSession *session = names->session;
+  bool is_enable = strcmp(name, "enable") == 0;
+  bool is_disable = strcmp(name, "disable") == 0;
+  bool is_sample = strcmp(name, "sample") == 0;
+  if (!is_enable && !is_disable && !is_sample) return;
+
+  // Get the name of the event type or folder
+  char event_name[MAX_NAME_LENGTH];
+  uint32_t sample_ratio = 0;
+  const char *ratio_separator = is_sample ? strrchr(value, ':') : NULL;
+  if (is_sample && ratio_separator == NULL) {
+    printf("Unikorn: the config setting '%s=%s' is expected to be 'sample=<event name>:<ratio>', so it will be ignored\n", name, value);
+    return;
+  }
+  size_t name_length = is_sample ? (size_t)(ratio_separator - value) : strlen(value);
+  if (name_length >= MAX_NAME_LENGTH) {
+    printf("Unikorn: the name in the config setting '%s=%s' has more than %d chars, so it will be ignored\n", name, value, MAX_NAME_LENGTH);
+    return;
+  }
+  memcpy(event_name, value, name_length);
+  event_name[name_length] = '\0';
+  if (is_sample) {
+    // Must be a whole number of at least 1: a ratio of 0 would record every instance instead of none
+    char *ratio_end = NULL;
+    unsigned long ratio = strtoul(ratio_separator+1, &ratio_end, 0);
+    if (ratio_end == ratio_separator+1 || *ratio_end != '\0' || ratio < 1 || ratio > UINT32_MAX) {
+      printf("Unikorn: the ratio in the config setting '%s=%s' is not in the range 1 to %u, so it will be ignored\n", name, value, UINT32_MAX);
+      return;
+    }
+    sample_ratio = (uint32_t)ratio;
+  }
+
+  for (uint16_t i=0; i<session->event_registration_count; i++) {
+    PrivateEventInfo *event = &session->event_registration_list[i];
+    if (strcmp(event->name, event_name) != 0) continue;
+    if (is_enable) {
+      names->is_event_enabled[i] = true;
+      names->has_enabled_events = true;
+    } else if (is_disable) {
+      event->is_disabled = true;
+    } else {
+      event->sample_ratio = sample_ratio;
+    }
+    return;
+  }
+  for (uint16_t i=1; !is_sample && i<session->folder_registration_count; i++) {
+    PrivateFolderInfo *folder = &session->folder_registration_list[i];
+    if (strcmp(folder->name, event_name) != 0) continue;
+    if (is_enable) {
+      names->is_folder_enabled[i] = true;
+      names->has_enabled_folders = true;
+    } else {
+      folder->is_disabled = true;
+    }
+    return;
+  }
+  printf("Unikorn: the config setting '%s=%s' does not match a registered %s, so it will be ignored\n", name, value, is_sample ? "event" : "event or folder");
+}
+
+static void applyConfigNames(UnikornSession *session) {
+  // Enable, disable, and sample event types and folders by name
+  ConfigNames names;
+  names.session = session;
+  names.is_folder_enabled = calloc(session->folder_registration_count+1, sizeof(bool));
+  assert(names.is_folder_enabled != NULL);
+  names.is_event_enabled = calloc(session->event_registration_count, sizeof(bool));
+  assert(names.is_event_enabled != NULL);
+  names.has_enabled_folders = false;
+  names.has_enabled_events = false;
+  forEachConfigSetting(applyConfigName, &names, false);
+  // If any are enabled, the rest are disabled
+  for (uint16_t i=1; names.has_enabled_folders && i<session->folder_registration_count; i++) {
+    if (!names.is_folder_enabled[i]) session->folder_registration_list[i].is_disabled = true;
+  }
+  for (uint16_t i=0; names.has_enabled_events && i<session->event_registration_count; i++) {
+    if (!names.is_event_enabled[i]) session->event_registration_list[i].is_disabled = true;
+  }
+  free(names.is_folder_enabled);
+  free(names.is_event_enabled);
+}
+
+static void updatePlainRecording(UnikornSession *session) {
+  // Decide which events can skip the general recording path in ukRecordEvent(). Called again if an event type gets a threshold or its own ring.
+  session->use_plain_recording = !session->aggregate_only && session->counter_count == 0 && !session->record_cpu && !session->record_per_cpu && !session->has_thresholds;
+  if (session->drop_newest_when_full) session->use_plain_recording = false; // Only recordEvent() checks for a full buffer before storing
+#ifdef DISABLE_UNIKORN_SPECIALIZED_RECORDING
+  session->use_plain_recording = false; // Helpful to measure the difference (see examples/test_record_overhead)
+#endif
+  session->plain_record_index = (uint8_t)((session->is_multi_threaded ? 1 : 0) | (session->record_instance ? 2 : 0) | (session->record_value ? 4 : 0) |
+                                          (session->record_file_location ? 8 : 0) | (session->flush_when_full ? 16 : 0));
+  bool all_plain = true;
+  for (uint16_t i=0; i<session->event_registration_count; i++) {
+    PrivateEventInfo *event = &session->event_registration_list[i];
+    event->is_plain = !event->is_disabled && event->sample_ratio <= 1 && event->threshold == 0 && event->ring == NULL;
+    if (!event->is_plain) all_plain = false;
+  }
+
+  // Inline recording (see unikorn_inline.h): single threaded, and the inline function has no per event type checks
+  closeInlineRange(session);
+  session->use_inline_recording = session->use_plain_recording && !session->is_multi_threaded && all_plain;
+  UkInlineState *state = &session->inline_state;
+  EventBuffer *buffer = &session->main_buffer;
+  state->first_event_id = session->first_event_id;
+  state->time_delta_list = buffer->time_delta_list;
+  state->event_id_list = buffer->event_id_list;
+  state->instance_list = buffer->instance_list;
+  state->instance_counter_list = session->instance_counter_list;
+  state->value_list = buffer->value_list;
+  state->file_name_list = buffer->file_name_list;
+  state->function_name_list = buffer->function_name_list;
+  state->line_number_list = buffer->line_number_list;
+}
+
+static void applyConfigFilename(void *data, const char *name, const char *value) {
+  // NOTE: The settings are freed after they are applied, so the name is copied
+  char **filename_ref = (char **)data;
+  if (strcmp(name, "file") != 0 || value[0] == '\0') return;
+  free(*filename_ref);
+  *filename_ref = strdup(value);
+  assert(*filename_ref != NULL);
+}
+
+char *ukConfigFilename(const char *filename) {
+  char *config_filename = NULL;
+  forEachConfigSetting(applyConfigFilename, &config_filename, false);
+  if (config_filename != NULL) return config_filename;
+  char *copy = strdup(filename);
+  assert(copy != NULL);
+  return copy;
+}
+
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+static void *spillThread(void *data); // Needs the flush functions below
+#endif
+
+void *ukCreate(UkAttrs *attrs,
+	       uint64_t (*clockNanoseconds)(),
+	       void *flush_user_data,
+	       bool (*prepareFlush)(void *user_data),
+	       bool (*flush)(void *user_data, const void *data, size_t bytes),
+	       bool (*finishFlush)(void *user_data)) {
+  // Apply the runtime config (UNIKORN_CONFIG) to a copy of the attributes, if the application asked for it
+  UkAttrs config_attrs = *attrs;
+  if (attrs->apply_config) forEachConfigSetting(applyConfigAttr, &config_attrs, true);
+  attrs = &config_attrs;
+
+  // Verify attributes
+  if (attrs->max_event_count < MIN_EVENT_COUNT) { printf("Expected max events count=%d to be at least %d\n", attrs->max_event_count, MIN_EVENT_COUNT); assert(0); }
+  if (attrs->event_registration_count == 0) { printf("Expected at least one named event to be registered\n"); assert(0); }
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+#else
+  if (attrs->is_multi_threaded) { printf("Asked for threading, but the library is not compiled with threading.\n"); assert(0); }
+#endif
+  if (attrs->record_per_cpu && !attrs->is_multi_threaded) { printf("Asked for per CPU recording, but threading is not enabled.\n"); assert(0); }
+  if (attrs->spill_when_full && !attrs->is_multi_threaded) { printf("Asked to spill when full, but threading is not enabled.\n"); assert(0); }
+  if (attrs->spill_policy > UK_SPILL_DROP_OLDEST) { printf("Expected spill policy=%d to be one of UK_SPILL_*\n", attrs->spill_policy); assert(0); }
+  uint32_t num_event_types = 1;
+  for (uint16_t i=0; i<attrs->folder_registration_count; i++) {
+    if (attrs->folder_registration_list[i].name == NULL) { printf("Folder name[%d] is NULL\n", i); assert(0); }
+    if (strlen(attrs->folder_registration_list[i].name) >= MAX_NAME_LENGTH) { printf("Folder name[%d]='%s' has more than %d chars.\n", i, attrs->folder_registration_list[i].name, MAX_NAME_LENGTH); assert(0); }
+    if (attrs->folder_registration_list[i].id != num_event_types) { printf("Folder name[%d]='%s' was expected to have an ID=%d but has %d\n", i, attrs->folder_registration_list[i].name, num_event_types, attrs->folder_registration_list[i].id); assert(0); }
+    num_event_types++;
+  }
+  uint16_t first_event_id = num_event_types;
+  for (uint16_t i=0; i<attrs->event_registration_count; i++) {
+    if (attrs->event_registration_list[i].name == NULL) { printf("Event name[%d] is NULL\n", i); assert(0); }
+    if (strlen(attrs->event_registration_list[i].name) >= MAX_NAME_LENGTH) { printf("Event name[%d]='%s' has more than %d chars.\n", i, attrs->event_registration_list[i].name, MAX_NAME_LENGTH); assert(0); }
+    if (attrs->event_registration_list[i].start_id != num_event_types) { printf("Event name[%d]='%s' was expected to have a start ID=%d but has %d\n", i, attrs->event_registration_list[i].name, num_event_types, attrs->event_registration_list[i].start_id); assert(0); }
+    num_event_types++;
+    if (attrs->event_registration_list[i].end_id != num_event_types) { printf("Event name[%d]='%s' was expected to have an end ID=%d but has %d\n", i, attrs->event_registration_list[i].name, num_event_types, attrs->event_registration_list[i].end_id); assert(0); }
+    num_event_types++;
+  }
+  if (attrs->record_spans && num_event_types > SPAN_EVENT_FLAG) { printf("Asked to record spans, but the last event ID=%d is not less than %d\n", num_event_types-1, SPAN_EVENT_FLAG); assert(0); }
+
+  // Build session
+  UnikornSession *session = calloc(1, sizeof(UnikornSession));
+  assert(session != NULL);
+  session->magic_value1 = MAGIC_VALUE1;
+  session->magic_value2 = MAGIC_VALUE2;
+  session->clockNanoseconds = clockNanoseconds;
+  session->flush_user_data = flush_user_data;
+  session->prepareFlush = prepareFlush;
+  session->flush = flush;
+  session->finishFlush = finishFlush;
+  session->flush_when_full = attrs->flush_when_full;
+  session->is_multi_threaded = attrs->is_multi_threaded;
+  session->record_instance = attrs->record_instance;
+  session->record_value = attrs->record_value;
+  session->record_file_location = attrs->record_file_location;
+  session->record_per_cpu = attrs->record_per_cpu;
+  session->record_cpu = attrs->record_cpu;
+  session->record_spans = attrs->record_spans;
+  session->aggregate_only = attrs->aggregate_only;
+  session->real_time = attrs->real_time;
+  if (session->aggregate_only) {
+    // Nothing is stored per event
+    session->record_instance = false;
+    session->record_value = false;
+    session->record_file_location = false;
+    session->record_per_cpu = false;
+    session->record_cpu = false;
+    session->record_spans = false;
+  }
+  session->spill_when_full = attrs->spill_when_full && !session->aggregate_only;
+  if (session->spill_when_full) session->flush_when_full = true; // Spilling replaces the flush
+  session->spill_policy = attrs->spill_policy;
+  session->drop_newest_when_full = session->spill_when_full && session->spill_policy == UK_SPILL_DROP_NEWEST;
+  session->folder_registration_count = (attrs->folder_registration_count == 0) ? 0 : attrs->folder_registration_count + 1; // Also need the close folder event
+  session->event_registration_count = attrs->event_registration_count;
+  session->first_event_id = first_event_id;
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  pthread_mutex_init(&session->mutex, NULL);
+  if (session->is_multi_threaded) {
+    int rc = pthread_key_create(&session->thread_key, threadExited);
+    assert(rc == 0);
+  }
+#endif
+  session->thread_slot_count = 0;
+  session->thread_slot_list = NULL;
+  session->task_count = 0;
+  session->task_table_size = 0;
+  session->task_table = NULL;
+  session->ended_task_list = NULL;
+  getHostInfo(session->host_name, &session->process_id);
+  session->create_anchor = sampleClockAnchor(session);
+
+#ifdef PRINT_INIT_INFO
+  printf("%s():\n", __FUNCTION__);
+  printf("  max_event_count = %d\n", attrs->max_event_count);
+  printf("  flush_when_full = %s\n", session->flush_when_full ? "yes" : "no");
+  printf("  is_multi_threaded = %s\n", session->is_multi_threaded ? "yes" : "no");
+  printf("  record_instance = %s\n", session->record_instance ? "yes" : "no");
+  printf("  record_value = %s\n", session->record_value ? "yes" : "no");
+  printf("  record_file_location = %s\n", session->record_file_location ? "yes" : "no");
+  printf("  record_per_cpu = %s\n", session->record_per_cpu ? "yes" : "no");
+  printf("  record_cpu = %s\n", session->record_cpu ? "yes" : "no");
+  printf("  aggregate_only = %s\n", session->aggregate_only ? "yes" : "no");
+  printf("  real_time = %s\n", session->real_time ? "yes" : "no");
+  printf("  spill_when_full = %s\n", session->spill_when_full ? "yes" : "no");
+  printf("  record_spans = %s\n", session->record_spans ? "yes" : "no");
+  printf("  first_event_id = %d\n", session->first_event_id);
+#endif
+
+  // Named Folders
+#ifdef PRINT_INIT_INFO
+  printf("  folder_registration_count = %d\n", session->folder_registration_count);
+#endif
+  if (session->folder_registration_count > 0) {
+    session->folder_registration_list = calloc(session->folder_registration_count, sizeof(PrivateFolderInfo));
+    assert(session->folder_registration_list != NULL);
+    // Register the CLOSE_FOLDER_ID event
+    session->folder_registration_list[0].id = CLOSE_FOLDER_ID;
+    session->folder_registration_list[0].name = strdup("Close Folder");
+#ifdef PRINT_INIT_INFO
+    printf("    ID=%d, name='%s'\n", session->folder_registration_list[0].id, session->folder_registration_list[0].name);
+#endif
+    assert(session->folder_registration_list[0].name != NULL);
+    // Register custom folders
+    for (uint16_t i=1; i<session->folder_registration_count; i++) {
+      session->folder_registration_list[i].id = attrs->folder_registration_list[i-1].id;
+      session->folder_registration_list[i].name = strdup(attrs->folder_registration_list[i-1].name);
+#ifdef PRINT_INIT_INFO
+      printf("    ID=%d, name='%s'\n", session->folder_registration_list[i].id, session->folder_registration_list[i].name);
+#endif
+      assert(session->folder_registration_list[i].name != NULL);
+    }
+    // Create the stacks to track what folders are open
+    uint16_t max_folder_stack_count = session->folder_registration_count - 1; // -1 due to the close folder event
+    session->curr_folder_stack_count = 0;
+    session->curr_folder_stack = calloc(max_folder_stack_count, sizeof(uint16_t));
+    session->starting_folder_stack_count = 0;
+    session->starting_folder_stack = calloc(max_folder_stack_count, sizeof(uint16_t));
+  }
+
+  // Named events
+#ifdef PRINT_INIT_INFO
+  printf("  event_registration_count = %d\n", session->event_registration_count);
+#endif
+  session->event_registration_list = calloc(session->event_registration_count, sizeof(PrivateEventInfo));
+  assert(session->event_registration_list != NULL);
+  // Register custom events
+  for (uint16_t i=0; i<session->event_registration_count; i++) {
+    session->event_registration_list[i].start_id = attrs->event_registration_list[i].start_id;
+    session->event_registration_list[i].end_id = attrs->event_registration_list[i].end_id;
+    session->event_registration_list[i].rgb = attrs->event_registration_list[i].rgb;
+    session->event_registration_list[i].name = strdup(attrs->event_registration_list[i].name);
+    assert(session->event_registration_list[i].name != NULL);
+    session->event_registration_list[i].start_value_name = strdup(attrs->event_registration_list[i].start_value_name);
+    assert(session->event_registration_list[i].start_value_name != NULL);
+    session->event_registration_list[i].end_value_name = strdup(attrs->event_registration_list[i].end_value_name);
+    assert(session->event_registration_list[i].end_value_name != NULL);
+#ifdef PRINT_INIT_INFO
+    printf("    startID=%d, endID=%d, RGB=0x%04x, name='%s', start_value_name='%s', end_value_name='%s'\n", session->event_registration_list[i].start_id, session->event_registration_list[i].end_id, session->event_registration_list[i].rgb,
+           session->event_registration_list[i].name, session->event_registration_list[i].start_value_name, session->event_registration_list[i].end_value_name);
+#endif
+  }
+  session->instance_counter_list = malloc(session->event_registration_count*2*sizeof(uint64_t));
+  assert(session->instance_counter_list != NULL);
+  for (uint32_t i=0; i<session->event_registration_count*2u; i++) {
+    session->instance_counter_list[i] = 1;
+  }
+
+  // Histograms
+  if (session->aggregate_only) {
+    session->histogram_list = malloc(session->event_registration_count * sizeof(Histogram));
+    assert(session->histogram_list != NULL);
+    for (uint16_t i=0; i<session->event_registration_count; i++) {
+      initHistogram(&session->histogram_list[i]);
+    }
+  }
+  initAggregateStarts(session, &session->aggregate_starts);
+  initStagedEvents(&session->staged_events);
+
+  // Counters: drop the ones not supported by the system (e.g. no hardware counters in some virtual machines)
+  if (attrs->counter_mask != 0 && !session->aggregate_only) {
+    uint16_t num_definitions = sizeof(L_counter_definitions) / sizeof(L_counter_definitions[0]);
+    for (uint16_t i=0; i<num_definitions; i++) {
+      const CounterDefinition *counter = &L_counter_definitions[i];
+      if (counter->mask == 0 || !(attrs->counter_mask & counter->mask)) continue;
+      if (counterIsAvailable(counter)) {
+        assert(session->counter_count < MAX_COUNTERS);
+        session->counter_list[session->counter_count] = counter;
+        session->counter_count++;
+        if (counter->source == COUNTER_SOURCE_PERF) session->perf_counter_count++;
+      } else {
+        printf("Unikorn: the counter '%s' is not available on this system, so it will not be recorded\n", counter->name);
+      }
+    }
+  }
+  session->counter_reader.is_opened = false;
+#ifdef PRINT_INIT_INFO
+  printf("  counter_count = %d\n", session->counter_count);
+  for (uint16_t i=0; i<session->counter_count; i++) {
+    printf("    '%s'\n", session->counter_list[i]->name);
+  }
+#endif
+
+  // Prepare the storage buffers
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->record_per_cpu) {
+    // Split the events across the CPU cores, so memory is proportional to the number of cores instead of the number of threads. The main buffer only holds folder events.
+    session->cpu_buffer_count = numCpus();
+    uint32_t max_cpu_event_count = attrs->max_event_count / (session->cpu_buffer_count + 1);
+    if (max_cpu_event_count < MIN_EVENT_COUNT) max_cpu_event_count = MIN_EVENT_COUNT;
+#ifdef PRINT_INIT_INFO
+    printf("  cpu_buffer_count = %d, events per buffer = %d\n", session->cpu_buffer_count, max_cpu_event_count);
+#endif
+    session->cpu_buffer_list = calloc(session->cpu_buffer_count, sizeof(EventBuffer));
+    assert(session->cpu_buffer_list != NULL);
+    for (uint16_t i=0; i<session->cpu_buffer_count; i++) {
+      initEventBuffer(session, &session->cpu_buffer_list[i], max_cpu_event_count);
+    }
+    initEventBuffer(session, &session->main_buffer, max_cpu_event_count);
+  } else
+#endif
+  {
+    // NOTE: Events are never stored if aggregate_only==true
+    uint32_t max_event_count = session->aggregate_only ? MIN_EVENT_COUNT : attrs->max_event_count;
+    initEventBuffer(session, &session->main_buffer, max_event_count);
+  }
+
+  // Apply the runtime config (UNIKORN_CONFIG) of the event types and folders
+  if (attrs->apply_config) applyConfigNames(session);
+
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  // Spilling: spares of the buffers, and the thread that writes the full ones
+  if (session->spill_when_full) {
+    session->spill_buffer_count = (attrs->spill_buffer_count == 0) ? DEFAULT_SPILL_BUFFER_COUNT : attrs->spill_buffer_count;
+#ifdef PRINT_INIT_INFO
+    printf("  spill_buffer_count = %d, spill_policy = %d\n", session->spill_buffer_count, session->spill_policy);
+#endif
+    session->spill_buffer_list = calloc(session->spill_buffer_count, sizeof(SpillBuffers));
+    assert(session->spill_buffer_list != NULL);
+    for (uint16_t i=0; i<session->spill_buffer_count; i++) {
+      SpillBuffers *spill = &session->spill_buffer_list[i];
+      initSpillBuffers(session, spill);
+      spill->next = session->free_spill_buffers;
+      session->free_spill_buffers = spill;
+    }
+    session->spill_thread_slot_capacity = INITIAL_SPILL_THREAD_SLOTS;
+    session->spill_thread_slot_list = malloc(session->spill_thread_slot_capacity*sizeof(ThreadSlot));
+    assert(session->spill_thread_slot_list != NULL);
+    pthread_cond_init(&session->spill_ready_cond, NULL);
+    pthread_cond_init(&session->spill_done_cond, NULL);
+    int rc = pthread_create(&session->spill_thread, NULL, spillThread, session);
+    assert(rc == 0);
+  }
+#endif
+
+  // Real time mode: allocate up front what would otherwise be allocated when first needed
+  if (session->real_time) {
+    prepareRealTimeFlush(session);
+    session->max_pause_count = REAL_TIME_MAX_PAUSE_COUNT;
+    session->pause_list = malloc(session->max_pause_count*sizeof(PauseInterval));
+    assert(session->pause_list != NULL);
+    session->max_clock_sync_count = REAL_TIME_MAX_CLOCK_SYNC_COUNT;
+    session->clock_sync_list = malloc(session->max_clock_sync_count*sizeof(ClockSync));
+    assert(session->clock_sync_list != NULL);
+    if (!session->is_multi_threaded) preallocThreadState(session, &session->staged_events, &session->sample_states);
+  }
+
+  // Now that the attributes are final, choose the specialized record function
+  updatePlainRecording(session);
+
+  return session;
+}
+
+static uint64_t takeHistogramValue(uint64_t *value, uint64_t reset_value, bool keep_events) {
+  return keep_events ? atomicLoad(value) : atomicExchange(value, reset_value);
+}
+
+static void flushHistograms(UnikornSession *session, bool keep_events) {
+  // NOTE: Other threads may still be updating the histograms, so each value is atomically taken and reset. Each flush holds the durations since the previous flush.
+  //       If keep_events, the values are only read, so the next flush also has them
+  uint16_t sub_bucket_bits = HISTOGRAM_SUB_BUCKET_BITS;
+#ifdef PRINT_FLUSH_INFO
+  printf("  histogram sub_bucket_bits = %d\n", sub_bucket_bits);
+#endif
+  assert(session->flush(session->flush_user_data, &sub_bucket_bits, sizeof(sub_bucket_bits)));
+  uint16_t *bucket_index_list = session->flush_bucket_index_list; // Preallocated in real time mode
+  uint64_t *bucket_count_list = session->flush_bucket_count_list;
+  if (!session->real_time) {
+    bucket_index_list = malloc(HISTOGRAM_BUCKET_COUNT * sizeof(uint16_t));
+    assert(bucket_index_list != NULL);
+    bucket_count_list = malloc(HISTOGRAM_BUCKET_COUNT * sizeof(uint64_t));
+    assert(bucket_count_list != NULL);
+  }
+  for (uint16_t i=0; i<session->event_registration_count; i++) {
+    Histogram *histogram = &session->histogram_list[i];
+    uint64_t count = takeHistogramValue(&histogram->count, 0, keep_events);
+    uint64_t min_duration = takeHistogramValue(&histogram->min_duration, UINT64_MAX, keep_events);
+    uint64_t max_duration = takeHistogramValue(&histogram->max_duration, 0, keep_events);
+    uint64_t total_duration = takeHistogramValue(&histogram->total_duration, 0, keep_events);
+    uint64_t unmatched_count = takeHistogramValue(&histogram->unmatched_count, 0, keep_events);
+    if (min_duration == UINT64_MAX) min_duration = 0;
+    // Only the used buckets are flushed
+    uint16_t used_bucket_count = 0;
+    for (uint16_t j=0; j<HISTOGRAM_BUCKET_COUNT; j++) {
+      if (histogram->bucket_counts[j] == 0) continue;
+      bucket_index_list[used_bucket_count] = j;
+      bucket_count_list[used_bucket_count] = takeHistogramValue(&histogram->bucket_counts[j], 0, keep_events);
+      used_bucket_count++;
+    }
+#ifdef PRINT_FLUSH_INFO
+    printf("    '%s': count=%"UINT64_FORMAT", min=%"UINT64_FORMAT", max=%"UINT64_FORMAT", unmatched=%"UINT64_FORMAT", used_buckets=%d\n", session->event_registration_list[i].name, count, min_duration, max_duration, unmatched_count, used_bucket_count);
+#endif
+    assert(session->flush(session->flush_user_data, &count, sizeof(count)));
+    assert(session->flush(session->flush_user_data, &min_duration, sizeof(min_duration)));
+    assert(session->flush(session->flush_user_data, &max_duration, sizeof(max_duration)));
+    assert(session->flush(session->flush_user_data, &total_duration, sizeof(total_duration)));
+    assert(session->flush(session->flush_user_data, &unmatched_count, sizeof(unmatched_count)));
+    assert(session->flush(session->flush_user_data, &used_bucket_count, sizeof(used_bucket_count)));
+    for (uint16_t j=0; j<used_bucket_count; j++) {
+      assert(session->flush(session->flush_user_data, &bucket_index_list[j], sizeof(bucket_index_list[j])));
+      assert(session->flush(session->flush_user_data, &bucket_count_list[j], sizeof(bucket_count_list[j])));
+    }
+  }
+  if (!session->real_time) {
+    free(bucket_index_list);
+    free(bucket_count_list);
+  }
+}
+
+static void flushPauses(UnikornSession *session, bool keep_events) {
+  // If still paused, the current pause is split at the time of the flush
+  uint32_t pause_count = session->is_paused ? session->pause_count+1 : session->pause_count;
+#ifdef PRINT_FLUSH_INFO
+  printf("  pause_count = %d\n", pause_count);
+#endif
+  assert(session->flush(session->flush_user_data, &pause_count, sizeof(pause_count)));
+  for (uint32_t i=0; i<session->pause_count; i++) {
+    PauseInterval *pause = &session->pause_list[i];
+    assert(session->flush(session->flush_user_data, &pause->pause_time, sizeof(pause->pause_time)));
+    assert(session->flush(session->flush_user_data, &pause->resume_time, sizeof(pause->resume_time)));
+  }
+  if (session->is_paused) {
+    uint64_t flush_time = session->clockNanoseconds();
+    assert(session->flush(session->flush_user_data, &session->pause_time, sizeof(session->pause_time)));
+    assert(session->flush(session->flush_user_data, &flush_time, sizeof(flush_time)));
+    if (!keep_events) session->pause_time = flush_time;
+  }
+  if (!keep_events) session->pause_count = 0;
+}
+
+static void flushClockSyncs(UnikornSession *session, bool keep_events) {
+#ifdef PRINT_FLUSH_INFO
+  printf("  clock_sync_count = %d\n", session->clock_sync_count);
+#endif
+  assert(session->flush(session->flush_user_data, &session->clock_sync_count, sizeof(session->clock_sync_count)));
+  for (uint32_t i=0; i<session->clock_sync_count; i++) {
+    ClockSync *sync = &session->clock_sync_list[i];
+    assert(session->flush(session->flush_user_data, &sync->time, sizeof(sync->time)));
+    assert(session->flush(session->flush_user_data, &sync->peer_process_id, sizeof(sync->peer_process_id)));
+    assert(session->flush(session->flush_user_data, &sync->offset, sizeof(sync->offset)));
+    assert(session->flush(session->flush_user_data, &sync->round_trip, sizeof(sync->round_trip)));
+  }
+  if (!keep_events) session->clock_sync_count = 0;
+}
+
+typedef struct {
+  // What a flush writes: the session's own buffers, or spilled buffers (see spillThread()), and the state that goes with them
+  EventBuffer *main_buffer;
+  EventBuffer *cpu_buffer_list;   // cpu_buffer_count buffers
+  EventBuffer **ring_list;        // Per event type, or NULL for the session's own (see ukSetEventCapacity())
+  bool has_thresholds;
+  uint16_t thread_slot_count;
+  ThreadSlot *thread_slot_list;
+  uint16_t starting_folder_stack_count;
+  uint16_t *starting_folder_stack;
+  bool is_spill;                  // The histograms, pauses and clock syncs are left in the session for the next ukFlush()
+} FlushContents;
+
+static EventBuffer *flushRing(UnikornSession *session, FlushContents *contents, uint16_t event_registration_index) {
+  // Returns NULL if the event type is stored with the other event types
+  if (contents->ring_list != NULL) return contents->ring_list[event_registration_index];
+  return session->event_registration_list[event_registration_index].ring;
+}
+
+static bool writeFlush(UnikornSession *session, FlushContents *contents, bool keep_events) {
+  // Returns false if there is nothing to flush. The caller resets the buffers.
+  // Build the time ordered list of events to flush
+  uint32_t event_count = contents->main_buffer->num_stored_events;
+  for (uint16_t i=0; i<session->cpu_buffer_count; i++) {
+    event_count += contents->cpu_buffer_list[i].num_stored_events;
+  }
+  for (uint16_t i=0; session->event_ring_count>0 && i<session->event_registration_count; i++) {
+    EventBuffer *ring = flushRing(session, contents, i);
+    if (ring != NULL) event_count += ring->num_stored_events;
+  }
+  if (event_count == 0 && !session->aggregate_only) return false; // Nothing to flush
+  Event *event_list = session->flush_event_list; // Preallocated in real time mode, with room for every buffered event
+  Event **flush_list = session->flush_pointer_list;
+  if (session->real_time) {
+    assert(event_count <= session->flush_capacity);
+  } else if (event_count > 0) {
+    event_list = malloc(event_count * sizeof(Event));
+    assert(event_list != NULL);
+    flush_list = malloc(event_count * sizeof(Event *));
+    assert(flush_list != NULL);
+  }
+  uint32_t list_count = appendBufferToFlushList(session, contents->main_buffer, event_list, flush_list, 0);
+  Event **sorted_flush_list = flush_list;
+  Event **scratch_list = NULL;
+  for (uint16_t i=0; i<session->cpu_buffer_count; i++) {
+    list_count = appendBufferToFlushList(session, &contents->cpu_buffer_list[i], event_list, flush_list, list_count);
+  }
+  for (uint16_t i=0; session->event_ring_count>0 && i<session->event_registration_count; i++) {
+    EventBuffer *ring = flushRing(session, contents, i);
+    if (ring != NULL) list_count = appendBufferToFlushList(session, ring, event_list, flush_list, list_count);
+  }
+  if ((session->cpu_buffer_count > 0 || session->event_ring_count > 0 || contents->has_thresholds || session->record_spans) && event_count > 0) {
+    // Merge the per CPU buffers and per event type buffers, and any committed instances that were recorded before the events buffered ahead of them.
+    // Spans are buffered by end time, but flushed by start time.
+    scratch_list = session->real_time ? session->flush_scratch_list : malloc(event_count * sizeof(Event *));
+    assert(scratch_list != NULL);
+    sorted_flush_list = sortFlushList(flush_list, scratch_list, event_count);
+  }
+  assert(list_count == event_count);
+
+  // Make sure the application defined file, socket, etc. is ready for the data
+  bool ok = session->prepareFlush(session->flush_user_data);
+  assert(ok);
+
+  // Endian
+  bool is_big_endian = isBigEndian();
+#ifdef PRINT_FLUSH_INFO
+  printf("%s():\n", __FUNCTION__);
+  printf("  is_big_endian = %s\n", is_big_endian ? "yes" : "no");
+#endif
+  assert(session->flush(session->flush_user_data, &is_big_endian, sizeof(is_big_endian)));
+
+  // Version
+  uint16_t major = UK_API_VERSION_MAJOR;
+  uint16_t minor = UK_API_VERSION_MINOR;
+#ifdef PRINT_FLUSH_INFO
+  printf("  version: %d.%d\n", major, minor);
+#endif
+  assert(session->flush(session->flush_user_data, &major, sizeof(major)));
+  assert(session->flush(session->flush_user_data, &minor, sizeof(minor)));
+
+  // Miscellanyous info
+#ifdef PRINT_FLUSH_INFO
+  printf("  is_multi_threaded = %s\n", session->is_multi_threaded ? "yes" : "no");
+  printf("  record_instance = %s\n", session->record_instance ? "yes" : "no");
+  printf("  record_value = %s\n", session->record_value ? "yes" : "no");
+  printf("  record_file_location = %s\n", session->record_file_location ? "yes" : "no");
+  printf("  record_cpu = %s\n", session->record_cpu ? "yes" : "no");
+  printf("  aggregate_only = %s\n", session->aggregate_only ? "yes" : "no");
+  printf("  has_thresholds = %s\n", contents->has_thresholds ? "yes" : "no");
+#endif
+  assert(session->flush(session->flush_user_data, &session->is_multi_threaded, sizeof(session->is_multi_threaded)));
+  assert(session->flush(session->flush_user_data, &session->record_instance, sizeof(session->record_instance)));
+  assert(session->flush(session->flush_user_data, &session->record_value, sizeof(session->record_value)));
+  assert(session->flush(session->flush_user_data, &session->record_file_location, sizeof(session->record_file_location)));
+  assert(session->flush(session->flush_user_data, &session->record_cpu, sizeof(session->record_cpu)));
+  assert(session->flush(session->flush_user_data, &session->aggregate_only, sizeof(session->aggregate_only)));
+  assert(session->flush(session->flush_user_data, &contents->has_thresholds, sizeof(contents->has_thresholds)));
+
+  // Folder info
+#ifdef PRINT_FLUSH_INFO
   printf("  folder_registration_count = %d\n", session->folder_registration_count);
 #endif
   assert(session->flush(session->flush_user_data, &session->folder_registration_count, sizeof(session->folder_registration_count)));
@@ -485,6 +2216,34 @@ static void flushEvents(UnikornSession *session) {
     assert(session->flush(session->flush_user_data, event->end_value_name, num_chars));
   }
 
+  // Counter info
+#ifdef PRINT_FLUSH_INFO
+  printf("  counter_count = %d\n", session->counter_count);
+#endif
+  assert(session->flush(session->flush_user_data, &session->counter_count, sizeof(session->counter_count)));
+  for (uint16_t i=0; i<session->counter_count; i++) {
+    const char *name = session->counter_list[i]->name;
+#ifdef PRINT_FLUSH_INFO
+    printf("    '%s'\n", name);
+#endif
+    uint16_t num_chars = 1 + (uint16_t)strlen(name);
+    assert(session->flush(session->flush_user_data, &num_chars, sizeof(num_chars)));
+    assert(session->flush(session->flush_user_data, name, num_chars));
+  }
+
+  // Host, process, and the clock anchor from when the session was created
+  {
+#ifdef PRINT_FLUSH_INFO
+    printf("  host_name='%s', process_id=%" UINT64_FORMAT ", create anchor: time=%" UINT64_FORMAT ", wall_time=%" UINT64_FORMAT "\n", session->host_name, session->process_id, session->create_anchor.time, session->create_anchor.wall_time);
+#endif
+    uint16_t num_chars = 1 + (uint16_t)strlen(session->host_name);
+    assert(session->flush(session->flush_user_data, &num_chars, sizeof(num_chars)));
+    assert(session->flush(session->flush_user_data, session->host_name, num_chars));
+    assert(session->flush(session->flush_user_data, &session->process_id, sizeof(session->process_id)));
+    assert(session->flush(session->flush_user_data, &session->create_anchor.time, sizeof(session->create_anchor.time)));
+    assert(session->flush(session->flush_user_data, &session->create_anchor.wall_time, sizeof(session->create_anchor.wall_time)));
+  }
+
   // File names and function names
   uint16_t file_name_count = 0;
   uint16_t function_name_count = 0;
@@ -492,7 +2251,7 @@ static void flushEvents(UnikornSession *session) {
   char **function_name_list = NULL;
   if (session->record_file_location) {
     // File names
-    file_name_list = getFileNameList(session, &file_name_count);
+    file_name_list = getFileNameList(sorted_flush_list, event_count, session->flush_file_name_list, session->max_flush_name_count, &file_name_count);
 #ifdef PRINT_FLUSH_INFO
     printf("  file_name_count = %d\n", file_name_count);
 #endif
@@ -507,7 +2266,7 @@ static void flushEvents(UnikornSession *session) {
       assert(session->flush(session->flush_user_data, name, num_chars));
     }
     // Functions names
-    function_name_list = getFunctionNameList(session, &function_name_count);
+    function_name_list = getFunctionNameList(sorted_flush_list, event_count, session->flush_function_name_list, session->max_flush_name_count, &function_name_count);
 #ifdef PRINT_FLUSH_INFO
     printf("  function_name_count = %d\n", function_name_count);
 #endif
@@ -523,47 +2282,44 @@ static void flushEvents(UnikornSession *session) {
     }
   }
 
-  // Build thread ID list (this needs maintain old thread IDs between flushes since the flush pushes out an index into the list, which needs to be consistent over time
+  // Thread slots: the generation lets the loader know when a slot was recycled for a different thread
   if (session->is_multi_threaded) {
-    getThreadIdList(session);
 #ifdef PRINT_FLUSH_INFO
-    printf("  thread_id_list_count = %d\n", session->thread_id_list_count);
+    printf("  thread_slot_count = %d\n", contents->thread_slot_count);
 #endif
-    assert(session->flush(session->flush_user_data, &session->thread_id_list_count, sizeof(session->thread_id_list_count)));
-    for (uint16_t i=0; i<session->thread_id_list_count; i++) {
-      uint64_t thread_id = session->thread_id_list[i];
+    assert(session->flush(session->flush_user_data, &contents->thread_slot_count, sizeof(contents->thread_slot_count)));
+    for (uint16_t i=0; i<contents->thread_slot_count; i++) {
+      ThreadSlot *slot = &contents->thread_slot_list[i];
 #ifdef PRINT_FLUSH_INFO
-      printf("    %" UINT64_FORMAT "\n", thread_id);
+      printf("    thread_id=%" UINT64_FORMAT ", generation=%d, is_task=%s\n", slot->thread_id, slot->generation, slot->is_task ? "yes" : "no");
 #endif
-      assert(session->flush(session->flush_user_data, &thread_id, sizeof(thread_id)));
+      assert(session->flush(session->flush_user_data, &slot->thread_id, sizeof(slot->thread_id)));
+      assert(session->flush(session->flush_user_data, &slot->generation, sizeof(slot->generation)));
+      assert(session->flush(session->flush_user_data, &slot->is_task, sizeof(slot->is_task)));
     }
   }
 
   // Save list of folders that were open just prior to the first event in the buffer being saved
 #ifdef PRINT_FLUSH_INFO
-  printf("  Open folders at start of recording = %d\n", session->starting_folder_stack_count);
+  printf("  Open folders at start of recording = %d\n", contents->starting_folder_stack_count);
 #endif
-  assert(session->flush(session->flush_user_data, &session->starting_folder_stack_count, sizeof(session->starting_folder_stack_count)));
-  for (uint16_t i=0; i<session->starting_folder_stack_count; i++) {
+  assert(session->flush(session->flush_user_data, &contents->starting_folder_stack_count, sizeof(contents->starting_folder_stack_count)));
+  for (uint16_t i=0; i<contents->starting_folder_stack_count; i++) {
 #ifdef PRINT_FLUSH_INFO
-    printf("    '%s'\n", session->folder_registration_list[session->starting_folder_stack[i]].name);
+    printf("    '%s'\n", session->folder_registration_list[contents->starting_folder_stack[i]].name);
 #endif
-    assert(session->flush(session->flush_user_data, &session->starting_folder_stack[i], sizeof(session->starting_folder_stack[i])));
-  }
-  // Now that there are no events in the buffer, need to reset the starting folder stack to be the same as the current folder stack
-  session->starting_folder_stack_count = session->curr_folder_stack_count;
-  for (uint16_t i=0; i<session->starting_folder_stack_count; i++) {
-    session->starting_folder_stack[i] = session->curr_folder_stack[i];
+    assert(session->flush(session->flush_user_data, &contents->starting_folder_stack[i], sizeof(contents->starting_folder_stack[i])));
   }
 
   // Events
 #ifdef PRINT_FLUSH_INFO
-  printf("  num_stored_events = %d (max count = %d)\n", session->num_stored_events, session->max_event_count);
+  printf("  has_spans = %s\n", session->record_spans ? "yes" : "no");
+  printf("  event_count = %d\n", event_count);
 #endif
-  assert(session->flush(session->flush_user_data, &session->num_stored_events, sizeof(session->num_stored_events)));
-  uint32_t index = session->first_unsaved_event_index;
-  for (uint32_t i=0; i<session->num_stored_events; i++) {
-    Event *event = &session->events_buffer[index];
+  assert(session->flush(session->flush_user_data, &session->record_spans, sizeof(session->record_spans)));
+  assert(session->flush(session->flush_user_data, &event_count, sizeof(event_count)));
+  for (uint32_t i=0; i<event_count; i++) {
+    Event *event = sorted_flush_list[i];
     // Time
     assert(session->flush(session->flush_user_data, &event->time, sizeof(event->time)));
     // Event ID
@@ -571,6 +2327,14 @@ static void flushEvents(UnikornSession *session) {
 #ifdef PRINT_FLUSH_INFO
     printf("    time=%"UINT64_FORMAT", event_id=%d\n", time, event_id);
 #endif
+    // Span
+    if (session->record_spans) {
+      assert(session->flush(session->flush_user_data, &event->is_span, sizeof(event->is_span)));
+      if (event->is_span) assert(session->flush(session->flush_user_data, &event->span_duration, sizeof(event->span_duration)));
+#ifdef PRINT_FLUSH_INFO
+      printf("    is_span=%s, span_duration=%"UINT64_FORMAT"\n", event->is_span ? "yes" : "no", event->span_duration);
+#endif
+    }
     // Instance
     if (session->record_instance) {
       assert(session->flush(session->flush_user_data, &event->instance, sizeof(event->instance)));
@@ -585,14 +2349,24 @@ static void flushEvents(UnikornSession *session) {
       printf("    value=%f\n", value);
 #endif
     }
-    // Thread ID
+    // Thread slot
     if (session->is_multi_threaded) {
-      uint16_t thread_index = getThreadIndex(event->thread_id, session->thread_id_list, session->thread_id_list_count);
-      assert(session->flush(session->flush_user_data, &thread_index, sizeof(thread_index)));
+      assert(session->flush(session->flush_user_data, &event->thread_slot, sizeof(event->thread_slot)));
+#ifdef PRINT_FLUSH_INFO
+      printf("    thread_slot=%d\n", event->thread_slot);
+#endif
+    }
+    // CPU index
+    if (session->record_cpu) {
+      assert(session->flush(session->flush_user_data, &event->cpu, sizeof(event->cpu)));
 #ifdef PRINT_FLUSH_INFO
-      printf("    thread_index=%d\n", thread_index);
+      printf("    cpu=%d\n", event->cpu);
 #endif
     }
+    // Counter values
+    if (session->counter_count > 0) {
+      assert(session->flush(session->flush_user_data, event->counter_values, session->counter_count*sizeof(uint64_t)));
+    }
     // Location
     if (session->record_file_location) {
       // File name
@@ -606,31 +2380,407 @@ static void flushEvents(UnikornSession *session) {
 #ifdef PRINT_FLUSH_INFO
       printf("    file='%s', function='%s', line=%d\n", file_name, function_name, line_number);
 #endif
-    }
-
-    index = (index + 1) % session->max_event_count;
-  }
-
-  // Reset accounting of the event buffer
-  session->num_stored_events = 0;
-  session->curr_event_index = 0;
-  session->first_unsaved_event_index = 0;
-
-  // Cleanup
-  ok = session->finishFlush(session->flush_user_data);
-  assert(ok);
-  if (file_name_count > 0) free(file_name_list);
-  if (function_name_count > 0) free(function_name_list);
+    }
+  }
+
+  // Histograms
+  if (session->aggregate_only) flushHistograms(session, keep_events);
+
+  // Paused time ranges
+  if (contents->is_spill) {
+    // The spill thread doesn't hold the session's mutex, so the pauses are left for the next ukFlush()
+    uint32_t pause_count = 0;
+    assert(session->flush(session->flush_user_data, &pause_count, sizeof(pause_count)));
+  } else {
+    flushPauses(session, keep_events);
+  }
+
+  // Clock anchor at the time of the flush, so viewers can correct for the clocks drifting apart over a long recording
+  {
+    ClockAnchor flush_anchor = sampleClockAnchor(session);
+#ifdef PRINT_FLUSH_INFO
+    printf("  flush anchor: time=%" UINT64_FORMAT ", wall_time=%" UINT64_FORMAT "\n", flush_anchor.time, flush_anchor.wall_time);
+#endif
+    assert(session->flush(session->flush_user_data, &flush_anchor.time, sizeof(flush_anchor.time)));
+    assert(session->flush(session->flush_user_data, &flush_anchor.wall_time, sizeof(flush_anchor.wall_time)));
+  }
+
+  // Clock offsets to other processes
+  if (contents->is_spill) {
+    // Same as the pauses: left for the next ukFlush()
+    uint32_t clock_sync_count = 0;
+    assert(session->flush(session->flush_user_data, &clock_sync_count, sizeof(clock_sync_count)));
+  } else {
+    flushClockSyncs(session, keep_events);
+  }
+
+  // Cleanup
+  ok = session->finishFlush(session->flush_user_data);
+  assert(ok);
+  if (!session->real_time) {
+    free(event_list);
+    free(flush_list);
+    if (scratch_list != NULL) free(scratch_list);
+    if (file_name_count > 0) free(file_name_list);
+    if (function_name_count > 0) free(function_name_list);
+  }
+  return true;
+}
+
+static void resetFlushedBuffers(UnikornSession *session, FlushContents *contents) {
+  initEventBufferAccounting(contents->main_buffer);
+  for (uint16_t i=0; i<session->cpu_buffer_count; i++) {
+    initEventBufferAccounting(&contents->cpu_buffer_list[i]);
+  }
+  for (uint16_t i=0; session->event_ring_count>0 && i<session->event_registration_count; i++) {
+    EventBuffer *ring = flushRing(session, contents, i);
+    if (ring != NULL) initEventBufferAccounting(ring);
+  }
+}
+
+static void saveEvents(UnikornSession *session, bool keep_events) {
+  // NOTE: The session mutex is already locked, but the per CPU buffers also need to be locked so no other thread can record into them during the flush
+  lockCpuBuffers(session);
+  closeInlineRange(session);
+  FlushContents contents = {
+    .main_buffer = &session->main_buffer,
+    .cpu_buffer_list = session->cpu_buffer_list,
+    .ring_list = NULL,
+    .has_thresholds = session->has_thresholds,
+    .thread_slot_count = session->thread_slot_count,
+    .thread_slot_list = session->thread_slot_list,
+    .starting_folder_stack_count = session->starting_folder_stack_count,
+    .starting_folder_stack = session->starting_folder_stack,
+    .is_spill = false
+  };
+  if (writeFlush(session, &contents, keep_events)) {
+    // Now that there are no events in the buffer, need to reset the starting folder stack to be the same as the current folder stack
+    session->starting_folder_stack_count = session->curr_folder_stack_count;
+    for (uint16_t i=0; i<session->starting_folder_stack_count; i++) {
+      session->starting_folder_stack[i] = session->curr_folder_stack[i];
+    }
+    // Reset accounting of the event buffers
+    if (!keep_events) resetFlushedBuffers(session, &contents);
+  }
+  unlockCpuBuffers(session);
+}
+
+
+static void flushEvents(UnikornSession *session) {
+  saveEvents(session, false);
+}
+
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+static void swapEventBuffers(EventBuffer *buffer, EventBuffer *spare) {
+  // Everything but the mutex, so a thread waiting on the buffer's mutex still gets the buffer it asked for
+  EventBuffer temp;
+  size_t bytes = offsetof(EventBuffer, mutex);
+  memcpy(&temp, buffer, bytes);
+  memcpy(buffer, spare, bytes);
+  memcpy(spare, &temp, bytes);
+}
+
+static bool spillEvents(UnikornSession *session, EventBuffer *full_buffer) {
+  // NOTE: The session mutex is already locked. Returns false if full_buffer is still full, which only happens if every spare is busy and the policy is to drop events.
+  while (session->free_spill_buffers == NULL) {
+    if (session->spill_policy != UK_SPILL_BLOCK) return false;
+    pthread_cond_wait(&session->spill_done_cond, &session->mutex);
+  }
+  lockCpuBuffers(session);
+  if (!isEventBufferFull(full_buffer)) {
+    // Another thread spilled the buffers first
+    unlockCpuBuffers(session);
+    return true;
+  }
+  SpillBuffers *spill = session->free_spill_buffers;
+  session->free_spill_buffers = spill->next;
+
+  // Swap in the spares, so recording continues while the spill thread writes the full buffers
+  uint64_t oldest_time = 0;
+  bool has_events = getOldestBufferedTime(&session->main_buffer, false, &oldest_time);
+  swapEventBuffers(&session->main_buffer, &spill->main_buffer);
+  for (uint16_t i=0; i<session->cpu_buffer_count; i++) {
+    has_events = getOldestBufferedTime(&session->cpu_buffer_list[i], has_events, &oldest_time);
+    swapEventBuffers(&session->cpu_buffer_list[i], &spill->cpu_buffer_list[i]);
+  }
+  for (uint16_t i=0; session->event_ring_count>0 && i<session->event_registration_count; i++) {
+    EventBuffer *ring = session->event_registration_list[i].ring;
+    if (ring == NULL) continue;
+    has_events = getOldestBufferedTime(ring, has_events, &oldest_time);
+    swapEventBuffers(ring, spill->ring_list[i]);
+  }
+  spill->has_events = has_events;
+  spill->oldest_time = oldest_time;
+  spill->has_thresholds = session->has_thresholds;
+
+  // The spilled events start with the folders that were open before them, and the spares start with the folders open now
+  spill->starting_folder_stack_count = session->starting_folder_stack_count;
+  for (uint16_t i=0; i<session->starting_folder_stack_count; i++) {
+    spill->starting_folder_stack[i] = session->starting_folder_stack[i];
+  }
+  session->starting_folder_stack_count = session->curr_folder_stack_count;
+  for (uint16_t i=0; i<session->starting_folder_stack_count; i++) {
+    session->starting_folder_stack[i] = session->curr_folder_stack[i];
+  }
+  unlockCpuBuffers(session);
+
+  // Queue for the spill thread
+  spill->is_busy = true;
+  spill->next = NULL;
+  if (session->last_spill == NULL) session->first_spill = spill;
+  else session->last_spill->next = spill;
+  session->last_spill = spill;
+  session->busy_spill_count++;
+  pthread_cond_signal(&session->spill_ready_cond);
+  return true;
+}
+
+static void *spillThread(void *data) {
+  // Writes the spilled buffers in the order they were spilled, each as its own flush
+  UnikornSession *session = (UnikornSession *)data;
+  pthread_mutex_lock(&session->mutex);
+  while (true) {
+    while (session->first_spill == NULL && !session->stop_spilling) {
+      pthread_cond_wait(&session->spill_ready_cond, &session->mutex);
+    }
+    if (session->first_spill == NULL) break; // Stopping, and nothing left to write
+    SpillBuffers *spill = session->first_spill;
+    session->first_spill = spill->next;
+    if (session->first_spill == NULL) session->last_spill = NULL;
+    // New threads may grow the slot list while the events are written, so write from a copy. It only grows if more threads recorded since the last spill.
+    uint16_t thread_slot_count = session->thread_slot_count;
+    if (thread_slot_count > session->spill_thread_slot_capacity) {
+      uint32_t capacity = 2*(uint32_t)session->spill_thread_slot_capacity;
+      while (capacity < thread_slot_count) capacity *= 2;
+      session->spill_thread_slot_capacity = (capacity > USHRT_MAX) ? USHRT_MAX : (uint16_t)capacity;
+      session->spill_thread_slot_list = realloc(session->spill_thread_slot_list, session->spill_thread_slot_capacity*sizeof(ThreadSlot));
+      assert(session->spill_thread_slot_list != NULL);
+    }
+    ThreadSlot *thread_slot_list = session->spill_thread_slot_list;
+    if (thread_slot_count > 0) memcpy(thread_slot_list, session->thread_slot_list, thread_slot_count*sizeof(ThreadSlot));
+    pthread_mutex_unlock(&session->mutex);
+
+    // NOTE: Nothing else flushes while spilled buffers are busy (see waitForSpills()), so the flush functions and lists are not shared
+    FlushContents contents = {
+      .main_buffer = &spill->main_buffer,
+      .cpu_buffer_list = spill->cpu_buffer_list,
+      .ring_list = spill->ring_list,
+      .has_thresholds = spill->has_thresholds,
+      .thread_slot_count = thread_slot_count,
+      .thread_slot_list = thread_slot_list,
+      .starting_folder_stack_count = spill->starting_folder_stack_count,
+      .starting_folder_stack = spill->starting_folder_stack,
+      .is_spill = true
+    };
+    writeFlush(session, &contents, false);
+    resetFlushedBuffers(session, &contents);
+
+    pthread_mutex_lock(&session->mutex);
+    spill->is_busy = false;
+    spill->next = session->free_spill_buffers;
+    session->free_spill_buffers = spill;
+    session->busy_spill_count--;
+    pthread_cond_broadcast(&session->spill_done_cond);
+  }
+  pthread_mutex_unlock(&session->mutex);
+  return NULL;
+}
+#endif
+
+static bool flushFullBuffer(UnikornSession *session, EventBuffer *buffer) {
+  // NOTE: The session mutex is already locked. Returns false if the buffer is still full (see spillEvents()).
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->spill_when_full) return spillEvents(session, buffer);
+#else
+  (void)buffer;
+#endif
+  flushEvents(session);
+  return true;
+}
+
+static void spillIfFull(UnikornSession *session, EventBuffer *buffer) {
+  // NOTE: The session mutex is already locked. Needed before recording, since spillEvents() unlocks the mutex while waiting for a spare, so other threads can find the buffer full.
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->spill_when_full && isEventBufferFull(buffer)) spillEvents(session, buffer);
+#else
+  (void)session;
+  (void)buffer;
+#endif
+}
+
+static void waitForSpills(UnikornSession *session) {
+  // NOTE: The session mutex is already locked. Needed before anything the spill thread uses is changed, and before a flush, since the spilled events are older.
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  while (session->busy_spill_count > 0) {
+    pthread_cond_wait(&session->spill_done_cond, &session->mutex);
+  }
+#else
+  (void)session;
+#endif
+}
+
+void ukFlush(void *session_ref) {
+  UnikornSession *session = (UnikornSession *)session_ref;
+  assert(session->magic_value1 == MAGIC_VALUE1);
+  assert(session->magic_value2 == MAGIC_VALUE2);
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->is_multi_threaded) pthread_mutex_lock(&session->mutex);
+#endif
+  waitForSpills(session);
+  flushEvents(session);
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->is_multi_threaded) pthread_mutex_unlock(&session->mutex);
+#endif
+}
+
+void ukFlushTo(void *session_ref, bool keep_events,
+               void *flush_user_data,
+               bool (*prepareFlush)(void *user_data),
+               bool (*flush)(void *user_data, const void *data, size_t bytes),
+               bool (*finishFlush)(void *user_data)) {
+  UnikornSession *session = (UnikornSession *)session_ref;
+  assert(session->magic_value1 == MAGIC_VALUE1);
+  assert(session->magic_value2 == MAGIC_VALUE2);
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->is_multi_threaded) pthread_mutex_lock(&session->mutex);
+#endif
+  waitForSpills(session);
+  // Temporarily swap in the given flush functions
+  void *prev_flush_user_data = session->flush_user_data;
+  bool (*prevPrepareFlush)(void *user_data) = session->prepareFlush;
+  bool (*prevFlush)(void *user_data, const void *data, size_t bytes) = session->flush;
+  bool (*prevFinishFlush)(void *user_data) = session->finishFlush;
+  session->flush_user_data = flush_user_data;
+  session->prepareFlush = prepareFlush;
+  session->flush = flush;
+  session->finishFlush = finishFlush;
+  saveEvents(session, keep_events);
+  session->flush_user_data = prev_flush_user_data;
+  session->prepareFlush = prevPrepareFlush;
+  session->flush = prevFlush;
+  session->finishFlush = prevFinishFlush;
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->is_multi_threaded) pthread_mutex_unlock(&session->mutex);
+#endif
+}
+
+void ukLockForFork(void *session_ref) {
+  UnikornSession *session = (UnikornSession *)session_ref;
+  assert(session->magic_value1 == MAGIC_VALUE1);
+  assert(session->magic_value2 == MAGIC_VALUE2);
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  // Same order as flushing: the session's mutex, then the per CPU buffers
+  if (session->is_multi_threaded) {
+    pthread_mutex_lock(&session->mutex);
+    // The spill thread is not copied to the child, so let it finish writing what's already spilled. It then only waits on spill_ready_cond, which doesn't hold the mutex.
+    waitForSpills(session);
+    lockCpuBuffers(session);
+  }
+#endif
+}
+
+void ukUnlockAfterFork(void *session_ref, bool is_child) {
+  UnikornSession *session = (UnikornSession *)session_ref;
+  assert(session->magic_value1 == MAGIC_VALUE1);
+  assert(session->magic_value2 == MAGIC_VALUE2);
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  // NOTE: In the child, the only thread is the one that called fork(), which is the thread that locked them
+  if (session->is_multi_threaded) {
+    if (is_child && session->spill_when_full) {
+      // Nothing is spilled (see ukLockForFork()), but the child needs its own spill thread. The condition variables may still count the parent's waiters.
+      pthread_cond_init(&session->spill_ready_cond, NULL);
+      pthread_cond_init(&session->spill_done_cond, NULL);
+      int rc = pthread_create(&session->spill_thread, NULL, spillThread, session);
+      assert(rc == 0);
+    }
+    unlockCpuBuffers(session);
+    pthread_mutex_unlock(&session->mutex);
+  }
+#else
+  (void)is_child;
+#endif
+}
+
+uint64_t ukDroppedEventCount(void *session_ref) {
+  UnikornSession *session = (UnikornSession *)session_ref;
+  assert(session->magic_value1 == MAGIC_VALUE1);
+  assert(session->magic_value2 == MAGIC_VALUE2);
+  return atomicLoad(&session->dropped_event_count);
+}
+
+void ukSetEventName(void *session_ref, uint16_t start_id, const char *name) {
+  UnikornSession *session = (UnikornSession *)session_ref;
+  assert(session->magic_value1 == MAGIC_VALUE1);
+  assert(session->magic_value2 == MAGIC_VALUE2);
+  assert(start_id >= session->first_event_id);
+  uint16_t event_registration_index = (start_id - session->first_event_id) / 2;
+  assert(event_registration_index < session->event_registration_count);
+  assert(session->event_registration_list[event_registration_index].start_id == start_id);
+  if (strlen(name) >= MAX_NAME_LENGTH) { printf("Event name='%s' has more than %d chars.\n", name, MAX_NAME_LENGTH); assert(0); }
+  char *new_name = strdup(name);
+  assert(new_name != NULL);
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->is_multi_threaded) pthread_mutex_lock(&session->mutex);
+#endif
+  waitForSpills(session);
+  char *old_name = session->event_registration_list[event_registration_index].name;
+  session->event_registration_list[event_registration_index].name = new_name;
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->is_multi_threaded) pthread_mutex_unlock(&session->mutex);
+#endif
+  free(old_name);
+}
+
+void ukSetEventThreshold(void *session_ref, uint16_t start_id, uint64_t threshold) {
+  UnikornSession *session = (UnikornSession *)session_ref;
+  assert(session->magic_value1 == MAGIC_VALUE1);
+  assert(session->magic_value2 == MAGIC_VALUE2);
+  assert(start_id >= session->first_event_id);
+  uint16_t event_registration_index = (start_id - session->first_event_id) / 2;
+  assert(event_registration_index < session->event_registration_count);
+  assert(session->event_registration_list[event_registration_index].start_id == start_id);
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->is_multi_threaded) pthread_mutex_lock(&session->mutex);
+#endif
+  session->event_registration_list[event_registration_index].threshold = threshold;
+  if (threshold > 0) session->has_thresholds = true;
+  if (!session->is_multi_threaded) preallocThreadState(session, &session->staged_events, &session->sample_states);
+  updatePlainRecording(session);
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->is_multi_threaded) pthread_mutex_unlock(&session->mutex);
+#endif
 }
 
-void ukFlush(void *session_ref) {
+void ukSetEventCapacity(void *session_ref, uint16_t start_id, uint32_t max_event_count) {
   UnikornSession *session = (UnikornSession *)session_ref;
   assert(session->magic_value1 == MAGIC_VALUE1);
   assert(session->magic_value2 == MAGIC_VALUE2);
+  assert(start_id >= session->first_event_id);
+  uint16_t event_registration_index = (start_id - session->first_event_id) / 2;
+  assert(event_registration_index < session->event_registration_count);
+  PrivateEventInfo *event = &session->event_registration_list[event_registration_index];
+  assert(event->start_id == start_id);
+  if (max_event_count < MIN_EVENT_COUNT) { printf("Expected the capacity=%d of event '%s' to be at least %d\n", max_event_count, event->name, MIN_EVENT_COUNT); assert(0); }
+  if (session->aggregate_only) return; // Events are not stored
 #ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
   if (session->is_multi_threaded) pthread_mutex_lock(&session->mutex);
 #endif
-  flushEvents(session);
+  if (event->ring != NULL) { printf("The capacity of event '%s' was already set\n", event->name); assert(0); }
+  waitForSpills(session);
+  EventBuffer *ring = malloc(sizeof(EventBuffer));
+  assert(ring != NULL);
+  initEventBuffer(session, ring, max_event_count);
+  event->ring = ring;
+  for (uint16_t i=0; i<session->spill_buffer_count; i++) {
+    // Each set of spare buffers needs a spare of the new buffer
+    EventBuffer *spare_ring = malloc(sizeof(EventBuffer));
+    assert(spare_ring != NULL);
+    initEventBuffer(session, spare_ring, max_event_count);
+    session->spill_buffer_list[i].ring_list[event_registration_index] = spare_ring;
+  }
+  session->event_ring_count++;
+  if (session->real_time) prepareRealTimeFlush(session);
+  updatePlainRecording(session);
 #ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
   if (session->is_multi_threaded) pthread_mutex_unlock(&session->mutex);
 #endif
@@ -641,6 +2791,26 @@ void ukDestroy(void *session_ref) {
   UnikornSession *session = (UnikornSession *)session_ref;
   assert(session->magic_value1 == MAGIC_VALUE1);
   assert(session->magic_value2 == MAGIC_VALUE2);
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->spill_when_full) {
+    // The spill thread writes what is still spilled before it stops
+    pthread_mutex_lock(&session->mutex);
+    session->stop_spilling = true;
+    pthread_cond_signal(&session->spill_ready_cond);
+    pthread_mutex_unlock(&session->mutex);
+    pthread_join(session->spill_thread, NULL);
+    for (uint16_t i=0; i<session->spill_buffer_count; i++) {
+      freeSpillBuffers(session, &session->spill_buffer_list[i]);
+    }
+    free(session->spill_buffer_list);
+    free(session->spill_thread_slot_list);
+    pthread_cond_destroy(&session->spill_ready_cond);
+    pthread_cond_destroy(&session->spill_done_cond);
+    if (session->dropped_event_count > 0) {
+      printf("Unikorn: %llu events were dropped because every spill buffer was busy (see UkAttrs.spill_buffer_count and UkAttrs.spill_policy)\n", (unsigned long long)session->dropped_event_count);
+    }
+  }
+#endif
   if (session->folder_registration_count > 0) {
     for (uint16_t i=0; i<session->folder_registration_count; i++) {
       free(session->folder_registration_list[i].name);
@@ -651,14 +2821,51 @@ void ukDestroy(void *session_ref) {
   }
   if (session->event_registration_count > 0) {
     for (uint16_t i=0; i<session->event_registration_count; i++) {
+      if (session->event_registration_list[i].ring != NULL) {
+        freeEventBuffer(session->event_registration_list[i].ring);
+        free(session->event_registration_list[i].ring);
+      }
       free(session->event_registration_list[i].name);
       free(session->event_registration_list[i].start_value_name);
       free(session->event_registration_list[i].end_value_name);
     }
     free(session->event_registration_list);
+    free(session->instance_counter_list);
+  }
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->is_multi_threaded) {
+    // NOTE: Deleting the key means threadExited() will no longer be called for the remaining threads
+    pthread_key_delete(session->thread_key);
+  }
+#endif
+  if (session->thread_slot_count > 0) {
+    for (uint16_t i=0; i<session->thread_slot_count; i++) {
+      ThreadInfo *thread_info = session->thread_slot_list[i].thread_info;
+      if (thread_info != NULL) freeThreadInfo(thread_info);
+    }
+    free(session->thread_slot_list);
+  }
+  free(session->task_table);
+  while (session->ended_task_list != NULL) {
+    ThreadInfo *task_info = session->ended_task_list;
+    session->ended_task_list = task_info->next_ended_task;
+    free(task_info); // Already cleared by ukEndTask()
+  }
+  closeCounters(&session->counter_reader);
+  freeAggregateStarts(&session->aggregate_starts);
+  freeStagedEvents(&session->staged_events);
+  free(session->sample_states);
+  free(session->histogram_list);
+  free(session->pause_list);
+  free(session->clock_sync_list);
+  if (session->flush_memory != NULL) freeLockedMemory(session->flush_memory, session->flush_memory_bytes);
+  freeEventBuffer(&session->main_buffer);
+  if (session->cpu_buffer_count > 0) {
+    for (uint16_t i=0; i<session->cpu_buffer_count; i++) {
+      freeEventBuffer(&session->cpu_buffer_list[i]);
+    }
+    free(session->cpu_buffer_list);
   }
-  if (session->thread_id_list_count > 0) free(session->thread_id_list);
-  free(session->events_buffer);
 #ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
   pthread_mutex_destroy(&session->mutex);
 #endif
@@ -676,93 +2883,697 @@ static uint64_t getTime() {
 }
 #endif
 
-static void recordEvent(UnikornSession *session, uint16_t event_id, double value, uint64_t instance, const char *file, const char *function, uint16_t line_number) {
+static void overwriteOldestEvent(UnikornSession *session, EventBuffer *buffer) {
+  // Buffer was already full, must not have auto save enabled (or spilling with every spare buffer busy)
+  if (session->spill_when_full) atomicAdd(&session->dropped_event_count, 1);
+  TimeChunk *chunk = &buffer->chunk_list[buffer->first_chunk];
+  // If the event is a folder, need to remember it was opened/closed. Skipped if there are no folders, since the oldest event is usually not in the cache.
+  if (session->folder_registration_count > 0) {
+    uint16_t replaced_event_id = buffer->event_id_list[firstEventSlot(buffer)];
+    if (replaced_event_id < session->folder_registration_count) {
+      // This is a folder event
+      if (replaced_event_id == CLOSE_FOLDER_ID) {
+        popStartingFolderStack(session);
+      } else {
+        pushStartingFolderStack(session, replaced_event_id);
+      }
+    }
+  }
+  buffer->num_stored_events--;
+  chunk->first_event_index++;
+  if (chunk->first_event_index == chunk->event_count) {
+    // Chunk is empty
+    buffer->first_chunk = (buffer->first_chunk + 1) % buffer->chunk_count;
+    buffer->used_chunk_count--;
+  }
+}
+
+static uint32_t nextEventSlot(UnikornSession *session, EventBuffer *buffer, uint64_t time) {
+  // Returns the slot to store the event in. A new chunk is started if the current chunk is full or the time is too far from the chunk's base time.
+  if (session->is_inline_range_open) closeInlineRange(session);
+  if (buffer->num_stored_events >= buffer->max_event_count) overwriteOldestEvent(session, buffer);
+  if (buffer->used_chunk_count > 0) {
+    TimeChunk *chunk = &buffer->chunk_list[buffer->curr_chunk];
+    int64_t time_delta = (int64_t)(time - chunk->base_time); // Can be negative if the event was staged
+    if (chunk->event_count < TIME_CHUNK_EVENT_COUNT && time_delta >= INT32_MIN && time_delta <= INT32_MAX) {
+      uint32_t slot = buffer->curr_chunk * TIME_CHUNK_EVENT_COUNT + chunk->event_count;
+      buffer->time_delta_list[slot] = (int32_t)time_delta;
+      chunk->event_count++;
+      return slot;
+    }
+  }
+  // Chunks that ended early can use up the chunk list before max_event_count is reached, so free the oldest chunk
+  while (buffer->used_chunk_count == buffer->chunk_count) overwriteOldestEvent(session, buffer);
+  buffer->curr_chunk = (buffer->used_chunk_count == 0) ? buffer->first_chunk : (buffer->curr_chunk + 1) % buffer->chunk_count;
+  buffer->used_chunk_count++;
+  TimeChunk *chunk = &buffer->chunk_list[buffer->curr_chunk];
+  chunk->base_time = time;
+  chunk->first_event_index = 0;
+  chunk->event_count = 1;
+  uint32_t slot = buffer->curr_chunk * TIME_CHUNK_EVENT_COUNT;
+  buffer->time_delta_list[slot] = 0;
+  return slot;
+}
+
+static void openInlineRange(UnikornSession *session) {
+  // Give ukRecordEventInline() the free slots of the current chunk
+  if (!session->use_inline_recording || session->is_inline_range_open || session->is_paused) return;
+  EventBuffer *buffer = &session->main_buffer;
+  if (buffer->used_chunk_count == 0) return;
+  TimeChunk *chunk = &buffer->chunk_list[buffer->curr_chunk];
+  uint32_t slot_count = TIME_CHUNK_EVENT_COUNT - chunk->event_count;
+  uint32_t free_count = buffer->max_event_count - buffer->num_stored_events;
+  if (!session->flush_when_full) {
+    // The oldest events will be overwritten by the next events anyway, so make room for the whole range now. Can't overwrite from the current chunk.
+    while (free_count < slot_count && buffer->first_chunk != buffer->curr_chunk) {
+      overwriteOldestEvent(session, buffer);
+      free_count++;
+    }
+  }
+  // If flushing when full, the event that fills the buffer must be recorded out of line so it triggers the flush
+  if (session->flush_when_full && free_count > 0) free_count--;
+  if (slot_count > free_count) slot_count = free_count;
+  if (slot_count == 0) return;
+  UkInlineState *state = &session->inline_state;
+  session->inline_range_start = buffer->curr_chunk * TIME_CHUNK_EVENT_COUNT + chunk->event_count;
+  state->next_slot = session->inline_range_start;
+  state->end_slot = session->inline_range_start + slot_count;
+  state->base_time = chunk->base_time;
+  session->is_inline_range_open = true;
+}
+
+static bool recordEvent(UnikornSession *session, EventBuffer *buffer, uint16_t event_id, double value, uint64_t instance, uint16_t thread_slot, const uint64_t *counter_values, const char *file, const char *function, uint16_t line_number, const SpanTimes *span) {
+  // Returns true if the buffer is full and needs to be flushed. If span is not NULL, the event is the span's start event, and is stored at the end time.
+  if (session->drop_newest_when_full && isEventBufferFull(buffer)) {
+    // Every spare buffer is busy (see spillEvents())
+    atomicAdd(&session->dropped_event_count, 1);
+    return true;
+  }
 #ifdef TEST_RECORDING_OVERHEAD
   uint64_t t1 = getTime();
   t1 = getTime();
 #endif
 
   // Store the required values
-  Event *event = &session->events_buffer[session->curr_event_index];
-  uint16_t replaced_event_id = event->event_id; // Need for book keeping at the end of this function
-  event->time = session->clockNanoseconds();
-  event->event_id = event_id;
+  uint32_t slot = nextEventSlot(session, buffer, (span == NULL) ? session->clockNanoseconds() : span->end_time);
+  buffer->event_id_list[slot] = event_id;
+  if (span != NULL) {
+    buffer->event_id_list[slot] |= SPAN_EVENT_FLAG;
+    buffer->span_duration_list[slot] = span->end_time - span->start_time;
+  }
 
   // Store the optional values
-  // IMPORTANT: Even if the following will not be flushed, statistically the time overhead to record this extra info was indistinguisable from commenting it out and re-timing.
-  //            The most costly part is myThreadId(), which multiplies the overhead by about 10x:
+  // IMPORTANT: The most costly part used to be myThreadId(), which multiplied the overhead by about 10x, so it's now only called once per thread (see myThreadInfo()):
   //            Testing: Intel® Core™ i7-7700K CPU @ 4.20GHz × 8 using clock_gettime(CLOCK_MONOTONIC, &curr_time)
   //                     No thread ID recorded:  ~250 ns
   //                        Thread ID recorded: ~2000 ns
-  event->instance = instance;
-  event->value = value;
-#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
-  if (session->is_multi_threaded) {
-    event->thread_id = myThreadId();
+  if (buffer->instance_list != NULL) buffer->instance_list[slot] = instance;
+  if (buffer->value_list != NULL) buffer->value_list[slot] = value;
+  if (buffer->thread_slot_list != NULL) buffer->thread_slot_list[slot] = thread_slot;
+  if (buffer->cpu_list != NULL) {
+    int cpu = myCpu();
+    buffer->cpu_list[slot] = (cpu < 0 || cpu >= UNKNOWN_CPU) ? UNKNOWN_CPU : (uint16_t)cpu;
+  }
+  if (session->counter_count > 0) {
+    uint64_t *values = &buffer->counter_values[slot * session->counter_count];
+    if (counter_values != NULL) {
+      memcpy(values, counter_values, session->counter_count*sizeof(uint64_t));
+    } else {
+      memset(values, 0, session->counter_count*sizeof(uint64_t));
+    }
+  }
+  if (buffer->file_name_list != NULL) {
+    buffer->file_name_list[slot] = (char *)file;
+    buffer->function_name_list[slot] = (char *)function;
+    buffer->line_number_list[slot] = line_number;
   }
-#endif
-  event->file_name = (char *)file;
-  event->function_name = (char *)function;
-  event->line_number = line_number;
 
-  // Set the index of the next future event
-  session->curr_event_index = (session->curr_event_index + 1) % session->max_event_count;
 #ifdef TEST_RECORDING_OVERHEAD
   uint64_t t2 = getTime();
 #endif
 
-  // See if time to flush or wrap
-  bool buffer_is_full = session->num_stored_events == session->max_event_count;
-  if (buffer_is_full) { // This can only happen if auto flush is off
-    // Buffer was already full, must not have auto save enabled
-    session->first_unsaved_event_index = (session->first_unsaved_event_index + 1) % session->max_event_count;
-    // If the event is a folder, need to remember it was opened/closed
-    if (replaced_event_id < session->folder_registration_count) {
-      // This is a folder event
-      if (replaced_event_id == CLOSE_FOLDER_ID) {
-        popStartingFolderStack(session);
-      } else {
-        pushStartingFolderStack(session, replaced_event_id);
+  // See if time to flush
+  buffer->num_stored_events++;
+  bool needs_flush = session->flush_when_full && isEventBufferFull(buffer);
+
+#ifdef TEST_RECORDING_OVERHEAD
+  uint64_t t3 = getTime();
+  printf("record time: %zd ns, book keeping time: %zd ns\n", t2-t1, t3-t2);
+#endif
+
+  return needs_flush;
+}
+
+static bool copyEvent(UnikornSession *session, EventBuffer *buffer, EventBuffer *src, uint32_t src_slot) {
+  // Same as recordEvent(), but the event was already recorded (e.g. staged). Returns true if the buffer is full and needs to be flushed
+  if (session->drop_newest_when_full && isEventBufferFull(buffer)) {
+    atomicAdd(&session->dropped_event_count, 1);
+    return true;
+  }
+  uint32_t slot = nextEventSlot(session, buffer, eventTime(src, src_slot));
+  buffer->event_id_list[slot] = src->event_id_list[src_slot];
+  if (src->event_id_list[src_slot] & SPAN_EVENT_FLAG) buffer->span_duration_list[slot] = src->span_duration_list[src_slot];
+  if (buffer->instance_list != NULL) buffer->instance_list[slot] = src->instance_list[src_slot];
+  if (buffer->value_list != NULL) buffer->value_list[slot] = src->value_list[src_slot];
+  if (buffer->thread_slot_list != NULL) buffer->thread_slot_list[slot] = src->thread_slot_list[src_slot];
+  if (buffer->cpu_list != NULL) buffer->cpu_list[slot] = src->cpu_list[src_slot];
+  if (session->counter_count > 0) {
+    memcpy(&buffer->counter_values[slot * session->counter_count], &src->counter_values[src_slot * session->counter_count], session->counter_count*sizeof(uint64_t));
+  }
+  if (buffer->file_name_list != NULL) {
+    buffer->file_name_list[slot] = src->file_name_list[src_slot];
+    buffer->function_name_list[slot] = src->function_name_list[src_slot];
+    buffer->line_number_list[slot] = src->line_number_list[src_slot];
+  }
+  buffer->num_stored_events++;
+  return session->flush_when_full && isEventBufferFull(buffer);
+}
+
+static uint64_t nextInstance(UnikornSession *session, uint16_t event_id, const SpanTimes *span) {
+  // A span is a start and end event, so its instance is also taken from the end ID's count
+  if (span != NULL) nextInstance(session, event_id+1, NULL);
+  uint64_t *instance_counter = &session->instance_counter_list[event_id - session->first_event_id];
+  if (!session->is_multi_threaded) return (*instance_counter)++;
+  // Staged events and per CPU buffers are recorded without locking the session's mutex
+#ifdef _WIN32
+  return (uint64_t)InterlockedIncrement64((volatile LONG64 *)instance_counter) - 1;
+#else
+  return __atomic_fetch_add(instance_counter, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+static EventBuffer *eventRing(UnikornSession *session, uint16_t event_id) {
+  // Returns NULL if the event type is stored with the other event types
+  if (session->event_ring_count == 0) return NULL;
+  uint16_t event_registration_index = ((event_id & ~SPAN_EVENT_FLAG) - session->first_event_id) / 2;
+  return session->event_registration_list[event_registration_index].ring;
+}
+
+static void commitStagedEvents(UnikornSession *session, StagedEvents *staged, uint64_t thread_id) {
+  // The staged instance is kept, so move its events to the event buffer
+  EventBuffer *stage = &staged->events;
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->record_per_cpu) {
+    EventBuffer *buffer = myCpuBuffer(session, thread_id);
+    pthread_mutex_lock(&buffer->mutex);
+    for (uint32_t i=0; i<stage->used_chunk_count; i++) {
+      uint32_t chunk_index = (stage->first_chunk + i) % stage->chunk_count;
+      for (uint32_t j=stage->chunk_list[chunk_index].first_event_index; j<stage->chunk_list[chunk_index].event_count; j++) {
+        uint32_t slot = chunk_index * TIME_CHUNK_EVENT_COUNT + j;
+        EventBuffer *ring = eventRing(session, stage->event_id_list[slot]);
+        if (ring != NULL) {
+          // The event type's own buffer is protected by the session's mutex
+          pthread_mutex_unlock(&buffer->mutex);
+          pthread_mutex_lock(&session->mutex);
+          spillIfFull(session, ring);
+          bool needs_flush = copyEvent(session, ring, stage, slot);
+          if (needs_flush) flushFullBuffer(session, ring);
+          pthread_mutex_unlock(&session->mutex);
+          pthread_mutex_lock(&buffer->mutex);
+          continue;
+        }
+        while (session->flush_when_full && isEventBufferFull(buffer)) {
+          // Can't hold the CPU buffer's mutex when locking the session's mutex, or else it could deadlock with another flush. Other threads may fill the buffer again before it's relocked.
+          pthread_mutex_unlock(&buffer->mutex);
+          pthread_mutex_lock(&session->mutex);
+          bool is_flushed = flushFullBuffer(session, buffer);
+          pthread_mutex_unlock(&session->mutex);
+          pthread_mutex_lock(&buffer->mutex);
+          if (!is_flushed) break; // Every spare buffer is busy, so the event is dropped or overwrites the oldest (see UkAttrs.spill_policy)
+        }
+        copyEvent(session, buffer, stage, slot);
       }
     }
+    bool needs_flush = session->flush_when_full && isEventBufferFull(buffer);
+    pthread_mutex_unlock(&buffer->mutex);
+    if (needs_flush) {
+      pthread_mutex_lock(&session->mutex);
+      flushFullBuffer(session, buffer);
+      pthread_mutex_unlock(&session->mutex);
+    }
+    initEventBufferAccounting(stage);
+    return;
+  }
+  if (session->is_multi_threaded) pthread_mutex_lock(&session->mutex);
+#else
+  (void)thread_id;
+#endif
+  for (uint32_t i=0; i<stage->used_chunk_count; i++) {
+    uint32_t chunk_index = (stage->first_chunk + i) % stage->chunk_count;
+    for (uint32_t j=stage->chunk_list[chunk_index].first_event_index; j<stage->chunk_list[chunk_index].event_count; j++) {
+      uint32_t slot = chunk_index * TIME_CHUNK_EVENT_COUNT + j;
+      EventBuffer *buffer = eventRing(session, stage->event_id_list[slot]);
+      if (buffer == NULL) buffer = &session->main_buffer;
+      spillIfFull(session, buffer);
+      bool needs_flush = copyEvent(session, buffer, stage, slot);
+      if (needs_flush) flushFullBuffer(session, buffer);
+    }
+  }
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->is_multi_threaded) pthread_mutex_unlock(&session->mutex);
+#endif
+  initEventBufferAccounting(stage);
+}
+
+static void stageEvent(UnikornSession *session, StagedEvents *staged, uint16_t event_registration_index, uint16_t event_id, double value, uint16_t thread_slot, uint64_t thread_id, const uint64_t *counter_values, const char *file, const char *function, uint16_t line_number, const SpanTimes *span) {
+  // NOTE: The staged events are only accessed by the calling thread, so no locking is needed until they are committed
+  // A span is only staged inside another instance, since it already has its end (see recordGeneralEvent())
+  PrivateEventInfo *event = &session->event_registration_list[event_registration_index];
+  bool is_start = event->start_id == event_id;
+  if (staged->depth == 0) {
+    // Start staging a new instance
+    if (staged->events.chunk_list == NULL) initEventBuffer(session, &staged->events, MAX_STAGED_EVENT_COUNT);
+    staged->event_registration_index = event_registration_index;
+  }
+  uint64_t instance = nextInstance(session, event_id, span);
+  recordEvent(session, &staged->events, event_id, value, instance, thread_slot, counter_values, file, function, line_number, span);
+  if (event_registration_index == staged->event_registration_index && span == NULL) {
+    if (is_start) staged->depth++;
+    else staged->depth--;
+  }
+
+  EventBuffer *stage = &staged->events;
+  if (staged->depth == 0) {
+    // The instance ended, so only keep it if it lasted long enough
+    uint64_t duration = eventTime(stage, lastEventSlot(stage)) - eventTime(stage, firstEventSlot(stage));
+    if (duration >= session->event_registration_list[staged->event_registration_index].threshold) {
+      commitStagedEvents(session, staged, thread_id);
+    } else {
+      initEventBufferAccounting(stage);
+    }
+  } else if (isEventBufferFull(stage)) {
+    // Too many events to stage, so keep the instance without knowing its duration. The rest of its events are recorded as usual.
+    commitStagedEvents(session, staged, thread_id);
+    staged->depth = 0;
+  }
+}
+
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+static void drainStagedEvents(UnikornSession *session, StagedEvents *staged, uint64_t thread_id) {
+  // The thread (or task) is going away with an instance still staged: it will never end, so keep it if it has already lasted long enough
+  if (staged->depth == 0) return;
+  EventBuffer *stage = &staged->events;
+  uint64_t duration = session->clockNanoseconds() - eventTime(stage, firstEventSlot(stage));
+  if (duration >= session->event_registration_list[staged->event_registration_index].threshold) {
+    commitStagedEvents(session, staged, thread_id);
   } else {
-    // Buffer not yet full
-    session->num_stored_events++;
-    if (session->flush_when_full && session->num_stored_events == session->max_event_count) {
-      flushEvents(session);
+    initEventBufferAccounting(stage);
+  }
+  staged->depth = 0;
+}
+#endif
+
+static bool isPaused(UnikornSession *session) {
+  // NOTE: Relaxed, since a thread recording an event while another thread pauses can't tell which happened first anyway
+#if defined(ENABLE_UNIKORN_ATOMIC_RECORDING) && !defined(_WIN32)
+  return __atomic_load_n(&session->is_paused, __ATOMIC_RELAXED);
+#else
+  return *(volatile bool *)&session->is_paused;
+#endif
+}
+
+static void setPaused(UnikornSession *session, bool is_paused) {
+#if defined(ENABLE_UNIKORN_ATOMIC_RECORDING) && !defined(_WIN32)
+  __atomic_store_n(&session->is_paused, is_paused, __ATOMIC_RELAXED);
+#else
+  *(volatile bool *)&session->is_paused = is_paused;
+#endif
+}
+
+void ukPause(void *session_ref) {
+  UnikornSession *session = (UnikornSession *)session_ref;
+  assert(session->magic_value1 == MAGIC_VALUE1);
+  assert(session->magic_value2 == MAGIC_VALUE2);
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->is_multi_threaded) pthread_mutex_lock(&session->mutex);
+#endif
+  if (!session->is_paused) {
+    closeInlineRange(session); // ukRecordEventInline() doesn't check if paused
+    session->pause_time = session->clockNanoseconds();
+    setPaused(session, true);
+  }
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->is_multi_threaded) pthread_mutex_unlock(&session->mutex);
+#endif
+}
+
+void ukResume(void *session_ref) {
+  UnikornSession *session = (UnikornSession *)session_ref;
+  assert(session->magic_value1 == MAGIC_VALUE1);
+  assert(session->magic_value2 == MAGIC_VALUE2);
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->is_multi_threaded) pthread_mutex_lock(&session->mutex);
+#endif
+  if (session->is_paused) {
+    if (session->real_time && session->pause_count == session->max_pause_count) {
+      // Real time mode: the list can't grow, so the previous pause is extended to the end of this one
+      session->pause_list[session->pause_count-1].resume_time = session->clockNanoseconds();
+    } else {
+      if (session->pause_count == session->max_pause_count) {
+        session->max_pause_count = (session->max_pause_count == 0) ? 10 : session->max_pause_count*2;
+        session->pause_list = realloc(session->pause_list, session->max_pause_count*sizeof(PauseInterval));
+        assert(session->pause_list != NULL);
+      }
+      PauseInterval *pause = &session->pause_list[session->pause_count];
+      pause->pause_time = session->pause_time;
+      pause->resume_time = session->clockNanoseconds();
+      session->pause_count++;
     }
+    setPaused(session, false);
   }
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->is_multi_threaded) pthread_mutex_unlock(&session->mutex);
+#endif
+}
 
-#ifdef TEST_RECORDING_OVERHEAD
-  uint64_t t3 = getTime();
-  printf("record time: %zd ns, book keeping time: %zd ns\n", t2-t1, t3-t2);
+void ukSetTaskId(void *session_ref, uint64_t task_id) {
+  UnikornSession *session = (UnikornSession *)session_ref;
+  OPTIONAL_ASSERT(session->magic_value1 == MAGIC_VALUE1);
+  OPTIONAL_ASSERT(session->magic_value2 == MAGIC_VALUE2);
+  if (!session->is_multi_threaded) { printf("Unikorn: ukSetTaskId() requires a session with is_multi_threaded==true\n"); assert(0); }
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  ThreadInfo *thread_info = myThreadInfo(session);
+  if (task_id == 0) {
+    // Back to recording as the thread
+    thread_info->curr_task_info = NULL;
+    return;
+  }
+  if (currTaskInfo(thread_info) != NULL && thread_info->curr_task_id == task_id) return; // Still running the same task
+
+  pthread_mutex_lock(&session->mutex);
+  if ((session->task_count+1)*2 > session->task_table_size) growTaskTable(session);
+  TaskEntry *entry = &session->task_table[taskTableIndex(session, task_id)];
+  if (entry->task_id == 0) {
+    // First time the task is running: give it its own thread slot
+    entry->task_id = task_id;
+    entry->task_info = newThreadInfo(session, task_id, true);
+    session->task_count++;
+  }
+  thread_info->curr_task_info = entry->task_info;
+  thread_info->curr_task_id = task_id;
+  pthread_mutex_unlock(&session->mutex);
+#else
+  (void)task_id;
 #endif
 }
 
-void ukRecordEvent(void *session_ref, uint16_t event_id, double value, const char *file, const char *function, uint16_t line_number) {
+void ukEndTask(void *session_ref, uint64_t task_id) {
   UnikornSession *session = (UnikornSession *)session_ref;
   OPTIONAL_ASSERT(session->magic_value1 == MAGIC_VALUE1);
   OPTIONAL_ASSERT(session->magic_value2 == MAGIC_VALUE2);
-  uint16_t event_registration_index = (event_id - session->first_event_id) / 2;
-  OPTIONAL_ASSERT(event_registration_index < session->event_registration_count*2);
-  PrivateEventInfo *event = &session->event_registration_list[event_registration_index];
-#ifdef PRINT_RECORD_INFO
-  printf("%s(): ID=%d, value=%f, file=%s, function=%s, line_number=%d\n", __FUNCTION__, event_id, value, file, function, line_number);
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (!session->is_multi_threaded || task_id == 0) return;
+  // If the calling thread is running the task, it goes back to recording as the thread
+  ThreadInfo *thread_info = (ThreadInfo *)pthread_getspecific(session->thread_key);
+  if (thread_info != NULL && currTaskInfo(thread_info) != NULL && thread_info->curr_task_id == task_id) thread_info->curr_task_info = NULL;
+
+  pthread_mutex_lock(&session->mutex);
+  ThreadInfo *task_info = NULL;
+  if (session->task_count > 0) {
+    uint32_t index = taskTableIndex(session, task_id);
+    task_info = session->task_table[index].task_info;
+    if (task_info != NULL) removeTaskEntry(session, index);
+  }
+  pthread_mutex_unlock(&session->mutex);
+  if (task_info == NULL) return;
+
+  // Same as a thread exiting: the slot is recycled once the task's events are no longer buffered
+  drainStagedEvents(session, &task_info->staged_events, task_info->thread_id);
+  // Other threads may still point to the info, so it's kept for reuse instead of freed. Clearing the ID stops them using it (see currTaskInfo()).
+  atomicExchange(&task_info->thread_id, 0);
+  clearThreadInfo(task_info);
+  pthread_mutex_lock(&session->mutex);
+  retireThreadSlot(session, task_info);
+  task_info->next_ended_task = session->ended_task_list;
+  session->ended_task_list = task_info;
+  pthread_mutex_unlock(&session->mutex);
+#else
+  (void)session;
+  (void)task_id;
 #endif
+}
 
+void ukRecordClockSync(void *session_ref, uint64_t peer_process_id, uint64_t time, int64_t offset, uint64_t round_trip) {
+  UnikornSession *session = (UnikornSession *)session_ref;
+  assert(session->magic_value1 == MAGIC_VALUE1);
+  assert(session->magic_value2 == MAGIC_VALUE2);
 #ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
   if (session->is_multi_threaded) pthread_mutex_lock(&session->mutex);
 #endif
+  if (session->clock_sync_count == session->max_clock_sync_count && !session->real_time) {
+    session->max_clock_sync_count = (session->max_clock_sync_count == 0) ? 10 : session->max_clock_sync_count*2;
+    session->clock_sync_list = realloc(session->clock_sync_list, session->max_clock_sync_count*sizeof(ClockSync));
+    assert(session->clock_sync_list != NULL);
+  }
+  if (session->clock_sync_count < session->max_clock_sync_count) {
+    // Real time mode: the list can't grow, so the sample is dropped if full
+    ClockSync *sync = &session->clock_sync_list[session->clock_sync_count];
+    sync->time = time;
+    sync->peer_process_id = peer_process_id;
+    sync->offset = offset;
+    sync->round_trip = round_trip;
+    session->clock_sync_count++;
+  }
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->is_multi_threaded) pthread_mutex_unlock(&session->mutex);
+#endif
+}
+
+static FORCE_INLINE void recordPlainEvent(UnikornSession *session, uint16_t event_id, double value, const char *file, const char *function, uint16_t line_number,
+                                          bool is_multi_threaded, bool record_instance, bool record_value, bool record_file_location, bool flush_when_full) {
+  // Same as recordGeneralEvent() followed by recordEvent(), but only for a plain event type (see updatePlainRecording()).
+  // The recording attributes are compile time constants in each of the functions below, so the compiler removes the unused stores and checks.
+  uint16_t thread_slot = 0;
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (is_multi_threaded) {
+    thread_slot = myTaskInfo(session)->thread_slot;
+    pthread_mutex_lock(&session->mutex);
+  }
+#else
+  (void)is_multi_threaded;
+#endif
+  EventBuffer *buffer = &session->main_buffer;
+  if (flush_when_full) spillIfFull(session, buffer);
+  uint32_t slot = nextEventSlot(session, buffer, session->clockNanoseconds());
+  buffer->event_id_list[slot] = event_id;
+  if (record_instance) {
+    uint64_t *instance_counter = &session->instance_counter_list[event_id - session->first_event_id];
+    // NOTE: Still atomic when multi-threaded, since the staged events of a thresholded event type are recorded without the session's mutex
+#ifdef _WIN32
+    buffer->instance_list[slot] = is_multi_threaded ? (uint64_t)InterlockedIncrement64((volatile LONG64 *)instance_counter) - 1 : (*instance_counter)++;
+#else
+    buffer->instance_list[slot] = is_multi_threaded ? __atomic_fetch_add(instance_counter, 1, __ATOMIC_RELAXED) : (*instance_counter)++;
+#endif
+  }
+  if (record_value) buffer->value_list[slot] = value;
+  if (is_multi_threaded) buffer->thread_slot_list[slot] = thread_slot;
+  if (record_file_location) {
+    buffer->file_name_list[slot] = (char *)file;
+    buffer->function_name_list[slot] = (char *)function;
+    buffer->line_number_list[slot] = line_number;
+  }
+  buffer->num_stored_events++;
+  if (flush_when_full && isEventBufferFull(buffer)) flushFullBuffer(session, buffer);
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (is_multi_threaded) pthread_mutex_unlock(&session->mutex);
+#endif
+}
+
+// One specialized record function per combination of the recording attributes. The index bits match plain_record_index (see updatePlainRecording())
+typedef void (*PlainRecordFunction)(UnikornSession *session, uint16_t event_id, double value, const char *file, const char *function, uint16_t line_number);
+#define DEFINE_PLAIN_RECORD_FUNCTION(_index) \
+  static void recordPlainEvent##_index(UnikornSession *session, uint16_t event_id, double value, const char *file, const char *function, uint16_t line_number) { \
+    recordPlainEvent(session, event_id, value, file, function, line_number, ((_index) & 1) != 0, ((_index) & 2) != 0, ((_index) & 4) != 0, ((_index) & 8) != 0, ((_index) & 16) != 0); \
+  }
+DEFINE_PLAIN_RECORD_FUNCTION(0)  DEFINE_PLAIN_RECORD_FUNCTION(1)  DEFINE_PLAIN_RECORD_FUNCTION(2)  DEFINE_PLAIN_RECORD_FUNCTION(3)
+DEFINE_PLAIN_RECORD_FUNCTION(4)  DEFINE_PLAIN_RECORD_FUNCTION(5)  DEFINE_PLAIN_RECORD_FUNCTION(6)  DEFINE_PLAIN_RECORD_FUNCTION(7)
+DEFINE_PLAIN_RECORD_FUNCTION(8)  DEFINE_PLAIN_RECORD_FUNCTION(9)  DEFINE_PLAIN_RECORD_FUNCTION(10) DEFINE_PLAIN_RECORD_FUNCTION(11)
+DEFINE_PLAIN_RECORD_FUNCTION(12) DEFINE_PLAIN_RECORD_FUNCTION(13) DEFINE_PLAIN_RECORD_FUNCTION(14) DEFINE_PLAIN_RECORD_FUNCTION(15)
+DEFINE_PLAIN_RECORD_FUNCTION(16) DEFINE_PLAIN_RECORD_FUNCTION(17) DEFINE_PLAIN_RECORD_FUNCTION(18) DEFINE_PLAIN_RECORD_FUNCTION(19)
+DEFINE_PLAIN_RECORD_FUNCTION(20) DEFINE_PLAIN_RECORD_FUNCTION(21) DEFINE_PLAIN_RECORD_FUNCTION(22) DEFINE_PLAIN_RECORD_FUNCTION(23)
+DEFINE_PLAIN_RECORD_FUNCTION(24) DEFINE_PLAIN_RECORD_FUNCTION(25) DEFINE_PLAIN_RECORD_FUNCTION(26) DEFINE_PLAIN_RECORD_FUNCTION(27)
+DEFINE_PLAIN_RECORD_FUNCTION(28) DEFINE_PLAIN_RECORD_FUNCTION(29) DEFINE_PLAIN_RECORD_FUNCTION(30) DEFINE_PLAIN_RECORD_FUNCTION(31)
+static const PlainRecordFunction L_plain_record_functions[32] = {
+  recordPlainEvent0,  recordPlainEvent1,  recordPlainEvent2,  recordPlainEvent3,  recordPlainEvent4,  recordPlainEvent5,  recordPlainEvent6,  recordPlainEvent7,
+  recordPlainEvent8,  recordPlainEvent9,  recordPlainEvent10, recordPlainEvent11, recordPlainEvent12, recordPlainEvent13, recordPlainEvent14, recordPlainEvent15,
+  recordPlainEvent16, recordPlainEvent17, recordPlainEvent18, recordPlainEvent19, recordPlainEvent20, recordPlainEvent21, recordPlainEvent22, recordPlainEvent23,
+  recordPlainEvent24, recordPlainEvent25, recordPlainEvent26, recordPlainEvent27, recordPlainEvent28, recordPlainEvent29, recordPlainEvent30, recordPlainEvent31
+};
+
+static void recordGeneralEvent(UnikornSession *session, PrivateEventInfo *event, uint16_t event_registration_index, uint16_t event_id, double value, const char *file, const char *function, uint16_t line_number, const SpanTimes *span) {
+  // The path for the event types and sessions that can't use the specialized record functions. If span is not NULL, event_id is the span's start ID.
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  ThreadInfo *thread_info = session->is_multi_threaded ? myThreadInfo(session) : NULL;
+  // If the thread is running a task (see ukSetTaskId()), the event belongs to the task, so start/end pairing follows the task across threads
+  ThreadInfo *task_info = (thread_info != NULL && currTaskInfo(thread_info) != NULL) ? thread_info->curr_task_info : thread_info;
+#endif
+
+  // Sampling: only record some of the instances
+  if (event->sample_ratio > 1) {
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+    SampleState **sample_states = (task_info != NULL) ? &task_info->sample_states : &session->sample_states;
+#else
+    SampleState **sample_states = &session->sample_states;
+#endif
+    bool is_kept = isSampled(session, sample_states, event_registration_index, event->start_id == event_id);
+    if (span != NULL) isSampled(session, sample_states, event_registration_index, false); // The span's end, which is kept if its start is
+    if (!is_kept) return;
+  }
+
+  if (session->aggregate_only) {
+    // Only update the event type's histogram
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+    AggregateStarts *starts = (task_info != NULL) ? &task_info->aggregate_starts : &session->aggregate_starts;
+#else
+    AggregateStarts *starts = &session->aggregate_starts;
+#endif
+    if (span != NULL) {
+      addHistogramDuration(&session->histogram_list[event_registration_index], span->end_time - span->start_time);
+    } else {
+      aggregateEvent(session, starts, event_registration_index, event->start_id == event_id);
+    }
+    return;
+  }
+
+  // Get the counter values before locking, since reading them is a system call
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  CounterReader *counter_reader = (thread_info != NULL) ? &thread_info->counter_reader : &session->counter_reader;
+#else
+  CounterReader *counter_reader = &session->counter_reader;
+#endif
+  uint64_t counter_values[MAX_COUNTERS];
+  if (session->counter_count > 0) readCounters(session, counter_reader, counter_values);
+
+  // Tail latency capture: stage the events until the duration of the thresholded instance is known
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  StagedEvents *staged = (task_info != NULL) ? &task_info->staged_events : &session->staged_events;
+#else
+  StagedEvents *staged = &session->staged_events;
+#endif
+  if (span != NULL && staged->depth == 0 && event->threshold > 0) {
+    // The span's duration is already known, so it's kept or dropped without staging
+    if (span->end_time - span->start_time < event->threshold) return;
+  } else if (staged->depth > 0 || (event->threshold > 0 && event->start_id == event_id)) {
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+    uint16_t staged_thread_slot = (task_info != NULL) ? task_info->thread_slot : 0;
+    uint64_t thread_id = (thread_info != NULL) ? thread_info->thread_id : 0;
+#else
+    uint16_t staged_thread_slot = 0;
+    uint64_t thread_id = 0;
+#endif
+    stageEvent(session, staged, event_registration_index, event_id, value, staged_thread_slot, thread_id, counter_values, file, function, line_number, span);
+    return;
+  }
+
+  if (event->ring != NULL) {
+    // The event type has its own buffer, so the other event types can't overwrite its events
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+    uint16_t ring_thread_slot = (task_info != NULL) ? task_info->thread_slot : 0;
+    if (session->is_multi_threaded) pthread_mutex_lock(&session->mutex);
+#else
+    uint16_t ring_thread_slot = 0;
+#endif
+    spillIfFull(session, event->ring);
+    uint64_t instance = nextInstance(session, event_id, span);
+    bool needs_flush = recordEvent(session, event->ring, event_id, value, instance, ring_thread_slot, counter_values, file, function, line_number, span);
+    if (needs_flush) flushFullBuffer(session, event->ring);
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+    if (session->is_multi_threaded) pthread_mutex_unlock(&session->mutex);
+#endif
+    return;
+  }
+
+#ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
+  if (session->record_per_cpu) {
+    // Only lock the buffer of the current CPU core, so threads on different cores don't contend with each other
+    EventBuffer *buffer = myCpuBuffer(session, thread_info->thread_id);
+    pthread_mutex_lock(&buffer->mutex);
+    while (session->flush_when_full && isEventBufferFull(buffer)) {
+      // Another thread filled the buffer but has not yet flushed it
+      pthread_mutex_unlock(&buffer->mutex);
+      pthread_mutex_lock(&session->mutex);
+      bool is_flushed = flushFullBuffer(session, buffer);
+      pthread_mutex_unlock(&session->mutex);
+      pthread_mutex_lock(&buffer->mutex);
+      if (!is_flushed) break; // Every spare buffer is busy, so the event is dropped or overwrites the oldest (see UkAttrs.spill_policy)
+    }
+    uint64_t instance = nextInstance(session, event_id, span);
+    bool needs_flush = recordEvent(session, buffer, event_id, value, instance, task_info->thread_slot, counter_values, file, function, line_number, span);
+    pthread_mutex_unlock(&buffer->mutex);
+    if (needs_flush) {
+      // Can't hold the CPU buffer's mutex when locking the session's mutex, or else it could deadlock with another flush
+      pthread_mutex_lock(&session->mutex);
+      flushFullBuffer(session, buffer);
+      pthread_mutex_unlock(&session->mutex);
+    }
+    return;
+  }
+  uint16_t thread_slot = 0;
+  if (session->is_multi_threaded) {
+    thread_slot = task_info->thread_slot;
+    pthread_mutex_lock(&session->mutex);
+  }
+#else
+  uint16_t thread_slot = 0;
+#endif
 
   // Add the event to the event buffer
-  uint64_t instance = (event->start_id == event_id) ? event->start_instance++ : event->end_instance++;
-  recordEvent(session, event_id, value, instance, file, function, line_number);
+  spillIfFull(session, &session->main_buffer);
+  uint64_t instance = nextInstance(session, event_id, span);
+  bool needs_flush = recordEvent(session, &session->main_buffer, event_id, value, instance, thread_slot, counter_values, file, function, line_number, span);
+  if (needs_flush) flushFullBuffer(session, &session->main_buffer);
 
 #ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
   if (session->is_multi_threaded) pthread_mutex_unlock(&session->mutex);
 #endif
 }
 
+void ukRecordEvent(void *session_ref, uint16_t event_id, double value, const char *file, const char *function, uint16_t line_number) {
+  UnikornSession *session = (UnikornSession *)session_ref;
+  OPTIONAL_ASSERT(session->magic_value1 == MAGIC_VALUE1);
+  OPTIONAL_ASSERT(session->magic_value2 == MAGIC_VALUE2);
+  if (isPaused(session)) return; // Checked before anything else, so a paused session is almost free
+  uint16_t event_registration_index = (uint16_t)(event_id - session->first_event_id) >> 1; // Shift instead of a signed division
+  OPTIONAL_ASSERT(event_registration_index < session->event_registration_count*2);
+  PrivateEventInfo *event = &session->event_registration_list[event_registration_index];
+#ifdef PRINT_RECORD_INFO
+  printf("%s(): ID=%d, value=%f, file=%s, function=%s, line_number=%d\n", __FUNCTION__, event_id, value, file, function, line_number);
+#endif
+
+  // Most events only need the specialized record function
+  if (event->is_plain && session->use_plain_recording) {
+    L_plain_record_functions[session->plain_record_index](session, event_id, value, file, function, line_number);
+    return;
+  }
+  if (event->is_disabled) return;
+  recordGeneralEvent(session, event, event_registration_index, event_id, value, file, function, line_number, NULL);
+}
+
+void ukRecordSpan(void *session_ref, uint16_t start_id, uint64_t start_time, uint64_t end_time, double value, const char *file, const char *function, uint16_t line_number) {
+  UnikornSession *session = (UnikornSession *)session_ref;
+  OPTIONAL_ASSERT(session->magic_value1 == MAGIC_VALUE1);
+  OPTIONAL_ASSERT(session->magic_value2 == MAGIC_VALUE2);
+  if (isPaused(session)) return;
+  uint16_t event_registration_index = (uint16_t)(start_id - session->first_event_id) >> 1;
+  OPTIONAL_ASSERT(event_registration_index < session->event_registration_count);
+  PrivateEventInfo *event = &session->event_registration_list[event_registration_index];
+  OPTIONAL_ASSERT(event->start_id == start_id);
+  OPTIONAL_ASSERT(start_time <= end_time);
+#ifdef PRINT_RECORD_INFO
+  printf("%s(): ID=%d, start_time=%"UINT64_FORMAT", end_time=%"UINT64_FORMAT", value=%f, file=%s, function=%s, line_number=%d\n", __FUNCTION__, start_id, start_time, end_time, value, file, function, line_number);
+#endif
+  // Aggregate only sessions don't store events, so spans only need to update the histogram
+  if (!session->record_spans && !session->aggregate_only) { printf("ukRecordSpan() requires UkAttrs.record_spans==true\n"); assert(0); }
+  if (event->is_disabled) return;
+  SpanTimes span = { start_time, end_time };
+  recordGeneralEvent(session, event, event_registration_index, start_id, value, file, function, line_number, &span);
+}
+
+void ukRecordEventOutOfLine(void *session_ref, uint16_t event_id, double value, const char *file, const char *function, uint16_t line_number) {
+  ukRecordEvent(session_ref, event_id, value, file, function, line_number);
+  openInlineRange((UnikornSession *)session_ref);
+}
+
 void ukOpenFolder(void *session_ref, uint16_t folder_id) {
   UnikornSession *session = (UnikornSession *)session_ref;
   OPTIONAL_ASSERT(session->magic_value1 == MAGIC_VALUE1);
@@ -772,9 +3583,14 @@ void ukOpenFolder(void *session_ref, uint16_t folder_id) {
 #ifdef PRINT_RECORD_INFO
   printf("%s(): ID=%d\n", __FUNCTION__, folder_id);
 #endif
+  if (session->aggregate_only) return; // Folders are not part of the histograms
 
+  uint16_t thread_slot = 0;
 #ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
-  if (session->is_multi_threaded) pthread_mutex_lock(&session->mutex);
+  if (session->is_multi_threaded) {
+    thread_slot = myTaskInfo(session)->thread_slot;
+    pthread_mutex_lock(&session->mutex);
+  }
 #endif
 
   // Push folder onto current folder stack
@@ -786,7 +3602,11 @@ void ukOpenFolder(void *session_ref, uint16_t folder_id) {
   session->curr_folder_stack_count++;
 
   // Add the folder event to the event buffer
-  recordEvent(session, folder_id, 0, 0, L_unused_name, L_unused_name, 0);
+  if (!session->folder_registration_list[folder_id].is_disabled) {
+    spillIfFull(session, &session->main_buffer);
+    bool needs_flush = recordEvent(session, &session->main_buffer, folder_id, 0, 0, thread_slot, NULL, L_unused_name, L_unused_name, 0, NULL);
+    if (needs_flush) flushFullBuffer(session, &session->main_buffer);
+  }
 
 #ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
   if (session->is_multi_threaded) pthread_mutex_unlock(&session->mutex);
@@ -801,17 +3621,27 @@ void ukCloseFolder(void *session_ref) {
 #ifdef PRINT_RECORD_INFO
   printf("%s()\n", __FUNCTION__);
 #endif
+  if (session->aggregate_only) return; // Folders are not part of the histograms
 
+  uint16_t thread_slot = 0;
 #ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
-  if (session->is_multi_threaded) pthread_mutex_lock(&session->mutex);
+  if (session->is_multi_threaded) {
+    thread_slot = myTaskInfo(session)->thread_slot;
+    pthread_mutex_lock(&session->mutex);
+  }
 #endif
 
   // Pop the latest folder from the current folder stack
   OPTIONAL_ASSERT(session->curr_folder_stack_count > 0);
   session->curr_folder_stack_count--;
+  uint16_t folder_id = session->curr_folder_stack[session->curr_folder_stack_count];
 
   // Add the folder event to the event buffer
-  recordEvent(session, CLOSE_FOLDER_ID, 0, 0, L_unused_name, L_unused_name, 0);
+  if (!session->folder_registration_list[folder_id].is_disabled) {
+    spillIfFull(session, &session->main_buffer);
+    bool needs_flush = recordEvent(session, &session->main_buffer, CLOSE_FOLDER_ID, 0, 0, thread_slot, NULL, L_unused_name, L_unused_name, 0, NULL);
+    if (needs_flush) flushFullBuffer(session, &session->main_buffer);
+  }
 
 #ifdef ENABLE_UNIKORN_ATOMIC_RECORDING
   if (session->is_multi_threaded) pthread_mutex_unlock(&session->mutex);
@@ -0,0 +1,119 @@
+// Copyright 2021 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define _GNU_SOURCE             // For dladdr()
+#include "unikorn_address_slots.h"
+#ifdef NDEBUG // Don't want assert compiled out
+  #undef NDEBUG
+#endif
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dlfcn.h>
+
+// IMPORTANT: Called from the function tracing hooks, so none of these can be instrumented
+#define NO_INSTRUMENT __attribute__((no_instrument_function))
+
+#define SLOT_PENDING -2         // Another thread is assigning the address's slot
+
+NO_INSTRUMENT void ukAddressSlotsInit(UkAddressSlots *slots, uint16_t max_slots, uint8_t hash_shift, bool (*isAllowed)(void *address)) {
+  slots->max_slots = max_slots;
+  slots->hash_shift = hash_shift;
+  slots->isAllowed = isAllowed;
+  slots->count = 0;
+  slots->addresses = calloc(max_slots, sizeof(void *));
+  assert(slots->addresses != NULL);
+  slots->table_size = 1;
+  while (slots->table_size < 4*(uint32_t)max_slots) slots->table_size *= 2; // Addresses that are not allowed also use entries
+  slots->table = malloc(slots->table_size * sizeof(UkAddressEntry));
+  assert(slots->table != NULL);
+  for (uint32_t i=0; i<slots->table_size; i++) {
+    slots->table[i].address = NULL;
+    slots->table[i].slot = SLOT_PENDING;
+  }
+}
+
+NO_INSTRUMENT void ukAddressSlotsFree(UkAddressSlots *slots) {
+  free(slots->addresses);
+  slots->addresses = NULL;
+  free(slots->table);
+  slots->table = NULL;
+}
+
+NO_INSTRUMENT static int32_t assignSlot(UkAddressSlots *slots, void *address) {
+  if (slots->isAllowed != NULL && !slots->isAllowed(address)) return UK_NO_SLOT;
+  uint32_t slot = __atomic_fetch_add(&slots->count, 1, __ATOMIC_RELAXED);
+  if (slot >= slots->max_slots) return UK_NO_SLOT;
+  __atomic_store_n(&slots->addresses[slot], address, __ATOMIC_RELEASE);
+  return (int32_t)slot;
+}
+
+NO_INSTRUMENT static int32_t waitForSlot(UkAddressEntry *entry) {
+  // Another thread just claimed the entry, and is about to assign the slot
+  int32_t slot;
+  while ((slot = __atomic_load_n(&entry->slot, __ATOMIC_ACQUIRE)) == SLOT_PENDING) {
+    // Spin
+  }
+  return slot;
+}
+
+NO_INSTRUMENT int32_t ukAddressSlot(UkAddressSlots *slots, void *address) {
+  // NOTE: Entries are never removed, so no locking is needed
+  uint32_t mask = slots->table_size - 1;
+  uint32_t index = (uint32_t)(((uintptr_t)address >> slots->hash_shift) * 2654435761u) & mask;
+  for (uint32_t probe=0; probe<slots->table_size; probe++) {
+    UkAddressEntry *entry = &slots->table[index];
+    void *entry_address = __atomic_load_n(&entry->address, __ATOMIC_ACQUIRE);
+    if (entry_address == address) return waitForSlot(entry);
+    if (entry_address == NULL) {
+      void *expected = NULL;
+      if (__atomic_compare_exchange_n(&entry->address, &expected, address, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        // First use of this address
+        int32_t slot = assignSlot(slots, address);
+        __atomic_store_n(&entry->slot, slot, __ATOMIC_RELEASE);
+        return slot;
+      }
+      if (expected == address) return waitForSlot(entry);
+    }
+    index = (index + 1) & mask;
+  }
+  // Table is full
+  return UK_NO_SLOT;
+}
+
+NO_INSTRUMENT uint32_t ukAddressSlotCount(UkAddressSlots *slots) {
+  uint32_t count = __atomic_load_n(&slots->count, __ATOMIC_RELAXED);
+  return (count > slots->max_slots) ? slots->max_slots : count;
+}
+
+NO_INSTRUMENT void *ukSlotAddress(UkAddressSlots *slots, uint32_t slot) {
+  return __atomic_load_n(&slots->addresses[slot], __ATOMIC_ACQUIRE);
+}
+
+NO_INSTRUMENT void ukAddressName(void *address, bool is_data, char *name, size_t max_name_length) {
+  Dl_info info;
+  bool found = (dladdr(address, &info) != 0);
+  if (found && info.dli_sname != NULL && info.dli_saddr == address) {
+    snprintf(name, max_name_length, "%s", info.dli_sname);
+  } else if (found && is_data && info.dli_sname != NULL) {
+    snprintf(name, max_name_length, "%s+0x%lx", info.dli_sname, (unsigned long)((uintptr_t)address - (uintptr_t)info.dli_saddr));
+  } else if (found && !is_data && info.dli_fname != NULL) {
+    const char *module_name = strrchr(info.dli_fname, '/');
+    module_name = (module_name == NULL) ? info.dli_fname : module_name+1;
+    snprintf(name, max_name_length, "%s+0x%lx", module_name, (unsigned long)((uintptr_t)address - (uintptr_t)info.dli_fbase));
+  } else {
+    snprintf(name, max_name_length, "%p", address);
+  }
+}
@@ -0,0 +1,261 @@
+// Copyright 2021 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "unikorn_clock_sync.h"
+#ifdef NDEBUG // Don't want assert compiled out
+  #undef NDEBUG
+#endif
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define POLL_MILLISECONDS 100  // How often the serving thread checks if it should stop
+#define REPLY_MILLISECONDS 1000 // How long the client waits for each reply
+#ifdef MSG_NOSIGNAL
+  #define SEND_FLAGS MSG_NOSIGNAL // Don't raise SIGPIPE if the other process is gone
+#else
+  #define SEND_FLAGS 0            // Mac: SO_NOSIGPIPE is set on the socket instead
+#endif
+
+enum {
+  MESSAGE_PING,    // Client to server: time1=client send time
+  MESSAGE_PONG,    // Server to client: time1=server receive time, time2=server send time
+  MESSAGE_RESULT   // Client to server: the best exchange, from the server's point of view
+};
+
+typedef struct {
+  uint64_t type;
+  uint64_t process_id;     // Of the sender
+  uint64_t time1;
+  uint64_t time2;
+  int64_t offset;
+  uint64_t round_trip;
+} SyncMessage;             // Both processes are on the same host, so no need to worry about endianness
+
+static void *L_session = NULL;
+static uint64_t (*L_clockNanoseconds)() = NULL;
+static char *L_socket_path = NULL;
+static int L_listen_fd = -1;
+static volatile bool L_stop_requested = false;
+static pthread_t L_serve_thread;
+
+static void disableSigpipe(int fd) {
+#ifdef SO_NOSIGPIPE
+  int enable = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#else
+  (void)fd;
+#endif
+}
+
+static bool sendMessage(int fd, SyncMessage *message) {
+  const char *data = (const char *)message;
+  size_t bytes_left = sizeof(SyncMessage);
+  while (bytes_left > 0) {
+    ssize_t bytes = send(fd, data, bytes_left, SEND_FLAGS);
+    if (bytes < 0 && errno == EINTR) continue;
+    if (bytes <= 0) return false;
+    data += bytes;
+    bytes_left -= (size_t)bytes;
+  }
+  return true;
+}
+
+static bool receiveMessage(int fd, SyncMessage *message) {
+  char *data = (char *)message;
+  size_t bytes_left = sizeof(SyncMessage);
+  while (bytes_left > 0) {
+    ssize_t bytes = read(fd, data, bytes_left);
+    if (bytes < 0 && errno == EINTR) continue;
+    if (bytes <= 0) return false;
+    data += bytes;
+    bytes_left -= (size_t)bytes;
+  }
+  return true;
+}
+
+static bool waitForInput(int fd) {
+  // Returns false if asked to stop before there is input
+  struct pollfd poll_info = { .fd = fd, .events = POLLIN, .revents = 0 };
+  while (!L_stop_requested) {
+    int count = poll(&poll_info, 1, POLL_MILLISECONDS);
+    if (count > 0) return true;
+    if (count < 0 && errno != EINTR) return false;
+  }
+  return false;
+}
+
+static bool waitForReply(int fd) {
+  // Returns false if the server doesn't reply in time (e.g. it's stuck, or serving another client that is)
+  struct pollfd poll_info = { .fd = fd, .events = POLLIN, .revents = 0 };
+  while (true) {
+    int count = poll(&poll_info, 1, REPLY_MILLISECONDS);
+    if (count > 0) return true;
+    if (count == 0 || errno != EINTR) return false;
+  }
+}
+
+static void serveClient(int fd) {
+  SyncMessage message;
+  while (waitForInput(fd) && receiveMessage(fd, &message)) {
+    uint64_t receive_time = L_clockNanoseconds();
+    if (message.type == MESSAGE_PING) {
+      SyncMessage reply;
+      memset(&reply, 0, sizeof(reply));
+      reply.type = MESSAGE_PONG;
+      reply.process_id = (uint64_t)getpid();
+      reply.time1 = receive_time;
+      reply.time2 = L_clockNanoseconds();
+      if (!sendMessage(fd, &reply)) return;
+    } else if (message.type == MESSAGE_RESULT) {
+      ukRecordClockSync(L_session, message.process_id, message.time1, message.offset, message.round_trip);
+    } else {
+      printf("Unikorn: ignoring clock sync client that sent an unknown message type %d\n", (int)message.type);
+      return;
+    }
+  }
+}
+
+static void *serveThread(void *user_data) {
+  (void)user_data;
+  // Clients are served one at a time, since an exchange only takes a few microseconds
+  while (waitForInput(L_listen_fd)) {
+    int fd = accept(L_listen_fd, NULL, NULL);
+    if (fd < 0) continue;
+    disableSigpipe(fd);
+    serveClient(fd);
+    close(fd);
+  }
+  return NULL;
+}
+
+static bool initAddress(struct sockaddr_un *address, const char *socket_path) {
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(address->sun_path)) {
+    printf("Unikorn: clock sync socket path '%s' is too long\n", socket_path);
+    return false;
+  }
+  strcpy(address->sun_path, socket_path);
+  return true;
+}
+
+bool ukClockSyncServe(void *session, uint64_t (*clockNanoseconds)(), const char *socket_path) {
+  if (L_session != NULL) { printf("Unikorn: ukClockSyncServe() was already called\n"); assert(0); }
+  struct sockaddr_un address;
+  if (!initAddress(&address, socket_path)) return false;
+
+  // Create the socket. A socket file left behind by a previous run is replaced.
+  unlink(socket_path);
+  L_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (L_listen_fd < 0) return false;
+  if (bind(L_listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(L_listen_fd, 8) != 0) {
+    close(L_listen_fd);
+    L_listen_fd = -1;
+    return false;
+  }
+
+  // Start the serving thread
+  L_session = session;
+  L_clockNanoseconds = clockNanoseconds;
+  L_socket_path = strdup(socket_path);
+  assert(L_socket_path != NULL);
+  L_stop_requested = false;
+  if (pthread_create(&L_serve_thread, NULL, serveThread, NULL) != 0) {
+    close(L_listen_fd);
+    L_listen_fd = -1;
+    unlink(L_socket_path);
+    free(L_socket_path);
+    L_socket_path = NULL;
+    L_session = NULL;
+    return false;
+  }
+  return true;
+}
+
+void ukClockSyncStopServing() {
+  if (L_session == NULL) return;
+  L_stop_requested = true;
+  pthread_join(L_serve_thread, NULL);
+  close(L_listen_fd);
+  L_listen_fd = -1;
+  unlink(L_socket_path);
+  free(L_socket_path);
+  L_socket_path = NULL;
+  L_session = NULL;
+}
+
+bool ukClockSyncWith(void *session, uint64_t (*clockNanoseconds)(), const char *socket_path, uint16_t exchange_count) {
+  assert(exchange_count > 0);
+  struct sockaddr_un address;
+  if (!initAddress(&address, socket_path)) return false;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return false;
+  disableSigpipe(fd);
+  if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+    close(fd);
+    return false;
+  }
+
+  // Ping exchanges: keep the one with the shortest round trip, since its offset has the least uncertainty
+  bool got_sample = false;
+  uint64_t peer_process_id = 0;
+  uint64_t best_time = 0;
+  int64_t best_offset = 0;
+  uint64_t best_round_trip = 0;
+  for (uint16_t i=0; i<exchange_count; i++) {
+    SyncMessage message;
+    memset(&message, 0, sizeof(message));
+    message.type = MESSAGE_PING;
+    message.process_id = (uint64_t)getpid();
+    uint64_t send_time = clockNanoseconds();
+    message.time1 = send_time;
+    if (!sendMessage(fd, &message)) break;
+    if (!waitForReply(fd) || !receiveMessage(fd, &message)) break;
+    uint64_t receive_time = clockNanoseconds();
+    if (message.type != MESSAGE_PONG) break;
+    // Assuming the request and reply take the same time, the peer's clock is at the midpoint of its receive and send when this clock is at the midpoint of its send and receive
+    uint64_t round_trip = (receive_time - send_time) - (message.time2 - message.time1);
+    int64_t offset = (int64_t)((message.time1 - send_time) + (message.time2 - receive_time)) / 2;
+    if (!got_sample || round_trip < best_round_trip) {
+      got_sample = true;
+      peer_process_id = message.process_id;
+      best_time = send_time + (receive_time - send_time) / 2;
+      best_offset = offset;
+      best_round_trip = round_trip;
+    }
+  }
+
+  if (got_sample) {
+    // Record in both sessions
+    ukRecordClockSync(session, peer_process_id, best_time, best_offset, best_round_trip);
+    SyncMessage result;
+    memset(&result, 0, sizeof(result));
+    result.type = MESSAGE_RESULT;
+    result.process_id = (uint64_t)getpid();
+    result.time1 = best_time + (uint64_t)best_offset;
+    result.offset = -best_offset;
+    result.round_trip = best_round_trip;
+    (void)sendMessage(fd, &result);
+  }
+  close(fd);
+  return got_sample;
+}
@@ -0,0 +1,266 @@
+// Copyright 2021 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define _GNU_SOURCE             // For dl_iterate_phdr()
+#include "unikorn_cyg_profile.h"
+#include "unikorn_address_slots.h"
+#ifdef NDEBUG // Don't want assert compiled out
+  #undef NDEBUG
+#endif
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef __linux__
+  #include <link.h>            // For dl_iterate_phdr()
+#endif
+
+// IMPORTANT: None of the functions in this file can be instrumented, or else they would recursively call the profiling hooks
+#define NO_INSTRUMENT __attribute__((no_instrument_function))
+
+#define MAX_ADDRESS_RANGES 32   // Per allow and deny list
+#define MAX_TRACKED_DEPTH 256   // Calls nested deeper than this are never recorded
+#define NOT_TRACED UK_NO_SLOT  // Function is filtered out, or max_functions was reached
+
+typedef struct {
+  uintptr_t start;
+  uintptr_t end;              // Exclusive
+} AddressRange;
+
+// Filters: only changed before tracing starts
+static uint16_t L_allow_count = 0;
+static AddressRange L_allow_list[MAX_ADDRESS_RANGES];
+static uint16_t L_deny_count = 0;
+static AddressRange L_deny_list[MAX_ADDRESS_RANGES];
+
+// Tracing state
+static void *L_session = NULL;
+static uint16_t L_first_event_id = 0;
+static uint16_t L_max_functions = 0;
+static uint16_t L_max_call_depth = 0;
+static UkAddressSlots L_function_slots;    // Function address -> index of its event type
+static uint16_t L_resolved_count = 0;      // Slots with resolved names
+static pthread_mutex_t L_resolve_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Per thread call stack
+static __thread bool t_busy = false;       // Recording an event, so ignore any calls made by Unikorn
+static __thread uint32_t t_depth = 0;
+static __thread int32_t t_slot_stack[MAX_TRACKED_DEPTH]; // The recorded slot at each depth, or NOT_TRACED
+
+static const uint16_t L_colors[] = { UK_RED, UK_ORANGE, UK_YELLOW, UK_GREEN, UK_PURPLE, UK_BLUE, UK_TEAL, UK_GRAY };
+
+NO_INSTRUMENT static void addRange(AddressRange *list, uint16_t *count, uintptr_t start, uintptr_t end) {
+  if (L_session != NULL) { printf("Unikorn: address ranges must be added before calling ukCygProfileStart()\n"); assert(0); }
+  if (*count == MAX_ADDRESS_RANGES) { printf("Unikorn: can't have more than %d allowed or denied address ranges\n", MAX_ADDRESS_RANGES); assert(0); }
+  list[*count].start = start;
+  list[*count].end = end;
+  (*count)++;
+}
+
+NO_INSTRUMENT void ukCygProfileAllow(const void *start_address, const void *end_address) {
+  addRange(L_allow_list, &L_allow_count, (uintptr_t)start_address, (uintptr_t)end_address);
+}
+
+NO_INSTRUMENT void ukCygProfileDeny(const void *start_address, const void *end_address) {
+  addRange(L_deny_list, &L_deny_count, (uintptr_t)start_address, (uintptr_t)end_address);
+}
+
+#ifdef __linux__
+typedef struct {
+  const char *module_name;    // NULL for the application
+  bool found;
+  uintptr_t start;
+  uintptr_t end;
+} ModuleSearch;
+
+NO_INSTRUMENT static int findModule(struct dl_phdr_info *info, size_t size, void *data) {
+  (void)size;
+  ModuleSearch *search = (ModuleSearch *)data;
+  const char *name = (info->dlpi_name == NULL) ? "" : info->dlpi_name;
+  if (search->module_name == NULL) {
+    // The application is the first module, and has no name
+    if (name[0] != '\0') return 0;
+  } else {
+    // Match the end of the module's path
+    size_t name_length = strlen(name);
+    size_t module_name_length = strlen(search->module_name);
+    if (name_length < module_name_length || strcmp(&name[name_length-module_name_length], search->module_name) != 0) return 0;
+  }
+  // Get the extent of the code segments
+  for (uint16_t i=0; i<info->dlpi_phnum; i++) {
+    const ElfW(Phdr) *segment = &info->dlpi_phdr[i];
+    if (segment->p_type != PT_LOAD || !(segment->p_flags & PF_X)) continue;
+    uintptr_t start = (uintptr_t)info->dlpi_addr + segment->p_vaddr;
+    uintptr_t end = start + segment->p_memsz;
+    if (!search->found || start < search->start) search->start = start;
+    if (!search->found || end > search->end) search->end = end;
+    search->found = true;
+  }
+  return search->found ? 1 : 0;
+}
+#endif
+
+NO_INSTRUMENT static bool getModuleRange(const char *module_name, uintptr_t *start_ret, uintptr_t *end_ret) {
+#ifdef __linux__
+  ModuleSearch search = { module_name, false, 0, 0 };
+  dl_iterate_phdr(findModule, &search);
+  *start_ret = search.start;
+  *end_ret = search.end;
+  return search.found;
+#else
+  (void)module_name;
+  (void)start_ret;
+  (void)end_ret;
+  printf("Unikorn: filtering by module is not supported on this OS\n");
+  return false;
+#endif
+}
+
+NO_INSTRUMENT bool ukCygProfileAllowModule(const char *module_name) {
+  uintptr_t start, end;
+  if (!getModuleRange(module_name, &start, &end)) return false;
+  addRange(L_allow_list, &L_allow_count, start, end);
+  return true;
+}
+
+NO_INSTRUMENT bool ukCygProfileDenyModule(const char *module_name) {
+  uintptr_t start, end;
+  if (!getModuleRange(module_name, &start, &end)) return false;
+  addRange(L_deny_list, &L_deny_count, start, end);
+  return true;
+}
+
+NO_INSTRUMENT static bool isTraced(void *function) {
+  uintptr_t address = (uintptr_t)function;
+  for (uint16_t i=0; i<L_deny_count; i++) {
+    if (address >= L_deny_list[i].start && address < L_deny_list[i].end) return false;
+  }
+  if (L_allow_count == 0) return true;
+  for (uint16_t i=0; i<L_allow_count; i++) {
+    if (address >= L_allow_list[i].start && address < L_allow_list[i].end) return true;
+  }
+  return false;
+}
+
+NO_INSTRUMENT void __cyg_profile_func_enter(void *function, void *call_site) {
+  (void)call_site;
+  if (t_busy) return;
+  uint32_t depth = t_depth++;
+  if (depth >= MAX_TRACKED_DEPTH) return;
+  t_slot_stack[depth] = NOT_TRACED;
+  void *session = __atomic_load_n(&L_session, __ATOMIC_ACQUIRE);
+  if (session == NULL) return;
+  if (L_max_call_depth > 0 && depth >= L_max_call_depth) return;
+  int32_t slot = ukAddressSlot(&L_function_slots, function);
+  if (slot == NOT_TRACED) return;
+  t_busy = true;
+  ukRecordEvent(session, L_first_event_id + 2*slot, 0, NULL, NULL, 0);
+  t_busy = false;
+  t_slot_stack[depth] = slot;
+}
+
+NO_INSTRUMENT void __cyg_profile_func_exit(void *function, void *call_site) {
+  (void)function;
+  (void)call_site;
+  if (t_busy || t_depth == 0) return;
+  uint32_t depth = --t_depth;
+  if (depth >= MAX_TRACKED_DEPTH) return;
+  int32_t slot = t_slot_stack[depth];
+  if (slot == NOT_TRACED) return;
+  void *session = __atomic_load_n(&L_session, __ATOMIC_ACQUIRE);
+  if (session == NULL) return;
+  t_busy = true;
+  ukRecordEvent(session, L_first_event_id + 2*slot + 1, 0, NULL, NULL, 0);
+  t_busy = false;
+}
+
+NO_INSTRUMENT static void resolveFunctionNames() {
+  pthread_mutex_lock(&L_resolve_mutex);
+  uint32_t function_count = ukAddressSlotCount(&L_function_slots);
+  while (L_resolved_count < function_count) {
+    void *function = ukSlotAddress(&L_function_slots, L_resolved_count);
+    if (function == NULL) break; // Slot is still being assigned, resolve it on the next flush
+    char name[100];
+    ukAddressName(function, false, name, sizeof(name));
+    ukSetEventName(L_session, L_first_event_id + 2*L_resolved_count, name);
+    L_resolved_count++;
+  }
+  pthread_mutex_unlock(&L_resolve_mutex);
+}
+
+NO_INSTRUMENT void *ukCygProfileStart(UkAttrs *attrs, uint16_t max_functions, uint16_t max_call_depth,
+                                      uint64_t (*clockNanoseconds)(),
+                                      void *flush_user_data,
+                                      bool (*prepareFlush)(void *user_data),
+                                      bool (*flush)(void *user_data, const void *data, size_t bytes),
+                                      bool (*finishFlush)(void *user_data)) {
+  if (L_session != NULL) { printf("Unikorn: function tracing is already started\n"); assert(0); }
+  if (max_functions == 0) { printf("Unikorn: max_functions must be at least 1\n"); assert(0); }
+  uint16_t first_event_id = 1 + attrs->folder_registration_count;
+  if ((uint32_t)first_event_id + 2*(uint32_t)max_functions > 0xFFFF) { printf("Unikorn: max_functions=%d is too large\n", max_functions); assert(0); }
+
+  // Create an event type for each function that can be traced. The names are set when the first call is flushed.
+  UkEventRegistration *event_registration_list = malloc(max_functions * sizeof(UkEventRegistration));
+  assert(event_registration_list != NULL);
+  char *name_list = malloc(max_functions * 20);
+  assert(name_list != NULL);
+  for (uint16_t i=0; i<max_functions; i++) {
+    char *name = &name_list[i*20];
+    snprintf(name, 20, "Function %d", i+1);
+    event_registration_list[i].name = name;
+    event_registration_list[i].rgb = L_colors[i % (sizeof(L_colors)/sizeof(L_colors[0]))];
+    event_registration_list[i].start_id = first_event_id + 2*i;
+    event_registration_list[i].end_id = first_event_id + 2*i + 1;
+    event_registration_list[i].start_value_name = "";
+    event_registration_list[i].end_value_name = "";
+  }
+  UkAttrs session_attrs = *attrs;
+  session_attrs.event_registration_count = max_functions;
+  session_attrs.event_registration_list = event_registration_list;
+  session_attrs.record_per_cpu = attrs->is_multi_threaded;
+  session_attrs.record_file_location = false; // The function name is the event name
+  session_attrs.apply_config = false; // UNIKORN_CONFIG is for the application's sessions, and could undo the attributes above
+  void *session = ukCreate(&session_attrs, clockNanoseconds, flush_user_data, prepareFlush, flush, finishFlush);
+  free(name_list);
+  free(event_registration_list);
+
+  // Prepare the function table
+  L_first_event_id = first_event_id;
+  L_max_functions = max_functions;
+  L_max_call_depth = max_call_depth;
+  L_resolved_count = 0;
+  ukAddressSlotsInit(&L_function_slots, max_functions, 4, isTraced);
+
+  // Start tracing
+  __atomic_store_n(&L_session, session, __ATOMIC_RELEASE);
+  return session;
+}
+
+NO_INSTRUMENT void ukCygProfileFlush() {
+  assert(L_session != NULL);
+  resolveFunctionNames();
+  ukFlush(L_session);
+}
+
+NO_INSTRUMENT void ukCygProfileStop() {
+  // NOTE: this should be called after all other traced threads are done
+  assert(L_session != NULL);
+  resolveFunctionNames();
+  void *session = L_session;
+  __atomic_store_n(&L_session, NULL, __ATOMIC_RELEASE);
+  ukFlush(session);
+  ukDestroy(session);
+  ukAddressSlotsFree(&L_function_slots);
+}
@@ -40,6 +40,7 @@
 #endif
 
 //#define PRINT_UNIKORN_LOAD_INFO
+#define MAX_VERSION_MINOR 16 // Currently only supporting version 1.0 to 1.16
 
 static bool isBigEndian() {
   uint32_t a = 1;
@@ -99,6 +100,13 @@ static double readDouble(bool swap_endian, FILE *file) {
   return value;
 }
 
+typedef struct {
+  // Maps the thread slots of the current flush to the loaded thread list. A slot can be recycled for a new thread between flushes.
+  uint16_t slot_count;
+  uint32_t *generation_list;
+  uint32_t *thread_index_list;
+} ThreadSlotMap;
+
 static void readChars(char *name, int num_name_chars, FILE *file) {
   if (1 != fread(name, num_name_chars, 1, file)) {
     printf("End of event file reached before all expected data processed\n");
@@ -106,13 +114,23 @@ static void readChars(char *name, int num_name_chars, FILE *file) {
   }
 }
 
+static void addClockAnchor(UkEvents *object, uint64_t time, uint64_t wall_time) {
+#ifdef PRINT_UNIKORN_LOAD_INFO
+  printf("  clock anchor: time=%"UINT64_FORMAT", wall_time=%"UINT64_FORMAT"\n", time, wall_time);
+#endif
+  object->clock_anchor_list = realloc(object->clock_anchor_list, (object->clock_anchor_count+1)*sizeof(UkClockAnchor));
+  assert(object->clock_anchor_list != NULL);
+  object->clock_anchor_list[object->clock_anchor_count].time = time;
+  object->clock_anchor_list[object->clock_anchor_count].wall_time = wall_time;
+  object->clock_anchor_count++;
+}
+
 static void loadEventsHeader(FILE *file, bool first_time_loaded, bool swap_endian, UkEvents *object) {
   // Get and verify version
   uint16_t version_major = readUint16(swap_endian, file);
   uint16_t version_minor = readUint16(swap_endian, file);
-  // Currently only supporting version 1.0
   assert(version_major == 1);
-  assert(version_minor == 0 || version_minor == 1);
+  assert(version_minor <= MAX_VERSION_MINOR);
   if (first_time_loaded) {
     object->version_major = version_major;
     object->version_minor = version_minor;
@@ -146,6 +164,28 @@ static void loadEventsHeader(FILE *file, bool first_time_loaded, bool swap_endia
   } else {
     assert(object->includes_file_location == includes_file_location);
   }
+  bool includes_cpu = false;
+  if (version_major >= 1 && version_minor >= 3) {
+    includes_cpu = readBool(file);
+  }
+  if (first_time_loaded) {
+    object->includes_cpu = includes_cpu;
+  } else {
+    assert(object->includes_cpu == includes_cpu);
+  }
+  bool is_aggregate = false;
+  if (version_major >= 1 && version_minor >= 6) {
+    is_aggregate = readBool(file);
+  }
+  if (first_time_loaded) {
+    object->is_aggregate = is_aggregate;
+  } else {
+    assert(object->is_aggregate == is_aggregate);
+  }
+  if (version_major >= 1 && version_minor >= 7) {
+    // Thresholds can be set after the first flush
+    if (readBool(file)) object->has_thresholds = true;
+  }
 #ifdef PRINT_UNIKORN_LOAD_INFO
   printf("\n");
   printf("Event File Header: -------------------------------\n");
@@ -157,6 +197,9 @@ static void loadEventsHeader(FILE *file, bool first_time_loaded, bool swap_endia
   printf("  includes_instance = %s\n", object->includes_instance ? "yes" : "no");
   printf("  includes_value = %s\n", object->includes_value ? "yes" : "no");
   printf("  includes_file_location = %s\n", object->includes_file_location ? "yes" : "no");
+  printf("  includes_cpu = %s\n", object->includes_cpu ? "yes" : "no");
+  printf("  is_aggregate = %s\n", object->is_aggregate ? "yes" : "no");
+  printf("  has_thresholds = %s\n", object->has_thresholds ? "yes" : "no");
 #endif
 
   // Folder info
@@ -242,6 +285,12 @@ static void loadEventsHeader(FILE *file, bool first_time_loaded, bool swap_endia
       event->name = malloc(num_name_chars);
       assert(event->name != NULL);
       readChars(event->name, num_name_chars, file);
+    } else if (version_major >= 1 && version_minor >= 5) {
+      // The name may have been changed via ukSetEventName(), so use the latest name
+      free(event->name);
+      event->name = malloc(num_name_chars);
+      assert(event->name != NULL);
+      readChars(event->name, num_name_chars, file);
     } else {
       assert((uint16_t)strlen(event->name)+1 == num_name_chars);
       char ch;
@@ -294,6 +343,60 @@ static void loadEventsHeader(FILE *file, bool first_time_loaded, bool swap_endia
     printf("    startID=%d, endID=%d, RGB=0x%04x, name='%s', start_value_name='%s', end_value_name='%s'\n", event->start_id, event->end_id, event->rgb, event->name, event->start_value_name, event->end_value_name);
 #endif
   }
+
+  // Counter info
+  if (version_major >= 1 && version_minor >= 4) {
+    uint16_t counter_count = readUint16(swap_endian, file);
+    if (first_time_loaded) {
+      object->counter_count = counter_count;
+      object->counter_name_list = calloc(counter_count, sizeof(char *));
+      assert(counter_count == 0 || object->counter_name_list != NULL);
+    } else {
+      assert(object->counter_count == counter_count);
+    }
+#ifdef PRINT_UNIKORN_LOAD_INFO
+    printf("  counter_count = %d\n", counter_count);
+#endif
+    for (uint16_t i=0; i<counter_count; i++) {
+      uint16_t num_name_chars = readUint16(swap_endian, file);
+      if (first_time_loaded) {
+        object->counter_name_list[i] = malloc(num_name_chars);
+        assert(object->counter_name_list[i] != NULL);
+        readChars(object->counter_name_list[i], num_name_chars, file);
+      } else {
+        assert((uint16_t)strlen(object->counter_name_list[i])+1 == num_name_chars);
+        char ch;
+        for (uint16_t j=0; j<num_name_chars; j++) {
+          readChars(&ch, 1, file);
+          assert(object->counter_name_list[i][j] == ch);
+        }
+      }
+#ifdef PRINT_UNIKORN_LOAD_INFO
+      printf("    name='%s'\n", object->counter_name_list[i]);
+#endif
+    }
+  }
+
+  // Host, process, and the clock anchor from when the session was created
+  if (version_major >= 1 && version_minor >= 13) {
+    uint16_t num_host_name_chars = readUint16(swap_endian, file);
+    char *host_name = malloc(num_host_name_chars);
+    assert(host_name != NULL);
+    readChars(host_name, num_host_name_chars, file);
+    uint64_t process_id = readUint64(swap_endian, file);
+    uint64_t create_time = readUint64(swap_endian, file);
+    uint64_t create_wall_time = readUint64(swap_endian, file);
+#ifdef PRINT_UNIKORN_LOAD_INFO
+    printf("  host_name='%s', process_id=%"UINT64_FORMAT"\n", host_name, process_id);
+#endif
+    if (first_time_loaded) {
+      object->host_name = host_name;
+      object->process_id = process_id;
+      addClockAnchor(object, create_time, create_wall_time);
+    } else {
+      free(host_name);
+    }
+  }
 }
 
 #ifdef PRINT_UNIKORN_LOAD_INFO
@@ -333,7 +436,7 @@ static const char *elapsedTimeText(uint64_t diff_time) {
 }
 #endif
 
-static void loadEventsData(FILE *file, bool swap_endian, UkEvents *object) {
+static void loadEventsData(FILE *file, bool swap_endian, UkEvents *object, ThreadSlotMap *slot_map) {
 #ifdef PRINT_UNIKORN_LOAD_INFO
   printf("\n");
   printf("Event File Data: ---------------------------------\n");
@@ -402,27 +505,49 @@ static void loadEventsData(FILE *file, bool swap_endian, UkEvents *object) {
 
   // Thread IDs
   if (object->is_multi_threaded) {
-    uint16_t thread_id_count = readUint16(swap_endian, file);
+    uint16_t thread_slot_count = readUint16(swap_endian, file);
 #ifdef PRINT_UNIKORN_LOAD_INFO
-    printf("  thread_id_count = %d\n", thread_id_count);
+    printf("  thread_slot_count = %d\n", thread_slot_count);
 #endif
-    for (uint16_t i=0; i<thread_id_count; i++) {
+    // Slots are never removed, only recycled
+    assert(thread_slot_count >= slot_map->slot_count);
+    if (thread_slot_count > slot_map->slot_count) {
+      slot_map->generation_list = realloc(slot_map->generation_list, thread_slot_count*sizeof(uint32_t));
+      assert(slot_map->generation_list != NULL);
+      slot_map->thread_index_list = realloc(slot_map->thread_index_list, thread_slot_count*sizeof(uint32_t));
+      assert(slot_map->thread_index_list != NULL);
+    }
+    for (uint16_t i=0; i<thread_slot_count; i++) {
       uint64_t thread_id = readUint64(swap_endian, file);
+      uint32_t generation = 0;
+      if (object->version_major >= 1 && object->version_minor >= 2) {
+        generation = readUint32(swap_endian, file);
+      }
+      bool is_task = false;
+      if (object->version_major >= 1 && object->version_minor >= 12) {
+        is_task = readBool(file);
+      }
 #ifdef PRINT_UNIKORN_LOAD_INFO
-      printf("    index %d: ID=%"UINT64_FORMAT"\n", i, thread_id);
+      printf("    slot %d: ID=%"UINT64_FORMAT", generation=%d, is_task=%s\n", i, thread_id, generation, is_task ? "yes" : "no");
 #endif
-      if (i < object->thread_id_count) {
+      if (i < slot_map->slot_count && slot_map->generation_list[i] == generation) {
         // Verify the thread ID has not changed since the last flush
-        assert(object->thread_id_list[i] == thread_id);
+        assert(object->thread_id_list[slot_map->thread_index_list[i]] == thread_id);
       } else {
-        // Add the thread ID to the list
-        assert(i == object->thread_id_count);
+        // New slot, or the slot was recycled for a different thread: add the thread ID to the list
+        assert(object->thread_id_count < UINT32_MAX);
         object->thread_id_count++;
         object->thread_id_list = realloc(object->thread_id_list, object->thread_id_count*sizeof(uint64_t));
         assert(object->thread_id_list != NULL);
-        object->thread_id_list[i] = thread_id;
+        object->thread_id_list[object->thread_id_count-1] = thread_id;
+        object->thread_is_task_list = realloc(object->thread_is_task_list, object->thread_id_count*sizeof(bool));
+        assert(object->thread_is_task_list != NULL);
+        object->thread_is_task_list[object->thread_id_count-1] = is_task;
+        slot_map->generation_list[i] = generation;
+        slot_map->thread_index_list[i] = object->thread_id_count-1;
       }
     }
+    slot_map->slot_count = thread_slot_count;
   }
 
   // Open Folders: Stack of folders that were already open before the first event that was saved
@@ -489,20 +614,39 @@ static void loadEventsData(FILE *file, bool swap_endian, UkEvents *object) {
   }
 
   // Allocate events buffer
+  bool has_spans = false;
+  if (object->version_major >= 1 && object->version_minor >= 15) {
+    has_spans = readBool(file);
+    if (has_spans) object->has_spans = true;
+  }
   uint32_t prev_event_count = object->event_count;
   uint32_t event_count = readUint32(swap_endian, file);
 #ifdef PRINT_UNIKORN_LOAD_INFO
+  printf("  has_spans = %s\n", has_spans ? "yes" : "no");
   printf("  event_count = %d\n", event_count);
 #endif
   uint32_t event_index = object->event_count;
   object->event_count += event_count;
-  object->event_buffer = realloc(object->event_buffer, (num_final_open_folders+num_open_folders+object->event_count)*sizeof(UkEvent));
-  assert(object->event_buffer != NULL);
+  uint32_t max_span_count = has_spans ? event_count : 0; // Each span is expanded into a start and end event
+  if (num_final_open_folders+num_open_folders+object->event_count > 0) { // There are no events if is_aggregate==true
+    object->event_buffer = realloc(object->event_buffer, (num_final_open_folders+num_open_folders+object->event_count+max_span_count)*sizeof(UkEvent));
+    assert(object->event_buffer != NULL);
+  }
+  if (object->counter_count > 0) {
+    // Same indexing as the event buffer, and the inserted folder events have no counter values
+    size_t prev_values = (size_t)event_index * object->counter_count;
+    size_t total_values = ((size_t)num_final_open_folders+num_open_folders+object->event_count+max_span_count) * object->counter_count;
+    object->counter_value_buffer = realloc(object->counter_value_buffer, total_values*sizeof(uint64_t));
+    assert(object->counter_value_buffer != NULL);
+    memset(&object->counter_value_buffer[prev_values], 0, (total_values-prev_values)*sizeof(uint64_t));
+  }
 
   // Keep track of the latest event to do time comparisons later
   UkEvent *prev_event = NULL;
+  uint64_t prev_flush_end_time = 0;
   if (prev_event_count > 0) {
     prev_event = &object->event_buffer[prev_event_count-1];
+    prev_flush_end_time = prev_event->time;
   }
 
   // Create folder events for closing old folder and opening expected open folders
@@ -529,6 +673,7 @@ static void loadEventsData(FILE *file, bool swap_endian, UkEvents *object) {
   }
 
   // Load events
+  uint32_t span_count = 0;
   uint64_t time_adjustment = 0;
   UkEvent *first_loaded_event = NULL;
 #ifdef PRINT_UNIKORN_LOAD_INFO
@@ -541,7 +686,9 @@ static void loadEventsData(FILE *file, bool swap_endian, UkEvents *object) {
     }
     event->time = readUint64(swap_endian, file) + time_adjustment;
     // Verify time is increasing
-    if (prev_event != NULL) {
+    if (prev_event != NULL && !object->has_thresholds && !object->has_spans) {
+      // NOTE: If thresholds are used, a kept instance can be older than the events of the previous flush, so the events are sorted after loading instead.
+      //       Same for spans, since their end events are out of order.
       if (event->time < prev_event->time) {
 	printf("The event file contains an event that go backwards in time. Following event times will be adjusted to be forward in time. To avoid this, use a monotonically increasing clock when recording.\n");
 	time_adjustment += (prev_event->time - event->time);
@@ -553,6 +700,11 @@ static void loadEventsData(FILE *file, bool swap_endian, UkEvents *object) {
     printf("    ID = %d \"%s\"\n", event->event_id, getEventName(object, event->event_id));
     printf("      time = %"UINT64_FORMAT"  %s\n", event->time, elapsedTimeText(event->time - prev_time));
     prev_time = event->time;
+#endif
+    bool is_span = has_spans && readBool(file);
+    uint64_t span_duration = is_span ? readUint64(swap_endian, file) : 0;
+#ifdef PRINT_UNIKORN_LOAD_INFO
+    if (is_span) printf("      span duration = %"UINT64_FORMAT"\n", span_duration);
 #endif
     if (object->includes_instance) {
       event->instance = readUint64(swap_endian, file);
@@ -567,9 +719,23 @@ static void loadEventsData(FILE *file, bool swap_endian, UkEvents *object) {
 #endif
     }
     if (object->is_multi_threaded) {
-      event->thread_index = readUint16(swap_endian, file);
+      uint16_t thread_slot = readUint16(swap_endian, file);
+      assert(thread_slot < slot_map->slot_count);
+      event->thread_index = slot_map->thread_index_list[thread_slot];
+#ifdef PRINT_UNIKORN_LOAD_INFO
+      printf("      thread index = %d (slot %d)\n", event->thread_index, thread_slot);
+#endif
+    }
+    if (object->includes_cpu) {
+      event->cpu_index = readUint16(swap_endian, file);
+#ifdef PRINT_UNIKORN_LOAD_INFO
+      printf("      cpu index = %d\n", event->cpu_index);
+#endif
+    }
+    for (uint16_t j=0; j<object->counter_count; j++) {
+      object->counter_value_buffer[(size_t)event_index*object->counter_count + j] = readUint64(swap_endian, file);
 #ifdef PRINT_UNIKORN_LOAD_INFO
-      printf("      thread index = %d\n", event->thread_index);
+      printf("      %s = %"UINT64_FORMAT"\n", object->counter_name_list[j], object->counter_value_buffer[(size_t)event_index*object->counter_count + j]);
 #endif
     }
     if (object->includes_file_location) {
@@ -581,12 +747,27 @@ static void loadEventsData(FILE *file, bool swap_endian, UkEvents *object) {
 #endif
     }
     event_index++;
+    if (is_span) {
+      // Expand the span into its start event (just loaded) and its end event, which gets the same instance, value, thread, location and counter values
+      UkEvent *end_event = &object->event_buffer[event_index];
+      *end_event = *event;
+      end_event->event_id = event->event_id + 1;
+      end_event->time = event->time + span_duration;
+      if (object->counter_count > 0) {
+        memcpy(&object->counter_value_buffer[(size_t)event_index*object->counter_count], &object->counter_value_buffer[(size_t)(event_index-1)*object->counter_count], object->counter_count*sizeof(uint64_t));
+      }
+      event_index++;
+      span_count++;
+    }
   }
+  object->event_count += span_count;
 
   // Set the event times of the inserted close and open folders
   for (uint16_t i=0; i<num_final_open_folders+num_open_folders; i++) {
     UkEvent *event = &object->event_buffer[first_inserted_folder_event_index+i];
     event->time = first_loaded_event->time;
+    // Don't let the folders move into the previous flush's events when sorted
+    if ((object->has_thresholds || object->has_spans) && event->time < prev_flush_end_time) event->time = prev_flush_end_time;
   }
   object->event_count += num_open_folders;
 
@@ -597,6 +778,192 @@ static void loadEventsData(FILE *file, bool swap_endian, UkEvents *object) {
   if (object->folder_registration_count > 0) {
     free(final_folder_id_list);
   }
+
+  // Histograms: merge with the histograms from the previous flushes
+  if (object->is_aggregate) {
+    uint16_t sub_bucket_bits = readUint16(swap_endian, file);
+#ifdef PRINT_UNIKORN_LOAD_INFO
+    printf("  histogram_sub_bucket_bits = %d\n", sub_bucket_bits);
+#endif
+    assert(sub_bucket_bits < 16);
+    if (object->histogram_list == NULL) {
+      object->histogram_sub_bucket_bits = sub_bucket_bits;
+      object->histogram_bucket_count = (64-sub_bucket_bits+1) << sub_bucket_bits;
+      object->histogram_list = calloc(object->event_registration_count, sizeof(UkHistogram));
+      assert(object->histogram_list != NULL);
+      for (uint16_t i=0; i<object->event_registration_count; i++) {
+        object->histogram_list[i].bucket_counts = calloc(object->histogram_bucket_count, sizeof(uint64_t));
+        assert(object->histogram_list[i].bucket_counts != NULL);
+      }
+    } else {
+      assert(object->histogram_sub_bucket_bits == sub_bucket_bits);
+    }
+    for (uint16_t i=0; i<object->event_registration_count; i++) {
+      UkHistogram *histogram = &object->histogram_list[i];
+      uint64_t count = readUint64(swap_endian, file);
+      uint64_t min_duration = readUint64(swap_endian, file);
+      uint64_t max_duration = readUint64(swap_endian, file);
+      uint64_t total_duration = readUint64(swap_endian, file);
+      uint64_t unmatched_count = readUint64(swap_endian, file);
+      uint16_t used_bucket_count = readUint16(swap_endian, file);
+#ifdef PRINT_UNIKORN_LOAD_INFO
+      printf("    '%s': count=%"UINT64_FORMAT", min=%"UINT64_FORMAT", max=%"UINT64_FORMAT", unmatched=%"UINT64_FORMAT", used_buckets=%d\n", object->event_registration_list[i].name, count, min_duration, max_duration, unmatched_count, used_bucket_count);
+#endif
+      if (count > 0) {
+        if (histogram->count == 0 || min_duration < histogram->min_duration) histogram->min_duration = min_duration;
+        if (max_duration > histogram->max_duration) histogram->max_duration = max_duration;
+      }
+      histogram->count += count;
+      histogram->total_duration += total_duration;
+      histogram->unmatched_count += unmatched_count;
+      for (uint16_t j=0; j<used_bucket_count; j++) {
+        uint16_t bucket_index = readUint16(swap_endian, file);
+        uint64_t bucket_count = readUint64(swap_endian, file);
+        assert(bucket_index < object->histogram_bucket_count);
+        histogram->bucket_counts[bucket_index] += bucket_count;
+      }
+    }
+  }
+
+  // Paused time ranges
+  if (object->version_major >= 1 && object->version_minor >= 9) {
+    uint32_t pause_count = readUint32(swap_endian, file);
+#ifdef PRINT_UNIKORN_LOAD_INFO
+    printf("  pause_count = %d\n", pause_count);
+#endif
+    if (pause_count > 0) {
+      object->pause_list = realloc(object->pause_list, (object->pause_count+pause_count)*sizeof(UkPause));
+      assert(object->pause_list != NULL);
+    }
+    for (uint32_t i=0; i<pause_count; i++) {
+      uint64_t start_time = readUint64(swap_endian, file);
+      uint64_t end_time = readUint64(swap_endian, file);
+#ifdef PRINT_UNIKORN_LOAD_INFO
+      printf("    start_time = %"UINT64_FORMAT", end_time = %"UINT64_FORMAT"\n", start_time, end_time);
+#endif
+      UkPause *prev_pause = (object->pause_count > 0) ? &object->pause_list[object->pause_count-1] : NULL;
+      if (prev_pause != NULL && prev_pause->end_time == start_time) {
+        // A pause that was split by a flush
+        prev_pause->end_time = end_time;
+      } else {
+        object->pause_list[object->pause_count].start_time = start_time;
+        object->pause_list[object->pause_count].end_time = end_time;
+        object->pause_count++;
+      }
+    }
+  }
+
+  // Clock anchor at the time of the flush
+  if (object->version_major >= 1 && object->version_minor >= 13) {
+    uint64_t flush_time = readUint64(swap_endian, file);
+    uint64_t flush_wall_time = readUint64(swap_endian, file);
+    addClockAnchor(object, flush_time, flush_wall_time);
+  }
+
+  // Clock offsets to other processes
+  if (object->version_major >= 1 && object->version_minor >= 14) {
+    uint32_t clock_sync_count = readUint32(swap_endian, file);
+#ifdef PRINT_UNIKORN_LOAD_INFO
+    printf("  clock_sync_count=%d\n", clock_sync_count);
+#endif
+    if (clock_sync_count > 0) {
+      object->clock_sync_list = realloc(object->clock_sync_list, (object->clock_sync_count+clock_sync_count)*sizeof(UkClockSync));
+      assert(object->clock_sync_list != NULL);
+      for (uint32_t i=0; i<clock_sync_count; i++) {
+        UkClockSync *sync = &object->clock_sync_list[object->clock_sync_count];
+        sync->time = readUint64(swap_endian, file);
+        sync->peer_process_id = readUint64(swap_endian, file);
+        sync->offset = (int64_t)readUint64(swap_endian, file);
+        sync->round_trip = readUint64(swap_endian, file);
+        object->clock_sync_count++;
+      }
+    }
+  }
+}
+
+typedef struct {
+  uint64_t time;
+  uint32_t index;
+} EventOrder;
+
+static int compareEventOrder(const void *a, const void *b) {
+  // Ties keep the loaded order, so the sort is stable
+  const EventOrder *order1 = (const EventOrder *)a;
+  const EventOrder *order2 = (const EventOrder *)b;
+  if (order1->time != order2->time) return (order1->time < order2->time) ? -1 : 1;
+  return (order1->index < order2->index) ? -1 : (order1->index > order2->index);
+}
+
+static void clipPauses(UkEvents *object) {
+  // A pause may start before the first event (e.g. paused right after the session was created), but the events define the start of the recording
+  uint64_t first_time = object->event_buffer[0].time;
+  uint32_t pause_count = 0;
+  for (uint32_t i=0; i<object->pause_count; i++) {
+    UkPause *pause = &object->pause_list[i];
+    if (pause->end_time <= first_time) continue;
+    if (pause->start_time < first_time) pause->start_time = first_time;
+    object->pause_list[pause_count] = *pause;
+    pause_count++;
+  }
+  object->pause_count = pause_count;
+}
+
+static void sortEventsByTime(UkEvents *object) {
+  // Each flush is ordered by time, but an instance kept by a threshold may be older than the events of the previous flush, and a span's end event is loaded with its start
+  bool is_sorted = true;
+  for (uint32_t i=1; i<object->event_count; i++) {
+    if (object->event_buffer[i].time < object->event_buffer[i-1].time) {
+      is_sorted = false;
+      break;
+    }
+  }
+  if (is_sorted) return;
+  EventOrder *order_list = malloc(object->event_count * sizeof(EventOrder));
+  assert(order_list != NULL);
+  for (uint32_t i=0; i<object->event_count; i++) {
+    order_list[i].time = object->event_buffer[i].time;
+    order_list[i].index = i;
+  }
+  qsort(order_list, object->event_count, sizeof(EventOrder), compareEventOrder);
+  // Reorder the events and their counter values
+  UkEvent *event_buffer = malloc(object->event_count * sizeof(UkEvent));
+  assert(event_buffer != NULL);
+  uint64_t *counter_value_buffer = NULL;
+  if (object->counter_count > 0) {
+    counter_value_buffer = malloc((size_t)object->event_count * object->counter_count * sizeof(uint64_t));
+    assert(counter_value_buffer != NULL);
+  }
+  for (uint32_t i=0; i<object->event_count; i++) {
+    uint32_t index = order_list[i].index;
+    event_buffer[i] = object->event_buffer[index];
+    if (object->counter_count > 0) {
+      memcpy(&counter_value_buffer[(size_t)i*object->counter_count], &object->counter_value_buffer[(size_t)index*object->counter_count], object->counter_count*sizeof(uint64_t));
+    }
+  }
+  free(order_list);
+  free(object->event_buffer);
+  object->event_buffer = event_buffer;
+  if (object->counter_count > 0) {
+    free(object->counter_value_buffer);
+    object->counter_value_buffer = counter_value_buffer;
+  }
+}
+
+static bool isSupportedFile(FILE *file) {
+  // Peeks at the endian and version of the first flush, so a file that can't be loaded is rejected instead of asserting
+  bool is_big_endian;
+  uint16_t version[2]; // Major, minor
+  bool is_supported = false;
+  if (1 == fread(&is_big_endian, sizeof(is_big_endian), 1, file) && 2 == fread(version, sizeof(uint16_t), 2, file)) {
+    if (is_big_endian != isBigEndian()) {
+      version[0] = bswap_16(version[0]);
+      version[1] = bswap_16(version[1]);
+    }
+    is_supported = (version[0] == 1 && version[1] <= MAX_VERSION_MINOR);
+  }
+  int rc = fseek(file, 0, SEEK_SET);
+  assert(rc == 0);
+  return is_supported;
 }
 
 UkEvents *ukLoadEventsFile(const char *filename) {
@@ -608,11 +975,17 @@ UkEvents *ukLoadEventsFile(const char *filename) {
   FILE *file = fopen(filename, "rb");
   if (file == NULL) return NULL;
 #endif
+  if (!isSupportedFile(file)) {
+    // Empty, or saved by a newer version of Unikorn
+    fclose(file);
+    return NULL;
+  }
 
   UkEvents *object = calloc(1, sizeof(UkEvents));
   assert(object != NULL);
 
   // Get endian
+  ThreadSlotMap slot_map = { .slot_count = 0, .generation_list = NULL, .thread_index_list = NULL };
   bool first_time_loaded = true;
   bool swap_endian = false;
   bool is_big_endian = false;
@@ -636,12 +1009,16 @@ UkEvents *ukLoadEventsFile(const char *filename) {
       assert(subsequent_is_big_endian == is_big_endian);
     }
     loadEventsHeader(file, first_time_loaded, swap_endian, object);
-    loadEventsData(file, swap_endian, object);
+    loadEventsData(file, swap_endian, object, &slot_map);
     first_time_loaded = false;
   }
+  if (object->has_thresholds || object->has_spans) sortEventsByTime(object);
+  if (object->event_count > 0) clipPauses(object);
 
   int rc = fclose(file);
   assert(rc == 0);
+  free(slot_map.generation_list);
+  free(slot_map.thread_index_list);
 
   return object;
 }
@@ -666,6 +1043,112 @@ void ukFreeEvents(UkEvents *object) {
   }
   free(object->function_name_list);
   free(object->thread_id_list);
+  free(object->thread_is_task_list);
+  for (uint16_t i=0; i<object->counter_count; i++) {
+    free(object->counter_name_list[i]);
+  }
+  free(object->counter_name_list);
+  free(object->counter_value_buffer);
+  if (object->histogram_list != NULL) {
+    for (uint16_t i=0; i<object->event_registration_count; i++) {
+      free(object->histogram_list[i].bucket_counts);
+    }
+    free(object->histogram_list);
+  }
+  free(object->pause_list);
+  free(object->host_name);
+  free(object->clock_anchor_list);
+  free(object->clock_sync_list);
   free(object->event_buffer);
   free(object);
 }
+
+uint64_t *ukGetCounterValues(UkEvents *object, uint32_t event_index) {
+  if (object->counter_count == 0) return NULL;
+  assert(event_index < object->event_count);
+  return &object->counter_value_buffer[(size_t)event_index * object->counter_count];
+}
+
+uint64_t ukGetHistogramBucketStart(UkEvents *object, uint32_t bucket_index) {
+  assert(object->histogram_list != NULL);
+  assert(bucket_index <= object->histogram_bucket_count); // Allow one past the last bucket to get the end of the last bucket
+  uint16_t sub_bucket_bits = object->histogram_sub_bucket_bits;
+  uint32_t sub_bucket_count = 1 << sub_bucket_bits;
+  if (bucket_index < sub_bucket_count) return bucket_index;
+  uint32_t shift = bucket_index/sub_bucket_count - 1;
+  uint64_t sub_bucket = bucket_index % sub_bucket_count;
+  if (shift >= (uint32_t)(64 - sub_bucket_bits)) return UINT64_MAX; // End of the last bucket
+  return (sub_bucket_count + sub_bucket) << shift;
+}
+
+uint64_t ukGetHistogramPercentile(UkEvents *object, uint16_t event_registration_index, double percentile) {
+  assert(object->histogram_list != NULL);
+  assert(event_registration_index < object->event_registration_count);
+  UkHistogram *histogram = &object->histogram_list[event_registration_index];
+  if (histogram->count == 0) return 0;
+  uint64_t target_count = (uint64_t)(histogram->count * percentile / 100.0 + 0.5);
+  if (target_count == 0) target_count = 1;
+  uint64_t count = 0;
+  for (uint32_t i=0; i<object->histogram_bucket_count; i++) {
+    count += histogram->bucket_counts[i];
+    if (count >= target_count) {
+      uint64_t bucket_end = ukGetHistogramBucketStart(object, i+1) - 1;
+      return (bucket_end < histogram->max_duration) ? bucket_end : histogram->max_duration;
+    }
+  }
+  return histogram->max_duration;
+}
+
+uint64_t ukGetWallTime(UkEvents *object, uint64_t time) {
+  if (object->clock_anchor_count == 0) return 0;
+  // Find the first anchor after the time
+  UkClockAnchor *anchor_list = object->clock_anchor_list;
+  uint32_t next = 0;
+  while (next < object->clock_anchor_count && anchor_list[next].time <= time) next++;
+  if (next == 0 || next == object->clock_anchor_count) {
+    // Before the first anchor or after the last: use the closest anchor (unsigned wrap around handles times before the anchor)
+    UkClockAnchor *anchor = (next == 0) ? &anchor_list[0] : &anchor_list[next-1];
+    return anchor->wall_time + (time - anchor->time);
+  }
+  // Interpolate between the anchors on each side, so any drift between the clocks is spread out
+  UkClockAnchor *prev = &anchor_list[next-1];
+  UkClockAnchor *after = &anchor_list[next];
+  double fraction = (double)(time - prev->time) / (double)(after->time - prev->time);
+  int64_t wall_delta = (int64_t)(after->wall_time - prev->wall_time); // The wall clock may have been stepped back
+  return prev->wall_time + (uint64_t)(int64_t)(fraction * (double)wall_delta);
+}
+
+uint64_t ukGetPeerTime(UkEvents *object, uint64_t peer_process_id, uint64_t time, uint64_t *uncertainty_ret) {
+  // Fit a line to the peer's offset over time, so the drift between the clocks is corrected. Each sample is weighted by how precisely it was measured.
+  uint64_t base_time = 0;
+  uint64_t min_round_trip = UINT64_MAX;
+  double total_weight = 0, mean_time = 0, mean_offset = 0;
+  for (uint32_t i=0; i<object->clock_sync_count; i++) {
+    UkClockSync *sync = &object->clock_sync_list[i];
+    if (sync->peer_process_id != peer_process_id) continue;
+    if (total_weight == 0) base_time = sync->time; // Relative times keep the precision of the doubles
+    double uncertainty = sync->round_trip / 2.0 + 1.0;
+    double weight = 1.0 / (uncertainty * uncertainty);
+    total_weight += weight;
+    mean_time += weight * (double)(int64_t)(sync->time - base_time);
+    mean_offset += weight * (double)sync->offset;
+    if (sync->round_trip < min_round_trip) min_round_trip = sync->round_trip;
+  }
+  if (total_weight == 0) return 0;
+  mean_time /= total_weight;
+  mean_offset /= total_weight;
+  double covariance = 0, variance = 0;
+  for (uint32_t i=0; i<object->clock_sync_count; i++) {
+    UkClockSync *sync = &object->clock_sync_list[i];
+    if (sync->peer_process_id != peer_process_id) continue;
+    double uncertainty = sync->round_trip / 2.0 + 1.0;
+    double weight = 1.0 / (uncertainty * uncertainty);
+    double dt = (double)(int64_t)(sync->time - base_time) - mean_time;
+    covariance += weight * dt * ((double)sync->offset - mean_offset);
+    variance += weight * dt * dt;
+  }
+  double drift = (variance > 0) ? covariance / variance : 0; // Zero if only one sample, or all at the same time
+  double offset = mean_offset + drift * ((double)(int64_t)(time - base_time) - mean_time);
+  if (uncertainty_ret != NULL) *uncertainty_ret = min_round_trip / 2;
+  return time + (uint64_t)(int64_t)offset;
+}
@@ -0,0 +1,197 @@
+// Copyright 2021 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define _GNU_SOURCE             // For RTLD_NEXT
+#include "unikorn_preload.h"
+#include "unikorn_clock.h"
+#include "unikorn_file_flush.h"
+#ifdef NDEBUG // Don't want assert compiled out
+  #undef NDEBUG
+#endif
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#define MAX_NAME_LENGTH 32
+#define MAX_SETTINGS_LENGTH 1024
+#define MAX_FILENAME_LENGTH 1024
+#define DEFAULT_MAX_EVENT_COUNT 1000000
+#define MIN_EVENT_COUNT 10          // Same as unikorn.c
+
+static void *L_session = NULL;      // NULL if not recording
+static char L_name[MAX_NAME_LENGTH];
+static uint32_t L_max_event_count = DEFAULT_MAX_EVENT_COUNT;
+static bool L_flush_when_full = false;
+static bool L_aggregate_only = false;
+static char L_filename[MAX_FILENAME_LENGTH];
+static UkFileFlushInfo L_flush_info;
+static pthread_key_t L_exit_key;    // Only used to find out when a thread is exiting
+static void *L_fork_session = NULL; // The session locked by prepareFork()
+// NOTE: Exported, so every interposer library loaded into the process shares the first library's copy: a thread recording into one session is not
+//       recorded by the others (e.g. the pthread interposer would otherwise record the malloc interposer's buffer locks, nesting one session's locks
+//       in the other's, which can deadlock the fork handlers below)
+UK_PRELOAD_EXPORT THREAD_LOCAL bool t_unikorn_preload_busy = false;
+static bool L_busy_before_fork = false;
+static THREAD_LOCAL bool t_exiting = false;
+static THREAD_LOCAL bool t_watching_exit = false;
+
+static void threadExiting(void *value) {
+  // Called by pthreads when a thread that recorded an event exits. Calls made after this (e.g. by Unikorn freeing the thread's state) are not recorded,
+  // otherwise they would give the exiting thread new state that is never freed.
+  (void)value;
+  t_exiting = true;
+}
+
+static void setFilename() {
+  const char *folder = getenv("UNIKORN_PRELOAD_DIR");
+  if (folder == NULL || folder[0] == '\0') folder = ".";
+  snprintf(L_filename, sizeof(L_filename), "%s/unikorn_%s_%d.events", folder, L_name, (int)getpid());
+}
+
+static void prepareFork() {
+  // Wait for the other threads to finish recording, so the child doesn't inherit a locked buffer
+  L_busy_before_fork = t_unikorn_preload_busy;
+  t_unikorn_preload_busy = true; // The locking calls are not recorded
+  L_fork_session = __atomic_load_n(&L_session, __ATOMIC_ACQUIRE);
+  if (L_fork_session != NULL) ukLockForFork(L_fork_session);
+}
+
+static void parentAfterFork() {
+  if (L_fork_session != NULL) ukUnlockAfterFork(L_fork_session, false);
+  L_fork_session = NULL;
+  t_unikorn_preload_busy = L_busy_before_fork; // Another interposer's handlers may still be running
+}
+
+static void childAfterFork() {
+  // The child stops recording: its copy of the session only has the parent's events, which the parent saves.
+  // NOTE: The copy is not destroyed, since it's shared copy-on-write with the parent until the child writes to it (or calls exec())
+  if (L_fork_session != NULL) ukUnlockAfterFork(L_fork_session, true);
+  L_fork_session = NULL;
+  __atomic_store_n(&L_session, NULL, __ATOMIC_RELEASE);
+  t_unikorn_preload_busy = L_busy_before_fork;
+}
+
+void ukPreloadReadSettings(const char *interposer_name, UkPreloadApplySetting applySetting) {
+  if (L_session != NULL) { fprintf(stderr, "Unikorn: the '%s' interposer is already started\n", interposer_name); assert(0); }
+  if (strlen(interposer_name) >= MAX_NAME_LENGTH) { fprintf(stderr, "Unikorn: the interposer name '%s' has more than %d chars\n", interposer_name, MAX_NAME_LENGTH-1); assert(0); }
+  strcpy(L_name, interposer_name);
+
+  // UNIKORN_<NAME>: e.g. UNIKORN_MALLOC
+  char env_name[MAX_NAME_LENGTH+10];
+  snprintf(env_name, sizeof(env_name), "UNIKORN_%s", L_name);
+  for (char *c=&env_name[8]; *c!='\0'; c++) *c = (char)toupper(*c);
+  const char *env_value = getenv(env_name);
+  if (env_value == NULL) return;
+
+  // NOTE: Copied to the stack, since heap allocations may be what's being interposed
+  char settings[MAX_SETTINGS_LENGTH];
+  snprintf(settings, sizeof(settings), "%s", env_value);
+  char *save_ptr = NULL;
+  for (char *name = strtok_r(settings, ",", &save_ptr); name != NULL; name = strtok_r(NULL, ",", &save_ptr)) {
+    char *value = strchr(name, '=');
+    if (value == NULL) {
+      fprintf(stderr, "Unikorn: the setting '%s' in %s has no value, so it will be ignored\n", name, env_name);
+      continue;
+    }
+    *value = '\0';
+    value++;
+    if (strcmp(name, "max_event_count") == 0) {
+      unsigned long max_event_count = strtoul(value, NULL, 0);
+      if (max_event_count < MIN_EVENT_COUNT || max_event_count > UINT32_MAX) {
+        fprintf(stderr, "Unikorn: the setting '%s=%s' in %s is not in the range %d to %u, so it will be ignored\n", name, value, env_name, MIN_EVENT_COUNT, UINT32_MAX);
+      } else {
+        L_max_event_count = (uint32_t)max_event_count;
+      }
+    } else if (strcmp(name, "flush_when_full") == 0) {
+      L_flush_when_full = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+    } else if (strcmp(name, "aggregate_only") == 0) {
+      L_aggregate_only = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+    } else if (applySetting != NULL) {
+      applySetting(name, value);
+    } else {
+      fprintf(stderr, "Unikorn: the setting '%s' in %s is not known, so it will be ignored\n", name, env_name);
+    }
+  }
+}
+
+void ukPreloadStart(uint16_t event_registration_count, UkEventRegistration *event_registration_list, bool record_file_location) {
+  if (L_name[0] == '\0') { fprintf(stderr, "Unikorn: call ukPreloadReadSettings() before ukPreloadStart()\n"); assert(0); }
+  if (L_session != NULL) { fprintf(stderr, "Unikorn: the '%s' interposer is already started\n", L_name); assert(0); }
+  t_unikorn_preload_busy = true; // Unikorn's own calls (e.g. allocating the event buffers) are not recorded
+
+  // Attributes
+  UkAttrs attrs;
+  memset(&attrs, 0, sizeof(attrs));
+  attrs.max_event_count = L_max_event_count;
+  attrs.flush_when_full = L_flush_when_full;
+  attrs.is_multi_threaded = true;
+  attrs.record_value = true;
+  attrs.record_file_location = record_file_location;
+  attrs.record_per_cpu = true; // Threads making the interposed calls at the same time don't contend for one lock
+  attrs.event_registration_count = event_registration_count;
+  attrs.event_registration_list = event_registration_list;
+  attrs.aggregate_only = L_aggregate_only;
+  attrs.apply_config = false; // UNIKORN_CONFIG is for the application's sessions: the interposer's settings are in UNIKORN_<NAME>
+
+  // Create the session
+  // NOTE: The exit key is created before the session's thread key, so pthreads calls threadExiting() before Unikorn frees the thread's state
+  int rc = pthread_key_create(&L_exit_key, threadExiting);
+  assert(rc == 0);
+  rc = pthread_atfork(prepareFork, parentAfterFork, childAfterFork);
+  assert(rc == 0);
+  setFilename();
+  L_flush_info.filename = L_filename;
+  L_flush_info.file = NULL;
+  L_flush_info.events_saved = false;
+  L_flush_info.append_subsequent_saves = true;
+  void *session = ukCreate(&attrs, ukGetTime, &L_flush_info, ukPrepareFileFlush, ukFileFlush, ukFinishFileFlush);
+  t_unikorn_preload_busy = false;
+  __atomic_store_n(&L_session, session, __ATOMIC_RELEASE);
+}
+
+void ukPreloadStop() {
+  void *session = __atomic_exchange_n(&L_session, NULL, __ATOMIC_ACQ_REL);
+  if (session == NULL) return;
+  t_unikorn_preload_busy = true;
+  ukFlush(session);
+  t_unikorn_preload_busy = false;
+}
+
+void *ukPreloadBegin() {
+  if (t_unikorn_preload_busy || t_exiting) return NULL;
+  void *session = __atomic_load_n(&L_session, __ATOMIC_ACQUIRE);
+  if (session == NULL) return NULL;
+  t_unikorn_preload_busy = true;
+  if (!t_watching_exit) {
+    // Any non NULL value, so threadExiting() is called when the thread exits
+    t_watching_exit = true;
+    pthread_setspecific(L_exit_key, &L_exit_key);
+  }
+  return session;
+}
+
+void ukPreloadEnd() {
+  t_unikorn_preload_busy = false;
+}
+
+void *ukPreloadRealFunction(const char *function_name) {
+  void *function = dlsym(RTLD_NEXT, function_name);
+  if (function == NULL) { fprintf(stderr, "Unikorn: failed to find the function '%s' to interpose\n", function_name); assert(0); }
+  return function;
+}
@@ -0,0 +1,482 @@
+// Copyright 2021 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The LD_PRELOAD interposer for blocking I/O calls: built into libunikorn_io.so (see unikorn_preload.h)
+//  - Interposes read(), write(), pread(), pwrite(), fsync(), fdatasync(), send(), recv(), sendto() and recvfrom(). Each call is a start
+//    event (the bytes requested) and an end event (the call's result: the bytes transferred, or -1)
+//  - The file descriptor is in the event's file location: the file name is what the descriptor was opened on (from /proc/self/fd, e.g. the
+//    file's path or 'socket:[<inode>]'), the function name is the call, and the line number is the descriptor
+//  - Descriptor names are kept in a side table, found on the first call after the descriptor is opened, and forgotten by close(), fclose(),
+//    close_range(), and the calls that create a descriptor without opening a file: dup(), dup2(), dup3() and fcntl(F_DUPFD*).
+//    IMPORTANT: Calls made inside libc (e.g. the read() in fread()) are not seen, so a descriptor closed inside libc keeps its old name until
+//    it's closed or replaced with one of the above.
+//  - Settings in UNIKORN_IO:
+//      disable=<call>                  Don't record the call (e.g. disable=write). Can be used more than once. Disabled calls cost almost nothing.
+//      threshold=<call>:<nanoseconds>  Only keep the calls that take at least this long (see ukSetEventThreshold()). Use 'all' for every call.
+//      max_fds=<N>                     Descriptors from N up are all named 'fd'. Default is 1024.
+//      e.g. UNIKORN_IO="disable=fsync,threshold=all:100000"
+
+#define _GNU_SOURCE             // For pread64() and pwrite64()
+#include "unikorn_preload.h"
+#ifdef NDEBUG // Don't want assert compiled out
+  #undef NDEBUG
+#endif
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define DEFAULT_MAX_FDS 1024
+#define MAX_FD_NAMES 4096           // Unique descriptor names
+#define FD_NAME_ARENA_BYTES 262144  // Holds the unique descriptor names: never freed, since recorded events point at them
+#define UNNAMED_FD "fd"             // Descriptors above max_fds, or when there's no room for more names
+
+typedef enum {
+  IO_READ=0,
+  IO_WRITE,
+  IO_PREAD,
+  IO_PWRITE,
+  IO_FSYNC,
+  IO_FDATASYNC,
+  IO_SEND,
+  IO_RECV,
+  IO_SENDTO,
+  IO_RECVFROM,
+  IO_CALL_COUNT
+} IoCall;
+
+static UkEventRegistration L_events[IO_CALL_COUNT] = {
+  // Name         Color      Start ID  End ID  Start Value Name  End Value Name
+  { "read",       UK_BLUE,   1,        2,      "Bytes",          "Result"},
+  { "write",      UK_GREEN,  3,        4,      "Bytes",          "Result"},
+  { "pread",      UK_BLUE,   5,        6,      "Bytes",          "Result"},
+  { "pwrite",     UK_GREEN,  7,        8,      "Bytes",          "Result"},
+  { "fsync",      UK_RED,    9,        10,     "",               "Result"},
+  { "fdatasync",  UK_RED,    11,       12,     "",               "Result"},
+  { "send",       UK_PURPLE, 13,       14,     "Bytes",          "Result"},
+  { "recv",       UK_TEAL,   15,       16,     "Bytes",          "Result"},
+  { "sendto",     UK_PURPLE, 17,       18,     "Bytes",          "Result"},
+  { "recvfrom",   UK_TEAL,   19,       20,     "Bytes",          "Result"},
+};
+
+typedef ssize_t (*ReadFunction)(int fd, void *buf, size_t count);
+typedef ssize_t (*WriteFunction)(int fd, const void *buf, size_t count);
+typedef ssize_t (*PreadFunction)(int fd, void *buf, size_t count, off_t offset);
+typedef ssize_t (*PwriteFunction)(int fd, const void *buf, size_t count, off_t offset);
+typedef ssize_t (*Pread64Function)(int fd, void *buf, size_t count, off64_t offset);
+typedef ssize_t (*Pwrite64Function)(int fd, const void *buf, size_t count, off64_t offset);
+typedef int (*SyncFunction)(int fd);
+typedef ssize_t (*SendFunction)(int fd, const void *buf, size_t len, int flags);
+typedef ssize_t (*RecvFunction)(int fd, void *buf, size_t len, int flags);
+typedef ssize_t (*SendtoFunction)(int fd, const void *buf, size_t len, int flags, __CONST_SOCKADDR_ARG addr, socklen_t addr_len);
+typedef ssize_t (*RecvfromFunction)(int fd, void *buf, size_t len, int flags, __SOCKADDR_ARG addr, socklen_t *addr_len);
+typedef int (*CloseFunction)(int fd);
+typedef int (*FcloseFunction)(FILE *stream);
+typedef int (*Dup2Function)(int old_fd, int new_fd);
+typedef int (*Dup3Function)(int old_fd, int new_fd, int flags);
+typedef int (*DupFunction)(int old_fd);
+typedef int (*FcntlFunction)(int fd, int cmd, ...);
+typedef int (*CloseRangeFunction)(unsigned int first_fd, unsigned int last_fd, int flags);
+
+static ReadFunction L_real_read = NULL;
+static WriteFunction L_real_write = NULL;
+static PreadFunction L_real_pread = NULL;
+static PwriteFunction L_real_pwrite = NULL;
+static Pread64Function L_real_pread64 = NULL;
+static Pwrite64Function L_real_pwrite64 = NULL;
+static SyncFunction L_real_fsync = NULL;
+static SyncFunction L_real_fdatasync = NULL;
+static SendFunction L_real_send = NULL;
+static RecvFunction L_real_recv = NULL;
+static SendtoFunction L_real_sendto = NULL;
+static RecvfromFunction L_real_recvfrom = NULL;
+static CloseFunction L_real_close = NULL;
+static FcloseFunction L_real_fclose = NULL;
+static Dup2Function L_real_dup2 = NULL;
+static Dup3Function L_real_dup3 = NULL;
+static DupFunction L_real_dup = NULL;
+static FcntlFunction L_real_fcntl = NULL;
+static FcntlFunction L_real_fcntl64 = NULL;           // Found on first use, since it's not in glibc before 2.28
+static CloseRangeFunction L_real_close_range = NULL;  // Found on first use, since it's not in glibc before 2.34
+
+// Settings
+static bool L_disabled[IO_CALL_COUNT];
+static uint64_t L_threshold[IO_CALL_COUNT];
+static uint32_t L_max_fds = DEFAULT_MAX_FDS;
+
+// Descriptor side table: descriptor -> name. Names are unique, so the flush stores each one once.
+static const char **L_fd_names = NULL;      // NULL if the descriptor hasn't been named since it was opened
+static pthread_mutex_t L_name_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char *L_name_arena = NULL;
+static uint32_t L_name_arena_used = 0;
+static uint32_t L_name_count = 0;
+static const char *L_name_list[MAX_FD_NAMES];
+
+static void resolveRealFunctions() {
+  L_real_read = (ReadFunction)ukPreloadRealFunction("read");
+  L_real_write = (WriteFunction)ukPreloadRealFunction("write");
+  L_real_pread = (PreadFunction)ukPreloadRealFunction("pread");
+  L_real_pwrite = (PwriteFunction)ukPreloadRealFunction("pwrite");
+  L_real_pread64 = (Pread64Function)ukPreloadRealFunction("pread64");
+  L_real_pwrite64 = (Pwrite64Function)ukPreloadRealFunction("pwrite64");
+  L_real_fsync = (SyncFunction)ukPreloadRealFunction("fsync");
+  L_real_fdatasync = (SyncFunction)ukPreloadRealFunction("fdatasync");
+  L_real_send = (SendFunction)ukPreloadRealFunction("send");
+  L_real_recv = (RecvFunction)ukPreloadRealFunction("recv");
+  L_real_sendto = (SendtoFunction)ukPreloadRealFunction("sendto");
+  L_real_recvfrom = (RecvfromFunction)ukPreloadRealFunction("recvfrom");
+  L_real_close = (CloseFunction)ukPreloadRealFunction("close");
+  L_real_fclose = (FcloseFunction)ukPreloadRealFunction("fclose");
+  L_real_dup2 = (Dup2Function)ukPreloadRealFunction("dup2");
+  L_real_dup3 = (Dup3Function)ukPreloadRealFunction("dup3");
+  L_real_dup = (DupFunction)ukPreloadRealFunction("dup");
+  L_real_fcntl = (FcntlFunction)ukPreloadRealFunction("fcntl");
+}
+
+static bool findCalls(const char *call_name, bool *call_list) {
+  // Returns false if the call is not known. The call name 'all' selects every call.
+  bool found = false;
+  for (uint32_t i=0; i<IO_CALL_COUNT; i++) {
+    call_list[i] = (strcmp(call_name, "all") == 0 || strcmp(call_name, L_events[i].name) == 0);
+    if (call_list[i]) found = true;
+  }
+  return found;
+}
+
+static void applySetting(const char *name, const char *value) {
+  bool call_list[IO_CALL_COUNT];
+  if (strcmp(name, "disable") == 0) {
+    if (!findCalls(value, call_list)) { fprintf(stderr, "Unikorn: the call '%s' in UNIKORN_IO is not known, so it will be ignored\n", value); return; }
+    for (uint32_t i=0; i<IO_CALL_COUNT; i++) {
+      if (call_list[i]) L_disabled[i] = true;
+    }
+  } else if (strcmp(name, "threshold") == 0) {
+    // <call>:<nanoseconds>
+    char call_name[32];
+    const char *separator = strchr(value, ':');
+    if (separator == NULL || separator - value >= (long)sizeof(call_name)) { fprintf(stderr, "Unikorn: the setting 'threshold=%s' in UNIKORN_IO is not <call>:<nanoseconds>, so it will be ignored\n", value); return; }
+    memcpy(call_name, value, separator - value);
+    call_name[separator - value] = '\0';
+    if (!findCalls(call_name, call_list)) { fprintf(stderr, "Unikorn: the call '%s' in UNIKORN_IO is not known, so it will be ignored\n", call_name); return; }
+    uint64_t threshold = strtoull(separator+1, NULL, 0);
+    for (uint32_t i=0; i<IO_CALL_COUNT; i++) {
+      if (call_list[i]) L_threshold[i] = threshold;
+    }
+  } else if (strcmp(name, "max_fds") == 0) {
+    unsigned long max_fds = strtoul(value, NULL, 0);
+    if (max_fds < 1 || max_fds > UINT16_MAX) { fprintf(stderr, "Unikorn: the setting '%s=%s' in UNIKORN_IO is not in the range 1 to %d, so it will be ignored\n", name, value, UINT16_MAX); return; }
+    L_max_fds = (uint32_t)max_fds;
+  } else {
+    fprintf(stderr, "Unikorn: the setting '%s' in UNIKORN_IO is not known, so it will be ignored\n", name);
+  }
+}
+
+static const char *uniqueName(const char *name) {
+  // NOTE: Only called the first time a descriptor is used after being opened, so a lock and a linear search are fine
+  const char *unique_name = UNNAMED_FD;
+  pthread_mutex_lock(&L_name_mutex);
+  uint32_t i = 0;
+  while (i < L_name_count && strcmp(L_name_list[i], name) != 0) i++;
+  if (i < L_name_count) {
+    unique_name = L_name_list[i];
+  } else {
+    uint32_t bytes = (uint32_t)strlen(name) + 1;
+    if (L_name_count < MAX_FD_NAMES && L_name_arena_used + bytes <= FD_NAME_ARENA_BYTES) {
+      char *new_name = &L_name_arena[L_name_arena_used];
+      memcpy(new_name, name, bytes);
+      L_name_arena_used += bytes;
+      L_name_list[L_name_count] = new_name;
+      L_name_count++;
+      unique_name = new_name;
+    }
+  }
+  pthread_mutex_unlock(&L_name_mutex);
+  return unique_name;
+}
+
+static const char *fdName(int fd) {
+  if (fd < 0 || (uint32_t)fd >= L_max_fds) return UNNAMED_FD;
+  const char *name = __atomic_load_n(&L_fd_names[fd], __ATOMIC_ACQUIRE);
+  if (name != NULL) return name;
+  // First use since the descriptor was opened
+  char link_name[32];
+  char path[PATH_MAX];
+  snprintf(link_name, sizeof(link_name), "/proc/self/fd/%d", fd);
+  ssize_t length = readlink(link_name, path, sizeof(path)-1);
+  if (length < 0) return UNNAMED_FD; // Not open
+  path[length] = '\0';
+  name = uniqueName(path);
+  __atomic_store_n(&L_fd_names[fd], name, __ATOMIC_RELEASE);
+  return name;
+}
+
+static void forgetFdName(int fd) {
+  if (L_fd_names == NULL || fd < 0 || (uint32_t)fd >= L_max_fds) return;
+  __atomic_store_n(&L_fd_names[fd], NULL, __ATOMIC_RELEASE);
+}
+
+static void forgetFdNames(unsigned int first_fd, unsigned int last_fd) {
+  // NOTE: last_fd is usually UINT_MAX (every descriptor from first_fd up)
+  if (L_fd_names == NULL || L_max_fds == 0) return;
+  if (last_fd >= L_max_fds) last_fd = L_max_fds - 1;
+  for (unsigned int fd=first_fd; fd<=last_fd; fd++) {
+    __atomic_store_n(&L_fd_names[fd], NULL, __ATOMIC_RELEASE);
+  }
+}
+
+static uint16_t lineNumber(int fd) {
+  // The descriptor is the line number: invalid or too large descriptors are shown as 65535
+  return (fd < 0 || fd > UINT16_MAX) ? UINT16_MAX : (uint16_t)fd;
+}
+
+static void *beginCall(IoCall call, int fd, double bytes, const char **fd_name_ret) {
+  // Returns the session if the call is recorded
+  if (L_disabled[call]) return NULL;
+  void *session = ukPreloadBegin();
+  if (session == NULL) return NULL;
+  int application_errno = errno;
+  const char *fd_name = fdName(fd);
+  ukRecordEvent(session, L_events[call].start_id, bytes, fd_name, L_events[call].name, lineNumber(fd));
+  errno = application_errno;
+  *fd_name_ret = fd_name;
+  return session;
+}
+
+static void endCall(void *session, IoCall call, int fd, const char *fd_name, double result) {
+  // Recording may change errno (e.g. allocating the thread's state), but the application needs the errno of the real call
+  int real_errno = errno;
+  ukRecordEvent(session, L_events[call].end_id, result, fd_name, L_events[call].name, lineNumber(fd));
+  errno = real_errno;
+  ukPreloadEnd();
+}
+
+UK_PRELOAD_EXPORT ssize_t read(int fd, void *buf, size_t count) {
+  if (L_real_read == NULL) resolveRealFunctions();
+  const char *fd_name;
+  void *session = beginCall(IO_READ, fd, (double)count, &fd_name);
+  if (session == NULL) return L_real_read(fd, buf, count);
+  ssize_t result = L_real_read(fd, buf, count);
+  endCall(session, IO_READ, fd, fd_name, (double)result);
+  return result;
+}
+
+UK_PRELOAD_EXPORT ssize_t write(int fd, const void *buf, size_t count) {
+  if (L_real_write == NULL) resolveRealFunctions();
+  const char *fd_name;
+  void *session = beginCall(IO_WRITE, fd, (double)count, &fd_name);
+  if (session == NULL) return L_real_write(fd, buf, count);
+  ssize_t result = L_real_write(fd, buf, count);
+  endCall(session, IO_WRITE, fd, fd_name, (double)result);
+  return result;
+}
+
+UK_PRELOAD_EXPORT ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+  if (L_real_pread == NULL) resolveRealFunctions();
+  const char *fd_name;
+  void *session = beginCall(IO_PREAD, fd, (double)count, &fd_name);
+  if (session == NULL) return L_real_pread(fd, buf, count, offset);
+  ssize_t result = L_real_pread(fd, buf, count, offset);
+  endCall(session, IO_PREAD, fd, fd_name, (double)result);
+  return result;
+}
+
+UK_PRELOAD_EXPORT ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
+  if (L_real_pwrite == NULL) resolveRealFunctions();
+  const char *fd_name;
+  void *session = beginCall(IO_PWRITE, fd, (double)count, &fd_name);
+  if (session == NULL) return L_real_pwrite(fd, buf, count, offset);
+  ssize_t result = L_real_pwrite(fd, buf, count, offset);
+  endCall(session, IO_PWRITE, fd, fd_name, (double)result);
+  return result;
+}
+
+// Applications built with -D_FILE_OFFSET_BITS=64 call these instead
+UK_PRELOAD_EXPORT ssize_t pread64(int fd, void *buf, size_t count, off64_t offset) {
+  if (L_real_pread64 == NULL) resolveRealFunctions();
+  const char *fd_name;
+  void *session = beginCall(IO_PREAD, fd, (double)count, &fd_name);
+  if (session == NULL) return L_real_pread64(fd, buf, count, offset);
+  ssize_t result = L_real_pread64(fd, buf, count, offset);
+  endCall(session, IO_PREAD, fd, fd_name, (double)result);
+  return result;
+}
+
+UK_PRELOAD_EXPORT ssize_t pwrite64(int fd, const void *buf, size_t count, off64_t offset) {
+  if (L_real_pwrite64 == NULL) resolveRealFunctions();
+  const char *fd_name;
+  void *session = beginCall(IO_PWRITE, fd, (double)count, &fd_name);
+  if (session == NULL) return L_real_pwrite64(fd, buf, count, offset);
+  ssize_t result = L_real_pwrite64(fd, buf, count, offset);
+  endCall(session, IO_PWRITE, fd, fd_name, (double)result);
+  return result;
+}
+
+UK_PRELOAD_EXPORT int fsync(int fd) {
+  if (L_real_fsync == NULL) resolveRealFunctions();
+  const char *fd_name;
+  void *session = beginCall(IO_FSYNC, fd, 0, &fd_name);
+  if (session == NULL) return L_real_fsync(fd);
+  int result = L_real_fsync(fd);
+  endCall(session, IO_FSYNC, fd, fd_name, result);
+  return result;
+}
+
+UK_PRELOAD_EXPORT int fdatasync(int fd) {
+  if (L_real_fdatasync == NULL) resolveRealFunctions();
+  const char *fd_name;
+  void *session = beginCall(IO_FDATASYNC, fd, 0, &fd_name);
+  if (session == NULL) return L_real_fdatasync(fd);
+  int result = L_real_fdatasync(fd);
+  endCall(session, IO_FDATASYNC, fd, fd_name, result);
+  return result;
+}
+
+UK_PRELOAD_EXPORT ssize_t send(int fd, const void *buf, size_t len, int flags) {
+  if (L_real_send == NULL) resolveRealFunctions();
+  const char *fd_name;
+  void *session = beginCall(IO_SEND, fd, (double)len, &fd_name);
+  if (session == NULL) return L_real_send(fd, buf, len, flags);
+  ssize_t result = L_real_send(fd, buf, len, flags);
+  endCall(session, IO_SEND, fd, fd_name, (double)result);
+  return result;
+}
+
+UK_PRELOAD_EXPORT ssize_t recv(int fd, void *buf, size_t len, int flags) {
+  if (L_real_recv == NULL) resolveRealFunctions();
+  const char *fd_name;
+  void *session = beginCall(IO_RECV, fd, (double)len, &fd_name);
+  if (session == NULL) return L_real_recv(fd, buf, len, flags);
+  ssize_t result = L_real_recv(fd, buf, len, flags);
+  endCall(session, IO_RECV, fd, fd_name, (double)result);
+  return result;
+}
+
+UK_PRELOAD_EXPORT ssize_t sendto(int fd, const void *buf, size_t len, int flags, __CONST_SOCKADDR_ARG addr, socklen_t addr_len) {
+  if (L_real_sendto == NULL) resolveRealFunctions();
+  const char *fd_name;
+  void *session = beginCall(IO_SENDTO, fd, (double)len, &fd_name);
+  if (session == NULL) return L_real_sendto(fd, buf, len, flags, addr, addr_len);
+  ssize_t result = L_real_sendto(fd, buf, len, flags, addr, addr_len);
+  endCall(session, IO_SENDTO, fd, fd_name, (double)result);
+  return result;
+}
+
+UK_PRELOAD_EXPORT ssize_t recvfrom(int fd, void *buf, size_t len, int flags, __SOCKADDR_ARG addr, socklen_t *addr_len) {
+  if (L_real_recvfrom == NULL) resolveRealFunctions();
+  const char *fd_name;
+  void *session = beginCall(IO_RECVFROM, fd, (double)len, &fd_name);
+  if (session == NULL) return L_real_recvfrom(fd, buf, len, flags, addr, addr_len);
+  ssize_t result = L_real_recvfrom(fd, buf, len, flags, addr, addr_len);
+  endCall(session, IO_RECVFROM, fd, fd_name, (double)result);
+  return result;
+}
+
+// Not recorded: these only keep the side table current
+
+UK_PRELOAD_EXPORT int close(int fd) {
+  if (L_real_close == NULL) resolveRealFunctions();
+  forgetFdName(fd);
+  return L_real_close(fd);
+}
+
+UK_PRELOAD_EXPORT int fclose(FILE *stream) {
+  if (L_real_fclose == NULL) resolveRealFunctions();
+  if (stream != NULL) forgetFdName(fileno(stream));
+  return L_real_fclose(stream);
+}
+
+UK_PRELOAD_EXPORT int dup2(int old_fd, int new_fd) {
+  if (L_real_dup2 == NULL) resolveRealFunctions();
+  forgetFdName(new_fd);
+  return L_real_dup2(old_fd, new_fd);
+}
+
+UK_PRELOAD_EXPORT int dup3(int old_fd, int new_fd, int flags) {
+  if (L_real_dup3 == NULL) resolveRealFunctions();
+  forgetFdName(new_fd);
+  return L_real_dup3(old_fd, new_fd, flags);
+}
+
+UK_PRELOAD_EXPORT int dup(int old_fd) {
+  if (L_real_dup == NULL) resolveRealFunctions();
+  int new_fd = L_real_dup(old_fd);
+  if (new_fd >= 0) forgetFdName(new_fd); // May still have the name of a descriptor closed inside libc
+  return new_fd;
+}
+
+static int controlFd(FcntlFunction real_fcntl, int fd, int cmd, void *arg) {
+  int result = real_fcntl(fd, cmd, arg);
+  if ((cmd == F_DUPFD || cmd == F_DUPFD_CLOEXEC) && result >= 0) forgetFdName(result); // Same as dup()
+  return result;
+}
+
+// The optional argument is an int or a pointer depending on cmd: like glibc's own fcntl(), it's passed on as a pointer, which works for both
+UK_PRELOAD_EXPORT int fcntl(int fd, int cmd, ...) {
+  if (L_real_fcntl == NULL) resolveRealFunctions();
+  va_list args;
+  va_start(args, cmd);
+  void *arg = va_arg(args, void *);
+  va_end(args);
+  return controlFd(L_real_fcntl, fd, cmd, arg);
+}
+
+// Applications built with -D_FILE_OFFSET_BITS=64 call this instead
+UK_PRELOAD_EXPORT int fcntl64(int fd, int cmd, ...) {
+  if (L_real_fcntl64 == NULL) L_real_fcntl64 = (FcntlFunction)ukPreloadRealFunction("fcntl64");
+  va_list args;
+  va_start(args, cmd);
+  void *arg = va_arg(args, void *);
+  va_end(args);
+  return controlFd(L_real_fcntl64, fd, cmd, arg);
+}
+
+UK_PRELOAD_EXPORT int close_range(unsigned int first_fd, unsigned int last_fd, int flags) {
+  if (L_real_close_range == NULL) L_real_close_range = (CloseRangeFunction)ukPreloadRealFunction("close_range");
+  forgetFdNames(first_fd, last_fd); // Even if they are only marked close-on-exec: the names are just found again
+  return L_real_close_range(first_fd, last_fd, flags);
+}
+
+__attribute__((constructor)) static void startRecording() {
+  if (L_real_read == NULL) resolveRealFunctions();
+  ukPreloadReadSettings("io", applySetting);
+
+  // Side table
+  L_fd_names = calloc(L_max_fds, sizeof(const char *));
+  assert(L_fd_names != NULL);
+  L_name_arena = malloc(FD_NAME_ARENA_BYTES);
+  assert(L_name_arena != NULL);
+
+  ukPreloadStart(IO_CALL_COUNT, L_events, true);
+
+  // Thresholds
+  void *session = ukPreloadBegin();
+  if (session != NULL) {
+    for (uint32_t i=0; i<IO_CALL_COUNT; i++) {
+      if (L_threshold[i] > 0) ukSetEventThreshold(session, L_events[i].start_id, L_threshold[i]);
+    }
+    ukPreloadEnd();
+  }
+}
+
+__attribute__((destructor)) static void stopRecording() {
+  ukPreloadStop();
+}
@@ -0,0 +1,241 @@
+// Copyright 2021 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The LD_PRELOAD interposer for malloc(), calloc(), realloc(), free(), mmap() and munmap(): built into libunikorn_malloc.so (see unikorn_preload.h)
+//  - Each call is a start and end event. The start value is the bytes (for free(), the usable size of the block), the end value is the address.
+//  - Settings in UNIKORN_MALLOC, to sample by size class: small=<N>, medium=<N>, large=<N>
+//      Records 1 of every N calls, per thread, of up to 256 bytes (small), up to 64 KB (medium), or larger (large). Default is 1 (every call).
+//      e.g. UNIKORN_MALLOC="small=100,medium=10"
+
+#define _GNU_SOURCE             // For malloc_usable_size()
+#include "unikorn_preload.h"
+#ifdef NDEBUG // Don't want assert compiled out
+  #undef NDEBUG
+#endif
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <malloc.h>
+#include <sys/mman.h>
+
+#define SMALL_MAX_BYTES 256
+#define MEDIUM_MAX_BYTES 65536
+#define BOOTSTRAP_BYTES 65536       // Holds the allocations made while dlsym() is finding the real functions
+#define BOOTSTRAP_ALIGNMENT 16
+
+enum {
+  MALLOC_START_ID=1,
+  MALLOC_END_ID,
+  CALLOC_START_ID,
+  CALLOC_END_ID,
+  REALLOC_START_ID,
+  REALLOC_END_ID,
+  FREE_START_ID,
+  FREE_END_ID,
+  MMAP_START_ID,
+  MMAP_END_ID,
+  MUNMAP_START_ID,
+  MUNMAP_END_ID,
+};
+
+static UkEventRegistration L_events[] = {
+  // Name      Color      Start ID         End ID         Start Value Name  End Value Name
+  { "malloc",  UK_GREEN,  MALLOC_START_ID,  MALLOC_END_ID,  "Bytes",          "Address"},
+  { "calloc",  UK_TEAL,   CALLOC_START_ID,  CALLOC_END_ID,  "Bytes",          "Address"},
+  { "realloc", UK_ORANGE, REALLOC_START_ID, REALLOC_END_ID, "Bytes",          "Address"},
+  { "free",    UK_BLUE,   FREE_START_ID,    FREE_END_ID,    "Bytes",          "Address"},
+  { "mmap",    UK_PURPLE, MMAP_START_ID,    MMAP_END_ID,    "Bytes",          "Address"},
+  { "munmap",  UK_RED,    MUNMAP_START_ID,  MUNMAP_END_ID,  "Bytes",          "Address"},
+};
+
+enum {
+  SIZE_CLASS_SMALL=0,
+  SIZE_CLASS_MEDIUM,
+  SIZE_CLASS_LARGE,
+  SIZE_CLASS_COUNT
+};
+
+typedef void *(*MallocFunction)(size_t size);
+typedef void *(*CallocFunction)(size_t count, size_t size);
+typedef void *(*ReallocFunction)(void *ptr, size_t size);
+typedef void (*FreeFunction)(void *ptr);
+typedef void *(*MmapFunction)(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+typedef int (*MunmapFunction)(void *addr, size_t length);
+
+static MallocFunction L_real_malloc = NULL;
+static CallocFunction L_real_calloc = NULL;
+static ReallocFunction L_real_realloc = NULL;
+static FreeFunction L_real_free = NULL;
+static MmapFunction L_real_mmap = NULL;
+static MunmapFunction L_real_munmap = NULL;
+static bool L_resolving = false;
+static char L_bootstrap_memory[BOOTSTRAP_BYTES] __attribute__((aligned(BOOTSTRAP_ALIGNMENT)));
+static size_t L_bootstrap_used = 0;
+static uint32_t L_sample_ratio[SIZE_CLASS_COUNT] = { 1, 1, 1 };
+static THREAD_LOCAL uint32_t t_sample_counter[SIZE_CLASS_COUNT];
+
+static void *bootstrapAlloc(size_t size) {
+  // Never freed, and the memory is already zeroed, so it also works for calloc()
+  size_t aligned_size = (size + BOOTSTRAP_ALIGNMENT - 1) & ~(size_t)(BOOTSTRAP_ALIGNMENT - 1);
+  if (L_bootstrap_used + aligned_size > BOOTSTRAP_BYTES) { fprintf(stderr, "Unikorn: ran out of bootstrap memory while finding the real malloc functions\n"); assert(0); }
+  void *ptr = &L_bootstrap_memory[L_bootstrap_used];
+  L_bootstrap_used += aligned_size;
+  return ptr;
+}
+
+static bool isBootstrapMemory(void *ptr) {
+  return (char *)ptr >= L_bootstrap_memory && (char *)ptr < L_bootstrap_memory + BOOTSTRAP_BYTES;
+}
+
+static void resolveRealFunctions() {
+  // NOTE: The first allocation happens before main() or any other threads start. dlsym() may allocate, which is given bootstrap memory.
+  L_resolving = true;
+  L_real_malloc = (MallocFunction)ukPreloadRealFunction("malloc");
+  L_real_calloc = (CallocFunction)ukPreloadRealFunction("calloc");
+  L_real_realloc = (ReallocFunction)ukPreloadRealFunction("realloc");
+  L_real_free = (FreeFunction)ukPreloadRealFunction("free");
+  L_real_mmap = (MmapFunction)ukPreloadRealFunction("mmap");
+  L_real_munmap = (MunmapFunction)ukPreloadRealFunction("munmap");
+  L_resolving = false;
+}
+
+static void applySetting(const char *name, const char *value) {
+  uint32_t size_class;
+  if (strcmp(name, "small") == 0) size_class = SIZE_CLASS_SMALL;
+  else if (strcmp(name, "medium") == 0) size_class = SIZE_CLASS_MEDIUM;
+  else if (strcmp(name, "large") == 0) size_class = SIZE_CLASS_LARGE;
+  else { fprintf(stderr, "Unikorn: the setting '%s' in UNIKORN_MALLOC is not known, so it will be ignored\n", name); return; }
+  char *end = NULL;
+  unsigned long ratio = strtoul(value, &end, 0);
+  if (end == value || *end != '\0' || ratio < 1 || ratio > UINT32_MAX) {
+    fprintf(stderr, "Unikorn: the setting '%s=%s' in UNIKORN_MALLOC is not a number from 1 to %u, so it will be ignored\n", name, value, UINT32_MAX);
+    return;
+  }
+  L_sample_ratio[size_class] = (uint32_t)ratio;
+}
+
+static void *beginSampled(size_t bytes) {
+  // Returns the session if the call should be recorded
+  void *session = ukPreloadBegin();
+  if (session == NULL) return NULL;
+  uint32_t size_class = (bytes <= SMALL_MAX_BYTES) ? SIZE_CLASS_SMALL : (bytes <= MEDIUM_MAX_BYTES) ? SIZE_CLASS_MEDIUM : SIZE_CLASS_LARGE;
+  uint32_t ratio = L_sample_ratio[size_class];
+  if (++t_sample_counter[size_class] < ratio) {
+    ukPreloadEnd();
+    return NULL;
+  }
+  t_sample_counter[size_class] = 0;
+  return session;
+}
+
+static void recordStart(void *session, uint16_t start_id, size_t bytes) {
+  ukRecordEvent(session, start_id, (double)bytes, NULL, NULL, 0);
+}
+
+static void recordEnd(void *session, uint16_t end_id, void *address) {
+  // Recording may change errno (e.g. allocating the thread's state), but the application may need the errno of the real call (e.g. ENOMEM)
+  int real_errno = errno;
+  ukRecordEvent(session, end_id, (double)(uintptr_t)address, NULL, NULL, 0);
+  errno = real_errno;
+  ukPreloadEnd();
+}
+
+UK_PRELOAD_EXPORT void *malloc(size_t size) {
+  if (L_resolving) return bootstrapAlloc(size);
+  if (L_real_malloc == NULL) resolveRealFunctions();
+  void *session = beginSampled(size);
+  if (session == NULL) return L_real_malloc(size);
+  recordStart(session, MALLOC_START_ID, size);
+  void *ptr = L_real_malloc(size);
+  recordEnd(session, MALLOC_END_ID, ptr);
+  return ptr;
+}
+
+UK_PRELOAD_EXPORT void *calloc(size_t count, size_t size) {
+  size_t bytes;
+  if (__builtin_mul_overflow(count, size, &bytes)) {
+    // Same as the real calloc()
+    errno = ENOMEM;
+    return NULL;
+  }
+  if (L_resolving) return bootstrapAlloc(bytes);
+  if (L_real_calloc == NULL) resolveRealFunctions();
+  void *session = beginSampled(bytes);
+  if (session == NULL) return L_real_calloc(count, size);
+  recordStart(session, CALLOC_START_ID, bytes);
+  void *ptr = L_real_calloc(count, size);
+  recordEnd(session, CALLOC_END_ID, ptr);
+  return ptr;
+}
+
+UK_PRELOAD_EXPORT void *realloc(void *ptr, size_t size) {
+  if (L_resolving) return bootstrapAlloc(size); // dlsym() doesn't grow its allocations
+  if (L_real_realloc == NULL) resolveRealFunctions();
+  if (isBootstrapMemory(ptr)) {
+    // Move it to real memory. The old size is not known, but can't be more than the rest of the bootstrap memory.
+    void *new_ptr = malloc(size);
+    size_t max_old_size = (size_t)(L_bootstrap_memory + BOOTSTRAP_BYTES - (char *)ptr);
+    if (new_ptr != NULL) memcpy(new_ptr, ptr, (size < max_old_size) ? size : max_old_size);
+    return new_ptr;
+  }
+  void *session = beginSampled(size);
+  if (session == NULL) return L_real_realloc(ptr, size);
+  recordStart(session, REALLOC_START_ID, size);
+  void *new_ptr = L_real_realloc(ptr, size);
+  recordEnd(session, REALLOC_END_ID, new_ptr);
+  return new_ptr;
+}
+
+UK_PRELOAD_EXPORT void free(void *ptr) {
+  if (ptr == NULL || isBootstrapMemory(ptr)) return;
+  if (L_real_free == NULL) resolveRealFunctions();
+  size_t bytes = malloc_usable_size(ptr);
+  void *session = beginSampled(bytes);
+  if (session == NULL) { L_real_free(ptr); return; }
+  recordStart(session, FREE_START_ID, bytes);
+  L_real_free(ptr);
+  recordEnd(session, FREE_END_ID, ptr);
+}
+
+UK_PRELOAD_EXPORT void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
+  if (L_real_mmap == NULL) resolveRealFunctions();
+  void *session = beginSampled(length);
+  if (session == NULL) return L_real_mmap(addr, length, prot, flags, fd, offset);
+  recordStart(session, MMAP_START_ID, length);
+  void *ptr = L_real_mmap(addr, length, prot, flags, fd, offset);
+  recordEnd(session, MMAP_END_ID, ptr);
+  return ptr;
+}
+
+UK_PRELOAD_EXPORT int munmap(void *addr, size_t length) {
+  if (L_real_munmap == NULL) resolveRealFunctions();
+  void *session = beginSampled(length);
+  if (session == NULL) return L_real_munmap(addr, length);
+  recordStart(session, MUNMAP_START_ID, length);
+  int rc = L_real_munmap(addr, length);
+  recordEnd(session, MUNMAP_END_ID, addr);
+  return rc;
+}
+
+__attribute__((constructor)) static void startRecording() {
+  if (L_real_malloc == NULL) resolveRealFunctions();
+  ukPreloadReadSettings("malloc", applySetting);
+  ukPreloadStart(sizeof(L_events) / sizeof(UkEventRegistration), L_events, false);
+}
+
+__attribute__((destructor)) static void stopRecording() {
+  ukPreloadStop();
+}
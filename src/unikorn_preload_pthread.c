@@ -0,0 +1,262 @@
+// Copyright 2021 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The LD_PRELOAD interposer for pthread mutexes and condition variables: built into libunikorn_pthread.so (see unikorn_preload.h)
+//  - Interposes pthread_mutex_lock(), pthread_mutex_trylock(), pthread_mutex_unlock(), pthread_cond_wait() and pthread_cond_timedwait()
+//  - Each mutex gets its own three event types, assigned the first time the mutex is used:
+//      Wait      From calling lock (wait begin) until acquired
+//      Hold      From acquired until released (pthread_cond_*wait() releases the mutex while waiting). Not recorded for a mutex that
+//                was already locked when recording started.
+//      Cond Wait From calling pthread_cond_*wait() until it returns
+//    so UnikornViewer shows when each mutex is waited for and held. aggregate_only=true only keeps the wait and hold time histograms,
+//    which UnikornViewer can't show: print them with examples/aggregate_histograms (> ./aggregate_histograms <file>.events)
+//  - Mutex names are resolved via dladdr() when the events are saved: the name of a global or static mutex (or 'name+offset' if it's a
+//    member of one) if the application is linked with -rdynamic, otherwise its address
+//  - Settings in UNIKORN_PTHREAD: max_locks=<N>   Mutexes used after the first N are not recorded. Default is 256.
+//      e.g. UNIKORN_PTHREAD="max_locks=1000,aggregate_only=true"
+
+#define _GNU_SOURCE             // For dlvsym()
+#include "unikorn_preload.h"
+#include "unikorn_address_slots.h"
+#ifdef NDEBUG // Don't want assert compiled out
+  #undef NDEBUG
+#endif
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#define DEFAULT_MAX_LOCKS 256
+#define EVENT_TYPES_PER_LOCK 3
+#define MAX_LOCKS ((0xFFFF - 1) / (2*EVENT_TYPES_PER_LOCK))
+#define FIRST_EVENT_ID 1
+#define NOT_RECORDED UK_NO_SLOT // max_locks was reached
+
+enum {
+  WAIT_EVENT=0,
+  HOLD_EVENT,
+  COND_WAIT_EVENT,
+};
+
+typedef int (*MutexFunction)(pthread_mutex_t *mutex);
+typedef int (*CondWaitFunction)(pthread_cond_t *cond, pthread_mutex_t *mutex);
+typedef int (*CondTimedWaitFunction)(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime);
+
+static MutexFunction L_real_lock = NULL;
+static MutexFunction L_real_trylock = NULL;
+static MutexFunction L_real_unlock = NULL;
+static CondWaitFunction L_real_cond_wait = NULL;
+static CondTimedWaitFunction L_real_cond_timedwait = NULL;
+
+static uint16_t L_max_locks = DEFAULT_MAX_LOCKS;
+static UkAddressSlots L_lock_slots;         // Lock address -> index of its event types
+static uint32_t *L_hold_depths = NULL;      // Hold starts of each slot that are not yet ended: only changed by the thread holding the lock
+
+static void *realCondFunction(const char *function_name) {
+  // IMPORTANT: glibc also has the pthread_cond_*() from before version 2.3.2, with a different pthread_cond_t, and dlsym() may return those
+#if defined(__GLIBC__) && defined(__x86_64__)
+  void *function = dlvsym(RTLD_NEXT, function_name, "GLIBC_2.3.2");
+  if (function != NULL) return function;
+#endif
+  return ukPreloadRealFunction(function_name);
+}
+
+static void resolveRealFunctions() {
+  L_real_lock = (MutexFunction)ukPreloadRealFunction("pthread_mutex_lock");
+  L_real_trylock = (MutexFunction)ukPreloadRealFunction("pthread_mutex_trylock");
+  L_real_unlock = (MutexFunction)ukPreloadRealFunction("pthread_mutex_unlock");
+  L_real_cond_wait = (CondWaitFunction)realCondFunction("pthread_cond_wait");
+  L_real_cond_timedwait = (CondTimedWaitFunction)realCondFunction("pthread_cond_timedwait");
+}
+
+static void applySetting(const char *name, const char *value) {
+  if (strcmp(name, "max_locks") == 0) {
+    unsigned long max_locks = strtoul(value, NULL, 0);
+    if (max_locks < 1 || max_locks > MAX_LOCKS) {
+      fprintf(stderr, "Unikorn: the setting '%s=%s' in UNIKORN_PTHREAD is not in the range 1 to %d, so it will be ignored\n", name, value, MAX_LOCKS);
+      return;
+    }
+    L_max_locks = (uint16_t)max_locks;
+  } else {
+    fprintf(stderr, "Unikorn: the setting '%s' in UNIKORN_PTHREAD is not known, so it will be ignored\n", name);
+  }
+}
+
+static uint16_t startId(int32_t slot, uint16_t event_type) {
+  return (uint16_t)(FIRST_EVENT_ID + 2*(EVENT_TYPES_PER_LOCK*slot + event_type));
+}
+
+static void recordHoldStart(void *session, int32_t slot) {
+  L_hold_depths[slot]++; // More than 1 if it's a recursive mutex
+  ukRecordEvent(session, startId(slot, HOLD_EVENT), 0, NULL, NULL, 0);
+}
+
+static void recordHoldEnd(void *session, int32_t slot) {
+  // No start if the lock was acquired before recording started, or while the thread couldn't record
+  if (L_hold_depths[slot] == 0) return;
+  L_hold_depths[slot]--;
+  ukRecordEvent(session, startId(slot, HOLD_EVENT)+1, 0, NULL, NULL, 0);
+}
+
+static void *beginLock(pthread_mutex_t *mutex, int32_t *slot_ret, int *errno_ret) {
+  // Returns the session if the lock should be recorded
+  void *session = ukPreloadBegin();
+  if (session == NULL) return NULL;
+  int32_t slot = ukAddressSlot(&L_lock_slots, mutex);
+  if (slot == NOT_RECORDED) {
+    ukPreloadEnd();
+    return NULL;
+  }
+  *slot_ret = slot;
+  *errno_ret = errno;
+  return session;
+}
+
+static void endLock(int application_errno) {
+  // The pthread functions don't change errno, but recording may (e.g. allocating the thread's state)
+  errno = application_errno;
+  ukPreloadEnd();
+}
+
+UK_PRELOAD_EXPORT int pthread_mutex_lock(pthread_mutex_t *mutex) {
+  if (L_real_lock == NULL) resolveRealFunctions();
+  int32_t slot;
+  int application_errno;
+  void *session = beginLock(mutex, &slot, &application_errno);
+  if (session == NULL) return L_real_lock(mutex);
+  ukRecordEvent(session, startId(slot, WAIT_EVENT), 0, NULL, NULL, 0);
+  int rc = L_real_lock(mutex);
+  ukRecordEvent(session, startId(slot, WAIT_EVENT)+1, rc, NULL, NULL, 0);
+  if (rc == 0) recordHoldStart(session, slot);
+  endLock(application_errno);
+  return rc;
+}
+
+UK_PRELOAD_EXPORT int pthread_mutex_trylock(pthread_mutex_t *mutex) {
+  if (L_real_trylock == NULL) resolveRealFunctions();
+  int32_t slot;
+  int application_errno;
+  void *session = beginLock(mutex, &slot, &application_errno);
+  if (session == NULL) return L_real_trylock(mutex);
+  int rc = L_real_trylock(mutex);
+  if (rc == 0) recordHoldStart(session, slot);
+  endLock(application_errno);
+  return rc;
+}
+
+UK_PRELOAD_EXPORT int pthread_mutex_unlock(pthread_mutex_t *mutex) {
+  if (L_real_unlock == NULL) resolveRealFunctions();
+  int32_t slot;
+  int application_errno;
+  void *session = beginLock(mutex, &slot, &application_errno);
+  if (session == NULL) return L_real_unlock(mutex);
+  recordHoldEnd(session, slot);
+  int rc = L_real_unlock(mutex);
+  endLock(application_errno);
+  return rc;
+}
+
+UK_PRELOAD_EXPORT int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+  if (L_real_cond_wait == NULL) resolveRealFunctions();
+  int32_t slot;
+  int application_errno;
+  void *session = beginLock(mutex, &slot, &application_errno);
+  if (session == NULL) return L_real_cond_wait(cond, mutex);
+  recordHoldEnd(session, slot);
+  ukRecordEvent(session, startId(slot, COND_WAIT_EVENT), 0, NULL, NULL, 0);
+  int rc = L_real_cond_wait(cond, mutex);
+  ukRecordEvent(session, startId(slot, COND_WAIT_EVENT)+1, rc, NULL, NULL, 0);
+  recordHoldStart(session, slot);
+  endLock(application_errno);
+  return rc;
+}
+
+UK_PRELOAD_EXPORT int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime) {
+  if (L_real_cond_timedwait == NULL) resolveRealFunctions();
+  int32_t slot;
+  int application_errno;
+  void *session = beginLock(mutex, &slot, &application_errno);
+  if (session == NULL) return L_real_cond_timedwait(cond, mutex, abstime);
+  recordHoldEnd(session, slot);
+  ukRecordEvent(session, startId(slot, COND_WAIT_EVENT), 0, NULL, NULL, 0);
+  int rc = L_real_cond_timedwait(cond, mutex, abstime);
+  ukRecordEvent(session, startId(slot, COND_WAIT_EVENT)+1, rc, NULL, NULL, 0);
+  recordHoldStart(session, slot);
+  endLock(application_errno);
+  return rc;
+}
+
+static void resolveLockNames(void *session) {
+  // NOTE: Locks first used after this are saved with their placeholder names
+  uint32_t lock_count = ukAddressSlotCount(&L_lock_slots);
+  for (uint32_t slot=0; slot<lock_count; slot++) {
+    void *lock = ukSlotAddress(&L_lock_slots, slot);
+    if (lock == NULL) continue; // Slot is still being assigned
+    char lock_name[80];
+    ukAddressName(lock, true, lock_name, sizeof(lock_name));
+    char name[100];
+    snprintf(name, sizeof(name), "Wait %s", lock_name);
+    ukSetEventName(session, startId((int32_t)slot, WAIT_EVENT), name);
+    snprintf(name, sizeof(name), "Hold %s", lock_name);
+    ukSetEventName(session, startId((int32_t)slot, HOLD_EVENT), name);
+    snprintf(name, sizeof(name), "Cond Wait %s", lock_name);
+    ukSetEventName(session, startId((int32_t)slot, COND_WAIT_EVENT), name);
+  }
+}
+
+__attribute__((constructor)) static void startRecording() {
+  if (L_real_lock == NULL) resolveRealFunctions();
+  ukPreloadReadSettings("pthread", applySetting);
+
+  // Create the event types for each lock that can be recorded. The names are set when the events are saved.
+  uint16_t event_registration_count = L_max_locks * EVENT_TYPES_PER_LOCK;
+  UkEventRegistration *event_registration_list = malloc(event_registration_count * sizeof(UkEventRegistration));
+  assert(event_registration_list != NULL);
+  char *name_list = malloc(event_registration_count * 24);
+  assert(name_list != NULL);
+  static const char *type_names[EVENT_TYPES_PER_LOCK] = { "Wait", "Hold", "Cond Wait" };
+  static const uint16_t type_colors[EVENT_TYPES_PER_LOCK] = { UK_RED, UK_BLUE, UK_GRAY };
+  for (uint16_t i=0; i<event_registration_count; i++) {
+    uint16_t event_type = i % EVENT_TYPES_PER_LOCK;
+    char *name = &name_list[i*24];
+    snprintf(name, 24, "%s Lock %d", type_names[event_type], i / EVENT_TYPES_PER_LOCK + 1);
+    event_registration_list[i].name = name;
+    event_registration_list[i].rgb = type_colors[event_type];
+    event_registration_list[i].start_id = FIRST_EVENT_ID + 2*i;
+    event_registration_list[i].end_id = FIRST_EVENT_ID + 2*i + 1;
+    event_registration_list[i].start_value_name = "";
+    event_registration_list[i].end_value_name = (event_type == HOLD_EVENT) ? "" : "Result";
+  }
+
+  // Prepare the lock table
+  ukAddressSlotsInit(&L_lock_slots, L_max_locks, 3, NULL);
+  L_hold_depths = calloc(L_max_locks, sizeof(uint32_t));
+  assert(L_hold_depths != NULL);
+
+  ukPreloadStart(event_registration_count, event_registration_list, false);
+  free(name_list);
+  free(event_registration_list);
+}
+
+__attribute__((destructor)) static void stopRecording() {
+  void *session = ukPreloadBegin();
+  if (session != NULL) {
+    resolveLockNames(session);
+    ukPreloadEnd();
+  }
+  ukPreloadStop();
+}
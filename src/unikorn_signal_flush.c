@@ -0,0 +1,126 @@
+// Copyright 2021 Michael Both
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "unikorn_signal_flush.h"
+#include "unikorn_file_flush.h"
+#ifdef NDEBUG // Don't want assert compiled out
+  #undef NDEBUG
+#endif
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+#define POLL_NANOSECONDS 100000000  // How often the save thread checks if the signal was received
+#define MAX_FILENAME_LENGTH 1024
+
+static volatile sig_atomic_t L_save_requested = 0; // Set by the signal handler, cleared by the save thread
+static volatile sig_atomic_t L_stop_requested = 0;
+static void *L_session = NULL;
+static int L_signal_number = 0;
+static struct sigaction L_prev_action;
+static char *L_base_filename = NULL;
+static bool L_keep_events = false;
+static uint32_t L_save_count = 0;
+static pthread_t L_save_thread;
+
+static void signalHandler(int signal_number) {
+  // IMPORTANT: Only async signal safe operations can be done here
+  (void)signal_number;
+  L_save_requested = 1;
+}
+
+static void saveEvents() {
+  // Get a unique file name
+  time_t now = time(NULL);
+  struct tm local_time;
+  localtime_r(&now, &local_time);
+  char timestamp[32];
+  strftime(timestamp, sizeof(timestamp), "%Y%m%d_%H%M%S", &local_time);
+  char filename[MAX_FILENAME_LENGTH];
+  L_save_count++;
+  snprintf(filename, MAX_FILENAME_LENGTH, "%s_%s_%u.events", L_base_filename, timestamp, L_save_count);
+
+  // Save
+  UkFileFlushInfo flush_info;
+  flush_info.filename = filename;
+  flush_info.file = NULL;
+  flush_info.events_saved = false;
+  flush_info.append_subsequent_saves = false;
+  ukFlushTo(L_session, L_keep_events, &flush_info, ukPrepareFileFlush, ukFileFlush, ukFinishFileFlush);
+  if (flush_info.events_saved) {
+    printf("Unikorn: saved the events to '%s'\n", filename);
+  } else {
+    printf("Unikorn: no events were recorded, so '%s' was not saved\n", filename);
+  }
+}
+
+static void *saveThread(void *user_data) {
+  (void)user_data;
+  struct timespec poll_time = { .tv_sec = 0, .tv_nsec = POLL_NANOSECONDS };
+  while (!L_stop_requested) {
+    nanosleep(&poll_time, NULL);
+    if (L_save_requested) {
+      // Cleared before saving, so a signal received during the save causes another save
+      L_save_requested = 0;
+      saveEvents();
+    }
+  }
+  return NULL;
+}
+
+bool ukSignalFlushStart(void *session, int signal_number, const char *base_filename, bool keep_events) {
+  if (L_session != NULL) { printf("Unikorn: ukSignalFlushStart() was already called\n"); assert(0); }
+  L_session = session;
+  L_signal_number = signal_number;
+  L_base_filename = strdup(base_filename);
+  assert(L_base_filename != NULL);
+  L_keep_events = keep_events;
+  L_save_requested = 0;
+  L_stop_requested = 0;
+
+  // Install the signal handler
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = signalHandler;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART; // Don't interrupt the application's system calls
+  if (sigaction(signal_number, &action, &L_prev_action) != 0) {
+    free(L_base_filename);
+    L_session = NULL;
+    return false;
+  }
+
+  // Start the save thread
+  if (pthread_create(&L_save_thread, NULL, saveThread, NULL) != 0) {
+    sigaction(signal_number, &L_prev_action, NULL);
+    free(L_base_filename);
+    L_session = NULL;
+    return false;
+  }
+  return true;
+}
+
+void ukSignalFlushStop() {
+  if (L_session == NULL) return;
+  sigaction(L_signal_number, &L_prev_action, NULL);
+  L_stop_requested = 1;
+  pthread_join(L_save_thread, NULL);
+  free(L_base_filename);
+  L_base_filename = NULL;
+  L_session = NULL;
+}
@@ -33,7 +33,7 @@ bool EventTreeNode::isAncestorCollapsed() {
   return false;
 }
 
-EventTree::EventTree(UkEvents *_events, QString _name, QString _folder, bool show_folders, bool show_threads) {
+EventTree::EventTree(UkEvents *_events, QString _name, QString _folder, bool show_folders, bool show_threads, bool show_cpus) {
   events = _events;
   name = _name;
   folder = _folder;
@@ -43,7 +43,7 @@ EventTree::EventTree(UkEvents *_events, QString _name, QString _folder, bool sho
   tree->name = _name + "   (" + _folder + ")";
   // Recursively build tree
   uint32_t event_index = 0;
-  buildTree(tree, event_index, show_folders, show_threads);
+  buildTree(tree, event_index, show_folders, show_threads, show_cpus);
   clearEventGhosting();
 }
 
@@ -77,16 +77,22 @@ EventTreeNode *EventTree::getChildWithEventInfoIndex(EventTreeNode *parent, uint
   return NULL;
 }
 
-EventTreeNode *EventTree::getThreadFolder(EventTreeNode *parent, uint16_t thread_index) {
+EventTreeNode *EventTree::getThreadFolder(EventTreeNode *parent, uint32_t thread_index, bool is_cpu) {
   for (auto child: parent->children) {
     if (child->tree_node_type == TREE_NODE_IS_THREAD && child->thread_index == thread_index) return child;
   }
   // Does not exist yet so create it
-  assert(thread_index < events->thread_id_count);
   EventTreeNode *thread_folder = new EventTreeNode();
   thread_folder->tree_node_type = TREE_NODE_IS_THREAD;
   thread_folder->thread_index = thread_index;
-  thread_folder->name = "Thread " + QString::number(events->thread_id_list[thread_index]);
+  if (is_cpu) {
+    thread_folder->name = (thread_index == UK_UNKNOWN_CPU) ? QString("CPU unknown") : "CPU " + QString::number(thread_index);
+  } else {
+    assert(thread_index < events->thread_id_count);
+    // Events recorded while running a logical task (see ukSetTaskId()) are grouped by the task instead of by the threads running it
+    bool is_task = events->thread_is_task_list != NULL && events->thread_is_task_list[thread_index];
+    thread_folder->name = (is_task ? "Task " : "Thread ") + QString::number(events->thread_id_list[thread_index]);
+  }
   parent->children += thread_folder;
   thread_folder->parent = parent;
 #ifdef PRINT_HELPFUL_MESSAGES
@@ -95,7 +101,7 @@ EventTreeNode *EventTree::getThreadFolder(EventTreeNode *parent, uint16_t thread
   return thread_folder;
 }
 
-void EventTree::buildTree(EventTreeNode *node, uint32_t &event_index, bool show_folders, bool show_threads) {
+void EventTree::buildTree(EventTreeNode *node, uint32_t &event_index, bool show_folders, bool show_threads, bool show_cpus) {
   while (true) {
     if (event_index == events->event_count) return; // Done processing events
 
@@ -142,7 +148,7 @@ void EventTree::buildTree(EventTreeNode *node, uint32_t &event_index, bool show_
 
         // Recurse into folder node
         event_index++;
-        buildTree(folder, event_index, show_folders, show_threads);
+        buildTree(folder, event_index, show_folders, show_threads, show_cpus);
       }
 
     } else {
@@ -152,9 +158,11 @@ void EventTree::buildTree(EventTreeNode *node, uint32_t &event_index, bool show_
       UkLoaderEventRegistration *event_registration = &events->event_registration_list[event_registration_index];
       EventTreeNode *parent = node;
 
-      // Get thread folder if threaded
-      if (events->is_multi_threaded && show_threads) {
-        parent = getThreadFolder(node, event->thread_index);
+      // Get thread folder if threaded, or CPU folder if grouping by CPU core (scheduler style lanes)
+      if (events->includes_cpu && show_cpus) {
+        parent = getThreadFolder(node, event->cpu_index, true);
+      } else if (events->is_multi_threaded && show_threads) {
+        parent = getThreadFolder(node, event->thread_index, false);
       }
 
       // Get the EventTreeNode (create one if doesn't exist)
@@ -37,7 +37,7 @@ class EventTreeNode {
 public:
   TreeNodeType tree_node_type = TREE_NODE_IS_FILE;
   bool is_open = true;
-  uint16_t thread_index = 0;
+  uint32_t thread_index = 0; // Or the CPU index if grouping by CPU core
   uint16_t event_registration_index = 0;
   uint16_t ID = 0;
   QColor color;
@@ -63,12 +63,13 @@ class EventTree {
 public:
   UkEvents *events = NULL;
   uint64_t native_start_time = 0;
+  uint64_t wall_start_time = 0; // Wall clock time of the first event, or 0 if the file has no clock anchors
   QString name; // Filename (not including folder or .event suffix)
   QString folder;
   EventTreeNode *tree = NULL;
   bool events_ghosted = false;
 
-  EventTree(UkEvents *events, QString name, QString folder, bool show_folders, bool show_threads);
+  EventTree(UkEvents *events, QString name, QString folder, bool show_folders, bool show_threads, bool show_cpus);
   ~EventTree();
   void sortTree(SortType sort_type);
   void openAllFolders();
@@ -77,10 +78,10 @@ public:
   void clearEventGhosting();
 
 private:
-  void buildTree(EventTreeNode *node, uint32_t &event_index, bool show_folders, bool show_threads);
+  void buildTree(EventTreeNode *node, uint32_t &event_index, bool show_folders, bool show_threads, bool show_cpus);
   void deleteTree(EventTreeNode *node);
   EventTreeNode *getChildWithEventInfoIndex(EventTreeNode *parent, uint16_t event_registration_index);
-  EventTreeNode *getThreadFolder(EventTreeNode *parent, uint16_t thread_index);
+  EventTreeNode *getThreadFolder(EventTreeNode *parent, uint32_t thread_index, bool is_cpu);
   void sortNode(EventTreeNode *parent, SortType sort_type);
   void setFoldersExpanded(EventTreeNode *parent, bool is_expanded);
 };
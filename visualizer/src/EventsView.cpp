@@ -60,6 +60,44 @@ EventsView::~EventsView() {
   // Nothing to do
 }
 
+static int findCounter(UkEvents *events, const char *name) {
+  for (int i=0; i<events->counter_count; i++) {
+    if (QString(events->counter_name_list[i]) == name) return i;
+  }
+  return -1;
+}
+
+static QStringList buildCounterLines(UkEvents *events, bool is_on_duration, uint32_t start_event_index, uint32_t end_event_index) {
+  // One line per recorded counter, plus some derived ratios. Values are the deltas across the duration, or "-" if not on a duration
+  QStringList lines;
+  if (events->counter_count == 0) return lines;
+  uint64_t *start_values = is_on_duration ? ukGetCounterValues(events, start_event_index) : NULL;
+  uint64_t *end_values = is_on_duration ? ukGetCounterValues(events, end_event_index) : NULL;
+  bool has_deltas = (start_values != NULL && end_values != NULL);
+  for (int i=0; i<events->counter_count; i++) {
+    QString value_text = has_deltas ? QString::number(end_values[i] - start_values[i]) : "-";
+    lines += " " + QString(events->counter_name_list[i]) + ": " + value_text;
+  }
+  int instructions_index = findCounter(events, "instructions");
+  int cycles_index = findCounter(events, "cycles");
+  int cache_misses_index = findCounter(events, "cache-misses");
+  int branch_misses_index = findCounter(events, "branch-misses");
+  double instructions = (has_deltas && instructions_index >= 0) ? (double)(end_values[instructions_index] - start_values[instructions_index]) : 0;
+  if (instructions_index >= 0 && cycles_index >= 0) {
+    double cycles = has_deltas ? (double)(end_values[cycles_index] - start_values[cycles_index]) : 0;
+    lines += " IPC: " + ((cycles > 0) ? niceValueText(instructions / cycles) : "-");
+  }
+  if (instructions_index >= 0 && cache_misses_index >= 0) {
+    double misses = has_deltas ? (double)(end_values[cache_misses_index] - start_values[cache_misses_index]) : 0;
+    lines += " cache-misses per 1K instructions: " + ((instructions > 0) ? niceValueText(1000 * misses / instructions) : "-");
+  }
+  if (instructions_index >= 0 && branch_misses_index >= 0) {
+    double misses = has_deltas ? (double)(end_values[branch_misses_index] - start_values[branch_misses_index]) : 0;
+    lines += " branch-misses per 1K instructions: " + ((instructions > 0) ? niceValueText(1000 * misses / instructions) : "-");
+  }
+  return lines;
+}
+
 static uint32_t findEventIndexAtTime(UkEvents *events, EventTreeNode *node, uint64_t time, int32_t index_offset) {
   uint32_t first = 0;
   uint32_t last = node->num_event_instances-1;
@@ -468,6 +506,15 @@ void EventsView::drawHierarchyLine(QPainter *painter, UkEvents *events, EventTre
       painter->fillRect(row_rect, ROW_SELECTED_COLOR);
     }
 
+    // Grey out the time ranges when recording was paused
+    for (uint32_t i=0; i<events->pause_count; i++) {
+      UkPause *pause = &events->pause_list[i];
+      if (pause->end_time <= start_time || pause->start_time >= end_time) continue;
+      int x1 = (pause->start_time <= start_time) ? 0 : (int)(w * (pause->start_time-start_time) / time_range);
+      int x2 = (pause->end_time >= end_time) ? w-1 : (int)(w * (pause->end_time-start_time) / time_range);
+      painter->fillRect(QRect(x1,y,x2-x1+1,line_h), PAUSED_COLOR);
+    }
+
     // As events are drawn, keep track of location of min and max durations
     uint64_t min_duration = 0;
     uint64_t max_duration = 0;
@@ -965,7 +1012,22 @@ void EventsView::drawEventInfo(QPainter &painter, EventTreeNode *node, UkEvents
   QFontMetrics fm = painter.fontMetrics();
   int th = fm.height() * 1.3f;
   int m = th * 0.25f;
-  int num_lines = 10;
+  QStringList counter_lines;
+  if (!ancestor_collapsed && node->tree_node_type == TREE_NODE_IS_EVENT) {
+    uint32_t event_index_to_right_of_mouse = findEventIndexAtTime(events, node, time_at_mouse, 0);
+    uint32_t event_index_to_left_of_mouse = (event_index_to_right_of_mouse > 0) ? event_index_to_right_of_mouse-1 : 0;
+    bool is_on_duration = false;
+    uint32_t start_event_index = 0;
+    uint32_t end_event_index = 0;
+    if (event_index_to_left_of_mouse < event_index_to_right_of_mouse && event_index_to_right_of_mouse < node->num_event_instances) {
+      UkLoaderEventRegistration *event_registration = &events->event_registration_list[node->event_registration_index];
+      start_event_index = node->event_indices[event_index_to_left_of_mouse];
+      end_event_index = node->event_indices[event_index_to_right_of_mouse];
+      is_on_duration = (events->event_buffer[start_event_index].event_id == event_registration->start_id && events->event_buffer[end_event_index].event_id == event_registration->end_id);
+    }
+    counter_lines = buildCounterLines(events, is_on_duration, start_event_index, end_event_index);
+  }
+  int num_lines = 10 + counter_lines.count();
   int dialog_w = fm.horizontalAdvance(" XXXXXxxxfilename::function_name::line_numberxxxXXXXX ");
   int dialog_h = th*num_lines;
   int dialog_x = mouse_location.x() + m;
@@ -1246,11 +1308,20 @@ void EventsView::drawEventInfo(QPainter &painter, EventTreeNode *node, UkEvents
         painter.restore();
       }
     }
+    dialog_y += th;
+
+    // Counter deltas across the duration
+    painter.setPen(QPen(ROLLOVER_TEXT_COLOR, 1, Qt::SolidLine));
+    for (int i=0; i<counter_lines.count(); i++) {
+      painter.drawText(dialog_x, dialog_y, dialog_w-m, th, Qt::AlignLeft | Qt::AlignVCenter, counter_lines[i]);
+      dialog_y += th;
+    }
   }
 }
 
 void EventsView::updateTimeAlignment() {
-  QString alignment_mode = G_settings->value("alignment_mode", "Native").toString();  // One of "Native", "TimeZero", "EventId"
+  // NOTE: every file in G_event_tree_map has at least one event; aggregate only and empty files are never loaded (see MainWindow::on_loadButton_clicked())
+  QString alignment_mode = G_settings->value("alignment_mode", "Native").toString();  // One of "Native", "TimeZero", "WallClock", "EventId"
 
   if (alignment_mode == "Native") {
     QMapIterator<QString, EventTree*> i(G_event_tree_map);
@@ -1264,8 +1335,10 @@ void EventsView::updateTimeAlignment() {
       if (delta > 0) {
         if (increase_time) {
           for (uint32_t j=0; j<events->event_count; j++) events->event_buffer[j].time += delta;
+          for (uint32_t j=0; j<events->pause_count; j++) { events->pause_list[j].start_time += delta; events->pause_list[j].end_time += delta; }
         } else {
           for (uint32_t j=0; j<events->event_count; j++) events->event_buffer[j].time -= delta;
+          for (uint32_t j=0; j<events->pause_count; j++) { events->pause_list[j].start_time -= delta; events->pause_list[j].end_time -= delta; }
         }
       }
     }
@@ -1281,6 +1354,43 @@ void EventsView::updateTimeAlignment() {
         for (uint32_t j=0; j<events->event_count; j++) {
           events->event_buffer[j].time -= first_time;
         }
+        for (uint32_t j=0; j<events->pause_count; j++) {
+          events->pause_list[j].start_time -= first_time;
+          events->pause_list[j].end_time -= first_time;
+        }
+      }
+    }
+
+  } else if (alignment_mode == "WallClock") {
+    // Find the earliest wall clock start time across files
+    uint64_t min_wall_start_time = UINT64_MAX;
+    {
+      QMapIterator<QString, EventTree*> i(G_event_tree_map);
+      while (i.hasNext()) {
+        i.next();
+        EventTree *event_tree = i.value();
+        if (event_tree->wall_start_time < min_wall_start_time) min_wall_start_time = event_tree->wall_start_time;
+      }
+    }
+
+    // Place the first event of each file relative to the earliest file
+    QMapIterator<QString, EventTree*> i(G_event_tree_map);
+    while (i.hasNext()) {
+      i.next();
+      EventTree *event_tree = i.value();
+      UkEvents *events = event_tree->events;
+      uint64_t first_time = events->event_buffer[0].time;
+      uint64_t new_first_time = event_tree->wall_start_time - min_wall_start_time;
+      bool increase_time = (first_time < new_first_time);
+      uint64_t delta = increase_time ? new_first_time - first_time : first_time - new_first_time;
+      if (delta > 0) {
+        if (increase_time) {
+          for (uint32_t j=0; j<events->event_count; j++) events->event_buffer[j].time += delta;
+          for (uint32_t j=0; j<events->pause_count; j++) { events->pause_list[j].start_time += delta; events->pause_list[j].end_time += delta; }
+        } else {
+          for (uint32_t j=0; j<events->event_count; j++) events->event_buffer[j].time -= delta;
+          for (uint32_t j=0; j<events->pause_count; j++) { events->pause_list[j].start_time -= delta; events->pause_list[j].end_time -= delta; }
+        }
       }
     }
 
@@ -1297,6 +1407,10 @@ void EventsView::updateTimeAlignment() {
           for (uint32_t j=0; j<events->event_count; j++) {
             events->event_buffer[j].time -= first_time;
           }
+          for (uint32_t j=0; j<events->pause_count; j++) {
+            events->pause_list[j].start_time -= first_time;
+            events->pause_list[j].end_time -= first_time;
+          }
         }
       }
     }
@@ -1371,8 +1485,10 @@ void EventsView::updateTimeAlignment() {
         if (delta > 0) {
           if (increase_time) {
             for (uint32_t j=0; j<events->event_count; j++) events->event_buffer[j].time += delta;
+            for (uint32_t j=0; j<events->pause_count; j++) { events->pause_list[j].start_time += delta; events->pause_list[j].end_time += delta; }
           } else {
             for (uint32_t j=0; j<events->event_count; j++) events->event_buffer[j].time -= delta;
+            for (uint32_t j=0; j<events->pause_count; j++) { events->pause_list[j].start_time -= delta; events->pause_list[j].end_time -= delta; }
           }
         }
       }
@@ -1500,7 +1616,7 @@ void EventsView::paintEvent(QPaintEvent* /*event*/) {
     painter2.fillRect(QRect(0,0,w,h), QColor(255,255,255));
     // Draw alignment time
     if (G_event_tree_map.count() > 1) {
-      QString alignment_mode = G_settings->value("alignment_mode", "Native").toString();  // One of "Native", "TimeZero", "EventId"
+      QString alignment_mode = G_settings->value("alignment_mode", "Native").toString();  // One of "Native", "TimeZero", "WallClock", "EventId"
       if (alignment_mode == "EventId") {
         if (alignment_time > start_time && alignment_time < end_time) {
           painter2.setPen(QPen(ALIGNMENT_COLOR, 1, Qt::DashLine));
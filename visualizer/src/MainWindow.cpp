@@ -15,6 +15,7 @@
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QScreen>
+#include <QSet>
 #include "ui_MainWindow.h"
 #include "MainWindow.hpp"
 #include "HelpfulFunctions.hpp"
@@ -66,7 +67,7 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWi
   }
 
   // Set the default time alignment
-  G_settings->setValue("alignment_mode", "Native");  // One of "Native", "TimeZero", "EventId"
+  G_settings->setValue("alignment_mode", "Native");  // One of "Native", "TimeZero", "WallClock", "EventId"
 
   // Set the height of the headers to the font size
   ui->hierarchyHeader->updateHeight();
@@ -224,6 +225,7 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWi
     ui->clearFilterButton,
     ui->showFoldersButton,
     ui->showThreadsButton,
+    ui->showCpusButton,
     ui->openFoldersButton,
     ui->closeFoldersButton,
     ui->sortByIdButton,
@@ -329,6 +331,7 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWi
   ui->closeSelectedButton->setIcon(buildIcon(":/close_selected.png",        false, toolbar_icon_size, NORMAL_COLOR, DISABLED_COLOR, TOGGLE_ON_COLOR, TOGGLE_OFF_COLOR));
   ui->showFoldersButton->setIcon(buildIcon(":/show_folders.png",            true,  toolbar_icon_size, NORMAL_COLOR, DISABLED_COLOR, TOGGLE_ON_COLOR, TOGGLE_OFF_COLOR));
   ui->showThreadsButton->setIcon(buildIcon(":/show_threads.png",            true,  toolbar_icon_size, NORMAL_COLOR, DISABLED_COLOR, TOGGLE_ON_COLOR, TOGGLE_OFF_COLOR));
+  ui->showCpusButton->setIcon(buildIcon(":/show_cpus.png",                  true,  toolbar_icon_size, NORMAL_COLOR, DISABLED_COLOR, TOGGLE_ON_COLOR, TOGGLE_OFF_COLOR));
   ui->openFoldersButton->setIcon(buildIcon(":/expand.png",                  false, toolbar_icon_size, NORMAL_COLOR, DISABLED_COLOR, TOGGLE_ON_COLOR, TOGGLE_OFF_COLOR));
   ui->closeFoldersButton->setIcon(buildIcon(":/collapse.png",               false, toolbar_icon_size, NORMAL_COLOR, DISABLED_COLOR, TOGGLE_ON_COLOR, TOGGLE_OFF_COLOR));
   ui->setFilterButton->setIcon(buildIcon(":/filter.png",                    false, toolbar_icon_size, NORMAL_COLOR, DISABLED_COLOR, TOGGLE_ON_COLOR, TOGGLE_OFF_COLOR));
@@ -483,6 +486,7 @@ void MainWindow::setWidgetUsability() {
   }
   bool folders_exist = eventFilesHaveFolders();
   bool threads_exist = eventFilesHaveThreads();
+  bool cpus_exist = eventFilesHaveCpus();
   int num_event_types_filtered = G_event_filters.count();
   bool font_size_can_grow = (G_font_point_size < G_max_font_point_size);
   bool font_size_can_shrink = (G_font_point_size > G_min_font_point_size);
@@ -498,6 +502,7 @@ void MainWindow::setWidgetUsability() {
   ui->clearFilterButton->setEnabled(num_event_types_filtered > 0);
   ui->showFoldersButton->setEnabled(folders_exist);
   ui->showThreadsButton->setEnabled(threads_exist);
+  ui->showCpusButton->setEnabled(cpus_exist);
   ui->openFoldersButton->setEnabled(event_files_loaded);
   ui->closeFoldersButton->setEnabled(event_files_loaded);
   ui->sortByIdButton->setEnabled(event_files_loaded);
@@ -526,11 +531,13 @@ void MainWindow::setWidgetUsability() {
   // Update status bar
   QString message = "Event Files: " + QString::number(G_event_tree_map.count());
   // Time alignment
-  QString alignment_mode = G_settings->value("alignment_mode", "Native").toString();  // One of "Native", "TimeZero", "EventId"
+  QString alignment_mode = G_settings->value("alignment_mode", "Native").toString();  // One of "Native", "TimeZero", "WallClock", "EventId"
   if (alignment_mode == "Native") {
     message += "          Time Alignment: unmodified";
   } else if (alignment_mode == "TimeZero") {
     message += "          Time Alignment: start at zero";
+  } else if (alignment_mode == "WallClock") {
+    message += "          Time Alignment: wall clock";
   } else { // "EventId"
     bool is_start = G_settings->value("alignment_event_is_start", false).toBool();
     QString event_name = G_settings->value("alignment_event_name", "unset").toString();
@@ -587,9 +594,35 @@ void MainWindow::on_loadButton_clicked() {
 
     // Load the events
     UkEvents *events = ukLoadEventsFile(filename.toLatin1().data());
+    if (events == NULL) {
+      QMessageBox::critical(this, "File Error", "Failed to load '" + filename + "': it can't be opened, is empty, or was saved by a newer version of Unikorn.");
+      continue;
+    }
+    if (events->is_aggregate || events->event_count == 0) {
+      // Nothing to draw (e.g. an aggregate only file just has histograms), so it's not added to the loaded files. The views and time alignment expect at least one event per file.
+      QString summary;
+      if (events->is_aggregate) {
+        summary = "'" + name + "' only has histograms of the event durations (UkAttrs.aggregate_only), so there are no events to show.\n"
+                  "To print the full histograms: aggregate_histograms " + filename + "\n";
+        for (uint16_t j=0; j<events->event_registration_count; j++) {
+          UkHistogram *histogram = &events->histogram_list[j];
+          if (histogram->count == 0) continue;
+          double avg_duration = (double)histogram->total_duration / (double)histogram->count;
+          summary += "\n" + QString(events->event_registration_list[j].name) + ": count=" + QString::number(histogram->count) +
+                     ", min=" + niceValueText(histogram->min_duration / 1000.0) + " us" +
+                     ", avg=" + niceValueText(avg_duration / 1000.0) + " us" +
+                     ", max=" + niceValueText(histogram->max_duration / 1000.0) + " us";
+        }
+      } else {
+        summary = "'" + name + "' has no events.";
+      }
+      QMessageBox::information(this, "No Events", summary);
+      ukFreeEvents(events);
+      continue;
+    }
 
     // Build the display tree
-    EventTree *tree = new EventTree(events, name, folder, ui->showFoldersButton->isChecked(), ui->showThreadsButton->isChecked());
+    EventTree *tree = new EventTree(events, name, folder, ui->showFoldersButton->isChecked(), ui->showThreadsButton->isChecked(), ui->showCpusButton->isChecked());
     tree->native_start_time = events->event_buffer[0].time;
     SortType sort_type = ui->sortByIdButton->isChecked() ? SORT_BY_ID : ui->sortByNameButton->isChecked() ? SORT_BY_NAME : SORT_BY_TIME;
     tree->sortTree(sort_type);
@@ -598,14 +631,22 @@ void MainWindow::on_loadButton_clicked() {
 
   // Allow user to set time alignment if multiple files are loaded
   if (files.count() > 0) {
+    updateWallStartTimes();
     setWidgetUsability();
     updateHierarchyScrollbars();
     ui->eventsView->zoomToAll();
     updateViews();
     if (G_event_tree_map.count() > 1) {
-      // Multiple files loaded, ask to time align
-      G_settings->setValue("alignment_mode", "Native");  // One of "Native", "TimeZero", "EventId"
-      on_timeAlignButton_clicked();
+      if (eventFilesHaveWallClock()) {
+        // Multiple files loaded, and each one knows its wall clock time, so no need to ask
+        G_settings->setValue("alignment_mode", "WallClock");  // One of "Native", "TimeZero", "WallClock", "EventId"
+        ui->eventsView->updateTimeAlignment();
+        setWidgetUsability();
+      } else {
+        // Multiple files loaded, ask to time align
+        G_settings->setValue("alignment_mode", "Native");  // One of "Native", "TimeZero", "WallClock", "EventId"
+        on_timeAlignButton_clicked();
+      }
     }
   }
 }
@@ -682,12 +723,14 @@ void MainWindow::updateEventTreeBuild() {
     EventTree *tree = i.value();
     UkEvents *events = tree->events;
     uint64_t native_start_time = tree->native_start_time;
+    uint64_t wall_start_time = tree->wall_start_time;
     QString name = tree->name;
     QString folder = tree->folder;
     delete tree;
     // Build new tree
-    tree = new EventTree(events, name, folder, ui->showFoldersButton->isChecked(), ui->showThreadsButton->isChecked());
+    tree = new EventTree(events, name, folder, ui->showFoldersButton->isChecked(), ui->showThreadsButton->isChecked(), ui->showCpusButton->isChecked());
     tree->native_start_time = native_start_time;
+    tree->wall_start_time = wall_start_time;
     tree->sortTree(sort_type);
     G_event_tree_map[filename] = tree; // NOTE: QMaps are ordered alphabetically
   }
@@ -753,6 +796,74 @@ bool MainWindow::eventFilesHaveThreads() {
   return false;
 }
 
+bool MainWindow::eventFilesHaveCpus() {
+  QMapIterator<QString, EventTree*> i(G_event_tree_map);
+  while (i.hasNext()) {
+    // Get old tree info
+    i.next();
+    EventTree *tree = i.value();
+    UkEvents *events = tree->events;
+    if (events->includes_cpu) return true;
+  }
+  return false;
+}
+
+static bool isClockSyncPeer(EventTree *tree, EventTree *peer) {
+  // Process IDs are only unique on the same host
+  UkEvents *events = tree->events;
+  UkEvents *peer_events = peer->events;
+  if (events->host_name == NULL || peer_events->host_name == NULL || QString(events->host_name) != QString(peer_events->host_name)) return false;
+  for (uint32_t i=0; i<events->clock_sync_count; i++) {
+    if (events->clock_sync_list[i].peer_process_id == peer_events->process_id) return true;
+  }
+  return false;
+}
+
+static uint64_t syncedWallTime(EventTree *tree, uint64_t time, QMap<EventTree*, EventTree*> &sync_parent_map) {
+  // Follow the clock syncs up to the file whose wall clock is used
+  EventTree *parent = sync_parent_map.value(tree, NULL);
+  if (parent == NULL) return ukGetWallTime(tree->events, time);
+  uint64_t parent_time = ukGetPeerTime(tree->events, parent->events->process_id, time, NULL);
+  return syncedWallTime(parent, parent_time, sync_parent_map);
+}
+
+void MainWindow::updateWallStartTimes() {
+  // Files that measured their clock offsets to each other (see unikorn_clock_sync.h) all use the wall clock of one of them,
+  // so they are aligned as precisely as the clock sync instead of the wall clock
+  QList<EventTree*> trees = G_event_tree_map.values();
+  QMap<EventTree*, EventTree*> sync_parent_map;
+  QSet<EventTree*> visited;
+  for (auto root: trees) {
+    if (visited.contains(root)) continue;
+    visited.insert(root);
+    QList<EventTree*> queue;
+    queue += root;
+    while (!queue.isEmpty()) {
+      EventTree *parent = queue.takeFirst();
+      for (auto tree: trees) {
+        if (!visited.contains(tree) && isClockSyncPeer(tree, parent)) {
+          visited.insert(tree);
+          sync_parent_map[tree] = parent;
+          queue += tree;
+        }
+      }
+    }
+  }
+  for (auto tree: trees) {
+    tree->wall_start_time = syncedWallTime(tree, tree->native_start_time, sync_parent_map);
+  }
+}
+
+bool MainWindow::eventFilesHaveWallClock() {
+  QMapIterator<QString, EventTree*> i(G_event_tree_map);
+  while (i.hasNext()) {
+    i.next();
+    EventTree *tree = i.value();
+    if (tree->wall_start_time == 0) return false;
+  }
+  return true;
+}
+
 bool MainWindow::eventFileSelected() {
   QMapIterator<QString, EventTree*> i(G_event_tree_map);
   while (i.hasNext()) {
@@ -801,6 +912,11 @@ void MainWindow::on_showThreadsButton_clicked() {
   if (threads_exist) updateEventTreeBuild();
 }
 
+void MainWindow::on_showCpusButton_clicked() {
+  bool cpus_exist = eventFilesHaveCpus();
+  if (cpus_exist) updateEventTreeBuild();
+}
+
 void MainWindow::on_openFoldersButton_clicked() {
   QMapIterator<QString, EventTree*> i(G_event_tree_map);
   while (i.hasNext()) {
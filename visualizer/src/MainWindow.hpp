@@ -42,6 +42,7 @@ private slots:
   void on_clearFilterButton_clicked();
   void on_showFoldersButton_clicked();
   void on_showThreadsButton_clicked();
+  void on_showCpusButton_clicked();
   void on_openFoldersButton_clicked();
   void on_closeFoldersButton_clicked();
   void on_sortByIdButton_clicked();
@@ -77,6 +78,9 @@ private:
   void updateEventTreeBuild();
   bool eventFilesHaveFolders();
   bool eventFilesHaveThreads();
+  bool eventFilesHaveCpus();
+  bool eventFilesHaveWallClock();
+  void updateWallStartTimes();
   bool eventFileSelected();
   EventTreeNode *eventRowSelected(UkEvents **selected_events_ret);
   EventTreeNode *eventRowSelected(EventTreeNode *parent);
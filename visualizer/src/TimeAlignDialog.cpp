@@ -21,7 +21,18 @@ TimeAlignDialog::TimeAlignDialog(QWidget *parent) : QDialog(parent), ui(new Ui::
   ui->setupUi(this);
 
   bool all_files_have_instances = true;
+  bool all_files_have_wall_clock = true;
   bool one_or_more_files_have_non_zero_start_time = false;
+  {
+    QMapIterator<QString, EventTree*> i(G_event_tree_map);
+    while (i.hasNext()) {
+      i.next();
+      if (i.value()->wall_start_time == 0) {
+        all_files_have_wall_clock = false;
+        break;
+      }
+    }
+  }
   {
     QMapIterator<QString, EventTree*> i(G_event_tree_map);
     bool got_initial_names = false;
@@ -64,6 +75,7 @@ TimeAlignDialog::TimeAlignDialog(QWidget *parent) : QDialog(parent), ui(new Ui::
   }
 
   ui->startFromZeroRadio->setEnabled(one_or_more_files_have_non_zero_start_time);
+  ui->wallClockRadio->setEnabled(all_files_have_wall_clock);
   ui->alignByEventRadio->setEnabled(all_files_have_instances && common_event_names.count() > 0);
   if (all_files_have_instances && common_event_names.count() > 0) {
     ui->eventNameCombo->addItems(common_event_names);
@@ -78,17 +90,20 @@ TimeAlignDialog::TimeAlignDialog(QWidget *parent) : QDialog(parent), ui(new Ui::
   ui->instanceSpin->setValue(prev_instance_index);
 
   // Set the initial alignment mode
-  QString prev_alignment_mode = G_settings->value("alignment_mode", "Native").toString();  // One of "Native", "TimeZero", "EventId"
+  QString prev_alignment_mode = G_settings->value("alignment_mode", "Native").toString();  // One of "Native", "TimeZero", "WallClock", "EventId"
   if (prev_alignment_mode == "Native") {
     ui->noAlignmentRadio->setChecked(true);
   } else if (prev_alignment_mode == "TimeZero") {
     ui->startFromZeroRadio->setChecked(true);
+  } else if (prev_alignment_mode == "WallClock") {
+    ui->wallClockRadio->setChecked(true);
   } else {
     ui->alignByEventRadio->setChecked(true);
   }
 
   this->connect(ui->noAlignmentRadio, SIGNAL(clicked()), this, SLOT(setWidgetUsability()));
   this->connect(ui->startFromZeroRadio, SIGNAL(clicked()), this, SLOT(setWidgetUsability()));
+  this->connect(ui->wallClockRadio, SIGNAL(clicked()), this, SLOT(setWidgetUsability()));
   this->connect(ui->alignByEventRadio, SIGNAL(clicked()), this, SLOT(setWidgetUsability()));
   this->connect(ui->startEndCombo, SIGNAL(currentIndexChanged(int)), this, SLOT(eventInfoChanged(int)));
   this->connect(ui->eventNameCombo, SIGNAL(currentIndexChanged(int)), this, SLOT(eventInfoChanged(int)));
@@ -181,10 +196,13 @@ bool TimeAlignDialog::getCommonInstanceRange(QString event_name, bool is_start,
 void TimeAlignDialog::setWidgetUsability() {
   ui->alignToCommonFrame->setEnabled(ui->alignByEventRadio->isChecked());
   if (ui->noAlignmentRadio->isChecked()) {
-    G_settings->setValue("alignment_mode", "Native");  // One of "Native", "TimeZero", "EventId"
+    G_settings->setValue("alignment_mode", "Native");  // One of "Native", "TimeZero", "WallClock", "EventId"
     emit timeAlignmentChanged();
   } else if (ui->startFromZeroRadio->isChecked()) {
-    G_settings->setValue("alignment_mode", "TimeZero");  // One of "Native", "TimeZero", "EventId"
+    G_settings->setValue("alignment_mode", "TimeZero");  // One of "Native", "TimeZero", "WallClock", "EventId"
+    emit timeAlignmentChanged();
+  } else if (ui->wallClockRadio->isChecked()) {
+    G_settings->setValue("alignment_mode", "WallClock");  // One of "Native", "TimeZero", "WallClock", "EventId"
     emit timeAlignmentChanged();
   } else if (ui->alignByEventRadio->isChecked()) {
     bool is_start = (ui->startEndCombo->currentIndex() == 0);
@@ -206,7 +224,7 @@ void TimeAlignDialog::setWidgetUsability() {
     }
     ui->instanceSpin->setValue(instance_index);
 
-    G_settings->setValue("alignment_mode", "EventId");  // One of "Native", "TimeZero", "EventId"
+    G_settings->setValue("alignment_mode", "EventId");  // One of "Native", "TimeZero", "WallClock", "EventId"
     G_settings->setValue("alignment_event_name", event_name);
     G_settings->setValue("alignment_event_is_start", is_start);
     G_settings->setValue("alignment_instance_index", instance_index);
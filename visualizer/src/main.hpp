@@ -36,6 +36,7 @@ extern QMap<QString,EventTree*> G_event_tree_map; // QMap is always sorted by ke
 #define HEADER_SEPARATOR_COLOR QColor(200, 200, 200)
 #define ROW_HIGHLIGHT_COLOR QColor(0, 0, 0, 50)
 #define ROW_SELECTED_COLOR QColor(0, 100, 255, 50)
+#define PAUSED_COLOR QColor(0, 0, 0, 20)
 #define TIME_SELECTION_COLOR QColor(200, 0, 0)
 
 #define ARROW_ICON_COLOR QColor(0, 0, 0)